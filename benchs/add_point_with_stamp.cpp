@@ -24,11 +24,12 @@
 
 // Tests the speed of various amounts of points of various stamp sizes.
 
-// In the past, I already did the following:
-// Test the speed of calling the heatmap point adding function once for
-// every single point (a la glVertex3f) vs. calling one function which
-// adds a whole buffer of points (a la glVertexPointer). Basically, time
-// the function call overhead.
+// Also compares calling the heatmap point adding function once for every
+// single point (a la glVertex3f) vs. calling one function which adds a whole
+// buffer of points (a la glVertexPointer).
+
+// Finally, compares the default row-major layout of the heatmap to the tiled
+// one, which touches fewer memory pages for large stamps.
 
 #include "benchs/common.hpp"
 
@@ -50,17 +51,47 @@ int main(/* int argc, char *argv[] */)
         std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(stampsize));
         for(size_t npoints = NPOINTS_MIN ; npoints <= NPOINTS_MAX ; npoints *= 10) {
             std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
-            std::cerr << "{'npoints': " << npoints << ", 'size': " << stampsize << ", ";
+            std::cerr << "{'npoints': " << npoints << ", 'size': " << stampsize << ", 'batch': false, ";
             std::cout << "Adding " << npoints << " points of size " << stampsize << " one after another... " << std::flush;
             for(RepeatTimer t(5) ; t ; t.next()) {
                 for(size_t i = 0 ; i < npoints ; ++i) {
                     heatmap_add_point_with_stamp(hm.get(), points[2*i], points[2*i+1], stamp.get());
                 }
             }
-            if(npoints < NPOINTS_MAX || stampsize < STAMP_MAX)
-                std::cerr << "," << std::endl;
+            std::cerr << "," << std::endl;
 
             ret += hm->buf[0] > 0.0f;
+
+            std::unique_ptr<heatmap_t> hm_batch(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'npoints': " << npoints << ", 'size': " << stampsize << ", 'batch': true, ";
+            std::cout << "Adding " << npoints << " points of size " << stampsize << " in one batch... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm_batch.get(), &points[0], &points[1], npoints, 2, stamp.get());
+            }
+            std::cerr << "," << std::endl;
+
+            ret += hm_batch->buf[0] > 0.0f;
+
+            std::unique_ptr<heatmap_t> hm_tiled(heatmap_new_tiled(MAPSIZE, MAPSIZE));
+            std::cerr << "{'npoints': " << npoints << ", 'size': " << stampsize << ", 'batch': true, 'tiled': true, ";
+            std::cout << "Adding " << npoints << " points of size " << stampsize << " in one batch onto a tiled map... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm_tiled.get(), &points[0], &points[1], npoints, 2, stamp.get());
+            }
+            std::cerr << "," << std::endl;
+
+            ret += hm_tiled->buf[0] > 0.0f;
+
+            std::unique_ptr<heatmap_t> hm_lazy(heatmap_new(MAPSIZE, MAPSIZE));
+            heatmap_set_lazy_max(hm_lazy.get(), 1);
+            std::cerr << "{'npoints': " << npoints << ", 'size': " << stampsize << ", 'batch': true, 'lazy': true, ";
+            std::cout << "Adding " << npoints << " points of size " << stampsize << " in one batch with lazy max... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm_lazy.get(), &points[0], &points[1], npoints, 2, stamp.get());
+                ret += heatmap_get_max(hm_lazy.get()) > 0.0f;
+            }
+            if(npoints < NPOINTS_MAX || stampsize < STAMP_MAX)
+                std::cerr << "," << std::endl;
         }
     }
     std::cerr << std::endl << "]" << std::endl;
@@ -0,0 +1,71 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Times approximating the default stamp of growing radii using box blurs,
+// for a few numbers of passes, and how far off the result is from the exact
+// one, which is computed using FFTs.
+
+#include "benchs/common.hpp"
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 2048;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    const unsigned radii[] = { 8, 32, 128, 512 };
+    const unsigned passes[] = { 1, 3, 6 };
+
+    std::cerr << "[" << std::endl;
+    for(unsigned r : radii) {
+        std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(r));
+        std::unique_ptr<heatmap_t> exact(heatmap_new(MAPSIZE, MAPSIZE));
+        heatmap_add_points_fft(exact.get(), &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), 0);
+
+        for(unsigned p : passes) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'passes': " << p << ", ";
+            std::cout << "Box blurring " << NPOINTS << " points for radius " << r << " in " << p << " passes... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_t* fresh = heatmap_new(MAPSIZE, MAPSIZE);
+                heatmap_add_points_boxes(fresh, &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), p, 0);
+                hm.reset(fresh);
+            }
+
+            const float error = heatmap_relative_error(hm.get(), exact.get());
+            std::cout << "Off by at most " << 100.0f*error << "% of the max" << std::endl;
+            std::cerr << "{'radius': " << r << ", 'passes': " << p << ", 'error': " << error << "}";
+            if(r != 512 || p != 6)
+                std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,76 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Compares adding clickstream-like points, which are mostly duplicates of a
+// few thousand distinct ones, with and without coalescing them first.
+
+#include "benchs/common.hpp"
+
+static const size_t NPOINTS = 4*1000*1000;
+static const size_t NDISTINCT = 10*1000;
+static const unsigned MAPSIZE = 4096;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> distinct = genpoints(NDISTINCT, MAPSIZE - 1);
+    const std::vector<unsigned> which = genpoints(NPOINTS/2, NDISTINCT - 1);
+    std::vector<unsigned> points(2*NPOINTS);
+    for(size_t i = 0 ; i < NPOINTS ; ++i) {
+        points[2*i] = distinct[2*which[i]];
+        points[2*i+1] = distinct[2*which[i]+1];
+    }
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(16));
+
+    std::cerr << "[" << std::endl;
+    for(int coalesced = 0 ; coalesced < 2 ; ++coalesced) {
+        // How many points actually get stamped, to report the reduction.
+        size_t stamped = NPOINTS;
+        if(coalesced) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            stamped = heatmap_add_points_coalesced(hm.get(), &points[0], &points[1], 0, NPOINTS, 2, stamp.get(), 0);
+        }
+
+        std::cerr << "{'coalesced': " << coalesced << ", 'reduction': " << static_cast<double>(NPOINTS)/stamped << ", ";
+        std::cout << "Adding " << NPOINTS << " points " << (coalesced ? "with" : "without") << " coalescing... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            if(coalesced)
+                heatmap_add_points_coalesced(hm.get(), &points[0], &points[1], 0, NPOINTS, 2, stamp.get(), 0);
+            else
+                heatmap_add_points_parallel(hm.get(), &points[0], &points[1], 0, NPOINTS, 2, stamp.get(), 0);
+            ret += heatmap_get_max(hm.get()) > 0.0f;
+        }
+        if(!coalesced)
+            std::cerr << "," << std::endl;
+    }
+    std::cerr << std::endl;
+    std::cerr << "]" << std::endl;
+
+    return ret;
+}
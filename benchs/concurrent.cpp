@@ -0,0 +1,103 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Test the speed of many threads adding points to one shared heatmap, one
+// point at a time, each point being added either while holding a mutex or
+// using the heatmap's lock-free concurrent mode.
+
+#include "benchs/common.hpp"
+
+#include <mutex>
+#include <thread>
+
+static const size_t NPOINTS = 200*1000;
+static const size_t STAMP_MIN = 4;
+static const size_t STAMP_MAX = 16;
+static const size_t MAPSIZE = 1024;
+static const unsigned THREADS_MAX = 64;
+
+// Runs `nthreads` threads, each adding its share of the points using `add`.
+template<typename F>
+static void run_threads(unsigned nthreads, const std::vector<unsigned>& points, F add)
+{
+    std::vector<std::thread> threads;
+    for(unsigned t = 0 ; t < nthreads ; ++t) {
+        threads.emplace_back([&points, &add, nthreads, t]() {
+            for(size_t i = NPOINTS*t/nthreads ; i < NPOINTS*(t+1)/nthreads ; ++i) {
+                add(points[2*i], points[2*i+1]);
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+    auto points = genpoints(NPOINTS, MAPSIZE);
+
+    std::cerr << "[" << std::endl;
+    for(size_t stampsize = STAMP_MIN ; stampsize <= STAMP_MAX ; stampsize *= 2) {
+        std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(stampsize));
+
+        for(unsigned nthreads = 1 ; nthreads <= THREADS_MAX ; nthreads *= 2) {
+            {
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                std::mutex mutex;
+                std::cerr << "{'npoints': " << NPOINTS << ", 'size': " << stampsize << ", 'threads': " << nthreads << ", 'concurrent': false, ";
+                std::cout << "Adding " << NPOINTS << " points of size " << stampsize << " from " << nthreads << " threads using a mutex... " << std::flush;
+                for(RepeatTimer t(5) ; t ; t.next()) {
+                    run_threads(nthreads, points, [&](unsigned x, unsigned y) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        heatmap_add_point_with_stamp(hm.get(), x, y, stamp.get());
+                    });
+                }
+                std::cerr << "," << std::endl;
+                ret += hm->buf[0] > 0.0f;
+            }
+
+            {
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                heatmap_set_concurrent(hm.get(), 1);
+                std::cerr << "{'npoints': " << NPOINTS << ", 'size': " << stampsize << ", 'threads': " << nthreads << ", 'concurrent': true, ";
+                std::cout << "Adding " << NPOINTS << " points of size " << stampsize << " from " << nthreads << " threads concurrently... " << std::flush;
+                for(RepeatTimer t(5) ; t ; t.next()) {
+                    run_threads(nthreads, points, [&](unsigned x, unsigned y) {
+                        heatmap_add_point_with_stamp(hm.get(), x, y, stamp.get());
+                    });
+                }
+                if(stampsize < STAMP_MAX || nthreads < THREADS_MAX)
+                    std::cerr << "," << std::endl;
+                ret += hm->buf[0] > 0.0f;
+            }
+        }
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,71 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Compares a live map fading away on every tick by multiplying all of its
+// heat with one using `heatmap_decay`.
+
+#include "benchs/common.hpp"
+
+static const size_t NTICKS = 50;
+static const size_t NPOINTS_PER_TICK = 10*1000;
+static const unsigned MAPSIZE = 8192;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NTICKS*NPOINTS_PER_TICK, MAPSIZE - 1);
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(16));
+
+    std::cerr << "[" << std::endl;
+    for(int decay = 0 ; decay < 2 ; ++decay) {
+        std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+        heatmap_set_lazy_max(hm.get(), 1);
+
+        std::cerr << "{'decay': '" << (decay ? "heatmap_decay" : "multiply") << "', ";
+        std::cout << NTICKS << " ticks of adding " << NPOINTS_PER_TICK << " points and " << (decay ? "decaying" : "multiplying") << "... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            for(size_t tick = 0 ; tick < NTICKS ; ++tick) {
+                heatmap_add_points_with_stamp(hm.get(), &points[2*tick*NPOINTS_PER_TICK], &points[2*tick*NPOINTS_PER_TICK+1], NPOINTS_PER_TICK, 2, stamp.get());
+                if(decay) {
+                    heatmap_decay(hm.get(), 0.9f);
+                } else {
+                    for(size_t i = 0 ; i < static_cast<size_t>(MAPSIZE)*MAPSIZE ; ++i) {
+                        hm->buf[i] *= 0.9f;
+                    }
+                    hm->max_dirty = 1;
+                }
+            }
+            ret += heatmap_get_max(hm.get()) > 0.0f;
+        }
+        if(!decay)
+            std::cerr << "," << std::endl;
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
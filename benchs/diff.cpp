@@ -0,0 +1,82 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares stamping every point with adding only the differences of the
+// stamp, for boxes and pyramids of growing radius. Stamping is skipped for
+// the larger stamps, as it would take minutes there.
+
+#include "benchs/common.hpp"
+
+namespace std {
+    template<>
+    struct default_delete<heatmap_diffstamp_t> {
+        void operator()(heatmap_diffstamp_t* p) { heatmap_diffstamp_free(p); }
+    };
+}
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 2048;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    const unsigned radii[] = { 8, 32, 512 };
+    const unsigned degrees[] = { 0, 1 };
+
+    std::cerr << "[" << std::endl;
+    for(unsigned r : radii) {
+        for(unsigned d : degrees) {
+            std::unique_ptr<heatmap_diffstamp_t> diff(heatmap_diffstamp_gen_poly(r, d));
+
+            if(r <= 32) {
+                std::unique_ptr<heatmap_stamp_t> dense(heatmap_diffstamp_to_stamp(diff.get()));
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                std::cerr << "{'radius': " << r << ", 'degree': " << d << ", 'what': 'stamp', ";
+                std::cout << "Stamping " << NPOINTS << " points with radius " << r << " and degree " << d << "... " << std::flush;
+                for(RepeatTimer t(3) ; t ; t.next()) {
+                    heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], NPOINTS, 2, dense.get());
+                }
+                std::cerr << "," << std::endl;
+                ret += hm->max > 0.0f;
+            }
+
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'degree': " << d << ", 'what': 'diff', ";
+            std::cout << "Difference-stamping " << NPOINTS << " points with radius " << r << " and degree " << d << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_diff(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, diff.get(), 0);
+            }
+            if(r != 512 || d != 1)
+                std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
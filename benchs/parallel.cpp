@@ -0,0 +1,95 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares adding a batch of points serially to adding them in parallel
+// with increasing amounts of threads, both by splitting the map into bands
+// and by letting every thread fill its own shard which are merged in the end.
+
+#include "benchs/common.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const size_t NPOINTS = 100*1000;
+static const size_t STAMP_MIN = 4;
+static const size_t STAMP_MAX = 64;
+static const size_t MAPSIZE = 8192;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+    auto points = genpoints(NPOINTS, MAPSIZE);
+
+#ifdef _OPENMP
+    const unsigned maxthreads = static_cast<unsigned>(omp_get_max_threads());
+#else
+    const unsigned maxthreads = 1;
+#endif
+
+    std::cerr << "[" << std::endl;
+    for(size_t stampsize = STAMP_MIN ; stampsize <= STAMP_MAX ; stampsize *= 4) {
+        std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(stampsize));
+        {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'npoints': " << NPOINTS << ", 'size': " << stampsize << ", 'threads': 0, ";
+            std::cout << "Adding " << NPOINTS << " points of size " << stampsize << " serially... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], NPOINTS, 2, stamp.get());
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->buf[0] > 0.0f;
+        }
+
+        for(unsigned nthreads = 1 ; nthreads <= maxthreads ; nthreads *= 2) {
+            {
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                std::cerr << "{'npoints': " << NPOINTS << ", 'size': " << stampsize << ", 'threads': " << nthreads << ", 'mode': 'bands', ";
+                std::cout << "Adding " << NPOINTS << " points of size " << stampsize << " using " << nthreads << " threads and bands... " << std::flush;
+                for(RepeatTimer t(5) ; t ; t.next()) {
+                    heatmap_add_points_parallel(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), nthreads);
+                }
+                std::cerr << "," << std::endl;
+                ret += hm->buf[0] > 0.0f;
+            }
+
+            {
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                std::cerr << "{'npoints': " << NPOINTS << ", 'size': " << stampsize << ", 'threads': " << nthreads << ", 'mode': 'shards', ";
+                std::cout << "Adding " << NPOINTS << " points of size " << stampsize << " using " << nthreads << " threads and shards... " << std::flush;
+                for(RepeatTimer t(5) ; t ; t.next()) {
+                    heatmap_add_points_sharded(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), nthreads);
+                }
+                if(stampsize*4 <= STAMP_MAX || nthreads*2 <= maxthreads)
+                    std::cerr << "," << std::endl;
+                ret += hm->buf[0] > 0.0f;
+            }
+        }
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
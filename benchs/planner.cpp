@@ -0,0 +1,98 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Calibrates the planner, prints its cost model (e.g. for saving it at install
+// time and handing it to `heatmap_set_costs`), and then checks how good its
+// picks are by timing all engines for a few point counts and stamps.
+
+#include "benchs/common.hpp"
+
+namespace std {
+    template<>
+    struct default_delete<heatmap_sepstamp_t> {
+        void operator()(heatmap_sepstamp_t* p) { heatmap_sepstamp_free(p); }
+    };
+    template<>
+    struct default_delete<heatmap_plan_t> {
+        void operator()(heatmap_plan_t* p) { heatmap_plan_free(p); }
+    };
+}
+
+static const unsigned MAPSIZE = 2048;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    std::cout << "Calibrating... " << std::flush;
+    {
+        Timer t;
+        heatmap_calibrate();
+    }
+
+    heatmap_costs_t c;
+    heatmap_get_costs(&c);
+    std::cout << "heatmap_costs_t costs = { " << c.point << ", " << c.stamp_point << ", " << c.stamp << ", "
+              << c.convolve_pixel << ", " << c.convolve << ", " << c.separable_pixel << ", " << c.separable << ", "
+              << c.fft << ", " << c.diff_point << ", " << c.diff_pixel << ", " << c.diff << " };" << std::endl;
+
+    const std::vector<unsigned> points = genpoints(1000*1000, MAPSIZE - 1);
+    const size_t npoints[] = { 1000, 100*1000, 1000*1000 };
+    const unsigned radii[] = { 4, 16, 64 };
+
+    std::cerr << "[" << std::endl;
+    for(size_t n : npoints) {
+        for(unsigned r : radii) {
+            for(int gaussian = 0 ; gaussian <= 1 ; ++gaussian) {
+                std::unique_ptr<heatmap_sepstamp_t> sep(heatmap_sepstamp_gen_gaussian(r/3.0f, 3.0f));
+                std::unique_ptr<heatmap_stamp_t> stamp(gaussian ? heatmap_sepstamp_to_stamp(sep.get()) : heatmap_stamp_gen(r));
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                std::unique_ptr<heatmap_plan_t> plan(heatmap_plan_new(hm.get(), n, stamp.get(), 0));
+                const heatmap_engine_t planned = plan->engine;
+
+                std::cout << n << " points, " << (gaussian ? "gaussian" : "cone") << " of radius " << r
+                          << ": planned " << heatmap_engine_name(planned) << std::endl;
+                for(int e = 0 ; e < HEATMAP_ENGINE_COUNT ; ++e) {
+                    if(plan->costs[e] < 0.0 || plan->costs[e] > 2.0)
+                        continue;
+
+                    plan->engine = static_cast<heatmap_engine_t>(e);
+                    std::cerr << "{'n': " << n << ", 'radius': " << r << ", 'gaussian': " << gaussian << ", 'engine': '" << heatmap_engine_name(plan->engine)
+                              << "', 'planned': " << (e == planned) << ", 'estimate': " << plan->costs[e] << ", ";
+                    std::cout << "  " << heatmap_engine_name(plan->engine) << " (estimated " << plan->costs[e]*1000.0 << "ms)... " << std::flush;
+                    for(RepeatTimer t(3) ; t ; t.next()) {
+                        heatmap_plan_run(plan.get(), hm.get(), &points[0], &points[1], nullptr, n, 2);
+                    }
+                    std::cerr << "," << std::endl;
+                    ret += hm->max > 0.0f;
+                }
+            }
+        }
+    }
+    std::cerr << "{}" << std::endl << "]" << std::endl;
+
+    return ret;
+}
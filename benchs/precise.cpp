@@ -0,0 +1,69 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares adding points to and rendering a large map whose heat is stored
+// as floats with the same map accumulating onto doubles.
+
+#include "benchs/common.hpp"
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 8192;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(16));
+    std::vector<unsigned char> img(static_cast<size_t>(MAPSIZE)*MAPSIZE*4);
+
+    const char* names[] = { "float32", "float64" };
+
+    std::cerr << "[" << std::endl;
+    for(int precise = 0 ; precise < 2 ; ++precise) {
+        std::unique_ptr<heatmap_t> hm(precise ? heatmap_new_precise(MAPSIZE, MAPSIZE) : heatmap_new(MAPSIZE, MAPSIZE));
+        heatmap_set_lazy_max(hm.get(), 1);
+
+        std::cerr << "{'storage': '" << names[precise] << "', 'what': 'add', ";
+        std::cout << "Adding " << NPOINTS << " points onto a " << names[precise] << " map... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], NPOINTS, 2, stamp.get());
+        }
+        std::cerr << "," << std::endl;
+
+        std::cerr << "{'storage': '" << names[precise] << "', 'what': 'render', ";
+        std::cout << "Rendering a " << names[precise] << " map... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            heatmap_render_default_to(hm.get(), &img[0]);
+        }
+        if(!precise)
+            std::cerr << "," << std::endl;
+        ret += img[img.size()/2] > 0;
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,77 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Compares adding points which all have their own radius one by one, with the
+// stamps taken from a cache, to adding them as a batch grouped by radius.
+
+#include "benchs/common.hpp"
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 4096;
+static const unsigned MAXRADIUS = 32;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    std::vector<unsigned> radii = genpoints(NPOINTS/2, MAXRADIUS - 4);
+    for(size_t i = 0 ; i < radii.size() ; ++i) {
+        radii[i] += 4;
+    }
+    heatmap_stampcache_t* cache = heatmap_stampcache_new(64 << 20);
+
+    std::cerr << "[" << std::endl;
+
+    std::cerr << "{'how': 'one by one', ";
+    std::cout << "Adding " << NPOINTS << " points with radii one by one... " << std::flush;
+    for(RepeatTimer t(3) ; t ; t.next()) {
+        std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+        for(size_t i = 0 ; i < NPOINTS ; ++i) {
+            const heatmap_stamp_t* s = heatmap_stampcache_get(cache, radii[i], 0);
+            heatmap_add_point_with_stamp(hm.get(), points[2*i], points[2*i+1], s);
+            heatmap_stampcache_release(cache, s);
+        }
+        ret += heatmap_get_max(hm.get()) > 0.0f;
+    }
+    std::cerr << "," << std::endl;
+
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 4) {
+        std::cerr << "{'how': 'batch', 'nthreads': " << nthreads << ", ";
+        std::cout << "Adding " << NPOINTS << " points with radii as a batch on " << nthreads << " threads... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            heatmap_add_points_with_radii(hm.get(), &points[0], &points[1], 0, &radii[0], NPOINTS, 2, 0, cache, nthreads);
+            ret += heatmap_get_max(hm.get()) > 0.0f;
+        }
+        std::cerr << (nthreads == 1 ? "," : "") << std::endl;
+    }
+    std::cerr << "]" << std::endl;
+
+    heatmap_stampcache_free(cache);
+    return ret;
+}
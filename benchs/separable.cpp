@@ -0,0 +1,119 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares stamping every point, convolving the point counts with a dense
+// stamp, convolving them with a separable stamp, convolving them using FFTs,
+// and filtering them with a recursive Gaussian, for Gaussian stamps of growing
+// radius. The slower ways are skipped for the larger stamps, as they
+// would take minutes to hours there.
+
+#include "benchs/common.hpp"
+
+namespace std {
+    template<>
+    struct default_delete<heatmap_sepstamp_t> {
+        void operator()(heatmap_sepstamp_t* p) { heatmap_sepstamp_free(p); }
+    };
+}
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 2048;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    const unsigned radii[] = { 8, 32, 512 };
+
+    std::cerr << "[" << std::endl;
+    for(unsigned r : radii) {
+        std::unique_ptr<heatmap_sepstamp_t> sep(heatmap_sepstamp_gen_gaussian(r/3.0f, 3.0f));
+        std::unique_ptr<heatmap_stamp_t> dense(heatmap_sepstamp_to_stamp(sep.get()));
+
+        if(r <= 32) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'what': 'stamp', ";
+            std::cout << "Stamping " << NPOINTS << " points with radius " << r << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], NPOINTS, 2, dense.get());
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+
+        if(r <= 8) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'what': 'convolved', ";
+            std::cout << "Convolving " << NPOINTS << " points with radius " << r << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_convolved(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, dense.get(), 0);
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+
+        {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'what': 'separable', ";
+            std::cout << "Separably convolving " << NPOINTS << " points with radius " << r << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_separable(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, sep.get(), 0);
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+
+        std::unique_ptr<heatmap_t> exact(heatmap_new(MAPSIZE, MAPSIZE));
+        heatmap_add_points_separable(exact.get(), &points[0], &points[1], nullptr, NPOINTS, 2, sep.get(), 0);
+
+        {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'what': 'fft', ";
+            std::cout << "FFT-convolving " << NPOINTS << " points with radius " << r << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_fft(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, dense.get(), 0);
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+
+        std::cerr << "{'radius': " << r << ", 'what': 'iir', ";
+        std::cout << "Recursively filtering " << NPOINTS << " points with radius " << r << "... " << std::flush;
+        std::unique_ptr<heatmap_t> hm;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            hm.reset(heatmap_new(MAPSIZE, MAPSIZE));
+            heatmap_add_points_gaussian(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, r/3.0f, 0);
+        }
+        std::cout << "Off by at most " << 100.0f*heatmap_relative_error(hm.get(), exact.get()) << "% of the max" << std::endl;
+        if(r != 512)
+            std::cerr << "," << std::endl;
+        ret += hm->max > 0.0f;
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,138 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Test how well adding points in parallel copes with real-world data, where
+// most points fall into a small part of the map: normally distributed points
+// and points clustered around a few centers of Zipf-distributed popularity,
+// compared to uniformly distributed ones. Also times counting the points and
+// convolving the counts with the stamp, and rendering the result.
+
+#include "benchs/common.hpp"
+
+#include <cmath>
+#include <string>
+
+static const size_t NPOINTS = 200*1000;
+static const size_t STAMP = 16;
+static const unsigned MAPSIZE = 4096;
+static const unsigned NCLUSTERS = 64;
+
+static unsigned clamp(double v)
+{
+    return v < 0.0 ? 0u : v >= MAPSIZE ? MAPSIZE - 1 : static_cast<unsigned>(v);
+}
+
+static std::vector<unsigned> genpoints_gaussian(size_t npoints)
+{
+    std::vector<unsigned> points(npoints*2);
+    std::mt19937 prng(42);
+    std::normal_distribution<double> dist(0.5*MAPSIZE, 0.05*MAPSIZE);
+
+    for(auto& p : points) {
+        p = clamp(dist(prng));
+    }
+
+    return points;
+}
+
+static std::vector<unsigned> genpoints_zipf(size_t npoints)
+{
+    std::vector<unsigned> points(npoints*2);
+    std::mt19937 prng(42);
+    std::uniform_real_distribution<double> center(0.0, MAPSIZE);
+    std::normal_distribution<double> spread(0.0, 0.01*MAPSIZE);
+
+    // The k-th cluster gets picked with a probability proportional to 1/k.
+    std::vector<double> cx(NCLUSTERS), cy(NCLUSTERS), popularity(NCLUSTERS);
+    for(unsigned k = 0 ; k < NCLUSTERS ; ++k) {
+        cx[k] = center(prng);
+        cy[k] = center(prng);
+        popularity[k] = 1.0/(k+1);
+    }
+    std::discrete_distribution<unsigned> cluster(popularity.begin(), popularity.end());
+
+    for(size_t i = 0 ; i < npoints ; ++i) {
+        const unsigned k = cluster(prng);
+        points[2*i] = clamp(cx[k] + spread(prng));
+        points[2*i+1] = clamp(cy[k] + spread(prng));
+    }
+
+    return points;
+}
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+#ifdef _OPENMP
+    const unsigned maxthreads = static_cast<unsigned>(omp_get_max_threads());
+#else
+    const unsigned maxthreads = 1;
+#endif
+
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(STAMP));
+    std::vector<unsigned> imgbuf(MAPSIZE*MAPSIZE);
+
+    const std::string names[] = { "uniform", "gaussian", "zipf" };
+    const std::vector<unsigned> datasets[] = { genpoints(NPOINTS, MAPSIZE - 1), genpoints_gaussian(NPOINTS), genpoints_zipf(NPOINTS) };
+
+    std::cerr << "[" << std::endl;
+    for(size_t d = 0 ; d < 3 ; ++d) {
+        const std::vector<unsigned>& points = datasets[d];
+
+        for(unsigned nthreads = 1 ; nthreads <= maxthreads ; nthreads *= 2) {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'points': '" << names[d] << "', 'threads': " << nthreads << ", 'what': 'add', ";
+            std::cout << "Adding " << NPOINTS << " " << names[d] << " points using " << nthreads << " threads... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_parallel(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), nthreads);
+            }
+            std::cerr << "," << std::endl;
+
+            std::cerr << "{'points': '" << names[d] << "', 'threads': " << nthreads << ", 'what': 'convolve', ";
+            std::cout << "Convolving " << NPOINTS << " " << names[d] << " points using " << nthreads << " threads... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_add_points_convolved(hm.get(), &points[0], &points[1], nullptr, NPOINTS, 2, stamp.get(), nthreads);
+            }
+            std::cerr << "," << std::endl;
+
+#ifdef _OPENMP
+            omp_set_num_threads(static_cast<int>(nthreads));
+#endif
+            std::cerr << "{'points': '" << names[d] << "', 'threads': " << nthreads << ", 'what': 'render', ";
+            std::cout << "Rendering them using " << nthreads << " threads... " << std::flush;
+            for(RepeatTimer t(5) ; t ; t.next()) {
+                heatmap_render_default_to(hm.get(), reinterpret_cast<unsigned char*>(&imgbuf[0]));
+            }
+            if(d < 2 || nthreads*2 <= maxthreads)
+                std::cerr << "," << std::endl;
+            ret += imgbuf[0];
+        }
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
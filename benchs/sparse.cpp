@@ -0,0 +1,111 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares dense and sparse heatmaps on a huge map where all points fall into
+// a few small "cities": how much memory the heat takes, and how long adding
+// the points, finding the max and rendering take.
+
+#include "benchs/common.hpp"
+
+#include <string>
+
+static const size_t NPOINTS = 1000*1000;
+static const size_t STAMP = 32;
+static const unsigned MAPSIZE = 16384;
+static const unsigned NCITIES = 50;
+static const unsigned CITYSIZE = 200;
+
+static std::vector<unsigned> genpoints_cities(size_t npoints)
+{
+    std::vector<unsigned> points(npoints*2);
+    std::mt19937 prng(42);
+    std::uniform_int_distribution<unsigned> center(0, MAPSIZE - CITYSIZE);
+    std::uniform_int_distribution<unsigned> city(0, NCITIES - 1);
+    std::uniform_int_distribution<unsigned> offset(0, CITYSIZE - 1);
+
+    std::vector<unsigned> cx(NCITIES), cy(NCITIES);
+    for(unsigned k = 0 ; k < NCITIES ; ++k) {
+        cx[k] = center(prng);
+        cy[k] = center(prng);
+    }
+
+    for(size_t i = 0 ; i < npoints ; ++i) {
+        const unsigned k = city(prng);
+        points[2*i] = cx[k] + offset(prng);
+        points[2*i+1] = cy[k] + offset(prng);
+    }
+
+    return points;
+}
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(STAMP));
+    std::vector<unsigned char> imgbuf(4*static_cast<size_t>(MAPSIZE)*MAPSIZE);
+    const std::vector<unsigned> points = genpoints_cities(NPOINTS);
+
+    const std::string names[] = { "dense", "sparse" };
+
+    std::cerr << "[" << std::endl;
+    for(size_t s = 0 ; s < 2 ; ++s) {
+        std::unique_ptr<heatmap_t> hm(s ? heatmap_new_sparse(MAPSIZE, MAPSIZE) : heatmap_new(MAPSIZE, MAPSIZE));
+        heatmap_set_lazy_max(hm.get(), 1);
+
+        std::cerr << "{'map': '" << names[s] << "', 'what': 'add', ";
+        std::cout << "Adding " << NPOINTS << " points onto a " << names[s] << " map... " << std::flush;
+        for(RepeatTimer t(5) ; t ; t.next()) {
+            heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], NPOINTS, 2, stamp.get());
+        }
+        std::cerr << "," << std::endl;
+
+        const size_t bytes = s ? heatmap_sparse_tiles_used(hm.get())*HEATMAP_TILE_SIZE*HEATMAP_TILE_SIZE*sizeof(float)
+                               : static_cast<size_t>(MAPSIZE)*MAPSIZE*sizeof(float);
+        std::cout << "The heat takes " << bytes/(1024*1024) << "MiB" << std::endl;
+        std::cerr << "{'map': '" << names[s] << "', 'what': 'memory', 'bytes': " << bytes << "}," << std::endl;
+
+        std::cerr << "{'map': '" << names[s] << "', 'what': 'max', ";
+        std::cout << "Finding the max of the " << names[s] << " map... " << std::flush;
+        for(RepeatTimer t(5) ; t ; t.next()) {
+            hm->max_dirty = 1;
+            ret += heatmap_get_max(hm.get()) > 0.0f;
+        }
+        std::cerr << "," << std::endl;
+
+        std::cerr << "{'map': '" << names[s] << "', 'what': 'render', ";
+        std::cout << "Rendering the " << names[s] << " map... " << std::flush;
+        for(RepeatTimer t(5) ; t ; t.next()) {
+            heatmap_render_default_to(hm.get(), &imgbuf[0]);
+        }
+        if(s == 0)
+            std::cerr << "," << std::endl;
+        ret += imgbuf[0];
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
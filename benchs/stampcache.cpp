@@ -0,0 +1,67 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Compares generating a big stamp for every render with getting it from a
+// stamp cache.
+
+#include "benchs/common.hpp"
+
+static const unsigned RADIUS = 512;
+static const int NRENDERS = 20;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    std::cerr << "[" << std::endl;
+
+    std::cerr << "{'stamp': 'generated', ";
+    std::cout << "Generating a radius " << RADIUS << " stamp " << NRENDERS << " times... " << std::flush;
+    for(RepeatTimer t(3) ; t ; t.next()) {
+        for(int i = 0 ; i < NRENDERS ; ++i) {
+            heatmap_stamp_t* s = heatmap_stamp_gen(RADIUS);
+            ret += s->buf[RADIUS] > 0.0f;
+            heatmap_stamp_free(s);
+        }
+    }
+    std::cerr << "," << std::endl;
+
+    heatmap_stampcache_t* c = heatmap_stampcache_new(64 << 20);
+    std::cerr << "{'stamp': 'cached', ";
+    std::cout << "Getting a radius " << RADIUS << " stamp from the cache " << NRENDERS << " times... " << std::flush;
+    for(RepeatTimer t(3) ; t ; t.next()) {
+        for(int i = 0 ; i < NRENDERS ; ++i) {
+            const heatmap_stamp_t* s = heatmap_stampcache_get(c, RADIUS, 0);
+            ret += s->buf[RADIUS] > 0.0f;
+            heatmap_stampcache_release(c, s);
+        }
+    }
+    heatmap_stampcache_free(c);
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,76 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Compares adding points at integer coordinates with adding them at
+// sub-pixel coordinates, which splits them bilinearly, for growing radii.
+
+#include "benchs/common.hpp"
+
+static const size_t NPOINTS = 1000*1000;
+static const unsigned MAPSIZE = 1024;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NPOINTS, MAPSIZE - 1);
+    std::vector<float> fpoints(points.size());
+    for(size_t i = 0 ; i < points.size() ; ++i) {
+        fpoints[i] = static_cast<float>(points[i]) + static_cast<float>(i % 7)/7.0f;
+    }
+
+    const unsigned radii[] = { 4, 16, 64 };
+
+    std::cerr << "[" << std::endl;
+    for(unsigned r : radii) {
+        std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(r));
+        const size_t n = NPOINTS/r;
+
+        {
+            std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+            std::cerr << "{'radius': " << r << ", 'what': 'integer', ";
+            std::cout << "Adding " << n << " integer points with radius " << r << "... " << std::flush;
+            for(RepeatTimer t(3) ; t ; t.next()) {
+                heatmap_add_points_with_stamp(hm.get(), &points[0], &points[1], n, 2, stamp.get());
+            }
+            std::cerr << "," << std::endl;
+            ret += hm->max > 0.0f;
+        }
+
+        std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+        std::cerr << "{'radius': " << r << ", 'what': 'subpixel', ";
+        std::cout << "Adding " << n << " sub-pixel points with radius " << r << "... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            heatmap_add_pointsf_with_stamp(hm.get(), &fpoints[0], &fpoints[1], n, 2, stamp.get());
+        }
+        if(r != 64)
+            std::cerr << "," << std::endl;
+        ret += hm->max > 0.0f;
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -0,0 +1,80 @@
+/* heatmap - High performance heatmap creation in C.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Lucas Beyer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+// Compares keeping a map of only the last 15 ticks by rebuilding it from all
+// of their points on every tick, to a sliding `heatmap_window_t`.
+
+#include <string.h> // memset
+
+#include "benchs/common.hpp"
+
+static const size_t NTICKS = 30;
+static const unsigned NBUCKETS = 15;
+static const size_t NPOINTS_PER_TICK = 10*1000;
+static const unsigned MAPSIZE = 4096;
+
+int main(/* int argc, char *argv[] */)
+{
+    // We'll do something funky with ret in order to avoid optimizing
+    // whole code-blocks away.
+    int ret = 0;
+
+    const std::vector<unsigned> points = genpoints(NTICKS*NPOINTS_PER_TICK, MAPSIZE - 1);
+    std::unique_ptr<heatmap_stamp_t> stamp(heatmap_stamp_gen(16));
+    static const char* names[] = {"rebuild", "window", "sparse window"};
+
+    std::cerr << "[" << std::endl;
+    for(int mode = 0 ; mode < 3 ; ++mode) {
+        std::cerr << "{'window': '" << names[mode] << "', ";
+        std::cout << NTICKS << " ticks of " << NPOINTS_PER_TICK << " points in a " << names[mode] << " of " << NBUCKETS << " ticks... " << std::flush;
+        for(RepeatTimer t(3) ; t ; t.next()) {
+            if(mode == 0) {
+                std::unique_ptr<heatmap_t> hm(heatmap_new(MAPSIZE, MAPSIZE));
+                heatmap_set_lazy_max(hm.get(), 1);
+                for(size_t tick = 0 ; tick < NTICKS ; ++tick) {
+                    const size_t first = tick + 1 > NBUCKETS ? tick + 1 - NBUCKETS : 0;
+                    memset(hm->buf, 0, static_cast<size_t>(MAPSIZE)*MAPSIZE*sizeof(float));
+                    heatmap_add_points_with_stamp(hm.get(), &points[2*first*NPOINTS_PER_TICK], &points[2*first*NPOINTS_PER_TICK+1], (tick + 1 - first)*NPOINTS_PER_TICK, 2, stamp.get());
+                    hm->max_dirty = 1;
+                    ret += heatmap_get_max(hm.get()) > 0.0f;
+                }
+            } else {
+                heatmap_window_t* win = heatmap_window_new(MAPSIZE, MAPSIZE, NBUCKETS, mode == 2);
+                for(size_t tick = 0 ; tick < NTICKS ; ++tick) {
+                    heatmap_add_points_with_stamp(heatmap_window_current(win), &points[2*tick*NPOINTS_PER_TICK], &points[2*tick*NPOINTS_PER_TICK+1], NPOINTS_PER_TICK, 2, stamp.get());
+                    ret += heatmap_get_max(heatmap_window_map(win)) > 0.0f;
+                    heatmap_window_advance(win);
+                }
+                heatmap_window_free(win);
+            }
+        }
+        if(mode < 2)
+            std::cerr << "," << std::endl;
+    }
+    std::cerr << std::endl << "]" << std::endl;
+
+    return ret;
+}
@@ -227,6 +227,14 @@ int main(int argc, char* argv[])
     }
     const heatmap_colorscheme_t* colorscheme = argc == 5 ? g_schemes[argv[4]] : heatmap_cs_default;
 
+    // Input files often contain lots of points on the same pixels, so we
+    // first only count them and convolve the counts with the stamp once at
+    // the end instead of stamping every single point.
+    heatmap_t* counts = heatmap_new(w, h);
+    heatmap_set_lazy_max(counts, 1);
+    float one = 1.0f;
+    heatmap_stamp_t* dot = heatmap_stamp_load(1, 1, &one);
+
     unsigned int x, y;
     float weight = 1.0f;
 #ifdef WEIGHTED
@@ -237,11 +245,15 @@ int main(int argc, char* argv[])
         if(x < w && y < h) {
             // Always using the weighted one even on unweighted data is not a
             // drama for this example and keeps the code somewhat clearer.
-            heatmap_add_weighted_point_with_stamp(hm, x, y, weight, stamp);
+            heatmap_add_weighted_point_with_stamp(counts, x, y, weight, dot);
         } else {
             std::cerr << "Warning: Skipping out-of-bound input coordinate: (" << x << "," << y << ")." << std::endl;
         }
     }
+    heatmap_stamp_free(dot);
+
+    heatmap_convolve(hm, counts, stamp, 0);
+    heatmap_free(counts);
     heatmap_stamp_free(stamp);
 
     std::vector<unsigned char> image(w*h*4);
@@ -26,8 +26,19 @@
 
 #include <stdlib.h> /* malloc, calloc, free */
 #include <string.h> /* memcpy, memset */
-#include <math.h>   /* sqrtf */
+#include <math.h>   /* sqrtf, lrintf */
 #include <assert.h> /* assert, #define NDEBUG to ignore. */
+#include <float.h>  /* FLT_MAX */
+#include <limits.h> /* UINT_MAX */
+#include <time.h>   /* clock, nanosleep */
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> /* Sleep */
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>    /* omp_get_max_threads */
+#endif
 
 /* Having a default stamp ready makes it easier for simple usage of the library
  * since there is no need to create a new stamp.
@@ -48,122 +59,5806 @@ static heatmap_stamp_t stamp_default_4 = {
     stamp_default_4_data, 9, 9
 };
 
-void heatmap_init(heatmap_t* hm, unsigned w, unsigned h)
+/* The innermost loop of stamping a point is adding a row of the stamp onto a
+ * row of the heatmap, while keeping track of the max. That's where all the
+ * time goes for larger stamps, so there's one such row kernel per instruction
+ * set, and the fastest one the CPU we're running on supports gets picked at
+ * runtime, the first time a point gets added.
+ *
+ * The `_max` kernels return the max of `m` and all updated heatmap pixels,
+ * the others don't care about the max at all, see `heatmap_set_lazy_max`.
+ * The weighted kernels may use FMA, so they may differ from the scalar ones
+ * in the last bit, the unweighted ones are always exactly the same.
+ */
+typedef float (*heatmap_row_max_fn)(float* line, const float* stampline, unsigned n, float m);
+typedef float (*heatmap_wrow_max_fn)(float* line, const float* stampline, unsigned n, float w, float m);
+typedef void (*heatmap_row_fn)(float* line, const float* stampline, unsigned n);
+typedef void (*heatmap_wrow_fn)(float* line, const float* stampline, unsigned n, float w);
+typedef float (*heatmap_max_fn)(const float* buf, size_t n);
+typedef void (*heatmap_unpack_fn)(float* out, const unsigned short* in, unsigned n);
+typedef void (*heatmap_pack_fn)(unsigned short* out, const float* in, unsigned n);
+typedef unsigned (*heatmap_qrow_max_fn)(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m);
+typedef void (*heatmap_qrow_fn)(unsigned* line, const unsigned short* stampline, unsigned n);
+typedef unsigned (*heatmap_umax_fn)(const unsigned* buf, size_t n);
+typedef int (*heatmap_wacc_fn)(unsigned long long* line, const float* heat, unsigned n);
+typedef void (*heatmap_wsub_fn)(unsigned long long* line, const float* heat, unsigned n);
+
+typedef struct {
+    heatmap_row_max_fn row_max;
+    heatmap_wrow_max_fn wrow_max;
+    heatmap_row_fn row;
+    heatmap_wrow_fn wrow;
+    heatmap_max_fn max; /* The max of a whole buffer (of non-negative values). */
+    /* Conversions between floats and the 16-bit floats of half-precision
+     * maps, rounding to nearest even. FP16 saturates at 65504 instead of
+     * going infinite. All of them give the exact same results as the scalar ones.
+     */
+    heatmap_unpack_fn unpack_fp16;
+    heatmap_pack_fn pack_fp16;
+    heatmap_unpack_fn unpack_bf16;
+    heatmap_pack_fn pack_bf16;
+    /* The fixed-point counterparts of `row_max`, `row` and `max`, adding a
+     * quantized stamp's row with saturation instead of wrapping around.
+     * Integers, so all of them give the exact same results.
+     */
+    heatmap_qrow_max_fn qrow_max;
+    heatmap_qrow_fn qrow;
+    heatmap_umax_fn umax;
+    /* Rounding a row of heat to the 64-bit fixed-point of windows like
+     * `heatmap_quantize_window` and adding it onto (or subtracting it from)
+     * a window's total, with saturation at both ends. `wacc` tells whether
+     * anything saturated. They all round the very same way, so subtracting
+     * a row gives back exactly what was there before adding it.
+     */
+    heatmap_wacc_fn wacc;
+    heatmap_wsub_fn wsub;
+} heatmap_kernels_t;
+
+static float heatmap_row_max_scalar(float* line, const float* stampline, unsigned n, float m)
 {
-    memset(hm, 0, sizeof(heatmap_t));
-    hm->buf = (float*)calloc(w*h, sizeof(float));
-    hm->w = w;
-    hm->h = h;
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        /* TODO: Let's actually accept negatives and try out funky stamps. */
+        /* Note that that might mess with the max though. */
+        /* And that we'll have to clamp the bottom to 0 when rendering. */
+        assert(stampline[i] >= 0.0f);
+
+        line[i] += stampline[i];
+        if(line[i] > m) {m = line[i];}
+
+        assert(line[i] >= 0.0f);
+    }
+    return m;
 }
 
-heatmap_t* heatmap_new(unsigned w, unsigned h)
+static float heatmap_wrow_max_scalar(float* line, const float* stampline, unsigned n, float w, float m)
 {
-    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
-    heatmap_init(hm, w, h);
-    return hm;
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        /* TODO: see unweighted function */
+        assert(stampline[i] >= 0.0f);
+
+        line[i] += stampline[i] * w;
+        if(line[i] > m) {m = line[i];}
+
+        assert(line[i] >= 0.0f);
+    }
+    return m;
 }
 
-void heatmap_free(heatmap_t* h)
+static void heatmap_row_scalar(float* line, const float* stampline, unsigned n)
 {
-    free(h->buf);
-    free(h);
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        assert(stampline[i] >= 0.0f);
+        line[i] += stampline[i];
+    }
 }
 
-void heatmap_add_point(heatmap_t* h, unsigned x, unsigned y)
+static void heatmap_wrow_scalar(float* line, const float* stampline, unsigned n, float w)
 {
-    heatmap_add_point_with_stamp(h, x, y, &stamp_default_4);
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        assert(stampline[i] >= 0.0f);
+        line[i] += stampline[i] * w;
+    }
 }
 
-void heatmap_add_point_with_stamp(heatmap_t* h, unsigned x, unsigned y, const heatmap_stamp_t* stamp)
+static float heatmap_max_scalar(const float* buf, size_t n)
 {
-    /* I'm still unsure whether we want this to be an assert or not... */
-    if(x >= h->w || y >= h->h)
-        return;
+    float m = 0.0f;
+    size_t i;
+    for(i = 0 ; i < n ; ++i) {
+        if(buf[i] > m) {m = buf[i];}
+    }
+    return m;
+}
+
+/* The largest finite FP16, which is where it saturates. */
+#define HEATMAP_FP16_MAX 65504.0f
+
+static float heatmap_fp16_to_float(unsigned short h)
+{
+    /* Move the exponent and mantissa into place and rebias the exponent.
+     * Subnormals are normalized by letting the FPU subtract the implicit one.
+     */
+    const float magic = 6.103515625e-05f; /* 2^-14, the smallest normal FP16. */
+    const unsigned exp = h & 0x7c00u;
+    unsigned u = (unsigned)(h & 0x7fffu) << 13;
+    float f;
+
+    if(exp == 0x7c00u) {
+        u += (255u - 31u) << 23; /* Inf and NaN stay what they are. */
+    } else if(exp == 0) {
+        u += 113u << 23;
+        memcpy(&f, &u, sizeof(f));
+        f -= magic;
+        memcpy(&u, &f, sizeof(f));
+    } else {
+        u += (127u - 15u) << 23;
+    }
+    u |= (unsigned)(h & 0x8000u) << 16;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static unsigned short heatmap_fp16_from_float(float f)
+{
+    unsigned u, sign, o;
+
+    memcpy(&u, &f, sizeof(f));
+    sign = (u >> 16) & 0x8000u;
+    u &= 0x7fffffffu;
+
+    if(u >= (143u << 23)) {
+        /* At least 65536 (or NaN): saturate. */
+        o = 0x7bffu;
+    } else if(u < (113u << 23)) {
+        /* Subnormal or zero: let the FPU round it into the mantissa's place. */
+        const unsigned magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        float a, m;
+        memcpy(&a, &u, sizeof(a));
+        memcpy(&m, &magic, sizeof(m));
+        a += m;
+        memcpy(&u, &a, sizeof(a));
+        o = u - magic;
+    } else {
+        /* Rebias the exponent and round the mantissa to nearest even. */
+        u += ((15u - 127u) << 23) + 0xfffu + ((u >> 13) & 1u);
+        o = u >> 13;
+        if(o > 0x7bffu) {o = 0x7bffu;}
+    }
+
+    return (unsigned short)(o | sign);
+}
+
+static float heatmap_bf16_to_float(unsigned short h)
+{
+    const unsigned u = (unsigned)h << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static unsigned short heatmap_bf16_from_float(float f)
+{
+    unsigned u;
+    memcpy(&u, &f, sizeof(f));
+    return (unsigned short)((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+}
+
+static void heatmap_unpack_fp16_scalar(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        out[i] = heatmap_fp16_to_float(in[i]);
+    }
+}
+
+static void heatmap_pack_fp16_scalar(unsigned short* out, const float* in, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        out[i] = heatmap_fp16_from_float(in[i]);
+    }
+}
+
+static void heatmap_unpack_bf16_scalar(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        out[i] = heatmap_bf16_to_float(in[i]);
+    }
+}
+
+static void heatmap_pack_bf16_scalar(unsigned short* out, const float* in, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        out[i] = heatmap_bf16_from_float(in[i]);
+    }
+}
+
+static unsigned heatmap_qrow_max_scalar(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned v = line[i] + stampline[i];
+        /* Only a sum which wrapped around is smaller than what it started from. */
+        line[i] = v < line[i] ? 0xffffffffu : v;
+        if(line[i] > m) {m = line[i];}
+    }
+    return m;
+}
+
+static void heatmap_qrow_scalar(unsigned* line, const unsigned short* stampline, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned v = line[i] + stampline[i];
+        line[i] = v < line[i] ? 0xffffffffu : v;
+    }
+}
+
+/* Windows keep their heat in 64-bit fixed-point with 32 fractional bits, so
+ * a pixel of a window can hold about 4 billion heat, and only heat below 2^-33
+ * rounds away.
+ */
+#define HEATMAP_WINDOW_ONE 4294967296.0
+/* From 2^52 on, doubles are whole numbers. */
+#define HEATMAP_DOUBLE_WHOLE 4503599627370496.0
+
+/* Rounds a heat to a window's fixed-point, to nearest even, saturating at
+ * 2^64. Doubles hold every float times 2^32 exactly, so that's the only
+ * rounding there is.
+ */
+static unsigned long long heatmap_quantize_window(float heat)
+{
+    const double v = (double)heat*HEATMAP_WINDOW_ONE;
+    return !(v > 0.0)                    ? 0
+         : v < HEATMAP_DOUBLE_WHOLE      ? (unsigned long long)llrint(v)
+         : v < 18446744073709551616.0    ? (unsigned long long)v
+         :                                 ~0ull;
+}
+
+static int heatmap_wacc_scalar(unsigned long long* line, const float* heat, unsigned n)
+{
+    int saturated = 0;
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned long long v = line[i] + heatmap_quantize_window(heat[i]);
+        if(v < line[i]) {
+            line[i] = ~0ull;
+            saturated = 1;
+        } else {
+            line[i] = v;
+        }
+    }
+    return saturated;
+}
+
+static void heatmap_wsub_scalar(unsigned long long* line, const float* heat, unsigned n)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned long long q = heatmap_quantize_window(heat[i]);
+        line[i] = line[i] > q ? line[i] - q : 0;
+    }
+}
+
+static unsigned heatmap_umax_scalar(const unsigned* buf, size_t n)
+{
+    unsigned m = 0;
+    size_t i;
+    for(i = 0 ; i < n ; ++i) {
+        if(buf[i] > m) {m = buf[i];}
+    }
+    return m;
+}
+
+static const heatmap_kernels_t heatmap_kernels_scalar = {
+    heatmap_row_max_scalar, heatmap_wrow_max_scalar, heatmap_row_scalar, heatmap_wrow_scalar, heatmap_max_scalar,
+    heatmap_unpack_fp16_scalar, heatmap_pack_fp16_scalar, heatmap_unpack_bf16_scalar, heatmap_pack_bf16_scalar,
+    heatmap_qrow_max_scalar, heatmap_qrow_scalar, heatmap_umax_scalar, heatmap_wacc_scalar, heatmap_wsub_scalar
+};
+
+#if !defined(HEATMAP_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define HEATMAP_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> /* __cpuid, _xgetbv */
+#define HEATMAP_TARGET(isa)
+#else
+#define HEATMAP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+HEATMAP_TARGET("sse2")
+static float heatmap_hmax_sse2(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+HEATMAP_TARGET("sse2")
+static float heatmap_row_max_sse2(float* line, const float* stampline, unsigned n, float m)
+{
+    __m128 vm = _mm_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const __m128 v = _mm_add_ps(_mm_loadu_ps(line + i), _mm_loadu_ps(stampline + i));
+        _mm_storeu_ps(line + i, v);
+        vm = _mm_max_ps(vm, v);
+    }
+
+    return heatmap_row_max_scalar(line + i, stampline + i, n - i, heatmap_hmax_sse2(vm));
+}
+
+HEATMAP_TARGET("sse2")
+static float heatmap_wrow_max_sse2(float* line, const float* stampline, unsigned n, float w, float m)
+{
+    const __m128 vw = _mm_set1_ps(w);
+    __m128 vm = _mm_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const __m128 v = _mm_add_ps(_mm_loadu_ps(line + i), _mm_mul_ps(_mm_loadu_ps(stampline + i), vw));
+        _mm_storeu_ps(line + i, v);
+        vm = _mm_max_ps(vm, v);
+    }
+
+    return heatmap_wrow_max_scalar(line + i, stampline + i, n - i, w, heatmap_hmax_sse2(vm));
+}
+
+HEATMAP_TARGET("sse2")
+static void heatmap_row_sse2(float* line, const float* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        _mm_storeu_ps(line + i, _mm_add_ps(_mm_loadu_ps(line + i), _mm_loadu_ps(stampline + i)));
+    }
+
+    heatmap_row_scalar(line + i, stampline + i, n - i);
+}
+
+HEATMAP_TARGET("sse2")
+static void heatmap_wrow_sse2(float* line, const float* stampline, unsigned n, float w)
+{
+    const __m128 vw = _mm_set1_ps(w);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        _mm_storeu_ps(line + i, _mm_add_ps(_mm_loadu_ps(line + i), _mm_mul_ps(_mm_loadu_ps(stampline + i), vw)));
+    }
+
+    heatmap_wrow_scalar(line + i, stampline + i, n - i, w);
+}
+
+/* Four independent accumulators, so that we're bound by the loads, not by
+ * the latency of the max instruction.
+ */
+HEATMAP_TARGET("sse2")
+static float heatmap_max_sse2(const float* buf, size_t n)
+{
+    __m128 m0 = _mm_setzero_ps(), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        m0 = _mm_max_ps(m0, _mm_loadu_ps(buf + i));
+        m1 = _mm_max_ps(m1, _mm_loadu_ps(buf + i + 4));
+        m2 = _mm_max_ps(m2, _mm_loadu_ps(buf + i + 8));
+        m3 = _mm_max_ps(m3, _mm_loadu_ps(buf + i + 12));
+    }
 
-    /* I hate you, C */
     {
-        /* Note: the order of operations is important, since we're computing with unsigned! */
+        const float m = heatmap_hmax_sse2(_mm_max_ps(_mm_max_ps(m0, m1), _mm_max_ps(m2, m3)));
+        const float t = heatmap_max_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
 
-        /* These are [first, last) pairs in the STAMP's pixels. */
-        const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
-        const unsigned y0 = y < stamp->h/2 ? (stamp->h/2 - y) : 0;
-        const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
-        const unsigned y1 = (y + stamp->h/2) < h->h ? stamp->h : stamp->h/2 + (h->h - y);
+HEATMAP_TARGET("sse2")
+static void heatmap_unpack_bf16_sse2(float* out, const unsigned short* in, unsigned n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned i = 0;
 
-        unsigned iy;
+    for( ; i + 8 <= n ; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+
+    heatmap_unpack_bf16_scalar(out + i, in + i, n - i);
+}
+
+/* SSE2 can only pack with signed saturation, so the rounded upper halves
+ * are shifted into the signed range for packing and back afterwards.
+ */
+HEATMAP_TARGET("sse2")
+static __m128i heatmap_round_bf16_sse2(__m128i u)
+{
+    const __m128i bias = _mm_add_epi32(_mm_set1_epi32(0x7fff), _mm_and_si128(_mm_srli_epi32(u, 16), _mm_set1_epi32(1)));
+    return _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(u, bias), 16), _mm_set1_epi32(0x8000));
+}
+
+HEATMAP_TARGET("sse2")
+static void heatmap_pack_bf16_sse2(unsigned short* out, const float* in, unsigned n)
+{
+    const __m128i offset = _mm_set1_epi16((short)0x8000);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m128i lo = heatmap_round_bf16_sse2(_mm_loadu_si128((const __m128i*)(in + i)));
+        const __m128i hi = heatmap_round_bf16_sse2(_mm_loadu_si128((const __m128i*)(in + i + 4)));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi16(_mm_packs_epi32(lo, hi), offset));
+    }
+
+    heatmap_pack_bf16_scalar(out + i, in + i, n - i);
+}
+
+/* SSE2 has neither unsigned 32-bit compares nor unsigned max, so these work
+ * on values shifted into the signed range by flipping their top bit.
+ */
+HEATMAP_TARGET("sse2")
+static __m128i heatmap_qadd_sse2(__m128i a, __m128i b)
+{
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    const __m128i r = _mm_add_epi32(a, b);
+    return _mm_or_si128(r, _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(r, bias)));
+}
+
+HEATMAP_TARGET("sse2")
+static __m128i heatmap_smax_sse2(__m128i a, __m128i b)
+{
+    const __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+HEATMAP_TARGET("sse2")
+static unsigned heatmap_hsmax_sse2(__m128i v)
+{
+    unsigned u[4], m = 0;
+    int i;
+
+    _mm_storeu_si128((__m128i*)u, v);
+    for(i = 0 ; i < 4 ; ++i) {
+        if((u[i] ^ 0x80000000u) > m) {m = u[i] ^ 0x80000000u;}
+    }
+    return m;
+}
+
+HEATMAP_TARGET("sse2")
+static unsigned heatmap_qrow_max_sse2(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m)
+{
+    const __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi32((int)0x80000000u);
+    __m128i vm = _mm_set1_epi32((int)(m ^ 0x80000000u));
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(stampline + i));
+        const __m128i lo = heatmap_qadd_sse2(_mm_loadu_si128((const __m128i*)(line + i)), _mm_unpacklo_epi16(s, zero));
+        const __m128i hi = heatmap_qadd_sse2(_mm_loadu_si128((const __m128i*)(line + i + 4)), _mm_unpackhi_epi16(s, zero));
+        _mm_storeu_si128((__m128i*)(line + i), lo);
+        _mm_storeu_si128((__m128i*)(line + i + 4), hi);
+        vm = heatmap_smax_sse2(vm, heatmap_smax_sse2(_mm_xor_si128(lo, bias), _mm_xor_si128(hi, bias)));
+    }
+
+    return heatmap_qrow_max_scalar(line + i, stampline + i, n - i, heatmap_hsmax_sse2(vm));
+}
+
+HEATMAP_TARGET("sse2")
+static void heatmap_qrow_sse2(unsigned* line, const unsigned short* stampline, unsigned n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(stampline + i));
+        _mm_storeu_si128((__m128i*)(line + i), heatmap_qadd_sse2(_mm_loadu_si128((const __m128i*)(line + i)), _mm_unpacklo_epi16(s, zero)));
+        _mm_storeu_si128((__m128i*)(line + i + 4), heatmap_qadd_sse2(_mm_loadu_si128((const __m128i*)(line + i + 4)), _mm_unpackhi_epi16(s, zero)));
+    }
+
+    heatmap_qrow_scalar(line + i, stampline + i, n - i);
+}
+
+HEATMAP_TARGET("sse2")
+static unsigned heatmap_umax_sse2(const unsigned* buf, size_t n)
+{
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    __m128i m0 = bias, m1 = bias;
+    size_t i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        m0 = heatmap_smax_sse2(m0, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + i)), bias));
+        m1 = heatmap_smax_sse2(m1, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + i + 4)), bias));
+    }
+
+    {
+        const unsigned m = heatmap_hsmax_sse2(heatmap_smax_sse2(m0, m1));
+        const unsigned t = heatmap_umax_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
+
+/* There's no FP16 conversion before F16C, which comes along with AVX2, and
+ * no 64-bit compare for saturating windows before SSE4.2.
+ */
+static const heatmap_kernels_t heatmap_kernels_sse2 = {
+    heatmap_row_max_sse2, heatmap_wrow_max_sse2, heatmap_row_sse2, heatmap_wrow_sse2, heatmap_max_sse2,
+    heatmap_unpack_fp16_scalar, heatmap_pack_fp16_scalar, heatmap_unpack_bf16_sse2, heatmap_pack_bf16_sse2,
+    heatmap_qrow_max_sse2, heatmap_qrow_sse2, heatmap_umax_sse2, heatmap_wacc_scalar, heatmap_wsub_scalar
+};
+
+HEATMAP_TARGET("avx2,fma")
+static float heatmap_hmax_avx2(__m256 v)
+{
+    __m128 r = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    r = _mm_max_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 0, 3, 2)));
+    r = _mm_max_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(r);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static float heatmap_row_max_avx2(float* line, const float* stampline, unsigned n, float m)
+{
+    __m256 vm = _mm256_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256 v = _mm256_add_ps(_mm256_loadu_ps(line + i), _mm256_loadu_ps(stampline + i));
+        _mm256_storeu_ps(line + i, v);
+        vm = _mm256_max_ps(vm, v);
+    }
+
+    return heatmap_row_max_scalar(line + i, stampline + i, n - i, heatmap_hmax_avx2(vm));
+}
+
+HEATMAP_TARGET("avx2,fma")
+static float heatmap_wrow_max_avx2(float* line, const float* stampline, unsigned n, float w, float m)
+{
+    const __m256 vw = _mm256_set1_ps(w);
+    __m256 vm = _mm256_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(stampline + i), vw, _mm256_loadu_ps(line + i));
+        _mm256_storeu_ps(line + i, v);
+        vm = _mm256_max_ps(vm, v);
+    }
+
+    return heatmap_wrow_max_scalar(line + i, stampline + i, n - i, w, heatmap_hmax_avx2(vm));
+}
+
+HEATMAP_TARGET("avx2,fma")
+static void heatmap_row_avx2(float* line, const float* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        _mm256_storeu_ps(line + i, _mm256_add_ps(_mm256_loadu_ps(line + i), _mm256_loadu_ps(stampline + i)));
+    }
+
+    heatmap_row_scalar(line + i, stampline + i, n - i);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static void heatmap_wrow_avx2(float* line, const float* stampline, unsigned n, float w)
+{
+    const __m256 vw = _mm256_set1_ps(w);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        _mm256_storeu_ps(line + i, _mm256_fmadd_ps(_mm256_loadu_ps(stampline + i), vw, _mm256_loadu_ps(line + i)));
+    }
+
+    heatmap_wrow_scalar(line + i, stampline + i, n - i, w);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static float heatmap_max_avx2(const float* buf, size_t n)
+{
+    __m256 m0 = _mm256_setzero_ps(), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 32 <= n ; i += 32) {
+        m0 = _mm256_max_ps(m0, _mm256_loadu_ps(buf + i));
+        m1 = _mm256_max_ps(m1, _mm256_loadu_ps(buf + i + 8));
+        m2 = _mm256_max_ps(m2, _mm256_loadu_ps(buf + i + 16));
+        m3 = _mm256_max_ps(m3, _mm256_loadu_ps(buf + i + 24));
+    }
+
+    {
+        const float m = heatmap_hmax_avx2(_mm256_max_ps(_mm256_max_ps(m0, m1), _mm256_max_ps(m2, m3)));
+        const float t = heatmap_max_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
+
+HEATMAP_TARGET("avx2,fma,f16c")
+static void heatmap_unpack_fp16_avx2(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i))));
+    }
+
+    heatmap_unpack_fp16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx2,fma,f16c")
+static void heatmap_pack_fp16_avx2(unsigned short* out, const float* in, unsigned n)
+{
+    const __m256 vmax = _mm256_set1_ps(HEATMAP_FP16_MAX);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256 v = _mm256_min_ps(_mm256_loadu_ps(in + i), vmax);
+        _mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+
+    heatmap_pack_fp16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx2,fma,f16c")
+static void heatmap_unpack_bf16_avx2(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_slli_epi32(v, 16));
+    }
+
+    heatmap_unpack_bf16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx2,fma,f16c")
+static void heatmap_pack_bf16_avx2(unsigned short* out, const float* in, unsigned n)
+{
+    const __m256i one = _mm256_set1_epi32(1), half = _mm256_set1_epi32(0x7fff);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256i u = _mm256_loadu_si256((const __m256i*)(in + i));
+        const __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(half, _mm256_and_si256(_mm256_srli_epi32(u, 16), one))), 16);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+    }
+
+    heatmap_pack_bf16_scalar(out + i, in + i, n - i);
+}
+
+/* a + min(b, ~a) can't wrap around, and is all ones exactly when a + b would have. */
+HEATMAP_TARGET("avx2,fma")
+static __m256i heatmap_qadd_avx2(__m256i a, __m256i b)
+{
+    return _mm256_add_epi32(a, _mm256_min_epu32(b, _mm256_xor_si256(a, _mm256_set1_epi32(-1))));
+}
+
+HEATMAP_TARGET("avx2,fma")
+static unsigned heatmap_humax_avx2(__m256i v)
+{
+    __m128i r = _mm_max_epu32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    r = _mm_max_epu32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(1, 0, 3, 2)));
+    r = _mm_max_epu32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (unsigned)_mm_cvtsi128_si32(r);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static unsigned heatmap_qrow_max_avx2(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m)
+{
+    __m256i vm = _mm256_set1_epi32((int)m);
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256i s = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(stampline + i)));
+        const __m256i v = heatmap_qadd_avx2(_mm256_loadu_si256((const __m256i*)(line + i)), s);
+        _mm256_storeu_si256((__m256i*)(line + i), v);
+        vm = _mm256_max_epu32(vm, v);
+    }
+
+    return heatmap_qrow_max_scalar(line + i, stampline + i, n - i, heatmap_humax_avx2(vm));
+}
+
+HEATMAP_TARGET("avx2,fma")
+static void heatmap_qrow_avx2(unsigned* line, const unsigned short* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        const __m256i s = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(stampline + i)));
+        _mm256_storeu_si256((__m256i*)(line + i), heatmap_qadd_avx2(_mm256_loadu_si256((const __m256i*)(line + i)), s));
+    }
+
+    heatmap_qrow_scalar(line + i, stampline + i, n - i);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static unsigned heatmap_umax_avx2(const unsigned* buf, size_t n)
+{
+    __m256i m0 = _mm256_setzero_si256(), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 32 <= n ; i += 32) {
+        m0 = _mm256_max_epu32(m0, _mm256_loadu_si256((const __m256i*)(buf + i)));
+        m1 = _mm256_max_epu32(m1, _mm256_loadu_si256((const __m256i*)(buf + i + 8)));
+        m2 = _mm256_max_epu32(m2, _mm256_loadu_si256((const __m256i*)(buf + i + 16)));
+        m3 = _mm256_max_epu32(m3, _mm256_loadu_si256((const __m256i*)(buf + i + 24)));
+    }
+
+    {
+        const unsigned m = heatmap_humax_avx2(_mm256_max_epu32(_mm256_max_epu32(m0, m1), _mm256_max_epu32(m2, m3)));
+        const unsigned t = heatmap_umax_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
+
+/* Rounds 4 heats to a window's fixed-point, with the sum of 2^52 and the
+ * heat times 2^32, a double, holding the rounded heat in its low bits. That
+ * only works below 2^52, so returns 0 if any is above, in which case the
+ * caller falls back to the scalar code.
+ */
+HEATMAP_TARGET("avx2,fma")
+static int heatmap_quantize_window_avx2(const float* heat, __m256i* q)
+{
+    const __m256d magic = _mm256_set1_pd(HEATMAP_DOUBLE_WHOLE);
+    /* Comes first, so that max turns NaN into 0. */
+    const __m256d v = _mm256_max_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(heat)), _mm256_set1_pd(HEATMAP_WINDOW_ONE)), _mm256_setzero_pd());
+    if(_mm256_movemask_pd(_mm256_cmp_pd(v, magic, _CMP_GE_OQ)))
+        return 0;
+    *q = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(v, magic)), _mm256_castpd_si256(magic));
+    return 1;
+}
+
+HEATMAP_TARGET("avx2,fma")
+static int heatmap_wacc_avx2(unsigned long long* line, const float* heat, unsigned n)
+{
+    const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    __m256i saturated = _mm256_setzero_si256();
+    int scalar = 0;
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        __m256i q;
+        if(heatmap_quantize_window_avx2(heat + i, &q)) {
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(line + i));
+            const __m256i v = _mm256_add_epi64(a, q);
+            const __m256i over = _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias), _mm256_xor_si256(v, bias));
+            _mm256_storeu_si256((__m256i*)(line + i), _mm256_or_si256(v, over));
+            saturated = _mm256_or_si256(saturated, over);
+        } else {
+            scalar |= heatmap_wacc_scalar(line + i, heat + i, 4);
+        }
+    }
+
+    return heatmap_wacc_scalar(line + i, heat + i, n - i) | scalar | !_mm256_testz_si256(saturated, saturated);
+}
+
+HEATMAP_TARGET("avx2,fma")
+static void heatmap_wsub_avx2(unsigned long long* line, const float* heat, unsigned n)
+{
+    const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        __m256i q;
+        if(heatmap_quantize_window_avx2(heat + i, &q)) {
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(line + i));
+            const __m256i under = _mm256_cmpgt_epi64(_mm256_xor_si256(q, bias), _mm256_xor_si256(a, bias));
+            _mm256_storeu_si256((__m256i*)(line + i), _mm256_andnot_si256(under, _mm256_sub_epi64(a, q)));
+        } else {
+            heatmap_wsub_scalar(line + i, heat + i, 4);
+        }
+    }
+
+    heatmap_wsub_scalar(line + i, heat + i, n - i);
+}
+
+static const heatmap_kernels_t heatmap_kernels_avx2 = {
+    heatmap_row_max_avx2, heatmap_wrow_max_avx2, heatmap_row_avx2, heatmap_wrow_avx2, heatmap_max_avx2,
+    heatmap_unpack_fp16_avx2, heatmap_pack_fp16_avx2, heatmap_unpack_bf16_avx2, heatmap_pack_bf16_avx2,
+    heatmap_qrow_max_avx2, heatmap_qrow_avx2, heatmap_umax_avx2, heatmap_wacc_avx2, heatmap_wsub_avx2
+};
+
+/* GCC 12 wrongly warns about the "undefined" passthrough registers used inside
+ * its own AVX-512 intrinsics (GCC bug 105593), so silence it for those only.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+HEATMAP_TARGET("avx512f")
+static float heatmap_hmax_avx512(__m512 v)
+{
+    __m128 r;
+    v = _mm512_max_ps(v, _mm512_shuffle_f32x4(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm512_max_ps(v, _mm512_shuffle_f32x4(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    r = _mm512_castps512_ps128(v);
+    r = _mm_max_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 0, 3, 2)));
+    r = _mm_max_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(r);
+}
+
+/* AVX-512 has masked loads and stores, so there's no scalar tail at all. */
+HEATMAP_TARGET("avx512f")
+static float heatmap_row_max_avx512(float* line, const float* stampline, unsigned n, float m)
+{
+    __m512 vm = _mm512_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512 v = _mm512_add_ps(_mm512_loadu_ps(line + i), _mm512_loadu_ps(stampline + i));
+        _mm512_storeu_ps(line + i, v);
+        vm = _mm512_max_ps(vm, v);
+    }
+
+    if(i < n) {
+        const __mmask16 k = (__mmask16)((1u << (n - i)) - 1u);
+        const __m512 v = _mm512_add_ps(_mm512_maskz_loadu_ps(k, line + i), _mm512_maskz_loadu_ps(k, stampline + i));
+        _mm512_mask_storeu_ps(line + i, k, v);
+        vm = _mm512_mask_max_ps(vm, k, vm, v);
+    }
+
+    return heatmap_hmax_avx512(vm);
+}
+
+HEATMAP_TARGET("avx512f")
+static float heatmap_wrow_max_avx512(float* line, const float* stampline, unsigned n, float w, float m)
+{
+    const __m512 vw = _mm512_set1_ps(w);
+    __m512 vm = _mm512_set1_ps(m);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512 v = _mm512_fmadd_ps(_mm512_loadu_ps(stampline + i), vw, _mm512_loadu_ps(line + i));
+        _mm512_storeu_ps(line + i, v);
+        vm = _mm512_max_ps(vm, v);
+    }
+
+    if(i < n) {
+        const __mmask16 k = (__mmask16)((1u << (n - i)) - 1u);
+        const __m512 v = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, stampline + i), vw, _mm512_maskz_loadu_ps(k, line + i));
+        _mm512_mask_storeu_ps(line + i, k, v);
+        vm = _mm512_mask_max_ps(vm, k, vm, v);
+    }
+
+    return heatmap_hmax_avx512(vm);
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_row_avx512(float* line, const float* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        _mm512_storeu_ps(line + i, _mm512_add_ps(_mm512_loadu_ps(line + i), _mm512_loadu_ps(stampline + i)));
+    }
+
+    if(i < n) {
+        const __mmask16 k = (__mmask16)((1u << (n - i)) - 1u);
+        _mm512_mask_storeu_ps(line + i, k, _mm512_add_ps(_mm512_maskz_loadu_ps(k, line + i), _mm512_maskz_loadu_ps(k, stampline + i)));
+    }
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_wrow_avx512(float* line, const float* stampline, unsigned n, float w)
+{
+    const __m512 vw = _mm512_set1_ps(w);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        _mm512_storeu_ps(line + i, _mm512_fmadd_ps(_mm512_loadu_ps(stampline + i), vw, _mm512_loadu_ps(line + i)));
+    }
+
+    if(i < n) {
+        const __mmask16 k = (__mmask16)((1u << (n - i)) - 1u);
+        _mm512_mask_storeu_ps(line + i, k, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, stampline + i), vw, _mm512_maskz_loadu_ps(k, line + i)));
+    }
+}
+
+HEATMAP_TARGET("avx512f")
+static float heatmap_max_avx512(const float* buf, size_t n)
+{
+    __m512 m0 = _mm512_setzero_ps(), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 64 <= n ; i += 64) {
+        m0 = _mm512_max_ps(m0, _mm512_loadu_ps(buf + i));
+        m1 = _mm512_max_ps(m1, _mm512_loadu_ps(buf + i + 16));
+        m2 = _mm512_max_ps(m2, _mm512_loadu_ps(buf + i + 32));
+        m3 = _mm512_max_ps(m3, _mm512_loadu_ps(buf + i + 48));
+    }
+    for( ; i + 16 <= n ; i += 16) {
+        m0 = _mm512_max_ps(m0, _mm512_loadu_ps(buf + i));
+    }
+    if(i < n) {
+        m1 = _mm512_max_ps(m1, _mm512_maskz_loadu_ps((__mmask16)((1u << (n - i)) - 1u), buf + i));
+    }
+
+    return heatmap_hmax_avx512(_mm512_max_ps(_mm512_max_ps(m0, m1), _mm512_max_ps(m2, m3)));
+}
+
+/* The 16-bit masked loads and stores would need AVX-512BW, so these do have
+ * a scalar tail.
+ */
+HEATMAP_TARGET("avx512f")
+static void heatmap_unpack_fp16_avx512(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(in + i))));
+    }
+
+    heatmap_unpack_fp16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_pack_fp16_avx512(unsigned short* out, const float* in, unsigned n)
+{
+    const __m512 vmax = _mm512_set1_ps(HEATMAP_FP16_MAX);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512 v = _mm512_min_ps(_mm512_loadu_ps(in + i), vmax);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+
+    heatmap_pack_fp16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_unpack_bf16_avx512(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        _mm512_storeu_si512(out + i, _mm512_slli_epi32(v, 16));
+    }
+
+    heatmap_unpack_bf16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_pack_bf16_avx512(unsigned short* out, const float* in, unsigned n)
+{
+    const __m512i one = _mm512_set1_epi32(1), half = _mm512_set1_epi32(0x7fff);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512i u = _mm512_loadu_si512(in + i);
+        const __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, _mm512_add_epi32(half, _mm512_and_si512(_mm512_srli_epi32(u, 16), one))), 16);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm512_cvtepi32_epi16(r));
+    }
+
+    heatmap_pack_bf16_scalar(out + i, in + i, n - i);
+}
+
+HEATMAP_TARGET("avx512f")
+static __m512i heatmap_qadd_avx512(__m512i a, __m512i b)
+{
+    return _mm512_add_epi32(a, _mm512_min_epu32(b, _mm512_xor_si512(a, _mm512_set1_epi32(-1))));
+}
+
+HEATMAP_TARGET("avx512f")
+static unsigned heatmap_qrow_max_avx512(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m)
+{
+    __m512i vm = _mm512_set1_epi32((int)m);
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512i s = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(stampline + i)));
+        const __m512i v = heatmap_qadd_avx512(_mm512_loadu_si512(line + i), s);
+        _mm512_storeu_si512(line + i, v);
+        vm = _mm512_max_epu32(vm, v);
+    }
+
+    return heatmap_qrow_max_scalar(line + i, stampline + i, n - i, _mm512_reduce_max_epu32(vm));
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_qrow_avx512(unsigned* line, const unsigned short* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        const __m512i s = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(stampline + i)));
+        _mm512_storeu_si512(line + i, heatmap_qadd_avx512(_mm512_loadu_si512(line + i), s));
+    }
+
+    heatmap_qrow_scalar(line + i, stampline + i, n - i);
+}
+
+HEATMAP_TARGET("avx512f")
+static unsigned heatmap_umax_avx512(const unsigned* buf, size_t n)
+{
+    __m512i m0 = _mm512_setzero_si512(), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 64 <= n ; i += 64) {
+        m0 = _mm512_max_epu32(m0, _mm512_loadu_si512(buf + i));
+        m1 = _mm512_max_epu32(m1, _mm512_loadu_si512(buf + i + 16));
+        m2 = _mm512_max_epu32(m2, _mm512_loadu_si512(buf + i + 32));
+        m3 = _mm512_max_epu32(m3, _mm512_loadu_si512(buf + i + 48));
+    }
+    for( ; i + 16 <= n ; i += 16) {
+        m0 = _mm512_max_epu32(m0, _mm512_loadu_si512(buf + i));
+    }
+    if(i < n) {
+        m1 = _mm512_max_epu32(m1, _mm512_maskz_loadu_epi32((__mmask16)((1u << (n - i)) - 1u), buf + i));
+    }
+
+    return _mm512_reduce_max_epu32(_mm512_max_epu32(_mm512_max_epu32(m0, m1), _mm512_max_epu32(m2, m3)));
+}
+
+/* Like `heatmap_quantize_window_avx2`, for 8 heats, since converting doubles
+ * to 64-bit integers right away takes AVX512DQ.
+ */
+HEATMAP_TARGET("avx512f")
+static int heatmap_quantize_window_avx512(const float* heat, __m512i* q)
+{
+    const __m512d magic = _mm512_set1_pd(HEATMAP_DOUBLE_WHOLE);
+    const __m512d v = _mm512_max_pd(_mm512_mul_pd(_mm512_cvtps_pd(_mm256_loadu_ps(heat)), _mm512_set1_pd(HEATMAP_WINDOW_ONE)), _mm512_setzero_pd());
+    if(_mm512_cmp_pd_mask(v, magic, _CMP_GE_OQ))
+        return 0;
+    *q = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(v, magic)), _mm512_castpd_si512(magic));
+    return 1;
+}
+
+HEATMAP_TARGET("avx512f")
+static int heatmap_wacc_avx512(unsigned long long* line, const float* heat, unsigned n)
+{
+    __mmask8 saturated = 0;
+    int scalar = 0;
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        __m512i q;
+        if(heatmap_quantize_window_avx512(heat + i, &q)) {
+            const __m512i a = _mm512_loadu_si512(line + i);
+            const __m512i v = _mm512_add_epi64(a, q);
+            const __mmask8 over = _mm512_cmplt_epu64_mask(v, a);
+            _mm512_storeu_si512(line + i, _mm512_mask_mov_epi64(v, over, _mm512_set1_epi64(-1)));
+            saturated |= over;
+        } else {
+            scalar |= heatmap_wacc_scalar(line + i, heat + i, 8);
+        }
+    }
+
+    return heatmap_wacc_scalar(line + i, heat + i, n - i) | scalar | (saturated != 0);
+}
+
+HEATMAP_TARGET("avx512f")
+static void heatmap_wsub_avx512(unsigned long long* line, const float* heat, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 8 <= n ; i += 8) {
+        __m512i q;
+        if(heatmap_quantize_window_avx512(heat + i, &q)) {
+            const __m512i a = _mm512_loadu_si512(line + i);
+            _mm512_storeu_si512(line + i, _mm512_sub_epi64(a, _mm512_min_epu64(a, q)));
+        } else {
+            heatmap_wsub_scalar(line + i, heat + i, 8);
+        }
+    }
+
+    heatmap_wsub_scalar(line + i, heat + i, n - i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static const heatmap_kernels_t heatmap_kernels_avx512 = {
+    heatmap_row_max_avx512, heatmap_wrow_max_avx512, heatmap_row_avx512, heatmap_wrow_avx512, heatmap_max_avx512,
+    heatmap_unpack_fp16_avx512, heatmap_pack_fp16_avx512, heatmap_unpack_bf16_avx512, heatmap_pack_bf16_avx512,
+    heatmap_qrow_max_avx512, heatmap_qrow_avx512, heatmap_umax_avx512, heatmap_wacc_avx512, heatmap_wsub_avx512
+};
+
+/* Returns the best x86 kernel level this CPU (and OS!) supports. */
+static heatmap_simd_t heatmap_simd_detect(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    int avx = 0, f16c;
+
+    __cpuid(info, 1);
+    f16c = (info[2] & (1 << 29)) ? 1 : 0;
+    if(!(info[3] & (1 << 26)))
+        return HEATMAP_SIMD_SCALAR;
+
+    /* AVX also needs the OS to save the ymm/zmm registers: check OSXSAVE and XCR0. */
+    if((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (info[2] & (1 << 12))) {
+        const unsigned long long xcr0 = _xgetbv(0);
+        avx = (xcr0 & 0x6) == 0x6 ? 1 : 0;
+        __cpuidex(info, 7, 0);
+        if(avx && (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+            return HEATMAP_SIMD_AVX512;
+        if(avx && (info[1] & (1 << 5)) && f16c)
+            return HEATMAP_SIMD_AVX2;
+    }
+    return HEATMAP_SIMD_SSE2;
+#else
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return HEATMAP_SIMD_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+        return HEATMAP_SIMD_AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return HEATMAP_SIMD_SSE2;
+    return HEATMAP_SIMD_SCALAR;
+#endif
+}
+
+#elif !defined(HEATMAP_NO_SIMD) && defined(__aarch64__)
+#define HEATMAP_SIMD_NEON_AVAILABLE
+#include <arm_neon.h>
+
+/* NEON is mandatory on aarch64, no need for any runtime detection here. */
+static float heatmap_row_max_neon(float* line, const float* stampline, unsigned n, float m)
+{
+    float32x4_t vm = vdupq_n_f32(m);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const float32x4_t v = vaddq_f32(vld1q_f32(line + i), vld1q_f32(stampline + i));
+        vst1q_f32(line + i, v);
+        vm = vmaxq_f32(vm, v);
+    }
+
+    return heatmap_row_max_scalar(line + i, stampline + i, n - i, vmaxvq_f32(vm));
+}
+
+static float heatmap_wrow_max_neon(float* line, const float* stampline, unsigned n, float w, float m)
+{
+    float32x4_t vm = vdupq_n_f32(m);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const float32x4_t v = vfmaq_n_f32(vld1q_f32(line + i), vld1q_f32(stampline + i), w);
+        vst1q_f32(line + i, v);
+        vm = vmaxq_f32(vm, v);
+    }
+
+    return heatmap_wrow_max_scalar(line + i, stampline + i, n - i, w, vmaxvq_f32(vm));
+}
+
+static void heatmap_row_neon(float* line, const float* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1q_f32(line + i, vaddq_f32(vld1q_f32(line + i), vld1q_f32(stampline + i)));
+    }
+
+    heatmap_row_scalar(line + i, stampline + i, n - i);
+}
+
+static void heatmap_wrow_neon(float* line, const float* stampline, unsigned n, float w)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1q_f32(line + i, vfmaq_n_f32(vld1q_f32(line + i), vld1q_f32(stampline + i), w));
+    }
+
+    heatmap_wrow_scalar(line + i, stampline + i, n - i, w);
+}
+
+static float heatmap_max_neon(const float* buf, size_t n)
+{
+    float32x4_t m0 = vdupq_n_f32(0.0f), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        m0 = vmaxq_f32(m0, vld1q_f32(buf + i));
+        m1 = vmaxq_f32(m1, vld1q_f32(buf + i + 4));
+        m2 = vmaxq_f32(m2, vld1q_f32(buf + i + 8));
+        m3 = vmaxq_f32(m3, vld1q_f32(buf + i + 12));
+    }
+
+    {
+        const float m = vmaxvq_f32(vmaxq_f32(vmaxq_f32(m0, m1), vmaxq_f32(m2, m3)));
+        const float t = heatmap_max_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
+
+static void heatmap_unpack_fp16_neon(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i))));
+    }
+
+    heatmap_unpack_fp16_scalar(out + i, in + i, n - i);
+}
+
+static void heatmap_pack_fp16_neon(unsigned short* out, const float* in, unsigned n)
+{
+    const float32x4_t vmax = vdupq_n_f32(HEATMAP_FP16_MAX);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vminq_f32(vld1q_f32(in + i), vmax))));
+    }
+
+    heatmap_pack_fp16_scalar(out + i, in + i, n - i);
+}
+
+static void heatmap_unpack_bf16_neon(float* out, const unsigned short* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1q_u32((uint32_t*)(out + i), vshll_n_u16(vld1_u16(in + i), 16));
+    }
+
+    heatmap_unpack_bf16_scalar(out + i, in + i, n - i);
+}
+
+static void heatmap_pack_bf16_neon(unsigned short* out, const float* in, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const uint32x4_t u = vld1q_u32((const uint32_t*)(in + i));
+        const uint32x4_t bias = vaddq_u32(vdupq_n_u32(0x7fff), vandq_u32(vshrq_n_u32(u, 16), vdupq_n_u32(1)));
+        vst1_u16(out + i, vshrn_n_u32(vaddq_u32(u, bias), 16));
+    }
+
+    heatmap_pack_bf16_scalar(out + i, in + i, n - i);
+}
+
+static unsigned heatmap_qrow_max_neon(unsigned* line, const unsigned short* stampline, unsigned n, unsigned m)
+{
+    uint32x4_t vm = vdupq_n_u32(m);
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        const uint32x4_t v = vqaddq_u32(vld1q_u32(line + i), vmovl_u16(vld1_u16(stampline + i)));
+        vst1q_u32(line + i, v);
+        vm = vmaxq_u32(vm, v);
+    }
+
+    return heatmap_qrow_max_scalar(line + i, stampline + i, n - i, vmaxvq_u32(vm));
+}
+
+static void heatmap_qrow_neon(unsigned* line, const unsigned short* stampline, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 4 <= n ; i += 4) {
+        vst1q_u32(line + i, vqaddq_u32(vld1q_u32(line + i), vmovl_u16(vld1_u16(stampline + i))));
+    }
+
+    heatmap_qrow_scalar(line + i, stampline + i, n - i);
+}
+
+static unsigned heatmap_umax_neon(const unsigned* buf, size_t n)
+{
+    uint32x4_t m0 = vdupq_n_u32(0), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+
+    for( ; i + 16 <= n ; i += 16) {
+        m0 = vmaxq_u32(m0, vld1q_u32(buf + i));
+        m1 = vmaxq_u32(m1, vld1q_u32(buf + i + 4));
+        m2 = vmaxq_u32(m2, vld1q_u32(buf + i + 8));
+        m3 = vmaxq_u32(m3, vld1q_u32(buf + i + 12));
+    }
+
+    {
+        const unsigned m = vmaxvq_u32(vmaxq_u32(vmaxq_u32(m0, m1), vmaxq_u32(m2, m3)));
+        const unsigned t = heatmap_umax_scalar(buf + i, n - i);
+        return m > t ? m : t;
+    }
+}
+
+/* NEON converts doubles to 64-bit integers right away, rounding to nearest
+ * even, turning NaN and negatives into 0 and saturating at 2^64.
+ */
+static uint64x2_t heatmap_quantize_window_neon(const float* heat)
+{
+    return vcvtnq_u64_f64(vmulq_n_f64(vcvt_f64_f32(vld1_f32(heat)), HEATMAP_WINDOW_ONE));
+}
+
+static int heatmap_wacc_neon(unsigned long long* line, const float* heat, unsigned n)
+{
+    uint64x2_t saturated = vdupq_n_u64(0);
+    unsigned i = 0;
+
+    for( ; i + 2 <= n ; i += 2) {
+        const uint64x2_t a = vld1q_u64((const uint64_t*)(line + i));
+        const uint64x2_t q = heatmap_quantize_window_neon(heat + i);
+        saturated = vorrq_u64(saturated, vcltq_u64(vaddq_u64(a, q), a));
+        vst1q_u64((uint64_t*)(line + i), vqaddq_u64(a, q));
+    }
+
+    return heatmap_wacc_scalar(line + i, heat + i, n - i) | (vmaxvq_u32(vreinterpretq_u32_u64(saturated)) != 0);
+}
+
+static void heatmap_wsub_neon(unsigned long long* line, const float* heat, unsigned n)
+{
+    unsigned i = 0;
+
+    for( ; i + 2 <= n ; i += 2) {
+        vst1q_u64((uint64_t*)(line + i), vqsubq_u64(vld1q_u64((const uint64_t*)(line + i)), heatmap_quantize_window_neon(heat + i)));
+    }
+
+    heatmap_wsub_scalar(line + i, heat + i, n - i);
+}
+
+static const heatmap_kernels_t heatmap_kernels_neon = {
+    heatmap_row_max_neon, heatmap_wrow_max_neon, heatmap_row_neon, heatmap_wrow_neon, heatmap_max_neon,
+    heatmap_unpack_fp16_neon, heatmap_pack_fp16_neon, heatmap_unpack_bf16_neon, heatmap_pack_bf16_neon,
+    heatmap_qrow_max_neon, heatmap_qrow_neon, heatmap_umax_neon, heatmap_wacc_neon, heatmap_wsub_neon
+};
+
+static heatmap_simd_t heatmap_simd_detect(void)
+{
+    return HEATMAP_SIMD_NEON;
+}
+
+#else
+
+static heatmap_simd_t heatmap_simd_detect(void)
+{
+    return HEATMAP_SIMD_SCALAR;
+}
+
+#endif
+
+/* The kernels in use, one of the tables above, or NULL until they're picked
+ * the first time a point gets added. Threads picking them at the same time all
+ * pick the same table, and as it's published through an atomic pointer, every
+ * thread sees either NULL or a whole table, never a half-written one.
+ */
+#ifdef _MSC_VER
+#include <intrin.h> /* _InterlockedCompareExchangePointer, _InterlockedExchangePointer */
+
+static const heatmap_kernels_t* heatmap_load_kernels(const heatmap_kernels_t** p)
+{
+    return (const heatmap_kernels_t*)_InterlockedCompareExchangePointer((void* volatile*)p, 0, 0);
+}
+
+static void heatmap_store_kernels(const heatmap_kernels_t** p, const heatmap_kernels_t* k)
+{
+    _InterlockedExchangePointer((void* volatile*)p, (void*)k);
+}
+#else
+/* Whoever sees the kernel table's pointer needs to see what it points to. */
+static const heatmap_kernels_t* heatmap_load_kernels(const heatmap_kernels_t** p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void heatmap_store_kernels(const heatmap_kernels_t** p, const heatmap_kernels_t* k)
+{
+    __atomic_store_n(p, k, __ATOMIC_RELEASE);
+}
+#endif
+
+static const heatmap_kernels_t* heatmap_kernels = 0;
+
+heatmap_simd_t heatmap_simd_select(heatmap_simd_t level)
+{
+    const heatmap_simd_t best = heatmap_simd_detect();
+    const heatmap_kernels_t* k;
+
+    /* Never pick something the CPU can't do; the levels are ordered by preference. */
+    if(level == HEATMAP_SIMD_AUTO || level > best)
+        level = best;
+
+    switch(level) {
+#ifdef HEATMAP_SIMD_X86
+    case HEATMAP_SIMD_AVX512:
+        k = &heatmap_kernels_avx512;
+        break;
+    case HEATMAP_SIMD_AVX2:
+        k = &heatmap_kernels_avx2;
+        break;
+    case HEATMAP_SIMD_SSE2:
+        k = &heatmap_kernels_sse2;
+        break;
+#endif
+#ifdef HEATMAP_SIMD_NEON_AVAILABLE
+    case HEATMAP_SIMD_NEON:
+        k = &heatmap_kernels_neon;
+        break;
+#endif
+    default:
+        level = HEATMAP_SIMD_SCALAR;
+        k = &heatmap_kernels_scalar;
+        break;
+    }
+
+    heatmap_store_kernels(&heatmap_kernels, k);
+    return level;
+}
+
+/* Returns the kernels to use, picking them first if that hasn't happened yet. */
+static const heatmap_kernels_t* heatmap_get_kernels(void)
+{
+    const heatmap_kernels_t* k = heatmap_load_kernels(&heatmap_kernels);
+
+    if(!k) {
+        heatmap_simd_select(HEATMAP_SIMD_AUTO);
+        k = heatmap_load_kernels(&heatmap_kernels);
+    }
+    return k;
+}
+
+heatmap_simd_t heatmap_simd_current(void)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+
+#ifdef HEATMAP_SIMD_X86
+    if(k == &heatmap_kernels_avx512) return HEATMAP_SIMD_AVX512;
+    if(k == &heatmap_kernels_avx2) return HEATMAP_SIMD_AVX2;
+    if(k == &heatmap_kernels_sse2) return HEATMAP_SIMD_SSE2;
+#endif
+#ifdef HEATMAP_SIMD_NEON_AVAILABLE
+    if(k == &heatmap_kernels_neon) return HEATMAP_SIMD_NEON;
+#endif
+    (void)k;
+    return HEATMAP_SIMD_SCALAR;
+}
+
+/* In concurrent mode (see `heatmap_set_concurrent`), many threads add onto
+ * the same heatmap at once. There are no atomic float additions, so they're
+ * done by compare-and-swapping the float's bits until no other thread got in
+ * between reading the old value and writing the new one. Same for the max.
+ * Relaxed ordering is enough, since the heat isn't read until all threads
+ * are done adding and have been joined somehow.
+ */
+#ifdef _MSC_VER
+#include <intrin.h> /* _InterlockedCompareExchange, _InterlockedExchange */
+
+static int heatmap_cas_float(float* p, float* expected, float desired)
+{
+    long e, d, old;
+    memcpy(&e, expected, sizeof(float));
+    memcpy(&d, &desired, sizeof(float));
+    old = _InterlockedCompareExchange((volatile long*)p, d, e);
+    if(old == e)
+        return 1;
+    memcpy(expected, &old, sizeof(float));
+    return 0;
+}
+
+static float heatmap_load_float(float* p)
+{
+    long v = _InterlockedCompareExchange((volatile long*)p, 0, 0);
+    float f;
+    memcpy(&f, &v, sizeof(float));
+    return f;
+}
+
+static void heatmap_store_flag(int* p)
+{
+    _InterlockedExchange((volatile long*)p, 1);
+}
+
+static float* heatmap_load_tile(float** p)
+{
+    return (float*)_InterlockedCompareExchangePointer((void* volatile*)p, 0, 0);
+}
+
+static int heatmap_cas_tile(float** p, float* desired)
+{
+    return _InterlockedCompareExchangePointer((void* volatile*)p, desired, 0) == 0;
+}
+
+static void heatmap_lock(int* p)
+{
+    while(_InterlockedExchange((volatile long*)p, 1))
+        ;
+}
+
+static void heatmap_unlock(int* p)
+{
+    _InterlockedExchange((volatile long*)p, 0);
+}
+
+static int heatmap_load_int(int* p)
+{
+    return (int)_InterlockedCompareExchange((volatile long*)p, 0, 0);
+}
+
+static void heatmap_store_int(int* p, int v)
+{
+    _InterlockedExchange((volatile long*)p, v);
+}
+
+static int heatmap_cas_int(int* p, int expected, int desired)
+{
+    return _InterlockedCompareExchange((volatile long*)p, desired, expected) == expected;
+}
+#else
+static int heatmap_cas_float(float* p, float* expected, float desired)
+{
+    return __atomic_compare_exchange(p, expected, &desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static float heatmap_load_float(float* p)
+{
+    float f;
+    __atomic_load(p, &f, __ATOMIC_RELAXED);
+    return f;
+}
+
+static void heatmap_store_flag(int* p)
+{
+    __atomic_store_n(p, 1, __ATOMIC_RELAXED);
+}
+
+/* A sparse map's tiles are allocated by whichever thread touches them first,
+ * and the others need to see the tile's zeros, hence acquire and release.
+ */
+static float* heatmap_load_tile(float** p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static int heatmap_cas_tile(float** p, float* desired)
+{
+    float* expected = 0;
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* A spinlock for the few places holding it for a handful of instructions,
+ * which doesn't drag in pthreads for C programs. Waiters spin on a plain load
+ * so as not to bounce the cache line around.
+ */
+static void heatmap_lock(int* p)
+{
+    while(__atomic_exchange_n(p, 1, __ATOMIC_ACQUIRE)) {
+        while(__atomic_load_n(p, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static void heatmap_unlock(int* p)
+{
+    __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+}
+
+/* For states guarding data set up by one thread and then read by the others. */
+static int heatmap_load_int(int* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void heatmap_store_int(int* p, int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int heatmap_cas_int(int* p, int expected, int desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+/* Atomically adds `w` times the stamp's row onto the heatmap's row and
+ * returns the max of `m` and all updated heatmap pixels.
+ */
+static float heatmap_wrow_max_atomic(float* line, const float* stampline, unsigned n, float w, float m)
+{
+    unsigned ix;
+    for(ix = 0 ; ix < n ; ++ix) {
+        const float v = stampline[ix] * w;
+        float old, heat;
+
+        /* A lot of stamps have zero corners, no need to fight over those. */
+        if(v == 0.0f)
+            continue;
+
+        old = heatmap_load_float(line + ix);
+        do {
+            heat = old + v;
+        } while(!heatmap_cas_float(line + ix, &old, heat));
+
+        if(heat > m) {m = heat;}
+    }
+    return m;
+}
+
+/* Atomically raises `*p` to `m`, unless some other thread beat us to it. */
+static void heatmap_max_atomic(float* p, float m)
+{
+    float old = heatmap_load_float(p);
+    while(m > old && !heatmap_cas_float(p, &old, m)) {
+    }
+}
+
+/* In tiled mode (see `heatmap_set_tiled`), the map is made of tiles of
+ * HEATMAP_TILE_SIZE pixels, each of them stored row-major. A row-major map is
+ * treated as one single tile covering all of the map, so that all code walking
+ * the map tile by tile works for both layouts.
+ */
+static unsigned heatmap_tile_w(const heatmap_t* h)
+{
+    return h->tiled ? HEATMAP_TILE_SIZE : h->w;
+}
+
+static unsigned heatmap_tile_h(const heatmap_t* h)
+{
+    return h->tiled ? HEATMAP_TILE_SIZE : h->h;
+}
+
+/* How many tiles there are in a row and a column of tiles. */
+static size_t heatmap_tiles_x(const heatmap_t* h)
+{
+    return h->tiled ? (h->w + HEATMAP_TILE_SIZE - 1)/HEATMAP_TILE_SIZE : 1;
+}
+
+static size_t heatmap_tiles_y(const heatmap_t* h)
+{
+    return h->tiled ? (h->h + HEATMAP_TILE_SIZE - 1)/HEATMAP_TILE_SIZE : 1;
+}
+
+/* The amount of floats in the buffer, including the tiles' padding. */
+static size_t heatmap_buflen(const heatmap_t* h)
+{
+    return heatmap_tiles_x(h)*heatmap_tile_w(h) * heatmap_tiles_y(h)*heatmap_tile_h(h);
+}
+
+/* The index of the tile the pixel (x, y) is in. */
+static size_t heatmap_tile_of(const heatmap_t* h, unsigned x, unsigned y)
+{
+    return (y/heatmap_tile_h(h))*heatmap_tiles_x(h) + x/heatmap_tile_w(h);
+}
+
+/* Where the pixel (x, y) is in the buffer. The following heatmap_tile_w(h)
+ * floats, up to the tile's border, are the pixels to the right of it and the
+ * pixel below it is heatmap_tile_w(h) floats further.
+ *
+ * For sparse maps (see `heatmap_new_sparse`), that's NULL if the pixel's tile
+ * hasn't been touched yet, meaning all of the tile's heat is zero.
+ */
+static float* heatmap_pixel(const heatmap_t* h, unsigned x, unsigned y)
+{
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    const size_t tile = heatmap_tile_of(h, x, y);
+    const size_t offset = (size_t)(y%th)*tw + x%tw;
+
+    if(h->tiles) {
+        float* t = heatmap_load_tile(h->tiles + tile);
+        return t ? t + offset : 0;
+    }
+    return h->buf + tile*th*tw + offset;
+}
+
+/* Same as `heatmap_pixel`, but first allocates the pixel's tile if it's an
+ * untouched one of a sparse map. Returns NULL only if there's no memory.
+ */
+static float* heatmap_touch_pixel(const heatmap_t* h, unsigned x, unsigned y)
+{
+    float* p = heatmap_pixel(h, x, y);
+
+    if(!p) {
+        float* t = (float*)calloc(HEATMAP_TILE_SIZE*HEATMAP_TILE_SIZE, sizeof(float));
+        if(!t)
+            return 0;
+
+        /* Another thread might have been faster, then we use its tile. */
+        if(!heatmap_cas_tile(h->tiles + heatmap_tile_of(h, x, y), t)) {
+            free(t);
+        }
+        p = heatmap_pixel(h, x, y);
+    }
+    return p;
+}
+
+/* Same as `heatmap_pixel` for half-precision maps, which are never sparse. */
+static unsigned short* heatmap_pixel16(const heatmap_t* h, unsigned x, unsigned y)
+{
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    return h->hbuf + heatmap_tile_of(h, x, y)*th*tw + (size_t)(y%th)*tw + x%tw;
+}
+
+/* Same as `heatmap_pixel` for fixed-point maps, which are never sparse either. */
+static unsigned* heatmap_pixel32(const heatmap_t* h, unsigned x, unsigned y)
+{
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    return h->ibuf + heatmap_tile_of(h, x, y)*th*tw + (size_t)(y%th)*tw + x%tw;
+}
+
+/* Same as `heatmap_pixel` for a precise map's doubles. */
+static double* heatmap_pixel64(const heatmap_t* h, unsigned x, unsigned y)
+{
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    return h->dbuf + heatmap_tile_of(h, x, y)*th*tw + (size_t)(y%th)*tw + x%tw;
+}
+
+/* Rounds a heat to fixed-point, saturating instead of wrapping around. */
+static unsigned heatmap_quantize(double heat)
+{
+    const double v = heat*HEATMAP_FIXED_ONE + 0.5;
+    return !(v >= 1.0) ? 0 : v >= 4294967295.0 ? 0xffffffffu : (unsigned)v;
+}
+
+static float heatmap_fixed_to_float(unsigned v)
+{
+    return (float)(v/(double)HEATMAP_FIXED_ONE);
+}
+
+/* Half-precision maps' heat is converted to floats and back in pieces of at
+ * most that many pixels, which live on the stack.
+ */
+#define HEATMAP_HALF_CHUNK 256
+
+/* A decaying map's stored heat is brought back to its real heat once `decay`
+ * drops below this, see `heatmap_decay`. The stored heat is then up to 2^32
+ * times heavier than the real heat, which still leaves it far away from
+ * overflowing, while only a tick out of thousands goes over the whole map.
+ */
+#define HEATMAP_DECAY_MIN (1.0f/4294967296.0f)
+/* Scaling the whole map is spread over threads for maps at least that large. */
+#define HEATMAP_SCALE_PARALLEL_MIN (256*256)
+
+static heatmap_unpack_fn heatmap_unpacker(const heatmap_t* h)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    return h->storage == HEATMAP_BF16 ? k->unpack_bf16 : k->unpack_fp16;
+}
+
+static heatmap_pack_fn heatmap_packer(const heatmap_t* h)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    return h->storage == HEATMAP_BF16 ? k->pack_bf16 : k->pack_fp16;
+}
+
+/* Rounds `v` to what the map can store. Rounding keeps the order of values,
+ * so the max of rounded heats is the rounded max.
+ */
+static float heatmap_round_heat(const heatmap_t* h, float v)
+{
+    switch(h->storage) {
+    case HEATMAP_FP16: return heatmap_fp16_to_float(heatmap_fp16_from_float(v));
+    case HEATMAP_BF16: return heatmap_bf16_to_float(heatmap_bf16_from_float(v));
+    case HEATMAP_FIXED: return heatmap_fixed_to_float(heatmap_quantize(v));
+    default: return v;
+    }
+}
+
+/* Returns the heat of the `n` pixels starting at (x, y), which don't go past
+ * the border of their tile. That's just `heatmap_pixel` for maps of floats,
+ * but a half-precision or fixed-point map's heat is converted into `tmp`
+ * first, so there `n` mustn't be larger than HEATMAP_HALF_CHUNK.
+ */
+static const float* heatmap_read_pixels(const heatmap_t* h, unsigned x, unsigned y, unsigned n, float* tmp)
+{
+    if(h->hbuf) {
+        heatmap_unpacker(h)(tmp, heatmap_pixel16(h, x, y), n);
+        return tmp;
+    }
+    if(h->ibuf) {
+        const unsigned* p = heatmap_pixel32(h, x, y);
+        unsigned i;
+        for(i = 0 ; i < n ; ++i) {
+            tmp[i] = heatmap_fixed_to_float(p[i]);
+        }
+        return tmp;
+    }
+    if(h->dbuf) {
+        const double* d = heatmap_pixel64(h, x, y);
+        const float* f = heatmap_pixel(h, x, y);
+        unsigned i;
+        for(i = 0 ; i < n ; ++i) {
+            tmp[i] = (float)(d[i] + f[i]);
+        }
+        return tmp;
+    }
+    return heatmap_pixel(h, x, y);
+}
+
+/* Sets the heat of the `n` pixels starting at (x, y) of a map which isn't
+ * sparse, where `heat` being NULL means zeros. Same limits as above.
+ */
+static void heatmap_write_pixels(const heatmap_t* h, unsigned x, unsigned y, unsigned n, const float* heat)
+{
+    if(h->hbuf) {
+        if(heat) {heatmap_packer(h)(heatmap_pixel16(h, x, y), heat, n);}
+        else {memset(heatmap_pixel16(h, x, y), 0, n*sizeof(unsigned short));}
+    } else if(h->ibuf) {
+        unsigned* p = heatmap_pixel32(h, x, y);
+        unsigned i;
+        for(i = 0 ; i < n ; ++i) {
+            p[i] = heat ? heatmap_quantize(heat[i]) : 0;
+        }
+    } else if(h->dbuf) {
+        double* d = heatmap_pixel64(h, x, y);
+        unsigned i;
+        for(i = 0 ; i < n ; ++i) {
+            d[i] = heat ? heat[i] : 0.0;
+        }
+        memset(heatmap_pixel(h, x, y), 0, n*sizeof(float));
+    } else {
+        if(heat) {memcpy(heatmap_pixel(h, x, y), heat, n*sizeof(float));}
+        else {memset(heatmap_pixel(h, x, y), 0, n*sizeof(float));}
+    }
+}
+
+/* The part of `heatmap_add_block` for a single tile of a half-precision map:
+ * the rows are converted to floats piece by piece, added onto and rounded
+ * back. Returns the max of `max` and the updated pixels before rounding.
+ */
+static float heatmap_add_rows_half(heatmap_t* h, unsigned x, unsigned y, const float* src, unsigned srcw, unsigned cols, unsigned rows, const float* w, float max)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    const heatmap_unpack_fn unpack = heatmap_unpacker(h);
+    const heatmap_pack_fn pack = heatmap_packer(h);
+    const unsigned tw = heatmap_tile_w(h);
+    unsigned short* line = heatmap_pixel16(h, x, y);
+    float tmp[HEATMAP_HALF_CHUNK];
+    unsigned iy, ix;
+
+    for(iy = 0 ; iy < rows ; ++iy, line += tw, src += srcw) {
+        for(ix = 0 ; ix < cols ; ix += HEATMAP_HALF_CHUNK) {
+            const unsigned n = cols - ix < HEATMAP_HALF_CHUNK ? cols - ix : HEATMAP_HALF_CHUNK;
+
+            unpack(tmp, line + ix, n);
+            if(h->lazy_max) {
+                if(w) {k->wrow(tmp, src + ix, n, *w);}
+                else {k->row(tmp, src + ix, n);}
+            } else {
+                max = w ? k->wrow_max(tmp, src + ix, n, *w, max)
+                        : k->row_max(tmp, src + ix, n, max);
+            }
+            pack(line + ix, tmp, n);
+        }
+    }
+    return max;
+}
+
+/* The part of `heatmap_add_block` for a single tile of a fixed-point map:
+ * every (weighted) value is quantized on its own and then added, saturating.
+ * Returns the max of `max` and the updated pixels.
+ */
+static float heatmap_add_rows_fixed(heatmap_t* h, unsigned x, unsigned y, const float* src, unsigned srcw, unsigned cols, unsigned rows, const float* w, float max)
+{
+    const double wv = w ? *w : 1.0;
+    const unsigned tw = heatmap_tile_w(h);
+    unsigned* line = heatmap_pixel32(h, x, y);
+    unsigned m = 0, iy, ix;
+
+    for(iy = 0 ; iy < rows ; ++iy, line += tw, src += srcw) {
+        for(ix = 0 ; ix < cols ; ++ix) {
+            const unsigned v = line[ix] + heatmap_quantize(src[ix]*wv);
+            line[ix] = v < line[ix] ? 0xffffffffu : v;
+            if(line[ix] > m) {m = line[ix];}
+        }
+    }
+    return heatmap_fixed_to_float(m) > max ? heatmap_fixed_to_float(m) : max;
+}
+
+/* Moves the heat of the `cols` x `rows` pixels at (x, y), which are all in
+ * the same tile, from a precise map's float scratch onto its doubles.
+ */
+static void heatmap_flush_scratch(const heatmap_t* h, unsigned x, unsigned y, unsigned cols, unsigned rows)
+{
+    const unsigned tw = heatmap_tile_w(h);
+    float* line = heatmap_pixel(h, x, y);
+    double* dline = heatmap_pixel64(h, x, y);
+    unsigned iy, ix;
+
+    for(iy = 0 ; iy < rows ; ++iy, line += tw, dline += tw) {
+        for(ix = 0 ; ix < cols ; ++ix) {
+            dline[ix] += line[ix];
+            line[ix] = 0.0f;
+        }
+    }
+}
+
+/* The part of `heatmap_add_block` for a single tile of a precise map: the
+ * block is added onto the float scratch, and if that made any of its pixels
+ * too hot, exactly these pixels are flushed onto the doubles. Flushing only
+ * what was added onto keeps threads working on separate rows apart.
+ */
+static void heatmap_add_rows_precise(heatmap_t* h, unsigned x, unsigned y, const float* src, unsigned srcw, unsigned cols, unsigned rows, const float* w)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    const unsigned tw = heatmap_tile_w(h);
+    float* line = heatmap_pixel(h, x, y);
+    float m = 0.0f;
+    unsigned iy;
+
+    for(iy = 0 ; iy < rows ; ++iy, line += tw, src += srcw) {
+        m = w ? k->wrow_max(line, src, cols, *w, m) : k->row_max(line, src, cols, m);
+    }
+
+    /* The scratch holds as much real heat as usual while decaying. */
+    if(h->decay != 0.0f ? m*h->decay > HEATMAP_SCRATCH_MAX : m > HEATMAP_SCRATCH_MAX) {
+        heatmap_flush_scratch(h, x, y, cols, rows);
+    }
+}
+
+/* Adds `*w` times (or just once, if `w` is NULL) the `cols` x `rows` block of
+ * `src`, which has `srcw` pixels per row, onto the heatmap, such that the
+ * block's top-left pixel lands on (x, y). All the clipping has been done by
+ * the caller already. This is where the actual work happens, tile by tile,
+ * such that every tile's pixels are only touched once, row after row.
+ */
+static void heatmap_add_block(heatmap_t* h, unsigned x, unsigned y, const float* src, unsigned srcw, unsigned cols, unsigned rows, const float* w)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    float max = h->concurrent ? -FLT_MAX : h->max;
+    float wd;
+    unsigned tx, ty;
+
+    /* A decaying map's new heat is heavier than its old one, see `heatmap_decay`. */
+    if(h->decay != 0.0f) {
+        wd = (w ? *w : 1.0f)/h->decay;
+        w = &wd;
+    }
+
+    for(ty = y/th ; ty*th < y + rows ; ++ty) {
+        /* [first, last) rows and columns of the block within this tile, in the MAP's pixels. */
+        const unsigned r0 = ty*th > y ? ty*th : y;
+        const unsigned r1 = y + rows - ty*th > th ? (ty+1)*th : y + rows;
+
+        for(tx = x/tw ; tx*tw < x + cols ; ++tx) {
+            const unsigned c0 = tx*tw > x ? tx*tw : x;
+            const unsigned c1 = x + cols - tx*tw > tw ? (tx+1)*tw : x + cols;
+            const float* srcline = src + (size_t)(r0 - y)*srcw + (c0 - x);
+            float* line;
+            unsigned iy;
+
+            if(h->hbuf) {
+                /* There are no atomic adds of 16-bit floats. */
+                assert(!h->concurrent);
+                max = heatmap_add_rows_half(h, c0, r0, srcline, srcw, c1 - c0, r1 - r0, w, max);
+                continue;
+            }
+            if(h->ibuf) {
+                /* Nor any atomic saturating adds. */
+                assert(!h->concurrent);
+                max = heatmap_add_rows_fixed(h, c0, r0, srcline, srcw, c1 - c0, r1 - r0, w, max);
+                continue;
+            }
+            if(h->dbuf) {
+                /* Flushing isn't atomic either. */
+                assert(!h->concurrent);
+                heatmap_add_rows_precise(h, c0, r0, srcline, srcw, c1 - c0, r1 - r0, w);
+                continue;
+            }
+
+            line = heatmap_touch_pixel(h, c0, r0);
+
+            /* Out of memory for a sparse map's tile: that heat is lost. */
+            if(!line)
+                continue;
+
+            for(iy = r0 ; iy < r1 ; ++iy, line += tw, srcline += srcw) {
+                if(h->concurrent) {
+                    max = heatmap_wrow_max_atomic(line, srcline, c1 - c0, w ? *w : 1.0f, max);
+                } else if(h->lazy_max) {
+                    if(w) {k->wrow(line, srcline, c1 - c0, *w);}
+                    else {k->row(line, srcline, c1 - c0);}
+                } else {
+                    max = w ? k->wrow_max(line, srcline, c1 - c0, *w, max)
+                            : k->row_max(line, srcline, c1 - c0, max);
+                }
+            }
+        }
+    }
+
+    /* A precise map's max is always lazy, its scratch doesn't know the heat. */
+    if(h->concurrent) {
+        if(h->lazy_max) {heatmap_store_flag(&h->max_dirty);}
+        else {heatmap_max_atomic(&h->max, max);}
+    } else if(h->lazy_max || h->dbuf) {
+        h->max_dirty = 1;
+    } else {
+        h->max = heatmap_round_heat(h, max);
+    }
+}
+
+/* Saturating adds of fixed-point heat, returning the max of `m` and `line`. */
+static unsigned heatmap_add_fixed_row(unsigned* line, const unsigned* src, unsigned n, unsigned m)
+{
+    unsigned i;
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned v = line[i] + src[i];
+        line[i] = v < line[i] ? 0xffffffffu : v;
+        if(line[i] > m) {m = line[i];}
+    }
+    return m;
+}
+
+/* The integer counterpart of `heatmap_add_block` for fixed-point maps: adds
+ * the block of the quantized stamp `q` or, if that's NULL, of the fixed-point
+ * heat `src`. These need no rounding, so the result is exact.
+ */
+static void heatmap_add_qblock(heatmap_t* h, unsigned x, unsigned y, const unsigned short* q, const unsigned* src, unsigned srcw, unsigned cols, unsigned rows)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    const unsigned tw = heatmap_tile_w(h), th = heatmap_tile_h(h);
+    unsigned max = 0;
+    unsigned tx, ty;
+
+    assert(!h->concurrent);
+
+    for(ty = y/th ; ty*th < y + rows ; ++ty) {
+        const unsigned r0 = ty*th > y ? ty*th : y;
+        const unsigned r1 = y + rows - ty*th > th ? (ty+1)*th : y + rows;
+
+        for(tx = x/tw ; tx*tw < x + cols ; ++tx) {
+            const unsigned c0 = tx*tw > x ? tx*tw : x;
+            const unsigned c1 = x + cols - tx*tw > tw ? (tx+1)*tw : x + cols;
+            const size_t offset = (size_t)(r0 - y)*srcw + (c0 - x);
+            unsigned* line = heatmap_pixel32(h, c0, r0);
+            unsigned iy;
+
+            if(!q) {
+                const unsigned* srcline = src + offset;
+                for(iy = r0 ; iy < r1 ; ++iy, line += tw, srcline += srcw) {
+                    max = heatmap_add_fixed_row(line, srcline, c1 - c0, max);
+                }
+                continue;
+            }
+
+            {
+                const unsigned short* qline = q + offset;
+                for(iy = r0 ; iy < r1 ; ++iy, line += tw, qline += srcw) {
+                    if(h->lazy_max) {k->qrow(line, qline, c1 - c0);}
+                    else {max = k->qrow_max(line, qline, c1 - c0, max);}
+                }
+            }
+        }
+    }
+
+    if(h->lazy_max) {
+        h->max_dirty = 1;
+    } else if(heatmap_fixed_to_float(max) > h->max) {
+        h->max = heatmap_fixed_to_float(max);
+    }
+}
+
+void heatmap_init(heatmap_t* hm, unsigned w, unsigned h)
+{
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->buf = (float*)calloc(w*h, sizeof(float));
+    hm->w = w;
+    hm->h = h;
+}
+
+heatmap_t* heatmap_new(unsigned w, unsigned h)
+{
+    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    heatmap_init(hm, w, h);
+    return hm;
+}
+
+heatmap_t* heatmap_new_tiled(unsigned w, unsigned h)
+{
+    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->w = w;
+    hm->h = h;
+    hm->tiled = 1;
+    hm->buf = (float*)calloc(heatmap_buflen(hm), sizeof(float));
+    return hm;
+}
+
+heatmap_t* heatmap_new_sparse(unsigned w, unsigned h)
+{
+    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->w = w;
+    hm->h = h;
+    hm->tiled = 1;
+    hm->tiles = (float**)calloc(heatmap_tiles_x(hm)*heatmap_tiles_y(hm), sizeof(float*));
+    return hm;
+}
+
+heatmap_t* heatmap_new_half(unsigned w, unsigned h, heatmap_storage_t storage)
+{
+    heatmap_t* hm;
+
+    if(storage == HEATMAP_FLOAT32)
+        return heatmap_new(w, h);
+
+    hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->w = w;
+    hm->h = h;
+    hm->storage = storage;
+    /* All zero bits are a zero in either kind of 16-bit float. */
+    hm->hbuf = (unsigned short*)calloc((size_t)w*h, sizeof(unsigned short));
+    return hm;
+}
+
+heatmap_t* heatmap_new_fixed(unsigned w, unsigned h)
+{
+    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->w = w;
+    hm->h = h;
+    hm->storage = HEATMAP_FIXED;
+    hm->ibuf = (unsigned*)calloc((size_t)w*h, sizeof(unsigned));
+    return hm;
+}
+
+/* Frees the heatmap's heat, be it a single buffer or a sparse map's tiles. */
+static void heatmap_free_heat(heatmap_t* h)
+{
+    if(h->tiles) {
+        const size_t ntiles = heatmap_tiles_x(h)*heatmap_tiles_y(h);
+        size_t i;
+        for(i = 0 ; i < ntiles ; ++i) {
+            free(h->tiles[i]);
+        }
+        free(h->tiles);
+    }
+    free(h->buf);
+    free(h->hbuf);
+    free(h->ibuf);
+    free(h->dbuf);
+}
+
+void heatmap_free(heatmap_t* h)
+{
+    heatmap_free_heat(h);
+    free(h);
+}
+
+size_t heatmap_sparse_tiles_used(const heatmap_t* h)
+{
+    const size_t ntiles = heatmap_tiles_x(h)*heatmap_tiles_y(h);
+    size_t i, n = 0;
+
+    if(!h->tiles)
+        return ntiles;
+
+    for(i = 0 ; i < ntiles ; ++i) {
+        n += h->tiles[i] != 0;
+    }
+    return n;
+}
+
+void heatmap_add_point(heatmap_t* h, unsigned x, unsigned y)
+{
+    heatmap_add_point_with_stamp(h, x, y, &stamp_default_4);
+}
+
+/* Adds the [x0,x1)x[y0,y1) window of the stamp's pixels onto the heatmap,
+ * such that the stamp's centre lands on (x, y). All the clipping has been
+ * done by the caller already.
+ */
+static void heatmap_add_stamp_window(heatmap_t* h, unsigned x, unsigned y, const heatmap_stamp_t* stamp, unsigned x0, unsigned y0, unsigned x1, unsigned y1)
+{
+    heatmap_add_block(h, (x + x0) - stamp->w/2, (y + y0) - stamp->h/2, stamp->buf + y0*stamp->w + x0, stamp->w, x1 - x0, y1 - y0, 0);
+}
+
+static void heatmap_add_weighted_stamp_window(heatmap_t* h, unsigned x, unsigned y, float w, const heatmap_stamp_t* stamp, unsigned x0, unsigned y0, unsigned x1, unsigned y1)
+{
+    heatmap_add_block(h, (x + x0) - stamp->w/2, (y + y0) - stamp->h/2, stamp->buf + y0*stamp->w + x0, stamp->w, x1 - x0, y1 - y0, &w);
+}
+
+int heatmap_set_concurrent(heatmap_t* h, int concurrent)
+{
+    /* Atomics only work on whole floats. */
+    if(concurrent && h->storage != HEATMAP_FLOAT32)
+        return 0;
+
+    h->concurrent = concurrent ? 1 : 0;
+    return 1;
+}
+
+/* Copies all rows of `from`'s pixels into `to`, which has the same size but
+ * possibly another layout or storage, going through both tile by tile.
+ */
+static void heatmap_copy_layout(const heatmap_t* from, heatmap_t* to)
+{
+    unsigned tw = heatmap_tile_w(from) < heatmap_tile_w(to) ? heatmap_tile_w(from) : heatmap_tile_w(to);
+    float tmp[HEATMAP_HALF_CHUNK];
+    unsigned x, y;
+
+    if((from->storage != HEATMAP_FLOAT32 || to->storage != HEATMAP_FLOAT32) && tw > HEATMAP_HALF_CHUNK) {
+        tw = HEATMAP_HALF_CHUNK;
+    }
+
+    for(y = 0 ; y < from->h ; ++y) {
+        for(x = 0 ; x < from->w ; x += tw) {
+            const unsigned n = from->w - x > tw ? tw : from->w - x;
+            /* Fixed-point and precise heat are copied as they are, the float
+             * detour would round them.
+             */
+            if(from->ibuf && to->ibuf) {
+                memcpy(heatmap_pixel32(to, x, y), heatmap_pixel32(from, x, y), n*sizeof(unsigned));
+            } else if(from->dbuf && to->dbuf) {
+                const double* d = heatmap_pixel64(from, x, y);
+                const float* f = heatmap_pixel(from, x, y);
+                double* td = heatmap_pixel64(to, x, y);
+                unsigned i;
+                for(i = 0 ; i < n ; ++i) {
+                    td[i] = d[i] + f[i];
+                }
+                memset(heatmap_pixel(to, x, y), 0, n*sizeof(float));
+            } else {
+                heatmap_write_pixels(to, x, y, n, heatmap_read_pixels(from, x, y, n, tmp));
+            }
+        }
+    }
+}
+
+/* Allocates the zeroed heat of a map which isn't sparse, for its layout and
+ * storage. Returns zero if there's no memory.
+ */
+static int heatmap_alloc_heat(heatmap_t* h)
+{
+    h->tiles = 0;
+    h->buf = 0;
+    h->hbuf = 0;
+    h->ibuf = 0;
+    h->dbuf = 0;
+    if(h->storage == HEATMAP_FLOAT32 || h->storage == HEATMAP_FLOAT64) {
+        h->buf = (float*)calloc(heatmap_buflen(h), sizeof(float));
+    } else if(h->storage == HEATMAP_FIXED) {
+        h->ibuf = (unsigned*)calloc(heatmap_buflen(h), sizeof(unsigned));
+    } else {
+        h->hbuf = (unsigned short*)calloc(heatmap_buflen(h), sizeof(unsigned short));
+    }
+
+    /* A precise map needs both its doubles and its float scratch. */
+    if(h->storage == HEATMAP_FLOAT64) {
+        h->dbuf = (double*)calloc(heatmap_buflen(h), sizeof(double));
+        if(!h->dbuf || !h->buf) {
+            free(h->dbuf);
+            free(h->buf);
+            h->dbuf = 0;
+            h->buf = 0;
+        }
+    }
+    return h->buf || h->hbuf || h->ibuf;
+}
+
+heatmap_t* heatmap_new_precise(unsigned w, unsigned h)
+{
+    heatmap_t* hm = (heatmap_t*)malloc(sizeof(heatmap_t));
+    memset(hm, 0, sizeof(heatmap_t));
+    hm->w = w;
+    hm->h = h;
+    hm->tiled = 1;
+    hm->storage = HEATMAP_FLOAT64;
+    heatmap_alloc_heat(hm);
+    return hm;
+}
+
+int heatmap_set_tiled(heatmap_t* h, int tiled)
+{
+    heatmap_t to = *h;
+    tiled = tiled ? 1 : 0;
+
+    if(tiled == h->tiled)
+        return 1;
+
+    to.tiled = tiled;
+    if(!heatmap_alloc_heat(&to))
+        return 0;
+
+    heatmap_copy_layout(h, &to);
+    heatmap_free_heat(h);
+    *h = to;
+    return 1;
+}
+
+/* Decaying maps get their stored heat scaled, see further down. */
+static void heatmap_scale_heat(heatmap_t* h, float factor);
+
+int heatmap_set_storage(heatmap_t* h, heatmap_storage_t storage)
+{
+    heatmap_t to = *h;
+
+    if(storage == h->storage)
+        return 1;
+
+    /* A sparse map's tiles are floats, and that's how they stay, and so is
+     * a concurrent map's heat, since atomics only work on whole floats.
+     */
+    if(h->tiles || h->concurrent)
+        return 0;
+
+    /* These can't hold heat heavier than the real one, see `heatmap_decay`. */
+    if(h->decay != 0.0f && (storage == HEATMAP_FP16 || storage == HEATMAP_FIXED)) {
+        heatmap_scale_heat(h, h->decay);
+        h->decay = 0.0f;
+        to = *h;
+    }
+
+    to.storage = storage;
+    if(!heatmap_alloc_heat(&to))
+        return 0;
+
+    heatmap_copy_layout(h, &to);
+    heatmap_free_heat(h);
+    to.max = heatmap_round_heat(&to, to.max);
+    *h = to;
+    return 1;
+}
+
+float* heatmap_to_rowmajor(const heatmap_t* h, float* out)
+{
+    heatmap_t to = *h;
+
+    /* For convenience, if no buffer is given, malloc a new one. */
+    if(!out) {
+        out = (float*)malloc((size_t)h->w*h->h*sizeof(float));
+        if(!out) {
+            return 0;
+        }
+    }
+
+    to.tiled = 0;
+    to.tiles = 0;
+    to.buf = out;
+    to.hbuf = 0;
+    to.ibuf = 0;
+    to.dbuf = 0;
+    to.storage = HEATMAP_FLOAT32;
+    heatmap_copy_layout(h, &to);
+
+    if(h->decay != 0.0f) {
+        const size_t n = (size_t)h->w*h->h;
+        size_t i;
+        for(i = 0 ; i < n ; ++i) {
+            out[i] *= h->decay;
+        }
+    }
+    return out;
+}
+
+void heatmap_set_lazy_max(heatmap_t* h, int lazy)
+{
+    /* Leaving lazy mode means `max` needs to be valid again from now on. */
+    if(!lazy) {
+        heatmap_get_max(h);
+    }
+    h->lazy_max = lazy ? 1 : 0;
+}
+
+/* The max of a heatmap's buffer, no matter whether it's up to date or not. */
+static float heatmap_compute_max(const heatmap_t* h)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+
+    /* Only the touched tiles of a sparse map can have any heat. */
+    if(h->tiles) {
+        const size_t ntiles = heatmap_tiles_x(h)*heatmap_tiles_y(h);
+        float max = 0.0f;
+        size_t i;
+        for(i = 0 ; i < ntiles ; ++i) {
+            if(h->tiles[i]) {
+                const float m = k->max(h->tiles[i], HEATMAP_TILE_SIZE*HEATMAP_TILE_SIZE);
+                if(m > max) {max = m;}
+            }
+        }
+        return max;
+    }
+
+    /* Non-negative 16-bit floats are ordered just like their bits, and the
+     * negative ones look negative as shorts too.
+     */
+    if(h->hbuf) {
+        const size_t n = heatmap_buflen(h);
+        short max = 0;
+        size_t i;
+        for(i = 0 ; i < n ; ++i) {
+            const short v = (short)h->hbuf[i];
+            if(v > max) {max = v;}
+        }
+        return h->storage == HEATMAP_BF16 ? heatmap_bf16_to_float((unsigned short)max)
+                                          : heatmap_fp16_to_float((unsigned short)max);
+    }
+
+    if(h->ibuf) {
+        return heatmap_fixed_to_float(k->umax(h->ibuf, heatmap_buflen(h)));
+    }
+
+    if(h->dbuf) {
+        const size_t n = heatmap_buflen(h);
+        double max = 0.0;
+        size_t i;
+        for(i = 0 ; i < n ; ++i) {
+            const double v = h->dbuf[i] + h->buf[i];
+            if(v > max) {max = v;}
+        }
+        return (float)max;
+    }
+
+    /* The padding of the tiles is all zeros, so it doesn't matter. */
+    return k->max(h->buf, heatmap_buflen(h));
+}
+
+float heatmap_get_max(heatmap_t* h)
+{
+    if(h->max_dirty) {
+        h->max = heatmap_compute_max(h);
+        h->max_dirty = 0;
+    }
+    return h->decay != 0.0f ? h->max*h->decay : h->max;
+}
+
+/* Multiplies the stored heat of every pixel by `factor`, and the max too.
+ * Rounding keeps the order of values, so the max stays exact.
+ */
+static void heatmap_scale_heat(heatmap_t* h, float factor)
+{
+    const unsigned tw = heatmap_tile_w(h);
+    int y;
+
+#pragma omp parallel for schedule(static) if((size_t)h->w*h->h >= HEATMAP_SCALE_PARALLEL_MIN)
+    for(y = 0 ; y < (int)h->h ; ++y) {
+        float tmp[HEATMAP_HALF_CHUNK];
+        unsigned x0, n, i;
+
+        for(x0 = 0 ; x0 < h->w ; x0 += n) {
+            n = tw - x0 % tw < h->w - x0 ? tw - x0 % tw : h->w - x0;
+            n = n < HEATMAP_HALF_CHUNK ? n : HEATMAP_HALF_CHUNK;
+
+            if(h->dbuf) {
+                double* d = heatmap_pixel64(h, x0, (unsigned)y);
+                float* f = heatmap_pixel(h, x0, (unsigned)y);
+                for(i = 0 ; i < n ; ++i) {
+                    d[i] = (d[i] + f[i])*factor;
+                    f[i] = 0.0f;
+                }
+            } else if(h->hbuf || h->ibuf) {
+                const float* heat = heatmap_read_pixels(h, x0, (unsigned)y, n, tmp);
+                for(i = 0 ; i < n ; ++i) {
+                    tmp[i] = heat[i]*factor;
+                }
+                heatmap_write_pixels(h, x0, (unsigned)y, n, tmp);
+            } else {
+                /* A sparse map's untouched tiles stay untouched. */
+                float* p = heatmap_pixel(h, x0, (unsigned)y);
+                if(p) {
+                    for(i = 0 ; i < n ; ++i) {
+                        p[i] *= factor;
+                    }
+                }
+            }
+        }
+    }
+
+    if(h->max_dirty || h->dbuf || factor < 0.0f) {
+        h->max_dirty = h->lazy_max || h->dbuf;
+        if(!h->max_dirty) {h->max = heatmap_compute_max(h);}
+    } else {
+        h->max = heatmap_round_heat(h, h->max*factor);
+    }
+}
+
+void heatmap_decay(heatmap_t* h, float factor)
+{
+    const float decay = (h->decay != 0.0f ? h->decay : 1.0f)*factor;
+
+    if(h->storage == HEATMAP_FP16 || h->storage == HEATMAP_FIXED
+    || !(decay >= HEATMAP_DECAY_MIN && decay <= 1.0f/HEATMAP_DECAY_MIN)) {
+        heatmap_scale_heat(h, decay);
+        h->decay = 0.0f;
+    } else {
+        h->decay = decay != 1.0f ? decay : 0.0f;
+    }
+}
+
+void heatmap_add_point_with_stamp(heatmap_t* h, unsigned x, unsigned y, const heatmap_stamp_t* stamp)
+{
+    /* I'm still unsure whether we want this to be an assert or not... */
+    if(x >= h->w || y >= h->h)
+        return;
+
+    /* I hate you, C */
+    {
+        /* Note: the order of operations is important, since we're computing with unsigned! */
+
+        /* These are [first, last) pairs in the STAMP's pixels. */
+        const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
+        const unsigned y0 = y < stamp->h/2 ? (stamp->h/2 - y) : 0;
+        const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
+        const unsigned y1 = (y + stamp->h/2) < h->h ? stamp->h : stamp->h/2 + (h->h - y);
+
+        heatmap_add_stamp_window(h, x, y, stamp, x0, y0, x1, y1);
+    } /* I hate you very much! */
+}
+
+void heatmap_add_weighted_point(heatmap_t* h, unsigned x, unsigned y, float w)
+{
+    heatmap_add_weighted_point_with_stamp(h, x, y, w, &stamp_default_4);
+}
+
+void heatmap_add_weighted_point_with_stamp(heatmap_t* h, unsigned x, unsigned y, float w, const heatmap_stamp_t* stamp)
+{
+    /* I'm still unsure whether we want this to be an assert or not... */
+    if(x >= h->w || y >= h->h)
+        return;
+
+    /* Currently, negative weights are not supported as they mess with the max. */
+    assert(w >= 0.0f);
+
+    /* I hate you, C */
+    {
+        /* Note: the order of operations is important, since we're computing with unsigned! */
+
+        /* These are [first, last) pairs in the STAMP's pixels. */
+        const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
+        const unsigned y0 = y < stamp->h/2 ? (stamp->h/2 - y) : 0;
+        const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
+        const unsigned y1 = (y + stamp->h/2) < h->h ? stamp->h : stamp->h/2 + (h->h - y);
+
+        heatmap_add_weighted_stamp_window(h, x, y, w, stamp, x0, y0, x1, y1);
+    } /* I hate you very much! */
+}
+
+/* Half-precision maps have batch functions of their own, see further down. */
+static void heatmap_add_points_half(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* How many points the batch functions cull at once before stamping them.
+ * Small enough for the survivors to stay on the stack (and in L1).
+ */
+#define HEATMAP_BATCH_CHUNK 256
+
+/* Whether all of the stamp's values are within [0, 1]. */
+static int heatmap_stamp_is_unit(const heatmap_stamp_t* stamp)
+{
+    const size_t n = (size_t)stamp->w*stamp->h;
+    size_t i;
+    for(i = 0 ; i < n ; ++i) {
+        if(!(stamp->buf[i] >= 0.0f && stamp->buf[i] <= 1.0f))
+            return 0;
+    }
+    return 1;
+}
+
+/* The other way around than `heatmap_qstamp_from_stamp`, for adding a
+ * quantized stamp onto maps which aren't fixed-point.
+ */
+static heatmap_stamp_t* heatmap_qstamp_to_stamp(const heatmap_qstamp_t* q)
+{
+    const size_t n = (size_t)q->w*q->h;
+    heatmap_stamp_t* s = (heatmap_stamp_t*)malloc(sizeof(heatmap_stamp_t));
+    float* data = (float*)malloc(n*sizeof(float));
+    size_t i;
+
+    if(!s || !data) {
+        free(s);
+        free(data);
+        return 0;
+    }
+
+    for(i = 0 ; i < n ; ++i) {
+        data[i] = heatmap_fixed_to_float(q->buf[i]);
+    }
+    s->buf = data;
+    s->w = q->w;
+    s->h = q->h;
+    return s;
+}
+
+void heatmap_add_point_with_qstamp(heatmap_t* h, unsigned x, unsigned y, const heatmap_qstamp_t* stamp)
+{
+    if(x >= h->w || y >= h->h)
+        return;
+
+    if(!h->ibuf) {
+        heatmap_stamp_t* s = heatmap_qstamp_to_stamp(stamp);
+        if(s) {
+            heatmap_add_point_with_stamp(h, x, y, s);
+            heatmap_stamp_free(s);
+        }
+        return;
+    }
+
+    {
+        /* Same clipping as in `heatmap_add_point_with_stamp`. */
+        const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
+        const unsigned y0 = y < stamp->h/2 ? (stamp->h/2 - y) : 0;
+        const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
+        const unsigned y1 = (y + stamp->h/2) < h->h ? stamp->h : stamp->h/2 + (h->h - y);
+
+        heatmap_add_qblock(h, (x + x0) - stamp->w/2, (y + y0) - stamp->h/2, stamp->buf + y0*stamp->w + x0, 0, stamp->w, x1 - x0, y1 - y0);
+    }
+}
+
+void heatmap_add_points_with_qstamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride, const heatmap_qstamp_t* stamp)
+{
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned W = h->w, H = h->h;
+    unsigned cx[HEATMAP_BATCH_CHUNK], cy[HEATMAP_BATCH_CHUNK];
+    size_t i0;
+
+    if(!h->ibuf) {
+        heatmap_stamp_t* s = heatmap_qstamp_to_stamp(stamp);
+        if(s) {
+            heatmap_add_points_with_stamp(h, xs, ys, n, stride, s);
+            heatmap_stamp_free(s);
+        }
+        return;
+    }
+
+    /* Just like `heatmap_add_points_with_stamp`. */
+    for(i0 = 0 ; i0 < n ; i0 += HEATMAP_BATCH_CHUNK) {
+        const size_t i1 = n - i0 < HEATMAP_BATCH_CHUNK ? n : i0 + HEATMAP_BATCH_CHUNK;
+        size_t i, k = 0;
+
+        for(i = i0 ; i < i1 ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            cx[k] = x;
+            cy[k] = y;
+            k += (x < W) & (y < H);
+        }
+
+        for(i = 0 ; i < k ; ++i) {
+            const unsigned x = cx[i], y = cy[i];
+            if(x >= sw2 && y >= sh2 && x + sw2 < W && y + sh2 < H) {
+                heatmap_add_qblock(h, x - sw2, y - sh2, stamp->buf, 0, stamp->w, stamp->w, stamp->h);
+            } else {
+                heatmap_add_point_with_qstamp(h, x, y, stamp);
+            }
+        }
+    }
+}
+
+void heatmap_add_points(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride)
+{
+    heatmap_add_points_with_stamp(h, xs, ys, n, stride, &stamp_default_4);
+}
+
+void heatmap_add_points_with_stamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride, const heatmap_stamp_t* stamp)
+{
+    /* Everything which only depends on the stamp and the map is hoisted here. */
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned W = h->w, H = h->h;
+    unsigned cx[HEATMAP_BATCH_CHUNK], cy[HEATMAP_BATCH_CHUNK];
+    size_t i0;
+
+    if(h->hbuf) {
+        heatmap_add_points_half(h, xs, ys, 0, n, stride, stamp, 1);
+        return;
+    }
+
+    /* A fixed-point map adds the stamp quantized once instead of quantizing
+     * it anew for every point, with the exact same result, unless it has
+     * values outside of [0, 1], which a quantized stamp can't have.
+     */
+    if(h->ibuf && heatmap_stamp_is_unit(stamp)) {
+        heatmap_qstamp_t* q = heatmap_qstamp_from_stamp(stamp);
+        if(q) {
+            heatmap_add_points_with_qstamp(h, xs, ys, n, stride, q);
+            heatmap_qstamp_free(q);
+            return;
+        }
+    }
+
+    for(i0 = 0 ; i0 < n ; i0 += HEATMAP_BATCH_CHUNK) {
+        const size_t i1 = n - i0 < HEATMAP_BATCH_CHUNK ? n : i0 + HEATMAP_BATCH_CHUNK;
+        size_t i, k = 0;
+
+        /* First pass: cull all points outside of the map, branch-free. */
+        for(i = i0 ; i < i1 ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            cx[k] = x;
+            cy[k] = y;
+            k += (x < W) & (y < H);
+        }
+
+        /* Second pass: stamp the survivors. Most of them don't touch the
+         * border, so they get the whole stamp without any clipping math.
+         */
+        for(i = 0 ; i < k ; ++i) {
+            const unsigned x = cx[i], y = cy[i];
+            if(x >= sw2 && y >= sh2 && x + sw2 < W && y + sh2 < H) {
+                heatmap_add_stamp_window(h, x, y, stamp, 0, 0, stamp->w, stamp->h);
+            } else {
+                heatmap_add_point_with_stamp(h, x, y, stamp);
+            }
+        }
+    }
+}
+
+void heatmap_add_weighted_points(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride)
+{
+    heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, &stamp_default_4);
+}
+
+void heatmap_add_weighted_points_with_stamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp)
+{
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned W = h->w, H = h->h;
+    unsigned cx[HEATMAP_BATCH_CHUNK], cy[HEATMAP_BATCH_CHUNK];
+    float cw[HEATMAP_BATCH_CHUNK];
+    size_t i0;
+
+    if(!ws) {
+        heatmap_add_points_with_stamp(h, xs, ys, n, stride, stamp);
+        return;
+    }
+
+    if(h->hbuf) {
+        heatmap_add_points_half(h, xs, ys, ws, n, stride, stamp, 1);
+        return;
+    }
+
+    for(i0 = 0 ; i0 < n ; i0 += HEATMAP_BATCH_CHUNK) {
+        const size_t i1 = n - i0 < HEATMAP_BATCH_CHUNK ? n : i0 + HEATMAP_BATCH_CHUNK;
+        size_t i, k = 0;
+
+        for(i = i0 ; i < i1 ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            cx[k] = x;
+            cy[k] = y;
+            cw[k] = ws[i];
+            k += (x < W) & (y < H);
+        }
+
+        for(i = 0 ; i < k ; ++i) {
+            const unsigned x = cx[i], y = cy[i];
+
+            /* Currently, negative weights are not supported as they mess with the max. */
+            assert(cw[i] >= 0.0f);
+
+            if(x >= sw2 && y >= sh2 && x + sw2 < W && y + sh2 < H) {
+                heatmap_add_weighted_stamp_window(h, x, y, cw[i], stamp, 0, 0, stamp->w, stamp->h);
+            } else {
+                heatmap_add_weighted_point_with_stamp(h, x, y, cw[i], stamp);
+            }
+        }
+    }
+}
+
+/* Sub-pixel points build their interpolated stamp in chunks of rows of that
+ * many floats on the stack, unless a single row doesn't fit.
+ */
+#define HEATMAP_SUBPIXEL_STACK 2048
+
+/* Writes the columns [c0, c1) of the row of the interpolated stamp, one
+ * pixel wider than the stamp, made of the stamp's rows `s0` and `s1`, where
+ * a00 (a01) is the weight of s0 (shifted right by one pixel) and a10 (a11)
+ * that of s1. The interior is a plain loop the compiler vectorizes.
+ */
+static void heatmap_lerp_row(float* out, const float* s0, const float* s1, unsigned sw, unsigned c0, unsigned c1, float a00, float a01, float a10, float a11)
+{
+    const unsigned i0 = c0 > 0 ? c0 : 1, i1 = c1 < sw ? c1 : sw;
+    float* o = out + (i0 - c0);
+    const float* p0 = s0 + i0;
+    const float* p1 = s1 + i0;
+    size_t i, n = i1 > i0 ? i1 - i0 : 0;
+
+    if(c0 == 0 && c1 > 0) {
+        out[0] = a00*s0[0] + a10*s1[0];
+    }
+    for(i = 0 ; i < n ; ++i) {
+        o[i] = a00*p0[i] + a01*p0[i-1] + a10*p1[i] + a11*p1[i-1];
+    }
+    if(c1 > sw) {
+        out[sw - c0] = a01*s0[sw-1] + a11*s1[sw-1];
+    }
+}
+
+/* Adds a point at sub-pixel coordinates by building the part of the stamp,
+ * interpolated at (x, y)'s fraction and one pixel wider and higher, which
+ * lands on the map, into `buf` and adding that, as many rows at once as fit
+ * into its `buflen` floats. If `buf` is NULL, the four weighted integer
+ * points are stamped one by one instead.
+ */
+static void heatmap_add_pointf_to(heatmap_t* h, float x, float y, float w, const heatmap_stamp_t* stamp, float* buf, size_t buflen)
+{
+    const long W = h->w, H = h->h;
+    const long sw = stamp->w, sh = stamp->h;
+    const long sw2 = sw/2, sh2 = sh/2;
+    long X, Y, c0, c1, r0, r1, r, y0;
+    size_t nrows;
+    float fx, fy, a00, a01, a10, a11;
+
+    /* Also gets rid of NaNs and of coordinates too large for a long. */
+    if(!(x > -1.0f && y > -1.0f && x < (float)W && y < (float)H))
+        return;
+
+    /* Currently, negative weights are not supported as they mess with the max. */
+    assert(w >= 0.0f);
+
+    X = (long)floorf(x);
+    Y = (long)floorf(y);
+    fx = x - (float)X;
+    fy = y - (float)Y;
+
+    /* The weights of the four integer points around (x, y); like integer
+     * points, those outside of the map don't count.
+     */
+    a00 = X >= 0 && Y >= 0 ? w*(1.0f - fx)*(1.0f - fy) : 0.0f;
+    a01 = X + 1 < W && Y >= 0 ? w*fx*(1.0f - fy) : 0.0f;
+    a10 = X >= 0 && Y + 1 < H ? w*(1.0f - fx)*fy : 0.0f;
+    a11 = X + 1 < W && Y + 1 < H ? w*fx*fy : 0.0f;
+
+    if(!buf) {
+        if(a00 > 0.0f) {heatmap_add_weighted_point_with_stamp(h, (unsigned)X, (unsigned)Y, a00, stamp);}
+        if(a01 > 0.0f) {heatmap_add_weighted_point_with_stamp(h, (unsigned)X + 1, (unsigned)Y, a01, stamp);}
+        if(a10 > 0.0f) {heatmap_add_weighted_point_with_stamp(h, (unsigned)X, (unsigned)Y + 1, a10, stamp);}
+        if(a11 > 0.0f) {heatmap_add_weighted_point_with_stamp(h, (unsigned)X + 1, (unsigned)Y + 1, a11, stamp);}
+        return;
+    }
+
+    /* The interpolated stamp's column c lands on the map's X + c - sw2, and
+     * its row r on Y + r - sh2. Its last (first) column and row are only
+     * needed if the points right of (left of) and below (above) count.
+     */
+    c0 = X < sw2 ? sw2 - X : 0;
+    c1 = X + sw - sw2 < W ? sw + 1 : W - X + sw2;
+    r0 = Y < sh2 ? sh2 - Y : 0;
+    r1 = Y + sh - sh2 < H ? sh + 1 : H - Y + sh2;
+    if(a01 == 0.0f && a11 == 0.0f && c1 > sw) {c1 = sw;}
+    if(a00 == 0.0f && a10 == 0.0f && c0 < 1) {c0 = 1;}
+    if(a10 == 0.0f && a11 == 0.0f && r1 > sh) {r1 = sh;}
+    if(a00 == 0.0f && a01 == 0.0f && r0 < 1) {r0 = 1;}
+    if(c0 >= c1 || r0 >= r1)
+        return;
+
+    /* A few rows at a time, such that they're still in L1 when being added.
+     * The first and last rows only have one of the stamp's rows, the other
+     * one being whichever row there is, weighted by zero.
+     */
+    nrows = buflen/(size_t)(c1 - c0);
+    for(y0 = r0 ; y0 < r1 ; y0 += nrows) {
+        const long y1 = r1 - y0 < (long)nrows ? r1 : y0 + (long)nrows;
+
+        for(r = y0 ; r < y1 ; ++r) {
+            const float* s0 = stamp->buf + (r < sh ? r : r-1)*sw;
+            const float* s1 = stamp->buf + (r > 0 ? r-1 : r)*sw;
+            heatmap_lerp_row(buf + (size_t)(r - y0)*(c1 - c0), s0, s1, (unsigned)sw, (unsigned)c0, (unsigned)c1,
+                             r < sh ? a00 : 0.0f, r < sh ? a01 : 0.0f, r > 0 ? a10 : 0.0f, r > 0 ? a11 : 0.0f);
+        }
+
+        heatmap_add_block(h, (unsigned)(X + c0 - sw2), (unsigned)(Y + y0 - sh2), buf, (unsigned)(c1 - c0), (unsigned)(c1 - c0), (unsigned)(y1 - y0), 0);
+    }
+}
+
+void heatmap_add_pointf(heatmap_t* h, float x, float y)
+{
+    heatmap_add_weighted_pointf_with_stamp(h, x, y, 1.0f, &stamp_default_4);
+}
+
+void heatmap_add_pointf_with_stamp(heatmap_t* h, float x, float y, const heatmap_stamp_t* stamp)
+{
+    heatmap_add_weighted_pointf_with_stamp(h, x, y, 1.0f, stamp);
+}
+
+void heatmap_add_weighted_pointf(heatmap_t* h, float x, float y, float w)
+{
+    heatmap_add_weighted_pointf_with_stamp(h, x, y, w, &stamp_default_4);
+}
+
+void heatmap_add_weighted_pointf_with_stamp(heatmap_t* h, float x, float y, float w, const heatmap_stamp_t* stamp)
+{
+    heatmap_add_weighted_pointsf_with_stamp(h, &x, &y, &w, 1, 1, stamp);
+}
+
+void heatmap_add_pointsf(heatmap_t* h, const float* xs, const float* ys, size_t n, size_t stride)
+{
+    heatmap_add_weighted_pointsf_with_stamp(h, xs, ys, 0, n, stride, &stamp_default_4);
+}
+
+void heatmap_add_pointsf_with_stamp(heatmap_t* h, const float* xs, const float* ys, size_t n, size_t stride, const heatmap_stamp_t* stamp)
+{
+    heatmap_add_weighted_pointsf_with_stamp(h, xs, ys, 0, n, stride, stamp);
+}
+
+void heatmap_add_weighted_pointsf(heatmap_t* h, const float* xs, const float* ys, const float* ws, size_t n, size_t stride)
+{
+    heatmap_add_weighted_pointsf_with_stamp(h, xs, ys, ws, n, stride, &stamp_default_4);
+}
+
+void heatmap_add_weighted_pointsf_with_stamp(heatmap_t* h, const float* xs, const float* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp)
+{
+    const size_t len = stamp->w + 1 <= HEATMAP_SUBPIXEL_STACK ? HEATMAP_SUBPIXEL_STACK : stamp->w + 1;
+    float onstack[HEATMAP_SUBPIXEL_STACK];
+    float* buf = len == HEATMAP_SUBPIXEL_STACK ? onstack : (float*)malloc(len*sizeof(float));
+    size_t i;
+
+    for(i = 0 ; i < n ; ++i) {
+        heatmap_add_pointf_to(h, xs[i*stride], ys[i*stride], ws ? ws[i] : 1.0f, stamp, buf, len);
+    }
+    if(buf != onstack) {free(buf);}
+}
+
+/* Returns how many threads the parallel functions should use. Without
+ * OpenMP, they simply fall back to their serial counterparts.
+ */
+static unsigned heatmap_nthreads(unsigned nthreads)
+{
+#ifdef _OPENMP
+    return nthreads ? nthreads : (unsigned)omp_get_max_threads();
+#else
+    (void)nthreads;
+    return 1;
+#endif
+}
+
+/* The index of the calling thread within the current parallel region. */
+static unsigned heatmap_thread_num(void)
+{
+#ifdef _OPENMP
+    return (unsigned)omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/* Adds the part of the stamp centered at (x, y) which falls into the map's
+ * rows [lo, hi) and nowhere else. `ws` being NULL means unweighted.
+ *
+ * The stamp is added onto `dst`, whose top row is the map's row `top`. That
+ * is the map itself (or a copy of its struct) with `top` being 0, or some
+ * scratch covering rows [top, top + dst->h) of it.
+ */
+static void heatmap_add_stamp_rows_to(heatmap_t* dst, unsigned top, const heatmap_t* h, unsigned x, unsigned y, const float* ws, size_t i, const heatmap_stamp_t* stamp, unsigned lo, unsigned hi)
+{
+    const unsigned sh2 = stamp->h/2;
+
+    /* Same as in `heatmap_add_point_with_stamp`, but additionally clipped to the rows. */
+    const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
+    const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
+    const unsigned y0 = lo + sh2 > y ? lo + sh2 - y : 0;
+    const unsigned y1c = (y + sh2) < h->h ? stamp->h : sh2 + (h->h - y);
+    const unsigned y1 = hi + sh2 - y < y1c ? hi + sh2 - y : y1c;
+
+    /* The first check is for the stamp being entirely below the rows. */
+    if(y >= hi + sh2 || y0 >= y1)
+        return;
+
+    heatmap_add_block(dst, (x + x0) - stamp->w/2, (y + y0) - sh2 - top, stamp->buf + y0*stamp->w + x0, stamp->w, x1 - x0, y1 - y0, ws ? ws + i : 0);
+}
+
+static void heatmap_add_stamp_rows(heatmap_t* h, unsigned x, unsigned y, const float* ws, size_t i, const heatmap_stamp_t* stamp, unsigned lo, unsigned hi)
+{
+    heatmap_add_stamp_rows_to(h, 0, h, x, y, ws, i, stamp, lo, hi);
+}
+
+/* Same as `heatmap_add_stamp_rows` with a quantized stamp, for fixed-point maps. */
+static void heatmap_add_qstamp_rows(heatmap_t* h, unsigned x, unsigned y, const heatmap_qstamp_t* stamp, unsigned lo, unsigned hi)
+{
+    const unsigned sh2 = stamp->h/2;
+    const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
+    const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
+    const unsigned y0 = lo + sh2 > y ? lo + sh2 - y : 0;
+    const unsigned y1c = (y + sh2) < h->h ? stamp->h : sh2 + (h->h - y);
+    const unsigned y1 = hi + sh2 - y < y1c ? hi + sh2 - y : y1c;
+
+    if(y >= hi + sh2 || y0 >= y1)
+        return;
+
+    heatmap_add_qblock(h, (x + x0) - stamp->w/2, (y + y0) - sh2, stamp->buf + y0*stamp->w + x0, 0, stamp->w, x1 - x0, y1 - y0);
+}
+
+/* Brings the map's max up to date after the bands have been worked on by
+ * the threads, each of them keeping track of their own band's max.
+ */
+static void heatmap_reduce_bandmax(heatmap_t* h, const float* bandmax, unsigned nbands, int touched)
+{
+    unsigned b;
+
+    /* The bands of a precise map never know their max, see `heatmap_add_block`. */
+    if(h->lazy_max || h->dbuf) {
+        if(touched) {
+            if(h->concurrent) {heatmap_store_flag(&h->max_dirty);}
+            else {h->max_dirty = 1;}
+        }
+    } else {
+        for(b = 0 ; b < nbands ; ++b) {
+            if(h->concurrent) {heatmap_max_atomic(&h->max, bandmax[b]);}
+            else if(bandmax[b] > h->max) {h->max = bandmax[b];}
+        }
+    }
+}
+
+/* Half-precision maps sum up a batch of points in bands of float scratch
+ * rows of at most that many pixels (per thread), and only round the totals.
+ */
+#define HEATMAP_HALF_BAND_PIXELS (1u << 20)
+
+/* The batch functions for half-precision maps. Every point goes into the
+ * bands of rows its stamp overlaps, and then every band's points are added
+ * onto float scratch, which is then added onto the map in one go. Only the
+ * part of the band which the points touched is cleared and added, so small
+ * batches don't cost a pass over the whole map. The bands are independent,
+ * so the result doesn't depend on the amount of threads.
+ */
+static void heatmap_add_points_half(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const unsigned nth = heatmap_nthreads(nthreads);
+    const unsigned W = h->w, H = h->h;
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned fit = W ? (W < HEATMAP_HALF_BAND_PIXELS ? HEATMAP_HALF_BAND_PIXELS/W : 1) : 1;
+    const unsigned bh = fit < H ? fit : (H ? H : 1);
+    const unsigned nbands = (H + bh - 1)/bh;
+    size_t* start = (size_t*)calloc((size_t)nbands + 2, sizeof(size_t));
+    size_t* entries = 0;
+    float* scratch = 0;
+    float* bandmax = 0;
+    size_t i;
+    int b;
+
+    if(!start || nbands == 0) {
+        free(start);
+        return;
+    }
+
+    /* Count every band's points into start[band + 2], then turn that into
+     * offsets such that filling in entries through start[band + 1] leaves
+     * every band's points in [start[band], start[band + 1]).
+     */
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned x = xs[i*stride], y = ys[i*stride];
+        if(x < W && y < H) {
+            const unsigned r0 = y > sh2 ? y - sh2 : 0;
+            const unsigned r1 = y + (stamp->h - 1 - sh2) < H ? y + (stamp->h - 1 - sh2) : H - 1;
+            unsigned bb;
+
+            /* Currently, negative weights are not supported as they mess with the max. */
+            assert(!ws || ws[i] >= 0.0f);
+
+            for(bb = r0/bh ; bb <= r1/bh ; ++bb) {
+                start[bb + 2]++;
+            }
+        }
+    }
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        start[b + 2] += start[b + 1];
+    }
+
+    entries = (size_t*)malloc((start[nbands + 1] ? start[nbands + 1] : 1)*sizeof(size_t));
+    scratch = (float*)malloc((size_t)nth*bh*W*sizeof(float));
+    bandmax = (float*)malloc(nbands*sizeof(float));
+
+    /* No memory for doing it properly, so round after every point instead. */
+    if(!entries || !scratch || !bandmax) {
+        free(start);
+        free(entries);
+        free(scratch);
+        free(bandmax);
+        for(i = 0 ; i < n ; ++i) {
+            if(ws) {heatmap_add_weighted_point_with_stamp(h, xs[i*stride], ys[i*stride], ws[i], stamp);}
+            else {heatmap_add_point_with_stamp(h, xs[i*stride], ys[i*stride], stamp);}
+        }
+        return;
+    }
+
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned x = xs[i*stride], y = ys[i*stride];
+        if(x < W && y < H) {
+            const unsigned r0 = y > sh2 ? y - sh2 : 0;
+            const unsigned r1 = y + (stamp->h - 1 - sh2) < H ? y + (stamp->h - 1 - sh2) : H - 1;
+            unsigned bb;
+            for(bb = r0/bh ; bb <= r1/bh ; ++bb) {
+                entries[start[bb + 1]++] = i;
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        const unsigned lo = b*bh, hi = lo + bh < H ? lo + bh : H;
+        heatmap_t part = *h, band;
+        unsigned bx0 = W, bx1 = 0, by0 = hi, by1 = lo; /* The [first, last) touched columns and rows. */
+        unsigned iy;
+        size_t e;
+
+        bandmax[b] = part.max;
+        if(start[b] == start[b + 1])
+            continue;
+
+        for(e = start[b] ; e < start[b + 1] ; ++e) {
+            const unsigned x = xs[entries[e]*stride], y = ys[entries[e]*stride];
+            const unsigned cx0 = x > sw2 ? x - sw2 : 0;
+            const unsigned cx1 = x + (stamp->w - sw2) < W ? x + (stamp->w - sw2) : W;
+            const unsigned cy0 = y > lo + sh2 ? y - sh2 : lo;
+            const unsigned cy1 = y + (stamp->h - sh2) < hi ? y + (stamp->h - sh2) : hi;
+            if(cx0 < bx0) {bx0 = cx0;}
+            if(cx1 > bx1) {bx1 = cx1;}
+            if(cy0 < by0) {by0 = cy0;}
+            if(cy1 > by1) {by1 = cy1;}
+        }
+
+        memset(&band, 0, sizeof(band));
+        band.buf = scratch + (size_t)heatmap_thread_num()*bh*W;
+        band.w = W;
+        band.h = hi - lo;
+        band.lazy_max = 1;
+        for(iy = by0 ; iy < by1 ; ++iy) {
+            memset(band.buf + (size_t)(iy - lo)*W + bx0, 0, (bx1 - bx0)*sizeof(float));
+        }
+
+        for(e = start[b] ; e < start[b + 1] ; ++e) {
+            const size_t k = entries[e];
+            heatmap_add_stamp_rows_to(&band, lo, h, xs[k*stride], ys[k*stride], ws, k, stamp, lo, hi);
+        }
+
+        heatmap_add_block(&part, bx0, by0, band.buf + (size_t)(by0 - lo)*W + bx0, W, bx1 - bx0, by1 - by0, 0);
+        bandmax[b] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, start[nbands] > 0);
+
+    free(start);
+    free(entries);
+    free(scratch);
+    free(bandmax);
+}
+
+/* The parallel functions cut the map into many more bins of rows than there
+ * are threads, so that no single bin makes up too much of the work.
+ */
+#define HEATMAP_BINS_PER_THREAD 8
+/* Hot bins get split further, until no task is more than this fraction of
+ * one thread's fair share of the work.
+ */
+#define HEATMAP_TASKS_PER_THREAD 4
+
+/* A task is a range of rows [lo, hi) of one bin. Every row belongs to exactly
+ * one task, so no two tasks ever write the same pixel.
+ */
+typedef struct {
+    unsigned bin, lo, hi;
+    size_t cost;
+} heatmap_task_t;
+
+/* Sorts the most expensive tasks first. */
+static int heatmap_task_cmp(const void* a, const void* b)
+{
+    const size_t ca = ((const heatmap_task_t*)a)->cost, cb = ((const heatmap_task_t*)b)->cost;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Turns bins of `bh` rows of an `H` rows tall map, with the given costs, into
+ * a list of tasks for `nth` threads, splitting hot bins into thinner ones.
+ * The tasks are ordered most expensive first, which together with threads
+ * grabbing the next task whenever they're done, keeps all of them busy until
+ * the very end. Returns NULL if there's no memory.
+ */
+static heatmap_task_t* heatmap_plan_tasks(const size_t* bincost, unsigned nbins, unsigned bh, unsigned H, unsigned nth, unsigned* ntasks)
+{
+    size_t total = 0, target;
+    heatmap_task_t* tasks;
+    unsigned b, n = 0;
+
+    for(b = 0 ; b < nbins ; ++b) {
+        total += bincost[b];
+    }
+    target = total/((size_t)nth*HEATMAP_TASKS_PER_THREAD) + 1;
+
+    /* Counting first, because there are as many tasks as rows at worst. */
+    for(b = 0 ; b < nbins ; ++b) {
+        const unsigned rows = (b+1)*bh < H ? bh : H - b*bh;
+        const size_t splits = bincost[b]/target + 1;
+        n += splits < rows ? (unsigned)splits : rows;
+    }
+
+    tasks = (heatmap_task_t*)malloc(n*sizeof(heatmap_task_t));
+    if(!tasks)
+        return 0;
+
+    *ntasks = 0;
+    for(b = 0 ; b < nbins ; ++b) {
+        const unsigned lo = b*bh, rows = (b+1)*bh < H ? bh : H - lo;
+        const size_t splits = bincost[b]/target + 1;
+        const unsigned s = splits < rows ? (unsigned)splits : rows;
+        unsigned i;
+
+        for(i = 0 ; i < s ; ++i) {
+            heatmap_task_t* t = tasks + (*ntasks)++;
+            t->bin = b;
+            t->lo = lo + (unsigned)((size_t)rows*i/s);
+            t->hi = lo + (unsigned)((size_t)rows*(i+1)/s);
+            t->cost = bincost[b]/s;
+        }
+    }
+
+    qsort(tasks, *ntasks, sizeof(heatmap_task_t), heatmap_task_cmp);
+    return tasks;
+}
+
+void heatmap_add_points_parallel(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const unsigned nth = heatmap_nthreads(nthreads);
+    const unsigned sh2 = stamp->h/2;
+    const unsigned nbins = nth*HEATMAP_BINS_PER_THREAD < h->h ? nth*HEATMAP_BINS_PER_THREAD : h->h;
+    const unsigned bh = nbins ? (h->h + nbins - 1)/nbins : 1;
+    size_t* counts = 0;  /* [chunk][bin] amount of points, then their offsets. */
+    size_t* entries = 0; /* The indices of the points, grouped by bin. */
+    size_t* binstart = 0;
+    heatmap_task_t* tasks = 0;
+    float* taskmax = 0;
+    heatmap_qstamp_t* q = 0;
+    unsigned ntasks = 0;
+    int c, t;
+
+    if(h->hbuf) {
+        heatmap_add_points_half(h, xs, ys, ws, n, stride, stamp, nth);
+        return;
+    }
+
+    if(nth > 1 && nbins > 1 && n >= nth) {
+        counts = (size_t*)calloc((size_t)nth*nbins, sizeof(size_t));
+        binstart = (size_t*)malloc((nbins + 1)*sizeof(size_t));
+    }
+
+    /* Nothing to parallelize, or no memory to do it with. */
+    if(!counts || !binstart) {
+        free(counts);
+        free(binstart);
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+        return;
+    }
+
+    /* First, count how many points touch every bin, per chunk of points.
+     * A point goes into every bin its stamp overlaps, thus some points are
+     * in two (or more, for huge stamps) bins.
+     */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(c = 0 ; c < (int)nth ; ++c) {
+        size_t* count = counts + (size_t)c*nbins;
+        size_t i;
+        for(i = n*c/nth ; i < n*(c+1)/nth ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            if(x < h->w && y < h->h) {
+                const unsigned r0 = y > sh2 ? y - sh2 : 0;
+                const unsigned r1 = y + (stamp->h - 1 - sh2) < h->h ? y + (stamp->h - 1 - sh2) : h->h - 1;
+                unsigned bb;
+                for(bb = r0/bh ; bb <= r1/bh ; ++bb) {
+                    count[bb]++;
+                }
+            }
+        }
+    }
+
+    /* Turn the counts into offsets. Within a bin, chunks are kept in order,
+     * so that every pixel sees its points in the original order and the
+     * result is exactly the same as when adding them serially.
+     */
+    {
+        size_t total = 0;
+        unsigned bb, cc;
+        for(bb = 0 ; bb < nbins ; ++bb) {
+            binstart[bb] = total;
+            for(cc = 0 ; cc < nth ; ++cc) {
+                const size_t cnt = counts[(size_t)cc*nbins + bb];
+                counts[(size_t)cc*nbins + bb] = total;
+                total += cnt;
+            }
+        }
+        binstart[nbins] = total;
+        entries = (size_t*)malloc((total ? total : 1)*sizeof(size_t));
+
+        /* The amount of points in a bin is what it costs to work on it. */
+        if(entries) {
+            size_t* bincost = (size_t*)malloc(nbins*sizeof(size_t));
+            if(bincost) {
+                for(bb = 0 ; bb < nbins ; ++bb) {
+                    bincost[bb] = binstart[bb+1] - binstart[bb];
+                }
+                tasks = heatmap_plan_tasks(bincost, nbins, bh, h->h, nth, &ntasks);
+                free(bincost);
+            }
+            taskmax = (float*)malloc((ntasks ? ntasks : 1)*sizeof(float));
+        }
+    }
+
+    if(!entries || !tasks || !taskmax) {
+        free(entries);
+        free(tasks);
+        free(taskmax);
+        free(counts);
+        free(binstart);
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+        return;
+    }
+
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(c = 0 ; c < (int)nth ; ++c) {
+        size_t* offset = counts + (size_t)c*nbins;
+        size_t i;
+        for(i = n*c/nth ; i < n*(c+1)/nth ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            if(x < h->w && y < h->h) {
+                const unsigned r0 = y > sh2 ? y - sh2 : 0;
+                const unsigned r1 = y + (stamp->h - 1 - sh2) < h->h ? y + (stamp->h - 1 - sh2) : h->h - 1;
+                unsigned bb;
+                for(bb = r0/bh ; bb <= r1/bh ; ++bb) {
+                    entries[offset[bb]++] = i;
+                }
+            }
+        }
+    }
+
+    /* A fixed-point map gets the stamp quantized once, as in the serial
+     * `heatmap_add_points_with_stamp`.
+     */
+    if(h->ibuf && !ws && heatmap_stamp_is_unit(stamp)) {
+        q = heatmap_qstamp_from_stamp(stamp);
+    }
+
+    /* Now the threads keep on grabbing the next task until none are left,
+     * and stamp the task's bin's points, clipped to the task's rows. Each
+     * task works on its own copy of the heatmap struct, which only differs
+     * in the max, so there's no shared state being written to.
+     */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(t = 0 ; t < (int)ntasks ; ++t) {
+        const heatmap_task_t* task = tasks + t;
+        heatmap_t part = *h;
+        size_t e;
+
+        for(e = binstart[task->bin] ; e < binstart[task->bin+1] ; ++e) {
+            const size_t i = entries[e];
+            if(q) {heatmap_add_qstamp_rows(&part, xs[i*stride], ys[i*stride], q, task->lo, task->hi);}
+            else {heatmap_add_stamp_rows(&part, xs[i*stride], ys[i*stride], ws, i, stamp, task->lo, task->hi);}
+        }
+
+        taskmax[t] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, taskmax, ntasks, binstart[nbins] > 0);
+
+    if(q) {
+        heatmap_qstamp_free(q);
+    }
+
+    free(entries);
+    free(tasks);
+    free(taskmax);
+    free(counts);
+    free(binstart);
+}
+
+/* Adds the precise heat `d` plus `f` of `n` pixels onto the precise map's
+ * doubles from (x, y) on, in as many pieces as the map's tiles cut it into.
+ */
+static void heatmap_add_precise_row(heatmap_t* h, unsigned x, unsigned y, const double* d, const float* f, unsigned n)
+{
+    const unsigned tw = heatmap_tile_w(h);
+
+    while(n > 0) {
+        const unsigned m = tw - x%tw < n ? tw - x%tw : n;
+        double* line = heatmap_pixel64(h, x, y);
+        unsigned i;
+        for(i = 0 ; i < m ; ++i) {
+            line[i] += d[i] + f[i];
+        }
+        x += m;
+        d += m;
+        f += m;
+        n -= m;
+    }
+    h->max_dirty = 1;
+}
+
+/* Adds the part of `src` which falls into the map's rows [lo, hi) onto the
+ * map, with `src`'s top-left pixel landing on (x, y).
+ */
+static void heatmap_merge_rows(heatmap_t* h, const heatmap_t* src, unsigned x, unsigned y, unsigned lo, unsigned hi)
+{
+    /* [first, last) rows and columns in the SOURCE's pixels. */
+    const unsigned r0 = y > lo ? 0 : lo - y;
+    const unsigned r1 = src->h < hi - y ? src->h : hi - y;
+    const unsigned cols = x >= h->w ? 0 : src->w < h->w - x ? src->w : h->w - x;
+    const unsigned tw = heatmap_tile_w(src), th = heatmap_tile_h(src);
+    /* A decaying source's stored heat is heavier than its real heat. */
+    const float* w = src->decay != 0.0f ? &src->decay : 0;
+    unsigned tx, ty;
+
+    if(y >= hi || r0 >= r1 || cols == 0)
+        return;
+
+    /* Every tile of the source is a row-major block of its own, and there's
+     * nothing to add from a sparse source's untouched tiles.
+     */
+    for(ty = r0/th ; ty*th < r1 ; ++ty) {
+        const unsigned br0 = ty*th > r0 ? ty*th : r0;
+        const unsigned br1 = r1 - ty*th > th ? (ty+1)*th : r1;
+
+        for(tx = 0 ; tx*tw < cols ; ++tx) {
+            const unsigned bc1 = cols - tx*tw > tw ? (tx+1)*tw : cols;
+            const float* block;
+
+            /* Fixed-point heat is added onto fixed-point maps exactly. */
+            if(src->ibuf && h->ibuf) {
+                heatmap_add_qblock(h, x + tx*tw, y + br0, 0, heatmap_pixel32(src, tx*tw, br0), tw, bc1 - tx*tw, br1 - br0);
+                continue;
+            }
+
+            /* So is precise heat onto precise maps, as doubles. */
+            if(src->dbuf && h->dbuf && src->decay == 0.0f && h->decay == 0.0f) {
+                unsigned iy;
+                for(iy = br0 ; iy < br1 ; ++iy) {
+                    heatmap_add_precise_row(h, x + tx*tw, y + iy, heatmap_pixel64(src, tx*tw, iy), heatmap_pixel(src, tx*tw, iy), bc1 - tx*tw);
+                }
+                continue;
+            }
+
+            /* Any other source which isn't floats gets converted piece by piece. */
+            if(src->storage != HEATMAP_FLOAT32) {
+                float tmp[HEATMAP_HALF_CHUNK];
+                unsigned iy, ix;
+                for(iy = br0 ; iy < br1 ; ++iy) {
+                    for(ix = tx*tw ; ix < bc1 ; ix += HEATMAP_HALF_CHUNK) {
+                        const unsigned n = bc1 - ix < HEATMAP_HALF_CHUNK ? bc1 - ix : HEATMAP_HALF_CHUNK;
+                        heatmap_add_block(h, x + ix, y + iy, heatmap_read_pixels(src, ix, iy, n, tmp), n, n, 1, w);
+                    }
+                }
+                continue;
+            }
+
+            block = heatmap_pixel(src, tx*tw, br0);
+            if(block) {
+                heatmap_add_block(h, x + tx*tw, y + br0, block, tw, bc1 - tx*tw, br1 - br0, w);
+            }
+        }
+    }
+}
+
+void heatmap_merge(heatmap_t* h, const heatmap_t* src, unsigned x, unsigned y)
+{
+    heatmap_merge_rows(h, src, x, y, 0, h->h);
+}
+
+void heatmap_merge_shards(heatmap_t* h, const heatmap_t* const* shards, const unsigned* xs, const unsigned* ys, size_t n, unsigned nthreads)
+{
+    const unsigned nth = heatmap_nthreads(nthreads);
+    /* Same split of the map into bands as in `heatmap_add_points_parallel`. */
+    const unsigned nbands = nth < h->h ? nth : h->h;
+    const unsigned bh = nbands ? (h->h + nbands - 1)/nbands : 1;
+    float* bandmax = 0;
+    int b;
+
+    if(nbands > 1) {
+        bandmax = (float*)malloc(nbands*sizeof(float));
+    }
+
+    /* Nothing to parallelize, or no memory to do it with. */
+    if(!bandmax) {
+        size_t i;
+        for(i = 0 ; i < n ; ++i) {
+            heatmap_merge_rows(h, shards[i], xs ? xs[i] : 0, ys ? ys[i] : 0, 0, h->h);
+        }
+        return;
+    }
+
+    /* Rather than merging the shards pairwise, every thread adds all shards'
+     * rows falling into its band. This reads each shard exactly once and,
+     * since every pixel still sees the shards in order, gives the exact
+     * same result as merging them one after another.
+     */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        const unsigned lo = b*bh, hi = lo + bh < h->h ? lo + bh : h->h;
+        heatmap_t band = *h;
+        size_t i;
+
+        for(i = 0 ; i < n ; ++i) {
+            heatmap_merge_rows(&band, shards[i], xs ? xs[i] : 0, ys ? ys[i] : 0, lo, hi);
+        }
+
+        bandmax[b] = band.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, n > 0);
+
+    free(bandmax);
+}
+
+struct heatmap_window {
+    heatmap_t** buckets; /* The ring of buckets, the current one at `cur`. */
+    unsigned nbuckets, cur;
+    unsigned w, h;
+    /* The 64-bit fixed-point sum of all buckets but the current one, see
+     * `heatmap_quantize_window`, and whether any of its pixels saturated.
+     */
+    unsigned long long* total;
+    int saturated;
+    heatmap_t* view; /* `total` plus the current bucket, see `heatmap_window_map`. */
+};
+
+/* Adds the rounded heat of the bucket's row `y` onto `line` using `wacc`, or
+ * subtracts it using `wsub`, skipping the untouched tiles of sparse buckets.
+ * If `clear` is non-zero, the row's heat is cleared afterwards, unless that's
+ * sparse. Returns whether anything saturated when adding.
+ */
+static int heatmap_window_row(const heatmap_kernels_t* k, int sub, unsigned long long* line, heatmap_t* bucket, unsigned y, int clear)
+{
+    const unsigned tw = heatmap_tile_w(bucket);
+    unsigned x0, n;
+    int saturated = 0;
+
+    assert(!bucket->hbuf && !bucket->ibuf && !bucket->dbuf && bucket->decay == 0.0f);
+
+    for(x0 = 0 ; x0 < bucket->w ; x0 += n) {
+        float* heat = heatmap_pixel(bucket, x0, y);
+        n = tw < bucket->w - x0 ? tw : bucket->w - x0;
+        if(heat) {
+            if(sub) {
+                k->wsub(line + x0, heat, n);
+            } else {
+                saturated |= k->wacc(line + x0, heat, n);
+            }
+            if(clear && !bucket->tiles) {memset(heat, 0, n*sizeof(float));}
+        }
+    }
+
+    return saturated;
+}
+
+/* Adds the heat of the bucket `add` onto the total and subtracts the heat of
+ * the bucket `sub`, which is cleared on the way, one row after the other,
+ * which keeps the rows in the cache. Returns whether anything saturated.
+ */
+static int heatmap_window_rows(heatmap_window_t* win, heatmap_t* add, heatmap_t* sub)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    int saturated = 0, y;
+
+#pragma omp parallel for schedule(static) if((size_t)win->w*win->h >= HEATMAP_SCALE_PARALLEL_MIN) reduction(|:saturated)
+    for(y = 0 ; y < (int)win->h ; ++y) {
+        unsigned long long* line = win->total + (size_t)y*win->w;
+        saturated |= heatmap_window_row(k, 0, line, add, (unsigned)y, 0);
+        heatmap_window_row(k, 1, line, sub, (unsigned)y, 1);
+    }
+
+    return saturated;
+}
+
+/* Sums all buckets but the current one into the total from scratch. Returns
+ * whether anything saturated (again).
+ */
+static int heatmap_window_rebuild(heatmap_window_t* win)
+{
+    const heatmap_kernels_t* k = heatmap_get_kernels();
+    int saturated = 0, y;
+
+#pragma omp parallel for schedule(static) if((size_t)win->w*win->h >= HEATMAP_SCALE_PARALLEL_MIN) reduction(|:saturated)
+    for(y = 0 ; y < (int)win->h ; ++y) {
+        unsigned long long* line = win->total + (size_t)y*win->w;
+        unsigned i;
+        memset(line, 0, win->w*sizeof(unsigned long long));
+        for(i = 0 ; i < win->nbuckets ; ++i) {
+            if(i != win->cur) {
+                saturated |= heatmap_window_row(k, 0, line, win->buckets[i], (unsigned)y, 0);
+            }
+        }
+    }
+
+    return saturated;
+}
+
+/* Gives a cleared sparse bucket's tiles back, and resets a bucket's max. */
+static void heatmap_window_cleared(heatmap_t* bucket)
+{
+    if(bucket->tiles) {
+        const size_t ntiles = heatmap_tiles_x(bucket)*heatmap_tiles_y(bucket);
+        size_t i;
+        for(i = 0 ; i < ntiles ; ++i) {
+            free(bucket->tiles[i]);
+            bucket->tiles[i] = 0;
+        }
+    }
+    bucket->max = 0.0f;
+    bucket->max_dirty = 0;
+}
+
+heatmap_window_t* heatmap_window_new(unsigned w, unsigned h, unsigned nbuckets, int sparse)
+{
+    heatmap_window_t* win;
+    unsigned i;
+
+    if(nbuckets == 0)
+        return 0;
+
+    win = (heatmap_window_t*)calloc(1, sizeof(heatmap_window_t));
+    if(!win)
+        return 0;
+
+    win->nbuckets = nbuckets;
+    win->w = w;
+    win->h = h;
+    win->buckets = (heatmap_t**)calloc(nbuckets, sizeof(heatmap_t*));
+    win->total = (unsigned long long*)calloc((size_t)w*h, sizeof(unsigned long long));
+    win->view = heatmap_new(w, h);
+    if(!win->buckets || !win->total || !win->view->buf) {
+        heatmap_window_free(win);
+        return 0;
+    }
+
+    for(i = 0 ; i < nbuckets ; ++i) {
+        heatmap_t* b = sparse ? heatmap_new_sparse(w, h) : heatmap_new(w, h);
+        win->buckets[i] = b;
+        if(sparse ? !b->tiles : !b->buf) {
+            heatmap_window_free(win);
+            return 0;
+        }
+        heatmap_set_lazy_max(b, 1);
+    }
+    heatmap_set_lazy_max(win->view, 1);
+
+    return win;
+}
+
+heatmap_t* heatmap_window_current(heatmap_window_t* win)
+{
+    return win->buckets[win->cur];
+}
+
+void heatmap_window_advance(heatmap_window_t* win)
+{
+    heatmap_t* current = win->buckets[win->cur];
+    heatmap_t* oldest;
+
+    win->cur = (win->cur + 1) % win->nbuckets;
+    oldest = win->buckets[win->cur];
+
+    if(oldest != current && !win->saturated) {
+        win->saturated = heatmap_window_rows(win, current, oldest);
+    } else if(!oldest->tiles) {
+        /* A single bucket never makes it into the total, it just starts over. */
+        memset(oldest->buf, 0, heatmap_buflen(oldest)*sizeof(float));
+    }
+    heatmap_window_cleared(oldest);
+
+    /* Saturated pixels lost count of their heat, and taking a bucket's heat
+     * away from them would leave too little. Until nothing saturates anymore,
+     * the total is rebuilt from the buckets instead.
+     */
+    if(win->saturated) {
+        win->saturated = heatmap_window_rebuild(win);
+    }
+}
+
+heatmap_t* heatmap_window_map(heatmap_window_t* win)
+{
+    heatmap_t* bucket = win->buckets[win->cur];
+    const unsigned tw = heatmap_tile_w(bucket);
+    int y;
+
+#pragma omp parallel for schedule(static) if((size_t)win->w*win->h >= HEATMAP_SCALE_PARALLEL_MIN)
+    for(y = 0 ; y < (int)win->h ; ++y) {
+        const unsigned long long* total = win->total + (size_t)y*win->w;
+        float* line = win->view->buf + (size_t)y*win->w;
+        unsigned x0, n, x;
+
+        for(x0 = 0 ; x0 < win->w ; x0 += n) {
+            const float* heat = heatmap_pixel(bucket, x0, (unsigned)y);
+            n = tw < win->w - x0 ? tw : win->w - x0;
+            /* Converting both halves separately is what compilers vectorize. */
+            for(x = x0 ; x < x0 + n ; ++x) {
+                const double t = (double)(unsigned)(total[x] >> 32) + (double)(unsigned)total[x]*(1.0/HEATMAP_WINDOW_ONE);
+                line[x] = (float)(heat ? t + heat[x - x0] : t);
+            }
+        }
+    }
+
+    win->view->max_dirty = 1;
+    return win->view;
+}
+
+void heatmap_window_free(heatmap_window_t* win)
+{
+    unsigned i;
+
+    if(!win)
+        return;
+
+    if(win->buckets) {
+        for(i = 0 ; i < win->nbuckets ; ++i) {
+            if(win->buckets[i]) {heatmap_free(win->buckets[i]);}
+        }
+        free(win->buckets);
+    }
+    free(win->total);
+    if(win->view) {heatmap_free(win->view);}
+    free(win);
+}
+
+void heatmap_add_points_with_stamps(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, const unsigned* cls, size_t n, size_t stride, const heatmap_stamp_t* const* stamps, unsigned nstamps, unsigned nthreads)
+{
+    size_t* end = (size_t*)calloc((size_t)nstamps + 1, sizeof(size_t));
+    unsigned* pts = (unsigned*)malloc((n ? n : 1)*2*sizeof(unsigned));
+    float* gws = ws ? (float*)malloc((n ? n : 1)*sizeof(float)) : 0;
+    size_t i;
+    unsigned c;
+
+    /* No memory to group them, so just stamp them one by one. */
+    if(!end || !pts || (ws && !gws)) {
+        free(end);
+        free(pts);
+        free(gws);
+        for(i = 0 ; i < n ; ++i) {
+            if(cls[i] < nstamps && stamps[cls[i]]) {
+                heatmap_add_weighted_point_with_stamp(h, xs[i*stride], ys[i*stride], ws ? ws[i] : 1.0f, stamps[cls[i]]);
+            }
+        }
+        return;
+    }
+
+    /* A stable counting sort by stamp, so that within every group the points
+     * stay in order. After scattering, end[c] is where group c ends.
+     */
+    for(i = 0 ; i < n ; ++i) {
+        if(cls[i] < nstamps && stamps[cls[i]])
+            end[cls[i] + 1]++;
+    }
+    for(c = 0 ; c < nstamps ; ++c) {
+        end[c + 1] += end[c];
+    }
+    for(i = 0 ; i < n ; ++i) {
+        if(cls[i] < nstamps && stamps[cls[i]]) {
+            const size_t j = end[cls[i]]++;
+            pts[2*j] = xs[i*stride];
+            pts[2*j+1] = ys[i*stride];
+            if(gws) {gws[j] = ws[i];}
+        }
+    }
+
+    for(c = 0 ; c < nstamps ; ++c) {
+        const size_t b = c ? end[c-1] : 0;
+        if(end[c] > b) {
+            heatmap_add_points_parallel(h, pts + 2*b, pts + 2*b + 1, gws ? gws + b : 0, end[c] - b, 2, stamps[c], nthreads);
+        }
+    }
+
+    free(end);
+    free(pts);
+    free(gws);
+}
+
+/* Orders radii for heatmap_add_points_with_radii. */
+static int heatmap_radius_cmp(const void* a, const void* b)
+{
+    const unsigned ra = *(const unsigned*)a, rb = *(const unsigned*)b;
+    return ra < rb ? -1 : ra > rb ? 1 : 0;
+}
+
+int heatmap_add_points_with_radii(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, const unsigned* rs, size_t n, size_t stride, float (*distshape)(float), heatmap_stampcache_t* cache, unsigned nthreads)
+{
+    heatmap_stampcache_t* own = cache ? 0 : heatmap_stampcache_new(0);
+    heatmap_stampcache_t* pool = cache ? cache : own;
+    const heatmap_stamp_t** stamps = 0;
+    unsigned* radii = 0;
+    unsigned* cls = 0;
+    size_t nradii = 0, i;
+    int missing = 0, k;
+
+    if(pool && n) {
+        radii = (unsigned*)malloc(n*sizeof(unsigned));
+        cls = (unsigned*)malloc(n*sizeof(unsigned));
+    }
+    if(n && (!radii || !cls)) {
+        free(radii);
+        free(cls);
+        if(own) {heatmap_stampcache_free(own);}
+        return 0;
+    }
+
+    /* Find the distinct radii in use, which is a handful no matter how big
+     * they are, and turn every point's radius into an index amongst them.
+     */
+    for(i = 0 ; i < n ; ++i) {
+        radii[i] = rs[i];
+    }
+    qsort(radii, n, sizeof(unsigned), heatmap_radius_cmp);
+    for(i = 0 ; i < n ; ++i) {
+        if(!nradii || radii[nradii-1] != radii[i]) {radii[nradii++] = radii[i];}
+    }
+    for(i = 0 ; i < n ; ++i) {
+        size_t lo = 0, hi = nradii;
+        while(hi - lo > 1) {
+            const size_t mid = lo + (hi - lo)/2;
+            if(radii[mid] <= rs[i]) {lo = mid;} else {hi = mid;}
+        }
+        cls[i] = (unsigned)lo;
+    }
+
+    /* Get all their stamps from the pool at once. Those which aren't in it yet
+     * get generated in parallel. A stamp which can't be had, because it's too
+     * big or there's no memory, only leaves out the points using that radius.
+     */
+    stamps = nradii ? (const heatmap_stamp_t**)calloc(nradii, sizeof(heatmap_stamp_t*)) : 0;
+    if(stamps) {
+#pragma omp parallel for schedule(dynamic) num_threads(heatmap_nthreads(nthreads)) reduction(|:missing)
+        for(k = 0 ; k < (int)nradii ; ++k) {
+            stamps[k] = heatmap_stampcache_get(pool, radii[k], distshape);
+            missing |= !stamps[k];
+        }
+
+        heatmap_add_points_with_stamps(h, xs, ys, ws, cls, n, stride, stamps, (unsigned)nradii, nthreads);
+
+        for(i = 0 ; i < nradii ; ++i) {
+            if(stamps[i]) {heatmap_stampcache_release(pool, stamps[i]);}
+        }
+    } else {
+        missing = nradii > 0;
+    }
+
+    free(stamps);
+    free(radii);
+    free(cls);
+    if(own) {heatmap_stampcache_free(own);}
+    return !missing;
+}
+
+/* Coalescing hashes the points into this many parts, every one of which is
+ * then deduplicated by a single thread. It doesn't depend on the amount of
+ * threads, so neither does the order of the coalesced points.
+ */
+#define HEATMAP_COALESCE_PARTS 64
+/* How many points `heatmap_add_points_coalesced` coalesces at a time, which
+ * bounds the memory it needs to about 32 bytes per point of that.
+ */
+#define HEATMAP_COALESCE_CHUNK (1u << 20)
+
+static unsigned long long heatmap_coalesce_hash(unsigned x, unsigned y)
+{
+    return (((unsigned long long)x << 32) | y)*0x9E3779B97F4A7C15ull;
+}
+
+size_t heatmap_coalesce_points(const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, unsigned* xys, float* cws, unsigned nthreads)
+{
+    const unsigned nth = heatmap_nthreads(nthreads);
+    size_t* counts = (size_t*)calloc((size_t)nth*HEATMAP_COALESCE_PARTS, sizeof(size_t));
+    size_t* idx = (size_t*)malloc((n ? n : 1)*sizeof(size_t));
+    size_t partstart[HEATMAP_COALESCE_PARTS + 1];
+    size_t nunique[HEATMAP_COALESCE_PARTS];
+    size_t i, total = 0;
+    int c, p;
+
+    /* No memory to coalesce them, so they all stay. */
+    if(!counts || !idx) {
+        free(counts);
+        free(idx);
+        for(i = 0 ; i < n ; ++i) {
+            xys[2*i] = xs[i*stride];
+            xys[2*i+1] = ys[i*stride];
+            cws[i] = ws ? ws[i] : 1.0f;
+        }
+        return n;
+    }
+
+    /* Sort the points into their parts, just like `heatmap_add_points_parallel`
+     * sorts them into bins: count per chunk of points, turn the counts into
+     * offsets, keeping the chunks in order, and scatter.
+     */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(c = 0 ; c < (int)nth ; ++c) {
+        size_t* count = counts + (size_t)c*HEATMAP_COALESCE_PARTS;
+        size_t j;
+        for(j = n*c/nth ; j < n*(c+1)/nth ; ++j) {
+            count[heatmap_coalesce_hash(xs[j*stride], ys[j*stride]) >> 58]++;
+        }
+    }
+
+    for(p = 0 ; p < HEATMAP_COALESCE_PARTS ; ++p) {
+        partstart[p] = total;
+        for(c = 0 ; c < (int)nth ; ++c) {
+            const size_t cnt = counts[(size_t)c*HEATMAP_COALESCE_PARTS + p];
+            counts[(size_t)c*HEATMAP_COALESCE_PARTS + p] = total;
+            total += cnt;
+        }
+    }
+    partstart[HEATMAP_COALESCE_PARTS] = total;
+
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(c = 0 ; c < (int)nth ; ++c) {
+        size_t* offset = counts + (size_t)c*HEATMAP_COALESCE_PARTS;
+        size_t j;
+        for(j = n*c/nth ; j < n*(c+1)/nth ; ++j) {
+            idx[offset[heatmap_coalesce_hash(xs[j*stride], ys[j*stride]) >> 58]++] = j;
+        }
+    }
+
+    /* Every part's unique points go to the start of its range of the output,
+     * in the order they first appear, with all their weights summed up in
+     * order. The hash table holds where in the output a point is, plus one.
+     */
+#pragma omp parallel for schedule(dynamic) num_threads(nth)
+    for(p = 0 ; p < HEATMAP_COALESCE_PARTS ; ++p) {
+        const size_t b = partstart[p], e = partstart[p+1];
+        size_t cap = 16, u = b, j;
+        size_t* slots;
+
+        while(cap < 2*(e - b))
+            cap *= 2;
+        slots = (size_t*)calloc(cap, sizeof(size_t));
+
+        for(j = b ; j < e ; ++j) {
+            const size_t k = idx[j];
+            const unsigned x = xs[k*stride], y = ys[k*stride];
+            size_t s = (size_t)(heatmap_coalesce_hash(x, y) >> 20) & (cap - 1);
+
+            if(slots) {
+                while(slots[s] && (xys[2*(slots[s]-1)] != x || xys[2*(slots[s]-1)+1] != y))
+                    s = (s + 1) & (cap - 1);
+                if(slots[s]) {
+                    cws[slots[s]-1] += ws ? ws[k] : 1.0f;
+                    continue;
+                }
+                slots[s] = u + 1;
+            }
+            xys[2*u] = x;
+            xys[2*u+1] = y;
+            cws[u] = ws ? ws[k] : 1.0f;
+            ++u;
+        }
+
+        nunique[p] = u - b;
+        free(slots);
+    }
+
+    /* Close the gaps between the parts. */
+    total = 0;
+    for(p = 0 ; p < HEATMAP_COALESCE_PARTS ; ++p) {
+        if(partstart[p] != total) {
+            memmove(xys + 2*total, xys + 2*partstart[p], 2*nunique[p]*sizeof(unsigned));
+            memmove(cws + total, cws + partstart[p], nunique[p]*sizeof(float));
+        }
+        total += nunique[p];
+    }
+
+    free(counts);
+    free(idx);
+    return total;
+}
+
+size_t heatmap_add_points_coalesced(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const size_t chunk = n < HEATMAP_COALESCE_CHUNK ? n : HEATMAP_COALESCE_CHUNK;
+    unsigned* xys = (unsigned*)malloc((chunk ? chunk : 1)*2*sizeof(unsigned));
+    float* cws = (float*)malloc((chunk ? chunk : 1)*sizeof(float));
+    size_t i, stamped = 0;
+
+    if(!xys || !cws) {
+        free(xys);
+        free(cws);
+        heatmap_add_points_parallel(h, xs, ys, ws, n, stride, stamp, nthreads);
+        return n;
+    }
+
+    for(i = 0 ; i < n ; i += chunk) {
+        const size_t m = n - i < chunk ? n - i : chunk;
+        const size_t u = heatmap_coalesce_points(xs + i*stride, ys + i*stride, ws ? ws + i : 0, m, stride, xys, cws, nthreads);
+        heatmap_add_points_parallel(h, xys, xys + 1, cws, u, 2, stamp, nthreads);
+        stamped += u;
+    }
+
+    free(xys);
+    free(cws);
+    return stamped;
+}
+
+void heatmap_add_points_sharded(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const unsigned nth = heatmap_nthreads(nthreads);
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    heatmap_t* shards = 0;
+    const heatmap_t** ptrs = 0;
+    unsigned* sx = 0;
+    unsigned* sy = 0;
+    int c, ok = 1;
+
+    if(nth > 1 && n >= nth) {
+        shards = (heatmap_t*)calloc(nth, sizeof(heatmap_t));
+        ptrs = (const heatmap_t**)malloc(nth*sizeof(heatmap_t*));
+        sx = (unsigned*)malloc(nth*sizeof(unsigned));
+        sy = (unsigned*)malloc(nth*sizeof(unsigned));
+    }
+
+    /* Nothing to parallelize, or no memory to do it with. */
+    if(!shards || !ptrs || !sx || !sy) {
+        free(shards);
+        free(ptrs);
+        free(sx);
+        free(sy);
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+        return;
+    }
+
+    /* First, every chunk of points gets a shard covering the bounding box of
+     * all its stamps, clipped to the map.
+     */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(c = 0 ; c < (int)nth ; ++c) {
+        unsigned minx = h->w, miny = h->h, maxx = 0, maxy = 0;
+        size_t i;
+
+        for(i = n*c/nth ; i < n*(c+1)/nth ; ++i) {
+            const unsigned x = xs[i*stride], y = ys[i*stride];
+            if(x < h->w && y < h->h) {
+                if(x < minx) {minx = x;}
+                if(x > maxx) {maxx = x;}
+                if(y < miny) {miny = y;}
+                if(y > maxy) {maxy = y;}
+            }
+        }
+
+        if(minx <= maxx && miny <= maxy) {
+            const unsigned x0 = minx > sw2 ? minx - sw2 : 0;
+            const unsigned y0 = miny > sh2 ? miny - sh2 : 0;
+            const unsigned x1 = maxx + (stamp->w - sw2) < h->w ? maxx + (stamp->w - sw2) : h->w;
+            const unsigned y1 = maxy + (stamp->h - sh2) < h->h ? maxy + (stamp->h - sh2) : h->h;
+            shards[c].w = x1 - x0;
+            shards[c].h = y1 - y0;
+            /* Fixed-point shards keep the sum exact, however it's split up. */
+            shards[c].storage = h->ibuf ? HEATMAP_FIXED : HEATMAP_FLOAT32;
+            heatmap_alloc_heat(&shards[c]);
+            sx[c] = x0;
+            sy[c] = y0;
+        } else {
+            sx[c] = sy[c] = 0;
+        }
+
+        /* The shards' max is never looked at. */
+        shards[c].lazy_max = 1;
+        ptrs[c] = &shards[c];
+    }
+
+    for(c = 0 ; c < (int)nth ; ++c) {
+        if(shards[c].w*shards[c].h > 0 && !shards[c].buf && !shards[c].ibuf) {ok = 0;}
+    }
+
+    /* Then, every thread adds its chunk onto its own shard, in batches of
+     * points translated into the shard's coordinates.
+     */
+    if(ok) {
+#pragma omp parallel for schedule(static) num_threads(nth)
+        for(c = 0 ; c < (int)nth ; ++c) {
+            unsigned tx[HEATMAP_BATCH_CHUNK], ty[HEATMAP_BATCH_CHUNK];
+            const size_t end = n*(c+1)/nth;
+            size_t i0;
+
+            for(i0 = n*c/nth ; i0 < end ; i0 += HEATMAP_BATCH_CHUNK) {
+                const size_t i1 = end - i0 < HEATMAP_BATCH_CHUNK ? end : i0 + HEATMAP_BATCH_CHUNK;
+                size_t i;
+
+                for(i = i0 ; i < i1 ; ++i) {
+                    const unsigned x = xs[i*stride], y = ys[i*stride];
+                    /* Points outside of the map must stay outside of the shard. */
+                    const int in = (x < h->w) & (y < h->h);
+                    tx[i - i0] = in ? x - sx[c] : (unsigned)-1;
+                    ty[i - i0] = in ? y - sy[c] : (unsigned)-1;
+                }
+
+                heatmap_add_weighted_points_with_stamp(&shards[c], tx, ty, ws ? ws + i0 : 0, i1 - i0, 1, stamp);
+            }
+        }
+
+        heatmap_merge_shards(h, ptrs, sx, sy, nth, nth);
+    }
+
+    for(c = 0 ; c < (int)nth ; ++c) {
+        heatmap_free_heat(&shards[c]);
+    }
+    free(shards);
+    free(ptrs);
+    free(sx);
+    free(sy);
+
+    if(!ok) {
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+    }
+}
+
+/* Convolution works on bands of that many rows of the map at once. */
+#define HEATMAP_CONVOLVE_ROWS 16
+
+/* Finds the [first, last] non-zero value of every row of the W x H `grid`,
+ * first being W for rows which are all zeros.
+ */
+static void heatmap_row_extents(const float* grid, unsigned W, unsigned H, unsigned* rowmin, unsigned* rowmax, unsigned nth)
+{
+    int y;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(y = 0 ; y < (int)H ; ++y) {
+        const float* row = grid + (size_t)y*W;
+        unsigned x0 = 0, x1 = W;
+        while(x0 < W && row[x0] == 0.0f) {++x0;}
+        while(x1 > x0 && row[x1-1] == 0.0f) {--x1;}
+        rowmin[y] = x0;
+        rowmax[y] = x1 ? x1 - 1 : 0;
+    }
+}
+
+/* Finds the [x0, x1] x [y0, y1] bounding box of all non-zero values of the
+ * W x H `grid`. Returns 1 if there are any, 0 if there are none, and -1 if
+ * there's not enough memory.
+ */
+static int heatmap_counts_bbox(const float* grid, unsigned W, unsigned H, unsigned* x0, unsigned* x1, unsigned* y0, unsigned* y1, unsigned nth)
+{
+    unsigned* rowmin = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    unsigned* rowmax = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    int found = 0;
+    unsigned y;
+
+    if(!rowmin || !rowmax) {
+        free(rowmin);
+        free(rowmax);
+        return -1;
+    }
+
+    heatmap_row_extents(grid, W, H, rowmin, rowmax, nth);
+    for(y = 0 ; y < H ; ++y) {
+        if(rowmin[y] >= W)
+            continue;
+        if(!found) {
+            *x0 = rowmin[y];
+            *x1 = rowmax[y];
+            *y0 = y;
+            found = 1;
+        }
+        *y1 = y;
+        if(rowmin[y] < *x0) {*x0 = rowmin[y];}
+        if(rowmax[y] > *x1) {*x1 = rowmax[y];}
+    }
+
+    free(rowmin);
+    free(rowmax);
+    return found;
+}
+
+/* Counts how many points (or how much weight) are on every pixel of the
+ * zeroed, row-major `counts`.
+ */
+static void heatmap_count_points(heatmap_t* counts, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride)
+{
+    size_t i;
+
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned x = xs[i*stride], y = ys[i*stride];
+        if(x < counts->w && y < counts->h) {
+            counts->buf[(size_t)y*counts->w + x] += ws ? ws[i] : 1.0f;
+        }
+    }
+}
+
+int heatmap_convolve(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned nbands = (H + HEATMAP_CONVOLVE_ROWS - 1)/HEATMAP_CONVOLVE_ROWS;
+    unsigned nth = heatmap_nthreads(nthreads);
+    float* grid = 0;
+    unsigned* rowmin = 0; /* The [first, last] non-zero count of every row, */
+    unsigned* rowmax = 0; /* rowmin being W for rows without any counts. */
+    float* scratch = 0;
+    float* bandmax = 0;
+    int b;
+
+    if(counts->w != W || counts->h != H)
+        return 0;
+
+    /* The rows of the counts need to be contiguous. */
+    grid = counts->tiled || counts->storage != HEATMAP_FLOAT32 || counts->decay != 0.0f ? heatmap_to_rowmajor(counts, 0) : counts->buf;
+    rowmin = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    rowmax = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    bandmax = (float*)malloc((nbands ? nbands : 1)*sizeof(float));
+    scratch = (float*)malloc((size_t)nth*HEATMAP_CONVOLVE_ROWS*W*sizeof(float));
+    if(!scratch) {
+        nth = 1;
+        scratch = (float*)malloc((size_t)HEATMAP_CONVOLVE_ROWS*W*sizeof(float));
+    }
+    if(!grid || !rowmin || !rowmax || !bandmax || !scratch) {
+        if(grid != counts->buf) {free(grid);}
+        free(rowmin);
+        free(rowmax);
+        free(bandmax);
+        free(scratch);
+        return 0;
+    }
+
+    heatmap_row_extents(grid, W, H, rowmin, rowmax, nth);
+
+    /* Every band of the map's rows is worked on by one thread, which
+     * gathers the band's heat from all the counts within the stamp's reach
+     * into its scratch rows, and then adds those onto the map. Thus, just
+     * like in `heatmap_add_points_parallel`, no two threads ever write the
+     * same pixel.
+     */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        const heatmap_kernels_t* k = heatmap_get_kernels();
+        float* out = scratch + (size_t)heatmap_thread_num()*HEATMAP_CONVOLVE_ROWS*W;
+        const unsigned lo = b*HEATMAP_CONVOLVE_ROWS;
+        const unsigned hi = lo + HEATMAP_CONVOLVE_ROWS < H ? lo + HEATMAP_CONVOLVE_ROWS : H;
+        heatmap_t part = *h;
+        unsigned oy;
+
+        for(oy = lo ; oy < hi ; ++oy) {
+            float* outline = out + (size_t)(oy - lo)*W;
+            unsigned o0 = W, o1 = 0; /* [first, last) heated columns of the row. */
+            unsigned sy;
+
+            /* The stamp's row sy of a point in row gy lands on row gy + sy - sh2. */
+            for(sy = 0 ; sy < stamp->h ; ++sy) {
+                const unsigned gy = oy + sh2 - sy;
+                unsigned sx;
+
+                if(oy + sh2 < sy || gy >= H || rowmin[gy] >= W)
+                    continue;
+
+                /* And its column sx of a point in column gx on column gx + sx - sw2. */
+                for(sx = 0 ; sx < stamp->w ; ++sx) {
+                    const float v = stamp->buf[sy*stamp->w + sx];
+                    const unsigned x0 = rowmin[gy] + sx > sw2 ? rowmin[gy] + sx - sw2 : 0;
+                    const unsigned x1 = rowmax[gy] + sx - sw2 < W ? rowmax[gy] + sx - sw2 + 1 : W;
+
+                    if(v == 0.0f || rowmax[gy] + sx < sw2 || x0 >= x1)
+                        continue;
+
+                    if(o1 == 0) {
+                        memset(outline, 0, W*sizeof(float));
+                    }
+                    if(x0 < o0) {o0 = x0;}
+                    if(x1 > o1) {o1 = x1;}
+
+                    k->wrow(outline + x0, grid + (size_t)gy*W + (x0 + sw2 - sx), x1 - x0, v);
+                }
+            }
+
+            /* Only the heated part of the row is added, such that a sparse
+             * map doesn't get tiles full of zeros.
+             */
+            if(o0 < o1) {
+                heatmap_add_block(&part, o0, oy, outline + o0, W, o1 - o0, 1, 0);
+            }
+        }
+
+        bandmax[b] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, 1);
+
+    if(grid != counts->buf) {free(grid);}
+    free(rowmin);
+    free(rowmax);
+    free(bandmax);
+    free(scratch);
+    return 1;
+}
+
+void heatmap_add_points_convolved(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    heatmap_t counts;
+
+    heatmap_init(&counts, h->w, h->h);
+
+    /* First, just count how many points (or how much weight) are on every pixel. */
+    if(counts.buf) {
+        heatmap_count_points(&counts, xs, ys, ws, n, stride);
+    }
+
+    /* No memory for the counts or the convolution, do it the slow way. */
+    if(!counts.buf || !heatmap_convolve(h, &counts, stamp, nthreads)) {
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+    }
+
+    free(counts.buf);
+}
+
+int heatmap_convolve_separable(heatmap_t* h, const heatmap_t* counts, const heatmap_sepstamp_t* stamp, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned rx = stamp->w/2, ry = stamp->h/2;
+    const unsigned nbands = (H + HEATMAP_CONVOLVE_ROWS - 1)/HEATMAP_CONVOLVE_ROWS;
+    unsigned nth = heatmap_nthreads(nthreads);
+    float* grid = 0;
+    float* rows = 0;      /* The counts convolved with the stamp's row only. */
+    unsigned* rowmin = 0; /* The [first, last] non-zero value of every row, */
+    unsigned* rowmax = 0; /* rowmin being W for rows without any. */
+    float* scratch = 0;
+    float* bandmax = 0;
+    int b;
+
+    if(counts->w != W || counts->h != H)
+        return 0;
+
+    grid = counts->tiled || counts->storage != HEATMAP_FLOAT32 || counts->decay != 0.0f ? heatmap_to_rowmajor(counts, 0) : counts->buf;
+    rows = (float*)malloc((size_t)W*H*sizeof(float));
+    rowmin = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    rowmax = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    bandmax = (float*)malloc((nbands ? nbands : 1)*sizeof(float));
+    scratch = (float*)malloc((size_t)nth*W*sizeof(float));
+    if(!grid || !rows || !rowmin || !rowmax || !bandmax || !scratch) {
+        if(grid != counts->buf) {free(grid);}
+        free(rows);
+        free(rowmin);
+        free(rowmax);
+        free(bandmax);
+        free(scratch);
+        return 0;
+    }
+
+    heatmap_row_extents(grid, W, H, rowmin, rowmax, nth);
+
+    /* First pass: every row of counts is convolved with the stamp's row `kx`
+     * on its own. The extents then become those of the resulting rows.
+     */
+#pragma omp parallel for schedule(dynamic, 16) num_threads(nth)
+    for(b = 0 ; b < (int)H ; ++b) {
+        const heatmap_kernels_t* k = heatmap_get_kernels();
+        const float* src = grid + (size_t)b*W;
+        float* dst = rows + (size_t)b*W;
+        const unsigned c0 = rowmin[b], c1 = rowmax[b];
+        unsigned sx;
+
+        if(c0 >= W)
+            continue;
+
+        rowmin[b] = c0 > rx ? c0 - rx : 0;
+        rowmax[b] = c1 + rx < W ? c1 + rx : W - 1;
+        memset(dst + rowmin[b], 0, (rowmax[b] - rowmin[b] + 1)*sizeof(float));
+
+        /* The stamp's column sx of a count in column gx lands on column gx + sx - rx. */
+        for(sx = 0 ; sx < stamp->w ; ++sx) {
+            const unsigned x0 = c0 + sx > rx ? c0 + sx - rx : 0;
+            const unsigned x1 = c1 + sx - rx < W ? c1 + sx - rx + 1 : W;
+
+            if(stamp->kx[sx] == 0.0f || c1 + sx < rx || x0 >= x1)
+                continue;
+
+            k->wrow(dst + x0, src + (x0 + rx - sx), x1 - x0, stamp->kx[sx]);
+        }
+    }
+
+    /* Second pass: every band of the map's rows is worked on by one thread,
+     * which sums up the rows of the first pass within the stamp's reach,
+     * weighted by the stamp's column `ky`, and adds that onto the map.
+     */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        const heatmap_kernels_t* k = heatmap_get_kernels();
+        float* outline = scratch + (size_t)heatmap_thread_num()*W;
+        const unsigned lo = b*HEATMAP_CONVOLVE_ROWS;
+        const unsigned hi = lo + HEATMAP_CONVOLVE_ROWS < H ? lo + HEATMAP_CONVOLVE_ROWS : H;
+        heatmap_t part = *h;
+        unsigned oy;
+
+        for(oy = lo ; oy < hi ; ++oy) {
+            unsigned o0 = W, o1 = 0; /* [first, last) heated columns of the row. */
+            unsigned sy;
+
+            for(sy = 0 ; sy < stamp->h ; ++sy) {
+                const unsigned gy = oy + ry - sy;
+
+                if(oy + ry < sy || gy >= H || rowmin[gy] >= W || stamp->ky[sy] == 0.0f)
+                    continue;
+
+                if(o1 == 0) {
+                    memset(outline, 0, W*sizeof(float));
+                }
+                if(rowmin[gy] < o0) {o0 = rowmin[gy];}
+                if(rowmax[gy] + 1 > o1) {o1 = rowmax[gy] + 1;}
+
+                k->wrow(outline + rowmin[gy], rows + (size_t)gy*W + rowmin[gy], rowmax[gy] - rowmin[gy] + 1, stamp->ky[sy]);
+            }
+
+            if(o0 < o1) {
+                heatmap_add_block(&part, o0, oy, outline + o0, W, o1 - o0, 1, 0);
+            }
+        }
+
+        bandmax[b] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, 1);
+
+    if(grid != counts->buf) {free(grid);}
+    free(rows);
+    free(rowmin);
+    free(rowmax);
+    free(bandmax);
+    free(scratch);
+    return 1;
+}
+
+void heatmap_add_points_separable(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_sepstamp_t* stamp, unsigned nthreads)
+{
+    heatmap_t counts;
+
+    heatmap_init(&counts, h->w, h->h);
+    if(counts.buf) {
+        heatmap_count_points(&counts, xs, ys, ws, n, stride);
+    }
+
+    /* No memory for the two passes, stamp the points one by one. */
+    if(!counts.buf || !heatmap_convolve_separable(h, &counts, stamp, nthreads)) {
+        heatmap_stamp_t* dense = heatmap_sepstamp_to_stamp(stamp);
+        if(dense) {
+            heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, dense);
+            heatmap_stamp_free(dense);
+        }
+    }
+
+    free(counts.buf);
+}
+
+/* The FFT engine works on blocks of at least that many pixels per side. */
+#define HEATMAP_FFT_MIN_BLOCK 256
+
+#define HEATMAP_PI 3.14159265358979323846
+
+/* A radix-2 complex FFT of size n, a power of two. Complex numbers are
+ * stored as interleaved pairs of doubles, which keeps the rounding noise
+ * far below what a float heatmap can see.
+ */
+typedef struct {
+    unsigned n;
+    unsigned* rev; /* The bit-reversed index of every index. */
+    double* tw;    /* cos and sin of -2*pi*i/n for every i in [0, n/2). */
+} heatmap_fft_t;
+
+static int heatmap_fft_init(heatmap_fft_t* f, unsigned n)
+{
+    unsigned i, bits = 0;
+
+    f->n = n;
+    f->rev = (unsigned*)malloc(n*sizeof(unsigned));
+    f->tw = (double*)malloc(n*sizeof(double));
+    if(!f->rev || !f->tw)
+        return 0;
+
+    while((1u << bits) < n) {++bits;}
+    for(i = 0 ; i < n ; ++i) {
+        unsigned b, r = 0;
+        for(b = 0 ; b < bits ; ++b) {
+            if(i & (1u << b)) {r |= 1u << (bits - 1 - b);}
+        }
+        f->rev[i] = r;
+    }
+
+    for(i = 0 ; i < n/2 ; ++i) {
+        const double a = -2.0*HEATMAP_PI*(double)i/(double)n;
+        f->tw[2*i] = cos(a);
+        f->tw[2*i+1] = sin(a);
+    }
+
+    return 1;
+}
+
+static void heatmap_fft_free(heatmap_fft_t* f)
+{
+    free(f->rev);
+    free(f->tw);
+}
+
+/* Transforms the n complex numbers in z in-place. The inverse transform
+ * isn't divided by n.
+ */
+static void heatmap_fft(const heatmap_fft_t* f, double* z, int inverse)
+{
+    const unsigned n = f->n;
+    const double sign = inverse ? -1.0 : 1.0;
+    unsigned i, len;
+
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned r = f->rev[i];
+        if(r > i) {
+            const double re = z[2*i], im = z[2*i+1];
+            z[2*i] = z[2*r];
+            z[2*i+1] = z[2*r+1];
+            z[2*r] = re;
+            z[2*r+1] = im;
+        }
+    }
+
+    for(len = 2 ; len <= n ; len <<= 1) {
+        const unsigned half = len/2, step = n/len;
+        unsigned s, j;
+
+        for(s = 0 ; s < n ; s += len) {
+            for(j = 0 ; j < half ; ++j) {
+                const double wr = f->tw[2*j*step], wi = sign*f->tw[2*j*step+1];
+                double* a = z + 2*(s + j);
+                double* b = z + 2*(s + j + half);
+                const double tr = b[0]*wr - b[1]*wi, ti = b[0]*wi + b[1]*wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+/* The FFT size needed along one side of a map of size `mapd` for a stamp of
+ * size `sd`: a block plus the stamp's overhang, rounded up to a power of two.
+ */
+static unsigned heatmap_fft_size(unsigned sd, unsigned mapd)
+{
+    unsigned b = sd > HEATMAP_FFT_MIN_BLOCK ? sd : HEATMAP_FFT_MIN_BLOCK;
+    unsigned n = 2;
+
+    if(b > mapd) {b = mapd ? mapd : 1;}
+    while(n < b + sd - 1) {n <<= 1;}
+    return n;
+}
+
+/* Transforms the `rows` x `cols` real values at `src` (`srcw` apart), padded
+ * with zeros to fx->n x fy->n, along the rows only, into `spec`. Of every
+ * row, only the fx->n/2+1 first frequencies are kept, the others being their
+ * conjugates. `spec` is stored column-major, that is frequency k of row r
+ * is at `spec + 2*(k*fy->n + r)`, and has to be zeroed.
+ *
+ * Two real rows a and b are transformed at once as the complex row a + ib.
+ * Rows r for which `rowmin[r] > x1 || rowmax[r] < x0` are known to be zeros,
+ * unless rowmin is NULL.
+ */
+static void heatmap_fft_rows(const heatmap_fft_t* fx, const heatmap_fft_t* fy, double* spec, const float* src, unsigned srcw, unsigned cols, unsigned rows, const unsigned* rowmin, const unsigned* rowmax, unsigned x0, unsigned x1, double* scratch, unsigned nth)
+{
+    const unsigned nx = fx->n, ny = fy->n;
+    int p;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(dynamic, 4) num_threads(nth)
+    for(p = 0 ; p < (int)(rows + 1)/2 ; ++p) {
+        double* z = scratch + (size_t)heatmap_thread_num()*2*nx;
+        const unsigned a = 2*p, b = 2*p + 1;
+        const int ua = !rowmin || (rowmin[a] <= x1 && rowmax[a] >= x0);
+        const int ub = b < rows && (!rowmin || (rowmin[b] <= x1 && rowmax[b] >= x0));
+        unsigned i, k;
+
+        if(!ua && !ub)
+            continue;
+
+        memset(z, 0, 2*nx*sizeof(double));
+        for(i = 0 ; i < cols ; ++i) {
+            if(ua) {z[2*i] = src[(size_t)a*srcw + i];}
+            if(ub) {z[2*i+1] = src[(size_t)b*srcw + i];}
+        }
+
+        heatmap_fft(fx, z, 0);
+
+        /* A[k] = (Z[k] + conj(Z[n-k]))/2 and B[k] = (Z[k] - conj(Z[n-k]))/2i. */
+        for(k = 0 ; k <= nx/2 ; ++k) {
+            const double* zk = z + 2*k;
+            const double* zc = z + 2*((nx - k) % nx);
+            double* sa = spec + 2*((size_t)k*ny + a);
+            double* sb = spec + 2*((size_t)k*ny + b);
+            sa[0] = 0.5*(zk[0] + zc[0]);
+            sa[1] = 0.5*(zk[1] - zc[1]);
+            sb[0] = 0.5*(zk[1] + zc[1]);
+            sb[1] = -0.5*(zk[0] - zc[0]);
+        }
+    }
+}
+
+int heatmap_convolve_fft(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned sw2 = stamp->w/2, sh2 = stamp->h/2;
+    const unsigned nx = heatmap_fft_size(stamp->w, W), ny = heatmap_fft_size(stamp->h, H);
+    const unsigned bw = nx - stamp->w + 1, bh = ny - stamp->h + 1;
+    const unsigned nk = nx/2 + 1;
+    const size_t speclen = 2*(size_t)nk*ny;
+    const unsigned nth = heatmap_nthreads(nthreads);
+    heatmap_fft_t fx = {0, 0, 0}, fy = {0, 0, 0};
+    float* grid = 0;
+    unsigned* rowmin = 0; /* The [first, last] non-zero count of every row, */
+    unsigned* rowmax = 0; /* rowmin being W for rows without any counts. */
+    double* sspec = 0;    /* The stamp's spectrum. */
+    double* spec = 0;     /* The current block's spectrum. */
+    double* scratch = 0;  /* One complex row per thread. */
+    float* outline = 0;   /* One float row per thread. */
+    unsigned char* reach = 0; /* Whether counts reach a row of the current block's result. */
+    float* tmax = 0;
+    unsigned bx, by, t;
+    int k, ok;
+
+    if(counts->w != W || counts->h != H)
+        return 0;
+
+    grid = counts->tiled || counts->storage != HEATMAP_FLOAT32 || counts->decay != 0.0f ? heatmap_to_rowmajor(counts, 0) : counts->buf;
+    rowmin = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    rowmax = (unsigned*)malloc((H ? H : 1)*sizeof(unsigned));
+    sspec = (double*)malloc(speclen*sizeof(double));
+    spec = (double*)malloc(speclen*sizeof(double));
+    scratch = (double*)malloc((size_t)nth*2*nx*sizeof(double));
+    outline = (float*)malloc((size_t)nth*nx*sizeof(float));
+    reach = (unsigned char*)malloc(ny);
+    tmax = (float*)malloc(nth*sizeof(float));
+    ok = heatmap_fft_init(&fx, nx) && heatmap_fft_init(&fy, ny);
+    if(!ok || !grid || !rowmin || !rowmax || !sspec || !spec || !scratch || !outline || !reach || !tmax) {
+        if(grid != counts->buf) {free(grid);}
+        heatmap_fft_free(&fx);
+        heatmap_fft_free(&fy);
+        free(rowmin);
+        free(rowmax);
+        free(sspec);
+        free(spec);
+        free(scratch);
+        free(outline);
+        free(reach);
+        free(tmax);
+        return 0;
+    }
+
+    heatmap_row_extents(grid, W, H, rowmin, rowmax, nth);
+    for(t = 0 ; t < nth ; ++t) {
+        tmax[t] = h->max;
+    }
+
+    /* The stamp's spectrum, already divided by the inverse transform's size. */
+    memset(sspec, 0, speclen*sizeof(double));
+    heatmap_fft_rows(&fx, &fy, sspec, stamp->buf, stamp->w, stamp->w, stamp->h, 0, 0, 0, 0, scratch, nth);
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(k = 0 ; k < (int)nk ; ++k) {
+        double* col = sspec + 2*(size_t)k*ny;
+        unsigned i;
+
+        heatmap_fft(&fy, col, 0);
+        for(i = 0 ; i < 2*ny ; ++i) {
+            col[i] /= (double)nx*(double)ny;
+        }
+    }
+
+    /* Overlap-add: the map is cut into blocks of bw x bh counts, the FFTs of
+     * which are big enough to hold their whole convolution with the stamp,
+     * overhang included. That overhang gets added onto the neighbouring
+     * blocks' pixels, which is why the blocks are done one after the other,
+     * each one using all threads. Blocks without counts are skipped.
+     */
+    for(by = 0 ; by < H ; by += bh) {
+        const unsigned rows = H - by < bh ? H - by : bh;
+
+        for(bx = 0 ; bx < W ; bx += bw) {
+            const unsigned cols = W - bx < bw ? W - bx : bw;
+            const unsigned x1 = bx + cols - 1;
+            const unsigned outrows = rows + stamp->h - 1;
+            unsigned c0 = W, c1 = 0; /* [first, last] column of counts within the block. */
+            unsigned i0, i1, r, used = 0;
+            int p;
+
+            /* Result row j is within the stamp's reach of count rows [j-h+1, j]. */
+            memset(reach, 0, ny);
+            for(r = 0 ; r < rows ; ++r) {
+                const unsigned gy = by + r;
+                if(rowmin[gy] > x1 || rowmax[gy] < bx)
+                    continue;
+                if(rowmin[gy] < c0) {c0 = rowmin[gy] > bx ? rowmin[gy] : bx;}
+                if(rowmax[gy] > c1) {c1 = rowmax[gy] < x1 ? rowmax[gy] : x1;}
+                memset(reach + r, 1, stamp->h);
+                ++used;
+            }
+            if(!used)
+                continue;
+
+            /* The result's columns [i0, i1) land on the map's columns [i0 + bx - sw2, i1 + bx - sw2). */
+            i0 = c0 < sw2 ? sw2 - bx : c0 - bx;
+            i1 = c1 + stamp->w < W + sw2 ? c1 - bx + stamp->w : W + sw2 - bx;
+            if(i0 >= i1)
+                continue;
+
+            memset(spec, 0, speclen*sizeof(double));
+            heatmap_fft_rows(&fx, &fy, spec, grid + (size_t)by*W + bx, W, cols, rows, rowmin + by, rowmax + by, bx, x1, scratch, nth);
+
+#pragma omp parallel for schedule(static) num_threads(nth)
+            for(k = 0 ; k < (int)nk ; ++k) {
+                double* col = spec + 2*(size_t)k*ny;
+                const double* scol = sspec + 2*(size_t)k*ny;
+                unsigned i;
+
+                heatmap_fft(&fy, col, 0);
+                for(i = 0 ; i < ny ; ++i) {
+                    const double re = col[2*i]*scol[2*i] - col[2*i+1]*scol[2*i+1];
+                    const double im = col[2*i]*scol[2*i+1] + col[2*i+1]*scol[2*i];
+                    col[2*i] = re;
+                    col[2*i+1] = im;
+                }
+                heatmap_fft(&fy, col, 1);
+            }
+
+            /* Back along the rows, two at a time again, and onto the map.
+             * The rows of a block's result are all different rows of the
+             * map, so no two threads ever write the same pixel.
+             */
+#pragma omp parallel for schedule(dynamic, 4) num_threads(nth)
+            for(p = 0 ; p < (int)(outrows + 1)/2 ; ++p) {
+                const unsigned tid = heatmap_thread_num();
+                double* z = scratch + (size_t)tid*2*nx;
+                float* line = outline + (size_t)tid*nx;
+                const unsigned j0 = 2*(unsigned)p;
+                heatmap_t part = *h;
+                unsigned j, i, kk;
+
+                if(!reach[j0] && (j0 + 1 >= outrows || !reach[j0 + 1]))
+                    continue;
+
+                /* Z[k] = A[k] + iB[k], using A[n-k] = conj(A[k]) for the upper half. */
+                for(kk = 0 ; kk < nx ; ++kk) {
+                    const unsigned kc = kk < nk ? kk : nx - kk;
+                    const double cj = kk < nk ? 1.0 : -1.0;
+                    const double* sa = spec + 2*((size_t)kc*ny + j0);
+                    const double* sb = spec + 2*((size_t)kc*ny + j0 + 1);
+                    z[2*kk] = sa[0] - cj*sb[1];
+                    z[2*kk+1] = cj*sa[1] + sb[0];
+                }
+                heatmap_fft(&fx, z, 1);
+
+                part.max = tmax[tid];
+                for(j = j0 ; j < j0 + 2 && j < outrows ; ++j) {
+                    const unsigned oy = by + j;
+
+                    if(!reach[j] || oy < sh2 || oy - sh2 >= H)
+                        continue;
+
+                    /* Round-off leaves pixels the stamp never reaches at about
+                     * -1e-16 instead of 0, but heat can't be negative.
+                     */
+                    for(i = i0 ; i < i1 ; ++i) {
+                        const double v = z[2*i + (j & 1)];
+                        line[i] = v > 0.0 ? (float)v : 0.0f;
+                    }
+                    heatmap_add_block(&part, i0 + bx - sw2, oy - sh2, line + i0, nx, i1 - i0, 1, 0);
+                }
+                tmax[tid] = part.max;
+            }
+        }
+    }
+
+    heatmap_reduce_bandmax(h, tmax, nth, 1);
+
+    if(grid != counts->buf) {free(grid);}
+    heatmap_fft_free(&fx);
+    heatmap_fft_free(&fy);
+    free(rowmin);
+    free(rowmax);
+    free(sspec);
+    free(spec);
+    free(scratch);
+    free(outline);
+    free(reach);
+    free(tmax);
+    return 1;
+}
+
+void heatmap_add_points_fft(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    heatmap_t counts;
+
+    heatmap_init(&counts, h->w, h->h);
+    if(counts.buf) {
+        heatmap_count_points(&counts, xs, ys, ws, n, stride);
+    }
+
+    /* No memory for the counts or the spectra, do it the slow way. */
+    if(!counts.buf || !heatmap_convolve_fft(h, &counts, stamp, nthreads)) {
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+    }
+
+    free(counts.buf);
+}
+
+/* The most box blurs `heatmap_convolve_boxes` does along each axis. */
+#define HEATMAP_BOX_MAX_PASSES 16
+/* The vertical box blurs work on strips of that many columns per thread. */
+#define HEATMAP_BOX_STRIP 256
+
+/* The size of a box blur of the given variance. A box of radius r has a
+ * variance of r(r+1)/3, so that only allows for some variances. Extended box
+ * blurs fix that by also weighting the pixels right outside of the box by
+ * `alpha` in [0, 1), see "Theoretical Foundations of Gaussian Convolution by
+ * Extended Box Filtering" by Gwosdek et al.
+ */
+static void heatmap_box_size(double var, unsigned* r, double* alpha)
+{
+    const double rr = floor((sqrt(12.0*var + 1.0) - 1.0)/2.0);
+    const double w = 2.0*rr + 1.0;
+
+    *r = (unsigned)rr;
+    *alpha = w*(rr*(rr + 1.0)/3.0 - var)/(2.0*(var - (rr + 1.0)*(rr + 1.0)));
+    if(*alpha < 0.0) {*alpha = 0.0;}
+}
+
+/* Box-blurs every row of the `gw` x `gh` grid `in` into `out`. */
+static void heatmap_box_rows(const float* in, float* out, unsigned gw, unsigned gh, unsigned r, double alpha, unsigned nth)
+{
+    const double inv = 1.0/(2.0*r + 1.0 + 2.0*alpha);
+    int y;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(y = 0 ; y < (int)gh ; ++y) {
+        const float* src = in + (size_t)y*gw;
+        float* dst = out + (size_t)y*gw;
+        double acc = 0.0; /* The sum of src[i-r .. i+r]. */
+        unsigned i;
+
+        for(i = 0 ; i < r && i < gw ; ++i) {
+            acc += src[i];
+        }
+        for(i = 0 ; i < gw ; ++i) {
+            const double left = i > r ? src[i - r - 1] : 0.0;
+            const double right = i + r + 1 < gw ? src[i + r + 1] : 0.0;
+            if(i + r < gw) {acc += src[i + r];}
+            dst[i] = (float)((acc + alpha*(left + right))*inv);
+            if(i >= r) {acc -= src[i - r];}
+        }
+    }
+}
+
+/* Box-blurs every column of the `gw` x `gh` grid `in` into `out`, keeping a
+ * running sum of a whole strip of columns such that all accesses are along
+ * the rows. `acc` has room for HEATMAP_BOX_STRIP doubles per thread.
+ */
+static void heatmap_box_cols(const float* in, float* out, unsigned gw, unsigned gh, unsigned r, double alpha, double* acc, unsigned nth)
+{
+    const double inv = 1.0/(2.0*r + 1.0 + 2.0*alpha);
+    const unsigned nstrips = (gw + HEATMAP_BOX_STRIP - 1)/HEATMAP_BOX_STRIP;
+    int s;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(s = 0 ; s < (int)nstrips ; ++s) {
+        double* a = acc + (size_t)heatmap_thread_num()*HEATMAP_BOX_STRIP;
+        const unsigned x0 = s*HEATMAP_BOX_STRIP;
+        const unsigned n = gw - x0 < HEATMAP_BOX_STRIP ? gw - x0 : HEATMAP_BOX_STRIP;
+        unsigned x, y;
+
+        memset(a, 0, n*sizeof(double));
+        for(y = 0 ; y < r && y < gh ; ++y) {
+            const float* src = in + (size_t)y*gw + x0;
+            for(x = 0 ; x < n ; ++x) {a[x] += src[x];}
+        }
+        for(y = 0 ; y < gh ; ++y) {
+            const float* above = y > r ? in + (size_t)(y - r - 1)*gw + x0 : 0;
+            const float* below = y + r + 1 < gh ? in + (size_t)(y + r + 1)*gw + x0 : 0;
+            float* dst = out + (size_t)y*gw + x0;
+
+            if(y + r < gh) {
+                const float* src = in + (size_t)(y + r)*gw + x0;
+                for(x = 0 ; x < n ; ++x) {a[x] += src[x];}
+            }
+            for(x = 0 ; x < n ; ++x) {
+                const double ends = (above ? above[x] : 0.0) + (below ? below[x] : 0.0);
+                dst[x] = (float)((a[x] + alpha*ends)*inv);
+            }
+            if(y >= r) {
+                const float* src = in + (size_t)(y - r)*gw + x0;
+                for(x = 0 ; x < n ; ++x) {a[x] -= src[x];}
+            }
+        }
+    }
+}
+
+int heatmap_convolve_boxes(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned passes, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned nth = heatmap_nthreads(nthreads);
+    unsigned boxx, boxy, rx, ry, gw, gh, cx0 = 0, cx1 = 0, cy0 = 0, cy1 = 0;
+    double mass = 0.0, varx = 0.0, vary = 0.0, alphax, alphay;
+    float weight;
+    float* grid = 0;
+    float* a = 0;
+    float* b = 0;
+    double* acc = 0;
+    float* bandmax = 0;
+    unsigned x, y, i, nbands;
+    int band, found;
+
+    if(counts->w != W || counts->h != H)
+        return 0;
+
+    /* The Gaussian standing in for the stamp has the same heat and spread. */
+    for(y = 0 ; y < stamp->h ; ++y) {
+        for(x = 0 ; x < stamp->w ; ++x) {
+            const double v = stamp->buf[y*stamp->w + x];
+            const double dx = (double)x - (double)(stamp->w/2), dy = (double)y - (double)(stamp->h/2);
+            mass += v;
+            varx += v*dx*dx;
+            vary += v*dy*dy;
+        }
+    }
+    if(mass <= 0.0)
+        return 0;
+
+    if(passes == 0) {passes = 3;}
+    if(passes > HEATMAP_BOX_MAX_PASSES) {passes = HEATMAP_BOX_MAX_PASSES;}
+    /* Variances add up, so every pass does its share of the blurring. */
+    heatmap_box_size(varx/mass/passes, &boxx, &alphax);
+    heatmap_box_size(vary/mass/passes, &boxy, &alphay);
+    rx = passes*(boxx + 1);
+    ry = passes*(boxy + 1);
+    weight = (float)mass;
+
+    /* Only the counts' bounding box, grown by how far the boxes reach
+     * altogether, is blurred. Since nothing reaches out of it, what's outside
+     * the map is blurred too and no heat is wrongly reflected at the borders.
+     */
+    grid = counts->tiled || counts->storage != HEATMAP_FLOAT32 || counts->decay != 0.0f ? heatmap_to_rowmajor(counts, 0) : counts->buf;
+    found = grid ? heatmap_counts_bbox(grid, W, H, &cx0, &cx1, &cy0, &cy1, nth) : -1;
+    if(found <= 0) {
+        if(grid != counts->buf) {free(grid);}
+        return found == 0;
+    }
+
+    gw = cx1 - cx0 + 1 + 2*rx;
+    gh = cy1 - cy0 + 1 + 2*ry;
+    nbands = (gh + HEATMAP_CONVOLVE_ROWS - 1)/HEATMAP_CONVOLVE_ROWS;
+    a = (float*)calloc((size_t)gw*gh, sizeof(float));
+    b = (float*)malloc((size_t)gw*gh*sizeof(float));
+    acc = (double*)malloc((size_t)nth*HEATMAP_BOX_STRIP*sizeof(double));
+    bandmax = (float*)malloc(nbands*sizeof(float));
+    if(!a || !b || !acc || !bandmax) {
+        if(grid != counts->buf) {free(grid);}
+        free(a);
+        free(b);
+        free(acc);
+        free(bandmax);
+        return 0;
+    }
+
+    for(y = cy0 ; y <= cy1 ; ++y) {
+        memcpy(a + (size_t)(y - cy0 + ry)*gw + rx, grid + (size_t)y*W + cx0, (cx1 - cx0 + 1)*sizeof(float));
+    }
+    if(grid != counts->buf) {free(grid);}
+
+    for(i = 0 ; i < passes ; ++i) {
+        heatmap_box_rows(a, b, gw, gh, boxx, alphax, nth);
+        heatmap_box_cols(b, a, gw, gh, boxy, alphay, acc, nth);
+    }
+
+    /* Grid pixel (gx, gy) is the map's pixel (gx + cx0 - rx, gy + cy0 - ry). */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(band = 0 ; band < (int)nbands ; ++band) {
+        const unsigned lo = band*HEATMAP_CONVOLVE_ROWS;
+        const unsigned hi = lo + HEATMAP_CONVOLVE_ROWS < gh ? lo + HEATMAP_CONVOLVE_ROWS : gh;
+        const unsigned g0 = cx0 < rx ? rx - cx0 : 0;
+        const unsigned g1 = cx1 + 1 + rx <= W ? gw : W + rx - cx0;
+        heatmap_t part = *h;
+        unsigned gy;
+
+        for(gy = lo ; gy < hi ; ++gy) {
+            if(gy + cy0 < ry || gy + cy0 - ry >= H)
+                continue;
+            heatmap_add_block(&part, g0 + cx0 - rx, gy + cy0 - ry, a + (size_t)gy*gw + g0, gw, g1 - g0, 1, &weight);
+        }
+
+        bandmax[band] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, 1);
+
+    free(a);
+    free(b);
+    free(acc);
+    free(bandmax);
+    return 1;
+}
+
+void heatmap_add_points_boxes(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned passes, unsigned nthreads)
+{
+    heatmap_t counts;
+
+    heatmap_init(&counts, h->w, h->h);
+    if(counts.buf) {
+        heatmap_count_points(&counts, xs, ys, ws, n, stride);
+    }
+
+    /* No memory for the blurring, or a weird stamp: stamp exactly. */
+    if(!counts.buf || !heatmap_convolve_boxes(h, &counts, stamp, passes, nthreads)) {
+        heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+    }
+
+    free(counts.buf);
+}
+
+/* Below that sigma, the recursive filter isn't accurate anymore, and a
+ * separable stamp is cheap anyways.
+ */
+#define HEATMAP_IIR_MIN_SIGMA 1.0f
+/* How many sigmas the recursive filter's grid reaches beyond the counts. */
+#define HEATMAP_IIR_REACH 5.0f
+
+/* The recursive filter works on strips of that many columns per thread. */
+#define HEATMAP_IIR_STRIP 16
+
+/* Deriche's fourth-order approximation of the Gaussian, from "Recursively
+ * implementing the Gaussian and its derivatives" (1993):
+ *   exp(-x²/2σ²) ≈ Σ Re(alpha_k * exp(-lambda_k*x/σ)) for x >= 0,
+ * which turns into two complex first-order recursions, one per term, running
+ * forwards for the right half and backwards for the left half. Everything is
+ * scaled such that the whole discrete filter sums up to one.
+ */
+typedef struct {
+    double ar[2], ai[2]; /* alpha_k, scaled. */
+    double pr[2], pi[2]; /* exp(-lambda_k/σ), the poles. */
+} heatmap_iir_t;
+
+static void heatmap_iir_init(heatmap_iir_t* c, double sigma)
+{
+    static const double a[2] = {1.680, -0.6803}, b[2] = {3.735, -0.2598};
+    static const double decay[2] = {1.783, 1.723}, freq[2] = {0.6318, 1.997};
+    double sum = 0.0;
+    int k;
+
+    for(k = 0 ; k < 2 ; ++k) {
+        const double m = exp(-decay[k]/sigma);
+        double dr, di, nr, ni, d;
+
+        c->ar[k] = a[k];
+        c->ai[k] = -b[k];
+        c->pr[k] = m*cos(freq[k]/sigma);
+        c->pi[k] = m*sin(freq[k]/sigma);
+
+        /* Both halves sum up to Re(alpha*(1 + p)/(1 - p)), the center being in the right one. */
+        nr = c->ar[k]*(1.0 + c->pr[k]) - c->ai[k]*c->pi[k];
+        ni = c->ai[k]*(1.0 + c->pr[k]) + c->ar[k]*c->pi[k];
+        dr = 1.0 - c->pr[k];
+        di = -c->pi[k];
+        d = dr*dr + di*di;
+        sum += (nr*dr + ni*di)/d;
+    }
+
+    for(k = 0 ; k < 2 ; ++k) {
+        c->ar[k] /= sum;
+        c->ai[k] /= sum;
+    }
+}
+
+/* Filters the `n` values in `in` (`instride` apart) into `out` (`outstride`
+ * apart), for `lanes` independent signals next to each other. `state` has
+ * room for 2*lanes doubles.
+ */
+static void heatmap_iir_filter(const double* in, size_t instride, double* out, size_t outstride, unsigned n, unsigned lanes, const heatmap_iir_t* c, double* state)
+{
+    double* sr = state;
+    double* si = state + lanes;
+    unsigned i, l;
+    int k;
+
+    for(i = 0 ; i < n ; ++i) {
+        for(l = 0 ; l < lanes ; ++l) {out[i*outstride + l] = 0.0;}
+    }
+
+    for(k = 0 ; k < 2 ; ++k) {
+        const double ar = c->ar[k], ai = c->ai[k], pr = c->pr[k], pi = c->pi[k];
+
+        /* Forwards: s[i] = alpha*in[i] + p*s[i-1], center included. */
+        memset(state, 0, 2*lanes*sizeof(double));
+        for(i = 0 ; i < n ; ++i) {
+            const double* x = in + i*instride;
+            double* y = out + i*outstride;
+            for(l = 0 ; l < lanes ; ++l) {
+                const double r = ar*x[l] + pr*sr[l] - pi*si[l];
+                si[l] = ai*x[l] + pr*si[l] + pi*sr[l];
+                sr[l] = r;
+                y[l] += r;
+            }
+        }
+
+        /* Backwards: s[i] = p*(alpha*in[i+1] + s[i+1]), center excluded. */
+        memset(state, 0, 2*lanes*sizeof(double));
+        for(i = n ; i-- > 0 ; ) {
+            const double* x = in + i*instride;
+            double* y = out + i*outstride;
+            for(l = 0 ; l < lanes ; ++l) {
+                y[l] += sr[l];
+            }
+            for(l = 0 ; l < lanes ; ++l) {
+                const double tr = ar*x[l] + sr[l], ti = ai*x[l] + si[l];
+                sr[l] = pr*tr - pi*ti;
+                si[l] = pr*ti + pi*tr;
+            }
+        }
+    }
+}
+
+/* Filters every row of the `gw` x `gh` grid in-place. The recursion runs
+ * along the row, so rows are done one by one, in parallel.
+ */
+static void heatmap_iir_rows(double* grid, unsigned gw, unsigned gh, const heatmap_iir_t* c, double* scratch, unsigned nth)
+{
+    int y;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(y = 0 ; y < (int)gh ; ++y) {
+        double* row = grid + (size_t)y*gw;
+        double* copy = scratch + (size_t)heatmap_thread_num()*(gw + 2);
+        memcpy(copy, row, gw*sizeof(double));
+        heatmap_iir_filter(copy, 1, row, 1, gw, 1, c, copy + gw);
+    }
+}
+
+/* Filters every column of the `gw` x `gh` grid in-place. The recursion runs
+ * from row to row, each step working on a strip of neighbouring columns at
+ * once, which vectorizes and only reads whole cache lines.
+ */
+static void heatmap_iir_cols(double* grid, unsigned gw, unsigned gh, const heatmap_iir_t* c, double* scratch, unsigned nth)
+{
+    const unsigned nstrips = (gw + HEATMAP_IIR_STRIP - 1)/HEATMAP_IIR_STRIP;
+    int s;
+
+    (void)nth; /* Unused without OpenMP. */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(s = 0 ; s < (int)nstrips ; ++s) {
+        const unsigned x0 = s*HEATMAP_IIR_STRIP;
+        const unsigned n = gw - x0 < HEATMAP_IIR_STRIP ? gw - x0 : HEATMAP_IIR_STRIP;
+        double* strip = scratch + (size_t)heatmap_thread_num()*((size_t)gh + 2)*HEATMAP_IIR_STRIP;
+        unsigned y;
+
+        for(y = 0 ; y < gh ; ++y) {
+            memcpy(strip + (size_t)y*n, grid + (size_t)y*gw + x0, n*sizeof(double));
+        }
+        heatmap_iir_filter(strip, n, grid + x0, gw, gh, n, c, strip + (size_t)gh*n);
+    }
+}
+
+int heatmap_convolve_gaussian(heatmap_t* h, const heatmap_t* counts, float sigma, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned nth = heatmap_nthreads(nthreads);
+    const unsigned reach = (unsigned)ceilf(HEATMAP_IIR_REACH*sigma);
+    /* The filter keeps the total heat, a Gaussian stamp is 1 at its center. */
+    const float weight = (float)(2.0*HEATMAP_PI*sigma*sigma);
+    unsigned cx0 = 0, cx1 = 0, cy0 = 0, cy1 = 0, gw, gh, nbands, y;
+    heatmap_iir_t c;
+    float* grid = 0;
+    double* g = 0;
+    double* scratch = 0;
+    float* lines = 0;
+    float* bandmax = 0;
+    int band, found;
+
+    if(counts->w != W || counts->h != H)
+        return 0;
+
+    if(sigma < HEATMAP_IIR_MIN_SIGMA) {
+        heatmap_sepstamp_t* stamp = heatmap_sepstamp_gen_gaussian(sigma, HEATMAP_IIR_REACH);
+        const int ok = stamp && heatmap_convolve_separable(h, counts, stamp, nthreads);
+        if(stamp) {heatmap_sepstamp_free(stamp);}
+        return ok;
+    }
+
+    /* Just like with the box blurs, only the counts' bounding box grown by
+     * the Gaussian's reach is filtered, with zeros all around it.
+     */
+    grid = counts->tiled || counts->storage != HEATMAP_FLOAT32 || counts->decay != 0.0f ? heatmap_to_rowmajor(counts, 0) : counts->buf;
+    found = grid ? heatmap_counts_bbox(grid, W, H, &cx0, &cx1, &cy0, &cy1, nth) : -1;
+    if(found <= 0) {
+        if(grid != counts->buf) {free(grid);}
+        return found == 0;
+    }
+
+    gw = cx1 - cx0 + 1 + 2*reach;
+    gh = cy1 - cy0 + 1 + 2*reach;
+    nbands = (gh + HEATMAP_CONVOLVE_ROWS - 1)/HEATMAP_CONVOLVE_ROWS;
+    g = (double*)calloc((size_t)gw*gh, sizeof(double));
+    scratch = (double*)malloc((size_t)nth*((gw > gh ? gw : gh) + 2)*HEATMAP_IIR_STRIP*sizeof(double));
+    lines = (float*)malloc((size_t)nth*gw*sizeof(float));
+    bandmax = (float*)malloc(nbands*sizeof(float));
+    if(!g || !scratch || !lines || !bandmax) {
+        if(grid != counts->buf) {free(grid);}
+        free(g);
+        free(scratch);
+        free(lines);
+        free(bandmax);
+        return 0;
+    }
+
+    for(y = cy0 ; y <= cy1 ; ++y) {
+        const float* src = grid + (size_t)y*W + cx0;
+        double* dst = g + (size_t)(y - cy0 + reach)*gw + reach;
+        unsigned x;
+        for(x = 0 ; x <= cx1 - cx0 ; ++x) {dst[x] = src[x];}
+    }
+    if(grid != counts->buf) {free(grid);}
+
+    heatmap_iir_init(&c, sigma);
+    heatmap_iir_rows(g, gw, gh, &c, scratch, nth);
+    heatmap_iir_cols(g, gw, gh, &c, scratch, nth);
+
+    /* Grid pixel (gx, gy) is the map's pixel (gx + cx0 - reach, gy + cy0 - reach). */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(band = 0 ; band < (int)nbands ; ++band) {
+        float* line = lines + (size_t)heatmap_thread_num()*gw;
+        const unsigned lo = band*HEATMAP_CONVOLVE_ROWS;
+        const unsigned hi = lo + HEATMAP_CONVOLVE_ROWS < gh ? lo + HEATMAP_CONVOLVE_ROWS : gh;
+        const unsigned g0 = cx0 < reach ? reach - cx0 : 0;
+        const unsigned g1 = cx1 + 1 + reach <= W ? gw : W + reach - cx0;
+        heatmap_t part = *h;
+        unsigned gy, gx;
+
+        for(gy = lo ; gy < hi ; ++gy) {
+            const double* src = g + (size_t)gy*gw;
+
+            if(gy + cy0 < reach || gy + cy0 - reach >= H)
+                continue;
+
+            /* The filter's ringing dips slightly below zero away from the
+             * points, but heat can't be negative.
+             */
+            for(gx = g0 ; gx < g1 ; ++gx) {line[gx] = src[gx] > 0.0 ? (float)src[gx] : 0.0f;}
+            heatmap_add_block(&part, g0 + cx0 - reach, gy + cy0 - reach, line + g0, gw, g1 - g0, 1, &weight);
+        }
+
+        bandmax[band] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, 1);
+
+    free(g);
+    free(scratch);
+    free(lines);
+    free(bandmax);
+    return 1;
+}
+
+void heatmap_add_points_gaussian(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, float sigma, unsigned nthreads)
+{
+    heatmap_t counts;
+
+    heatmap_init(&counts, h->w, h->h);
+    if(counts.buf) {
+        heatmap_count_points(&counts, xs, ys, ws, n, stride);
+    }
+
+    /* No memory for filtering, stamp the points one by one. */
+    if(!counts.buf || !heatmap_convolve_gaussian(h, &counts, sigma, nthreads)) {
+        heatmap_sepstamp_t* sep = heatmap_sepstamp_gen_gaussian(sigma, HEATMAP_IIR_REACH);
+        heatmap_stamp_t* stamp = sep ? heatmap_sepstamp_to_stamp(sep) : 0;
+        if(stamp) {
+            heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+            heatmap_stamp_free(stamp);
+        }
+        if(sep) {heatmap_sepstamp_free(sep);}
+    }
+
+    free(counts.buf);
+}
+
+void heatmap_add_points_diff(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_diffstamp_t* stamp, unsigned nthreads)
+{
+    const unsigned W = h->w, H = h->h;
+    const unsigned nth = heatmap_nthreads(nthreads);
+    /* Differences left of or above the map still count once summed up, those
+     * right of or below it don't. Thus, the grid starts where a stamp on the
+     * map's top-left pixel does and ends with the map.
+     */
+    const unsigned px = stamp->w/2, py = stamp->h/2;
+    const unsigned gw = W + px, gh = H + py;
+    const unsigned nstrips = (gw + HEATMAP_BOX_STRIP - 1)/HEATMAP_BOX_STRIP;
+    const unsigned nbands = (H + HEATMAP_CONVOLVE_ROWS - 1)/HEATMAP_CONVOLVE_ROWS;
+    double* g = (double*)calloc((size_t)gw*gh, sizeof(double));
+    float* lines = (float*)malloc((size_t)nth*(W ? W : 1)*sizeof(float));
+    float* bandmax = (float*)malloc((nbands ? nbands : 1)*sizeof(float));
+    double* stripmax = (double*)malloc((nstrips ? nstrips : 1)*sizeof(double));
+    double tol = 0.0;
+    size_t i;
+    int b;
+
+    if(!g || !lines || !bandmax || !stripmax) {
+        heatmap_stamp_t* dense = heatmap_diffstamp_to_stamp(stamp);
+        free(g);
+        free(lines);
+        free(bandmax);
+        free(stripmax);
+        if(dense) {
+            heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, dense);
+            heatmap_stamp_free(dense);
+        }
+        return;
+    }
+
+    /* Every point only adds nx*ny differences, whatever the stamp's size.
+     * Point (x, y) lands on the grid's (x + xoff, y + yoff).
+     */
+    for(i = 0 ; i < n ; ++i) {
+        const unsigned x = xs[i*stride], y = ys[i*stride];
+        const double w = ws ? ws[i] : 1.0;
+        unsigned ix, iy;
+
+        if(x >= W || y >= H)
+            continue;
+
+        for(iy = 0 ; iy < stamp->ny ; ++iy) {
+            const unsigned gy = y + stamp->yoff[iy];
+            const double wy = w*stamp->ydiff[iy];
+            double* row = g + (size_t)gy*gw + x;
+
+            if(gy >= gh)
+                continue;
+
+            for(ix = 0 ; ix < stamp->nx && x + stamp->xoff[ix] < gw ; ++ix) {
+                row[stamp->xoff[ix]] += wy*stamp->xdiff[ix];
+            }
+        }
+    }
+
+    /* Summing the differences up along the rows, ox times... */
+#pragma omp parallel for schedule(static) num_threads(nth)
+    for(b = 0 ; b < (int)gh ; ++b) {
+        double* row = g + (size_t)b*gw;
+        unsigned o, x;
+        for(o = 0 ; o < stamp->ox ; ++o) {
+            for(x = 1 ; x < gw ; ++x) {row[x] += row[x-1];}
+        }
+    }
+
+    /* ...and then along the columns, oy times, a strip of columns at once. */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(b = 0 ; b < (int)nstrips ; ++b) {
+        const unsigned x0 = b*HEATMAP_BOX_STRIP;
+        const unsigned ns = gw - x0 < HEATMAP_BOX_STRIP ? gw - x0 : HEATMAP_BOX_STRIP;
+        double m = 0.0;
+        unsigned o, x, y;
+
+        for(o = 0 ; o < stamp->oy ; ++o) {
+            for(y = 1 ; y < gh ; ++y) {
+                double* row = g + (size_t)y*gw + x0;
+                const double* above = row - gw;
+                for(x = 0 ; x < ns ; ++x) {row[x] += above[x];}
+            }
+        }
+        for(y = py ; y < gh ; ++y) {
+            const double* row = g + (size_t)y*gw + x0;
+            for(x = 0 ; x < ns ; ++x) {
+                if(fabs(row[x]) > m) {m = fabs(row[x]);}
+            }
+        }
+        stripmax[b] = m;
+    }
+
+    /* Heat cancels out right and below every stamp up to some rounding,
+     * which mustn't fill a sparse map with tiles of almost-zeros.
+     */
+    for(b = 0 ; b < (int)nstrips ; ++b) {
+        if(stripmax[b] > tol) {tol = stripmax[b];}
+    }
+    tol *= 1e-9;
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nth)
+    for(b = 0 ; b < (int)nbands ; ++b) {
+        float* line = lines + (size_t)heatmap_thread_num()*W;
+        const unsigned lo = b*HEATMAP_CONVOLVE_ROWS;
+        const unsigned hi = lo + HEATMAP_CONVOLVE_ROWS < H ? lo + HEATMAP_CONVOLVE_ROWS : H;
+        heatmap_t part = *h;
+        unsigned y, x0, x1, x;
+
+        for(y = lo ; y < hi ; ++y) {
+            const double* row = g + (size_t)(y + py)*gw + px;
+
+            for(x0 = 0 ; x0 < W && fabs(row[x0]) <= tol ; ++x0) {}
+            for(x1 = W ; x1 > x0 && fabs(row[x1-1]) <= tol ; --x1) {}
+            if(x0 >= x1)
+                continue;
+
+            for(x = x0 ; x < x1 ; ++x) {line[x] = (float)row[x];}
+            heatmap_add_block(&part, x0, y, line + x0, W, x1 - x0, 1, 0);
+        }
+
+        bandmax[b] = part.max;
+    }
+
+    heatmap_reduce_bandmax(h, bandmax, nbands, 1);
+
+    free(g);
+    free(lines);
+    free(bandmax);
+    free(stripmax);
+}
+
+/* The planner's cost model, see `heatmap_calibrate`; all zeros until then.
+ * It's only ever copied as a whole while holding the lock, so that a plan
+ * never sees half of an old model and half of a new one.
+ */
+static heatmap_costs_t heatmap_costs;
+static int heatmap_costs_lock = 0;
+
+/* Whether the cost model is set, so that the first plans calibrate only once. */
+enum { HEATMAP_COSTS_UNSET, HEATMAP_COSTS_CALIBRATING, HEATMAP_COSTS_SET };
+static int heatmap_costs_state = HEATMAP_COSTS_UNSET;
+
+/* Wall-clock seconds since some point in the past. */
+static double heatmap_seconds(void)
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* Lets other threads run for a millisecond, without spinning on the CPU. */
+static void heatmap_nap(void)
+{
+#ifdef _WIN32
+    Sleep(1);
+#else
+    struct timespec ts = { 0, 1000000 };
+    nanosleep(&ts, 0);
+#endif
+}
+
+/* Finds out whether the stamp is the product of a row and a column, up to
+ * float rounding, by dividing it by its row and column through its hottest
+ * pixel. Returns them if it is, NULL if it isn't or there's no memory.
+ */
+static heatmap_sepstamp_t* heatmap_stamp_separate(const heatmap_stamp_t* stamp)
+{
+    const unsigned w = stamp->w, h = stamp->h;
+    heatmap_sepstamp_t* sep;
+    float m = 0.0f;
+    unsigned x, y, mx = 0, my = 0;
+
+    for(y = 0 ; y < h ; ++y) {
+        for(x = 0 ; x < w ; ++x) {
+            if(fabsf(stamp->buf[y*w + x]) > m) {
+                m = fabsf(stamp->buf[y*w + x]);
+                mx = x;
+                my = y;
+            }
+        }
+    }
+    if(m == 0.0f)
+        return 0;
+
+    sep = (heatmap_sepstamp_t*)calloc(1, sizeof(heatmap_sepstamp_t));
+    if(!sep)
+        return 0;
+    sep->w = w;
+    sep->h = h;
+    sep->kx = (float*)malloc(sizeof(float)*w);
+    sep->ky = (float*)malloc(sizeof(float)*h);
+    if(!sep->kx || !sep->ky) {
+        heatmap_sepstamp_free(sep);
+        return 0;
+    }
+
+    memcpy(sep->kx, stamp->buf + my*w, sizeof(float)*w);
+    for(y = 0 ; y < h ; ++y) {
+        sep->ky[y] = stamp->buf[y*w + mx]/stamp->buf[my*w + mx];
+    }
+    for(y = 0 ; y < h ; ++y) {
+        for(x = 0 ; x < w ; ++x) {
+            if(fabsf(stamp->buf[y*w + x] - sep->kx[x]*sep->ky[y]) > 1e-5f*m) {
+                heatmap_sepstamp_free(sep);
+                return 0;
+            }
+        }
+    }
+    return sep;
+}
+
+/* Estimates the seconds every engine takes for adding `n` points onto a
+ * W x H map, negative for those which can't be used. The map-wide work of
+ * the convolutions is spread over all threads, the counting isn't. Few
+ * points only heat part of the map, which the convolutions make use of.
+ */
+static void heatmap_plan_costs(const heatmap_costs_t* c, unsigned W, unsigned H, size_t n, const heatmap_stamp_t* stamp, const heatmap_sepstamp_t* sep, const heatmap_diffstamp_t* diff, unsigned nth, double* costs)
+{
+    const double area = (double)stamp->w*stamp->h;
+    const double pixels = (double)W*H;
+    const double heated = (double)n*area < pixels ? (double)n*area : pixels;
+    /* Direct convolution goes along the rows with counts, from their first to
+     * their last count, which is most of the row once there are a few.
+     */
+    const double rows = (double)n < (double)H ? (double)n : (double)H;
+    const double span = (double)n > (double)H ? (double)W : 1.0;
+    const unsigned nx = heatmap_fft_size(stamp->w, W), ny = heatmap_fft_size(stamp->h, H);
+    const unsigned bw = nx - stamp->w + 1, bh = ny - stamp->h + 1;
+    double blocks = (double)((W + bw - 1)/bw)*((H + bh - 1)/bh);
+
+    if(blocks > (double)n) {blocks = (double)n;}
+
+    costs[HEATMAP_ENGINE_STAMP] = (double)n*(c->stamp_point + area*c->stamp)/nth;
+    costs[HEATMAP_ENGINE_CONVOLVED] = (double)n*c->point + pixels*c->convolve_pixel + rows*span*area*c->convolve/nth;
+    costs[HEATMAP_ENGINE_FFT] = (double)n*c->point + blocks*nx*ny*log2((double)nx*ny)*c->fft/nth;
+    costs[HEATMAP_ENGINE_SEPARABLE] = sep ? (double)n*c->point + pixels*c->separable_pixel + heated*(stamp->w + stamp->h)*c->separable/nth : -1.0;
+    costs[HEATMAP_ENGINE_DIFF] = diff ? (double)n*diff->nx*diff->ny*c->diff_point + pixels*(c->diff_pixel + (diff->ox + diff->oy)*c->diff/nth) : -1.0;
+}
+
+/* Adds the points using the engine `e`, which must be usable with the stamp. */
+static void heatmap_run_engine(heatmap_engine_t e, heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, const heatmap_sepstamp_t* sep, const heatmap_diffstamp_t* diff, unsigned nthreads)
+{
+    switch(e) {
+    case HEATMAP_ENGINE_CONVOLVED:
+        heatmap_add_points_convolved(h, xs, ys, ws, n, stride, stamp, nthreads);
+        break;
+    case HEATMAP_ENGINE_SEPARABLE:
+        heatmap_add_points_separable(h, xs, ys, ws, n, stride, sep, nthreads);
+        break;
+    case HEATMAP_ENGINE_FFT:
+        heatmap_add_points_fft(h, xs, ys, ws, n, stride, stamp, nthreads);
+        break;
+    case HEATMAP_ENGINE_DIFF:
+        heatmap_add_points_diff(h, xs, ys, ws, n, stride, diff, nthreads);
+        break;
+    default:
+        if(heatmap_nthreads(nthreads) > 1) {
+            heatmap_add_points_parallel(h, xs, ys, ws, n, stride, stamp, nthreads);
+        } else {
+            heatmap_add_weighted_points_with_stamp(h, xs, ys, ws, n, stride, stamp);
+        }
+        break;
+    }
+}
+
+/* The seconds the fastest of two single-threaded runs of engine `e` takes
+ * for the n points `pts` onto the map `h`, which is zeroed before each run.
+ */
+static double heatmap_time_engine(heatmap_engine_t e, heatmap_t* h, const unsigned* pts, size_t n, const heatmap_stamp_t* stamp, const heatmap_sepstamp_t* sep, const heatmap_diffstamp_t* diff)
+{
+    double best = -1.0;
+    int i;
+
+    for(i = 0 ; i < 2 ; ++i) {
+        double t;
+
+        memset(h->buf, 0, (size_t)h->w*h->h*sizeof(float));
+        h->max = 0.0f;
+        t = heatmap_seconds();
+        heatmap_run_engine(e, h, pts, pts + 1, 0, n, 2, stamp, sep, diff, 1);
+        t = heatmap_seconds() - t;
+        if(best < 0.0 || t < best) {best = t;}
+    }
+    return best > 1e-9 ? best : 1e-9;
+}
+
+/* Calibration runs on a map that's a little too large for most caches. */
+#define HEATMAP_CALIBRATE_SIZE 1024
+#define HEATMAP_CALIBRATE_POINTS (1u << 18)
+
+/* Solves t1 = a + b*x1 and t2 = a + b*x2 for the fixed cost a and the cost b
+ * per unit of work x, neither of which can be negative, nor zero.
+ */
+static void heatmap_fit_costs(double t1, double x1, double t2, double x2, double* a, double* b)
+{
+    *b = (t2 - t1)/(x2 - x1);
+    if(*b < 1e-15) {*b = 1e-15;}
+    *a = t1 - x1*(*b);
+    if(*a < 1e-15) {*a = 1e-15;}
+}
+
+void heatmap_calibrate(void)
+{
+    const unsigned S = HEATMAP_CALIBRATE_SIZE;
+    const size_t N = HEATMAP_CALIBRATE_POINTS;
+    const double pixels = (double)S*S;
+    unsigned* pts = (unsigned*)malloc(2*N*sizeof(unsigned));
+    heatmap_t* h = heatmap_new(S, S);
+    heatmap_stamp_t* small = heatmap_stamp_gen(0);
+    heatmap_stamp_t* mid = heatmap_stamp_gen(8);
+    heatmap_stamp_t* big = heatmap_stamp_gen(16);
+    heatmap_sepstamp_t* thin = heatmap_sepstamp_gen_gaussian(1.0f, 3.0f);
+    heatmap_sepstamp_t* wide = heatmap_sepstamp_gen_gaussian(8.0f, 3.0f);
+    heatmap_diffstamp_t* box = heatmap_diffstamp_gen_box(3, 3);
+    heatmap_diffstamp_t* curved = heatmap_diffstamp_gen_poly(16, 2);
+    heatmap_costs_t c;
+    unsigned seed = 12345;
+    double t, t1, t2;
+    size_t i;
+    int k;
+
+    if(!pts || !h || !h->buf || !small || !mid || !big || !thin || !wide || !box || !curved) {
+        free(pts);
+        if(h) {heatmap_free(h);}
+        if(small) {heatmap_stamp_free(small);}
+        if(mid) {heatmap_stamp_free(mid);}
+        if(big) {heatmap_stamp_free(big);}
+        if(thin) {heatmap_sepstamp_free(thin);}
+        if(wide) {heatmap_sepstamp_free(wide);}
+        if(box) {heatmap_diffstamp_free(box);}
+        if(curved) {heatmap_diffstamp_free(curved);}
+        return;
+    }
+
+    /* Any cheap pseudo-random points will do. */
+    for(i = 0 ; i < 2*N ; ++i) {
+        seed = seed*1103515245u + 12345u;
+        pts[i] = (seed >> 8) % S;
+    }
+
+    for(k = 0, c.point = -1.0 ; k < 2 ; ++k) {
+        memset(h->buf, 0, (size_t)S*S*sizeof(float));
+        t = heatmap_seconds();
+        heatmap_count_points(h, pts, pts + 1, 0, N, 2);
+        t = heatmap_seconds() - t;
+        if(c.point < 0.0 || t < c.point) {c.point = t;}
+    }
+    c.point = (c.point > 1e-9 ? c.point : 1e-9)/N;
+
+    /* Every engine is run for two stamp sizes, which tells the fixed cost
+     * from that growing with the stamp. There are enough points for every
+     * row of the map to have counts all along.
+     */
+    t1 = heatmap_time_engine(HEATMAP_ENGINE_STAMP, h, pts, N, small, 0, 0)/N;
+    t2 = heatmap_time_engine(HEATMAP_ENGINE_STAMP, h, pts, N/16, big, 0, 0)/(N/16);
+    heatmap_fit_costs(t1, (double)small->w*small->h, t2, (double)big->w*big->h, &c.stamp_point, &c.stamp);
+
+    t1 = (heatmap_time_engine(HEATMAP_ENGINE_CONVOLVED, h, pts, N, small, 0, 0) - N*c.point)/pixels;
+    t2 = (heatmap_time_engine(HEATMAP_ENGINE_CONVOLVED, h, pts, N, mid, 0, 0) - N*c.point)/pixels;
+    heatmap_fit_costs(t1, (double)small->w*small->h, t2, (double)mid->w*mid->h, &c.convolve_pixel, &c.convolve);
+
+    t1 = (heatmap_time_engine(HEATMAP_ENGINE_SEPARABLE, h, pts, N, 0, thin, 0) - N*c.point)/pixels;
+    t2 = (heatmap_time_engine(HEATMAP_ENGINE_SEPARABLE, h, pts, N, 0, wide, 0) - N*c.point)/pixels;
+    heatmap_fit_costs(t1, (double)thin->w + thin->h, t2, (double)wide->w + wide->h, &c.separable_pixel, &c.separable);
+
+    {
+        const unsigned n = heatmap_fft_size(big->w, S);
+        const unsigned nb = (S + n - big->w)/(n - big->w + 1);
+        t = heatmap_time_engine(HEATMAP_ENGINE_FFT, h, pts, N, big, 0, 0) - N*c.point;
+        c.fft = (t > 0.0 ? t : 1e-9)/((double)nb*nb*n*n*log2((double)n*n));
+    }
+
+    /* A single point is all summing up, many points mostly adding differences. */
+    t1 = heatmap_time_engine(HEATMAP_ENGINE_DIFF, h, pts, 1, 0, 0, box)/pixels;
+    t2 = heatmap_time_engine(HEATMAP_ENGINE_DIFF, h, pts, 1, 0, 0, curved)/pixels;
+    heatmap_fit_costs(t1, (double)box->ox + box->oy, t2, (double)curved->ox + curved->oy, &c.diff_pixel, &c.diff);
+    t = heatmap_time_engine(HEATMAP_ENGINE_DIFF, h, pts, N, 0, 0, curved) - t2*pixels;
+    c.diff_point = (t > 0.0 ? t : 1e-9)/((double)N*curved->nx*curved->ny);
+
+    heatmap_set_costs(&c);
+
+    free(pts);
+    heatmap_free(h);
+    heatmap_stamp_free(small);
+    heatmap_stamp_free(mid);
+    heatmap_stamp_free(big);
+    heatmap_sepstamp_free(thin);
+    heatmap_sepstamp_free(wide);
+    heatmap_diffstamp_free(box);
+    heatmap_diffstamp_free(curved);
+}
+
+void heatmap_get_costs(heatmap_costs_t* costs)
+{
+    heatmap_lock(&heatmap_costs_lock);
+    *costs = heatmap_costs;
+    heatmap_unlock(&heatmap_costs_lock);
+}
+
+void heatmap_set_costs(const heatmap_costs_t* costs)
+{
+    heatmap_lock(&heatmap_costs_lock);
+    heatmap_costs = *costs;
+    heatmap_unlock(&heatmap_costs_lock);
+    heatmap_store_int(&heatmap_costs_state, HEATMAP_COSTS_SET);
+}
+
+/* Calibrates unless the cost model is set. Only the first of several threads
+ * getting here at once calibrates, the others nap until it's done instead of
+ * spinning, which would skew its timings.
+ */
+static void heatmap_calibrate_once(void)
+{
+    int state = heatmap_load_int(&heatmap_costs_state);
+
+    if(state == HEATMAP_COSTS_UNSET
+    && heatmap_cas_int(&heatmap_costs_state, HEATMAP_COSTS_UNSET, HEATMAP_COSTS_CALIBRATING)) {
+        heatmap_calibrate();
+        /* Without memory for calibrating, the model stays all zeros. */
+        heatmap_store_int(&heatmap_costs_state, HEATMAP_COSTS_SET);
+        return;
+    }
+    while(state != HEATMAP_COSTS_SET) {
+        heatmap_nap();
+        state = heatmap_load_int(&heatmap_costs_state);
+    }
+}
+
+heatmap_plan_t* heatmap_plan_new(const heatmap_t* h, size_t n, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    heatmap_plan_t* p = (heatmap_plan_t*)calloc(1, sizeof(heatmap_plan_t));
+    heatmap_costs_t costs;
+    int e;
 
-        for(iy = y0 ; iy < y1 ; ++iy) {
-            /* TODO: could it be clearer by using separate vars and computing a ystep? */
-            float* line = h->buf + ((y + iy) - stamp->h/2)*h->w + (x + x0) - stamp->w/2;
-            const float* stampline = stamp->buf + iy*stamp->w + x0;
+    if(!p)
+        return 0;
 
-            unsigned ix;
-            for(ix = x0 ; ix < x1 ; ++ix, ++line, ++stampline) {
-                /* TODO: Let's actually accept negatives and try out funky stamps. */
-                /* Note that that might mess with the max though. */
-                /* And that we'll have to clamp the bottom to 0 when rendering. */
-                assert(*stampline >= 0.0f);
+    heatmap_calibrate_once();
+    heatmap_get_costs(&costs);
 
-                *line += *stampline;
-                if(*line > h->max) {h->max = *line;}
+    p->nthreads = nthreads;
+    p->stamp = stamp;
+    p->sep = heatmap_stamp_separate(stamp);
+    if(p->sep) {
+        p->diff = heatmap_diffstamp_from_sepstamp(p->sep);
+    }
 
-                assert(*line >= 0.0f);
-            }
+    heatmap_plan_costs(&costs, h->w, h->h, n, stamp, p->sep, p->diff, heatmap_nthreads(nthreads), p->costs);
+    p->engine = HEATMAP_ENGINE_STAMP;
+    for(e = 0 ; e < HEATMAP_ENGINE_COUNT ; ++e) {
+        if(p->costs[e] >= 0.0 && p->costs[e] < p->costs[p->engine]) {
+            p->engine = (heatmap_engine_t)e;
         }
-    } /* I hate you very much! */
+    }
+
+    return p;
 }
 
-void heatmap_add_weighted_point(heatmap_t* h, unsigned x, unsigned y, float w)
+void heatmap_plan_run(const heatmap_plan_t* p, heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride)
 {
-    heatmap_add_weighted_point_with_stamp(h, x, y, w, &stamp_default_4);
+    heatmap_engine_t e = p->engine;
+
+    /* Someone picked an engine which can't use the stamp. */
+    if((e == HEATMAP_ENGINE_SEPARABLE && !p->sep) || (e == HEATMAP_ENGINE_DIFF && !p->diff))
+        e = HEATMAP_ENGINE_STAMP;
+
+    heatmap_run_engine(e, h, xs, ys, ws, n, stride, p->stamp, p->sep, p->diff, p->nthreads);
 }
 
-/* Initial timings do show a difference large enough (~10% slower without FMA)
- * that we do care about splitting the implementation,
- * even though JUST A SINGLE LINE OF CODE has changed!
- * And I don't want to spoil the readability by using macro-trickery to avoid duplication.
- * sad :-(
- */
-void heatmap_add_weighted_point_with_stamp(heatmap_t* h, unsigned x, unsigned y, float w, const heatmap_stamp_t* stamp)
+void heatmap_plan_free(heatmap_plan_t* p)
 {
-    /* I'm still unsure whether we want this to be an assert or not... */
-    if(x >= h->w || y >= h->h)
-        return;
+    if(p->sep) {heatmap_sepstamp_free(p->sep);}
+    if(p->diff) {heatmap_diffstamp_free(p->diff);}
+    free(p);
+}
 
-    /* Currently, negative weights are not supported as they mess with the max. */
-    assert(w >= 0.0f);
+const char* heatmap_engine_name(heatmap_engine_t engine)
+{
+    switch(engine) {
+    case HEATMAP_ENGINE_STAMP: return "stamp";
+    case HEATMAP_ENGINE_CONVOLVED: return "convolved";
+    case HEATMAP_ENGINE_SEPARABLE: return "separable";
+    case HEATMAP_ENGINE_FFT: return "fft";
+    case HEATMAP_ENGINE_DIFF: return "diff";
+    default: return "unknown";
+    }
+}
 
-    /* I hate you, C */
-    {
-        /* Note: the order of operations is important, since we're computing with unsigned! */
+void heatmap_add_points_auto(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads)
+{
+    heatmap_plan_t* p = heatmap_plan_new(h, n, stamp, nthreads);
 
-        /* These are [first, last) pairs in the STAMP's pixels. */
-        const unsigned x0 = x < stamp->w/2 ? (stamp->w/2 - x) : 0;
-        const unsigned y0 = y < stamp->h/2 ? (stamp->h/2 - y) : 0;
-        const unsigned x1 = (x + stamp->w/2) < h->w ? stamp->w : stamp->w/2 + (h->w - x);
-        const unsigned y1 = (y + stamp->h/2) < h->h ? stamp->h : stamp->h/2 + (h->h - y);
+    if(p) {
+        heatmap_plan_run(p, h, xs, ys, ws, n, stride);
+        heatmap_plan_free(p);
+    } else {
+        heatmap_run_engine(HEATMAP_ENGINE_STAMP, h, xs, ys, ws, n, stride, stamp, 0, 0, nthreads);
+    }
+}
 
-        unsigned iy;
+float heatmap_relative_error(const heatmap_t* approx, const heatmap_t* exact)
+{
+    float* a;
+    float* e;
+    float maxdiff = 0.0f, maxheat = 0.0f;
+    size_t i;
 
-        for(iy = y0 ; iy < y1 ; ++iy) {
-            /* TODO: could it be clearer by using separate vars and computing a ystep? */
-            float* line = h->buf + ((y + iy) - stamp->h/2)*h->w + (x + x0) - stamp->w/2;
-            const float* stampline = stamp->buf + iy*stamp->w + x0;
+    if(approx->w != exact->w || approx->h != exact->h)
+        return -1.0f;
 
-            unsigned ix;
-            for(ix = x0 ; ix < x1 ; ++ix, ++line, ++stampline) {
-                /* TODO: see unweighted function */
-                assert(*stampline >= 0.0f);
+    a = heatmap_to_rowmajor(approx, 0);
+    e = heatmap_to_rowmajor(exact, 0);
+    if(!a || !e) {
+        free(a);
+        free(e);
+        return -1.0f;
+    }
 
-                *line += *stampline * w;
-                if(*line > h->max) {h->max = *line;}
+    for(i = 0 ; i < (size_t)exact->w*exact->h ; ++i) {
+        const float d = fabsf(a[i] - e[i]);
+        if(d > maxdiff) {maxdiff = d;}
+        if(fabsf(e[i]) > maxheat) {maxheat = fabsf(e[i]);}
+    }
 
-                assert(*line >= 0.0f);
-            }
-        }
-    } /* I hate you very much! */
+    free(a);
+    free(e);
+    return maxheat > 0.0f ? maxdiff/maxheat : maxdiff;
 }
 
+/* Rendering with a saturation in the stored heat's units, see further down. */
+static unsigned char* heatmap_render_stored(const heatmap_t* h, const heatmap_colorscheme_t* colorscheme, float saturation, unsigned char* colorbuf);
+
 unsigned char* heatmap_render_default_to(const heatmap_t* h, unsigned char* colorbuf)
 {
     return heatmap_render_to(h, heatmap_cs_default, colorbuf);
@@ -178,12 +5873,45 @@ unsigned char* heatmap_render_to(const heatmap_t* h, const heatmap_colorscheme_t
      * In that case, we should set the saturation to anything but 0, since we want the result of the division to be 0.
      * Also, a comparison to exact 0.0f (as opposed to 1e-14) is OK, since we only do division.
      */
-    return heatmap_render_saturated_to(h, colorscheme, h->max > 0.0f ? h->max : 1.0f, colorbuf);
+    /* In lazy mode, the max may be out of date. We can't store the fresh one
+     * in the const heatmap, call `heatmap_get_max` beforehand to avoid
+     * computing it on every render.
+     */
+    const float max = h->max_dirty ? heatmap_compute_max(h) : h->max;
+    return heatmap_render_stored(h, colorscheme, max > 0.0f ? max : 1.0f, colorbuf);
 }
 
-unsigned char* heatmap_render_saturated_to(const heatmap_t* h, const heatmap_colorscheme_t* colorscheme, float saturation, unsigned char* colorbuf)
+/* Rendering is spread over threads in blocks of that many rows, which are
+ * handed out on demand, but only for maps with at least that many pixels.
+ */
+#define HEATMAP_RENDER_ROWS_PER_TASK 16
+#define HEATMAP_RENDER_PARALLEL_MIN (256*256)
+
+/* Fixed-point heat is mapped onto the colors by a fixed-point scale instead
+ * of a float division: (ncolors-1)/isat with as many fractional bits as fit,
+ * which is returned in `shift`. It's rounded up, so that heat exactly halfway
+ * between two colors gets the hotter one, like with floats.
+ */
+static unsigned long long heatmap_fixed_scale(size_t ncolors, unsigned isat, unsigned* shift)
 {
-    unsigned y;
+    size_t c;
+
+    *shift = 62;
+    for(c = ncolors - 1 ; c > 1 ; c >>= 1) {
+        --*shift;
+    }
+    return (((unsigned long long)(ncolors - 1) << *shift) + isat - 1)/isat;
+}
+
+/* `heatmap_render_saturated_to`, the saturation being in the units of the
+ * stored heat, which differ from the real heat's while decaying.
+ */
+static unsigned char* heatmap_render_stored(const heatmap_t* h, const heatmap_colorscheme_t* colorscheme, float saturation, unsigned char* colorbuf)
+{
+    const unsigned isat = heatmap_quantize(saturation) > 0 ? heatmap_quantize(saturation) : 1;
+    unsigned shift;
+    const unsigned long long iscale = heatmap_fixed_scale(colorscheme->ncolors, isat, &shift);
+    int y;
     assert(saturation > 0.0f);
 
     /* For convenience, if no buffer is given, malloc a new one. */
@@ -195,39 +5923,74 @@ unsigned char* heatmap_render_saturated_to(const heatmap_t* h, const heatmap_col
     }
 
     /* TODO: could actually even flatten this loop before parallelizing it. */
-    /* I.e., to go i = 0 ; i < h*w since I don't have any padding! (yet?) */
-    for(y = 0 ; y < h->h ; ++y) {
-        float* bufline = h->buf + y*h->w;
-        unsigned char* colorline = colorbuf + 4*y*h->w;
+    /* I.e., to go i = 0 ; i < h*w for row-major maps, which have no padding. */
+#pragma omp parallel for schedule(dynamic, HEATMAP_RENDER_ROWS_PER_TASK) if((size_t)h->w*h->h >= HEATMAP_RENDER_PARALLEL_MIN)
+    for(y = 0 ; y < (int)h->h ; ++y) {
+        /* Half-precision maps are converted in pieces which fit into `tmp`. */
+        const unsigned tw = h->hbuf && heatmap_tile_w(h) > HEATMAP_HALF_CHUNK ? HEATMAP_HALF_CHUNK : heatmap_tile_w(h);
+        unsigned char* colorline = colorbuf + 4*(size_t)y*h->w;
+        float tmp[HEATMAP_HALF_CHUNK];
+        unsigned x0;
 
-        unsigned x;
-        for(x = 0 ; x < h->w ; ++x, ++bufline) {
-            /* Saturate the heat value to the given saturation, and then
-             * normalize by that.
-             */
-            const float val = (*bufline > saturation ? saturation : *bufline)/saturation;
+        /* In tiled mode, a row of the map is spread over a row of tiles. */
+        for(x0 = 0 ; x0 < h->w ; x0 += tw) {
+            const unsigned x1 = h->w - x0 > tw ? x0 + tw : h->w;
+            const float* bufline = h->ibuf ? 0 : heatmap_read_pixels(h, x0, (unsigned)y, x1 - x0, tmp);
 
-            /* We add 0.5 in order to do real rounding, not just dropping the
-             * decimal part. That way we are certain the highest value in the
-             * colorscheme is actually used.
-             */
-            const size_t idx = (size_t)((float)(colorscheme->ncolors-1)*val + 0.5f);
+            unsigned x;
 
-            /* This is probably caused by a negative entry in the stamp! */
-            assert(val >= 0.0f);
+            if(h->ibuf) {
+                const unsigned* iline = heatmap_pixel32(h, x0, (unsigned)y);
+                for(x = x0 ; x < x1 ; ++x, ++iline, colorline += 4) {
+                    const unsigned v = *iline > isat ? isat : *iline;
+                    const size_t idx = (size_t)(((unsigned long long)v*iscale + (1ull << (shift - 1))) >> shift);
+                    assert(idx < colorscheme->ncolors);
+                    memcpy(colorline, colorscheme->colors + idx*4, 4);
+                }
+                continue;
+            }
+
+            /* A sparse map's untouched tile is all of the coldest color. */
+            if(!bufline) {
+                for(x = x0 ; x < x1 ; ++x, colorline += 4) {
+                    memcpy(colorline, colorscheme->colors, 4);
+                }
+                continue;
+            }
+
+            for(x = x0 ; x < x1 ; ++x, ++bufline) {
+                /* Saturate the heat value to the given saturation, and then
+                 * normalize by that.
+                 */
+                const float val = (*bufline > saturation ? saturation : *bufline)/saturation;
 
-            /* This should never happen. It is likely a bug in this library. */
-            assert(idx < colorscheme->ncolors);
+                /* We add 0.5 in order to do real rounding, not just dropping the
+                 * decimal part. That way we are certain the highest value in the
+                 * colorscheme is actually used.
+                 */
+                const size_t idx = (size_t)((float)(colorscheme->ncolors-1)*val + 0.5f);
 
-            /* Just copy over the color from the colorscheme. */
-            memcpy(colorline, colorscheme->colors + idx*4, 4);
-            colorline += 4;
+                /* This is probably caused by a negative entry in the stamp! */
+                assert(val >= 0.0f);
+
+                /* This should never happen. It is likely a bug in this library. */
+                assert(idx < colorscheme->ncolors);
+
+                /* Just copy over the color from the colorscheme. */
+                memcpy(colorline, colorscheme->colors + idx*4, 4);
+                colorline += 4;
+            }
         }
     }
 
     return colorbuf;
 }
 
+unsigned char* heatmap_render_saturated_to(const heatmap_t* h, const heatmap_colorscheme_t* colorscheme, float saturation, unsigned char* colorbuf)
+{
+    return heatmap_render_stored(h, colorscheme, h->decay != 0.0f ? saturation/h->decay : saturation, colorbuf);
+}
+
 void heatmap_stamp_init(heatmap_stamp_t* stamp, unsigned w, unsigned h, float* data)
 {
     if(stamp) {
@@ -264,18 +6027,27 @@ heatmap_stamp_t* heatmap_stamp_gen(unsigned r)
 
 heatmap_stamp_t* heatmap_stamp_gen_nonlinear(unsigned r, float (*distshape)(float))
 {
-    unsigned y;
-    unsigned d = 2*r+1;
+    unsigned y, d;
+    float* stamp;
 
-    float* stamp = (float*)calloc(d*d, sizeof(float));
+    /* Radii whose stamp can't even be sized are as good as out of memory. */
+    if(r > (UINT_MAX - 1)/2)
+        return 0;
+    d = 2*r+1;
+    if((size_t)d > ((size_t)-1)/sizeof(float)/d)
+        return 0;
+
+    stamp = (float*)calloc((size_t)d*d, sizeof(float));
     if(!stamp)
         return 0;
 
     for(y = 0 ; y < d ; ++y) {
-        float* line = stamp + y*d;
+        float* line = stamp + (size_t)y*d;
+        const long long dy = (long long)y - r;
         unsigned x;
         for(x = 0 ; x < d ; ++x, ++line) {
-            const float dist = sqrtf((float)((x-r)*(x-r) + (y-r)*(y-r)))/(float)(r+1);
+            const long long dx = (long long)x - r;
+            const float dist = sqrtf((float)(dx*dx + dy*dy))/(float)(r+1);
             const float ds = (*distshape)(dist);
             /* This doesn't generate optimal assembly, but meh, it's readable. */
             const float clamped_ds = ds > 1.0f ? 1.0f
@@ -294,6 +6066,535 @@ void heatmap_stamp_free(heatmap_stamp_t* s)
     free(s);
 }
 
+/* A cached stamp. The stamp comes first so that the pointer handed out can be
+ * turned back into its entry. The entries are kept in a list, most recently
+ * used first, which is short enough to search through: it's a handful of radii.
+ */
+typedef struct heatmap_stampcache_entry {
+    heatmap_stamp_t stamp;
+    unsigned radius;
+    float (*distshape)(float);
+    size_t bytes;
+    unsigned refs;
+    struct heatmap_stampcache_entry* prev;
+    struct heatmap_stampcache_entry* next;
+} heatmap_stampcache_entry_t;
+
+struct heatmap_stampcache {
+    int lock;
+    size_t max_bytes, bytes;
+    size_t hits, misses;
+    heatmap_stampcache_entry_t* first;
+    heatmap_stampcache_entry_t* last;
+};
+
+heatmap_stampcache_t* heatmap_stampcache_new(size_t max_bytes)
+{
+    heatmap_stampcache_t* c = (heatmap_stampcache_t*)calloc(1, sizeof(heatmap_stampcache_t));
+    if(c)
+        c->max_bytes = max_bytes;
+    return c;
+}
+
+static void heatmap_stampcache_unlink(heatmap_stampcache_t* c, heatmap_stampcache_entry_t* e)
+{
+    if(e->prev) {e->prev->next = e->next;} else {c->first = e->next;}
+    if(e->next) {e->next->prev = e->prev;} else {c->last = e->prev;}
+    e->prev = e->next = 0;
+}
+
+static void heatmap_stampcache_push_front(heatmap_stampcache_t* c, heatmap_stampcache_entry_t* e)
+{
+    e->prev = 0;
+    e->next = c->first;
+    if(c->first) {c->first->prev = e;} else {c->last = e;}
+    c->first = e;
+}
+
+static heatmap_stampcache_entry_t* heatmap_stampcache_find(heatmap_stampcache_t* c, unsigned radius, float (*distshape)(float))
+{
+    heatmap_stampcache_entry_t* e;
+    for(e = c->first ; e ; e = e->next) {
+        if(e->radius == radius && e->distshape == distshape) {
+            heatmap_stampcache_unlink(c, e);
+            heatmap_stampcache_push_front(c, e);
+            ++e->refs;
+            return e;
+        }
+    }
+    return 0;
+}
+
+/* Unlinks the least recently used unused stamps until there's room for
+ * `bytes` more. They're handed back as a list to be freed outside the lock.
+ */
+static heatmap_stampcache_entry_t* heatmap_stampcache_evict(heatmap_stampcache_t* c, size_t bytes)
+{
+    heatmap_stampcache_entry_t* evicted = 0;
+    heatmap_stampcache_entry_t* e = c->last;
+    while(e && c->bytes + bytes > c->max_bytes) {
+        heatmap_stampcache_entry_t* prev = e->prev;
+        if(e->refs == 0) {
+            heatmap_stampcache_unlink(c, e);
+            c->bytes -= e->bytes;
+            e->next = evicted;
+            evicted = e;
+        }
+        e = prev;
+    }
+    return evicted;
+}
+
+static void heatmap_stampcache_free_entries(heatmap_stampcache_entry_t* e)
+{
+    while(e) {
+        heatmap_stampcache_entry_t* next = e->next;
+        free(e->stamp.buf);
+        free(e);
+        e = next;
+    }
+}
+
+const heatmap_stamp_t* heatmap_stampcache_get(heatmap_stampcache_t* c, unsigned radius, float (*distshape)(float))
+{
+    heatmap_stampcache_entry_t* e;
+    heatmap_stampcache_entry_t* found;
+    heatmap_stampcache_entry_t* evicted;
+    heatmap_stamp_t* s;
+
+    heatmap_lock(&c->lock);
+    e = heatmap_stampcache_find(c, radius, distshape);
+    if(e)
+        ++c->hits;
+    else
+        ++c->misses;
+    heatmap_unlock(&c->lock);
+    if(e)
+        return &e->stamp;
+
+    /* Generating big stamps takes a while, so other threads may go on using
+     * the cache meanwhile, and even generate the same stamp.
+     */
+    e = (heatmap_stampcache_entry_t*)calloc(1, sizeof(heatmap_stampcache_entry_t));
+    s = e ? heatmap_stamp_gen_nonlinear(radius, distshape ? distshape : linear_dist) : 0;
+    if(!s) {
+        free(e);
+        return 0;
+    }
+    e->stamp = *s;
+    free(s);
+    e->radius = radius;
+    e->distshape = distshape;
+    e->bytes = sizeof(heatmap_stampcache_entry_t) + sizeof(float)*e->stamp.w*e->stamp.h;
+    e->refs = 1;
+
+    heatmap_lock(&c->lock);
+    found = heatmap_stampcache_find(c, radius, distshape);
+    evicted = found ? 0 : heatmap_stampcache_evict(c, e->bytes);
+    if(!found) {
+        heatmap_stampcache_push_front(c, e);
+        c->bytes += e->bytes;
+    }
+    heatmap_unlock(&c->lock);
+
+    heatmap_stampcache_free_entries(evicted);
+    if(found) {
+        e->next = 0;
+        heatmap_stampcache_free_entries(e);
+        return &found->stamp;
+    }
+    return &e->stamp;
+}
+
+void heatmap_stampcache_release(heatmap_stampcache_t* c, const heatmap_stamp_t* s)
+{
+    heatmap_stampcache_entry_t* e = (heatmap_stampcache_entry_t*)s;
+    heatmap_stampcache_entry_t* evicted;
+
+    heatmap_lock(&c->lock);
+    assert(e->refs > 0);
+    --e->refs;
+    /* Stamps held on to while the cache was full may free up room now. */
+    evicted = heatmap_stampcache_evict(c, 0);
+    heatmap_unlock(&c->lock);
+
+    heatmap_stampcache_free_entries(evicted);
+}
+
+void heatmap_stampcache_stats(heatmap_stampcache_t* c, size_t* hits, size_t* misses, size_t* bytes)
+{
+    heatmap_lock(&c->lock);
+    if(hits) {*hits = c->hits;}
+    if(misses) {*misses = c->misses;}
+    if(bytes) {*bytes = c->bytes;}
+    heatmap_unlock(&c->lock);
+}
+
+void heatmap_stampcache_free(heatmap_stampcache_t* c)
+{
+#ifndef NDEBUG
+    heatmap_stampcache_entry_t* e;
+    for(e = c->first ; e ; e = e->next)
+        assert(e->refs == 0);
+#endif
+    heatmap_stampcache_free_entries(c->first);
+    free(c);
+}
+
+heatmap_qstamp_t* heatmap_qstamp_from_stamp(const heatmap_stamp_t* s)
+{
+    const size_t n = (size_t)s->w*s->h;
+    heatmap_qstamp_t* q = (heatmap_qstamp_t*)malloc(sizeof(heatmap_qstamp_t));
+    size_t i;
+
+    if(!q)
+        return 0;
+
+    q->buf = (unsigned short*)malloc(n*sizeof(unsigned short));
+    if(!q->buf) {
+        free(q);
+        return 0;
+    }
+    q->w = s->w;
+    q->h = s->h;
+
+    /* The same rounding as adding the float stamp onto a fixed-point map. */
+    for(i = 0 ; i < n ; ++i) {
+        const float v = s->buf[i] > 0.0f ? (s->buf[i] < 1.0f ? s->buf[i] : 1.0f) : 0.0f;
+        q->buf[i] = (unsigned short)heatmap_quantize(v);
+    }
+    return q;
+}
+
+void heatmap_qstamp_free(heatmap_qstamp_t* s)
+{
+    free(s->buf);
+    free(s);
+}
+
+heatmap_sepstamp_t* heatmap_sepstamp_load(unsigned w, unsigned h, const float* kx, const float* ky)
+{
+    heatmap_sepstamp_t* s = (heatmap_sepstamp_t*)calloc(1, sizeof(heatmap_sepstamp_t));
+    float* cx = (float*)malloc(sizeof(float)*w);
+    float* cy = (float*)malloc(sizeof(float)*h);
+
+    if(!s || !cx || !cy) {
+        free(s);
+        free(cx);
+        free(cy);
+        return 0;
+    }
+
+    memcpy(cx, kx, sizeof(float)*w);
+    memcpy(cy, ky, sizeof(float)*h);
+
+    s->kx = cx;
+    s->ky = cy;
+    s->w = w;
+    s->h = h;
+    return s;
+}
+
+heatmap_sepstamp_t* heatmap_sepstamp_gen_gaussian(float sigma, float truncate)
+{
+    const unsigned r = sigma > 0.0f && truncate > 0.0f ? (unsigned)ceilf(sigma*truncate) : 0;
+    const unsigned d = 2*r+1;
+    heatmap_sepstamp_t* s;
+    unsigned i;
+
+    float* k = (float*)malloc(d*sizeof(float));
+    if(!k)
+        return 0;
+
+    /* exp(-x²/2σ²) * exp(-y²/2σ²) = exp(-(x²+y²)/2σ²), so the stamp is round
+     * and, just like the default one, is 1 at its center.
+     */
+    for(i = 0 ; i < d ; ++i) {
+        const float x = (float)i - (float)r;
+        k[i] = r ? expf(-x*x/(2.0f*sigma*sigma)) : 1.0f;
+    }
+
+    s = heatmap_sepstamp_load(d, d, k, k);
+    free(k);
+    return s;
+}
+
+heatmap_stamp_t* heatmap_sepstamp_to_stamp(const heatmap_sepstamp_t* s)
+{
+    unsigned x, y;
+
+    float* data = (float*)malloc(sizeof(float)*s->w*s->h);
+    if(!data)
+        return 0;
+
+    for(y = 0 ; y < s->h ; ++y) {
+        for(x = 0 ; x < s->w ; ++x) {
+            data[y*s->w + x] = s->kx[x]*s->ky[y];
+        }
+    }
+
+    return heatmap_stamp_new_with(s->w, s->h, data);
+}
+
+void heatmap_sepstamp_free(heatmap_sepstamp_t* s)
+{
+    free(s->kx);
+    free(s->ky);
+    free(s);
+}
+
+/* The highest order of differences a difference stamp is made of. */
+#define HEATMAP_DIFF_MAX_ORDER 4
+
+/* Nudges the `count` differences of order `order` so that they sum up to
+ * exactly nothing beyond the last one, the way the exact differences of any
+ * stamp do. Rounding or dropping a difference would otherwise leave a
+ * polynomial tail of heat behind every point, all the way to the map's end.
+ * That's the case iff their first `order` moments are zero; the smallest
+ * nudge which makes them so is the projection onto the moments' null space.
+ */
+static void heatmap_diff_balance(const unsigned* offs, double* diffs, unsigned count, unsigned order, unsigned n)
+{
+    double g[HEATMAP_DIFF_MAX_ORDER][HEATMAP_DIFF_MAX_ORDER + 1];
+    double a[HEATMAP_DIFF_MAX_ORDER];
+    unsigned i, j, k, p;
+
+    /* Solves (V V^T) a = V d, V[k][i] being offs[i]^k scaled down to 1. */
+    memset(g, 0, sizeof(g));
+    for(i = 0 ; i < count ; ++i) {
+        const double t = (double)offs[i]/(double)(n + order);
+        double tj = 1.0;
+        for(j = 0 ; j < order ; ++j) {
+            double tk = 1.0;
+            for(k = 0 ; k < order ; ++k) {
+                g[j][k] += tj*tk;
+                tk *= t;
+            }
+            g[j][order] += tj*diffs[i];
+            tj *= t;
+        }
+    }
+
+    for(j = 0 ; j < order ; ++j) {
+        for(p = j, k = j + 1 ; k < order ; ++k) {
+            if(fabs(g[k][j]) > fabs(g[p][j])) {p = k;}
+        }
+        if(g[p][j] == 0.0)
+            return;
+        for(k = 0 ; k <= order ; ++k) {
+            const double tmp = g[j][k];
+            g[j][k] = g[p][k];
+            g[p][k] = tmp;
+        }
+        for(k = j + 1 ; k < order ; ++k) {
+            const double f = g[k][j]/g[j][j];
+            for(p = j ; p <= order ; ++p) {g[k][p] -= f*g[j][p];}
+        }
+    }
+    for(j = order ; j-- > 0 ; ) {
+        a[j] = g[j][order];
+        for(k = j + 1 ; k < order ; ++k) {a[j] -= g[j][k]*a[k];}
+        a[j] /= g[j][j];
+    }
+
+    /* ...and takes V^T a away from d. */
+    for(i = 0 ; i < count ; ++i) {
+        const double t = (double)offs[i]/(double)(n + order);
+        double tj = 1.0;
+        for(j = 0 ; j < order ; ++j) {
+            diffs[i] -= a[j]*tj;
+            tj *= t;
+        }
+    }
+}
+
+/* Finds the order of differences of the `n` values `k` which has the fewest
+ * non-zero differences, and stores them. Differences which are only due to
+ * the rounding of `k`, which is `eps` relative to its largest value, are
+ * dropped.
+ */
+static int heatmap_diff_axis(const double* k, unsigned n, double eps, unsigned* order, unsigned* count, unsigned** offs, double** diffs)
+{
+    double* d = (double*)malloc((n + HEATMAP_DIFF_MAX_ORDER)*sizeof(double));
+    double* best = (double*)malloc((n + HEATMAP_DIFF_MAX_ORDER)*sizeof(double));
+    double maxabs = 0.0;
+    unsigned i, o, c;
+
+    if(!d || !best) {
+        free(d);
+        free(best);
+        return 0;
+    }
+
+    for(i = 0 ; i < n ; ++i) {
+        if(fabs(k[i]) > maxabs) {maxabs = fabs(k[i]);}
+    }
+
+    /* d becomes the o-th difference of k (padded with zeros) step by step,
+     * getting one value longer each time.
+     */
+    for(i = 0 ; i < n ; ++i) {d[i] = k[i];}
+    *count = n + HEATMAP_DIFF_MAX_ORDER + 1;
+    for(o = 1 ; o <= HEATMAP_DIFF_MAX_ORDER ; ++o) {
+        const double tol = eps*maxabs*(double)(1u << o);
+        d[n + o - 1] = 0.0;
+        for(i = n + o - 1 ; i > 0 ; --i) {d[i] -= d[i-1];}
+
+        for(i = 0, c = 0 ; i < n + o ; ++i) {
+            if(fabs(d[i]) > tol) {++c;}
+        }
+        if(c < *count) {
+            *count = c;
+            *order = o;
+            memcpy(best, d, (n + o)*sizeof(double));
+        }
+    }
+
+    *offs = (unsigned*)malloc((*count ? *count : 1)*sizeof(unsigned));
+    *diffs = (double*)malloc((*count ? *count : 1)*sizeof(double));
+    if(!*offs || !*diffs) {
+        free(*offs);
+        free(*diffs);
+        free(d);
+        free(best);
+        return 0;
+    }
+
+    for(i = 0, c = 0 ; i < n + *order ; ++i) {
+        if(fabs(best[i]) > eps*maxabs*(double)(1u << *order)) {
+            (*offs)[c] = i;
+            (*diffs)[c] = best[i];
+            ++c;
+        }
+    }
+    heatmap_diff_balance(*offs, *diffs, *count, *order, n);
+
+    free(d);
+    free(best);
+    return 1;
+}
+
+/* Creates a w x h difference stamp out of rows and columns `kx` and `ky`. */
+static heatmap_diffstamp_t* heatmap_diffstamp_new(const double* kx, const double* ky, unsigned w, unsigned h, double eps)
+{
+    heatmap_diffstamp_t* ds = (heatmap_diffstamp_t*)calloc(1, sizeof(heatmap_diffstamp_t));
+    if(!ds)
+        return 0;
+
+    ds->w = w;
+    ds->h = h;
+    if(!heatmap_diff_axis(kx, w, eps, &ds->ox, &ds->nx, &ds->xoff, &ds->xdiff)
+    || !heatmap_diff_axis(ky, h, eps, &ds->oy, &ds->ny, &ds->yoff, &ds->ydiff)) {
+        heatmap_diffstamp_free(ds);
+        return 0;
+    }
+
+    return ds;
+}
+
+heatmap_diffstamp_t* heatmap_diffstamp_from_sepstamp(const heatmap_sepstamp_t* s)
+{
+    double* k = (double*)malloc((s->w + s->h)*sizeof(double));
+    heatmap_diffstamp_t* ds;
+    unsigned i;
+
+    if(!k)
+        return 0;
+
+    for(i = 0 ; i < s->w ; ++i) {k[i] = s->kx[i];}
+    for(i = 0 ; i < s->h ; ++i) {k[s->w + i] = s->ky[i];}
+    ds = heatmap_diffstamp_new(k, k + s->w, s->w, s->h, 1e-6);
+    free(k);
+    return ds;
+}
+
+heatmap_diffstamp_t* heatmap_diffstamp_gen_box(unsigned w, unsigned h)
+{
+    static const double one = 1.0;
+    heatmap_diffstamp_t* ds = heatmap_diffstamp_new(&one, &one, 1, 1, 1e-12);
+
+    /* A box's differences are +1 at its left and -1 right after its right. */
+    if(ds) {
+        ds->w = w;
+        ds->h = h;
+        ds->xoff[1] = w;
+        ds->yoff[1] = h;
+    }
+    return ds;
+}
+
+heatmap_diffstamp_t* heatmap_diffstamp_gen_poly(unsigned r, unsigned degree)
+{
+    const unsigned d = 2*r+1;
+    heatmap_diffstamp_t* ds;
+    unsigned i, p;
+
+    /* In doubles, so that even the tiny differences of wide stamps stand
+     * out of the rounding.
+     */
+    double* k = (double*)malloc(d*sizeof(double));
+    if(!k)
+        return 0;
+
+    for(i = 0 ; i < d ; ++i) {
+        const double t = 1.0 - fabs((double)i - (double)r)/(double)(r+1);
+        k[i] = 1.0;
+        for(p = 0 ; p < degree ; ++p) {k[i] *= t;}
+    }
+
+    ds = heatmap_diffstamp_new(k, k, d, d, 1e-12);
+    free(k);
+    return ds;
+}
+
+/* Sums up the `count` differences of order `order` back into `n` values. */
+static void heatmap_diff_integrate(const unsigned* offs, const double* diffs, unsigned count, unsigned order, unsigned n, float* out)
+{
+    double* v = (double*)calloc(n + order, sizeof(double));
+    unsigned i, o;
+
+    for(i = 0 ; i < count ; ++i) {v[offs[i]] += diffs[i];}
+    for(o = 0 ; o < order ; ++o) {
+        for(i = 1 ; i < n + order ; ++i) {v[i] += v[i-1];}
+    }
+    for(i = 0 ; i < n ; ++i) {out[i] = (float)v[i];}
+
+    free(v);
+}
+
+heatmap_stamp_t* heatmap_diffstamp_to_stamp(const heatmap_diffstamp_t* s)
+{
+    float* kx = (float*)malloc(sizeof(float)*(s->w + s->h));
+    float* data = (float*)malloc(sizeof(float)*s->w*s->h);
+    unsigned x, y;
+
+    if(!kx || !data) {
+        free(kx);
+        free(data);
+        return 0;
+    }
+
+    heatmap_diff_integrate(s->xoff, s->xdiff, s->nx, s->ox, s->w, kx);
+    heatmap_diff_integrate(s->yoff, s->ydiff, s->ny, s->oy, s->h, kx + s->w);
+    for(y = 0 ; y < s->h ; ++y) {
+        for(x = 0 ; x < s->w ; ++x) {
+            data[y*s->w + x] = kx[x]*kx[s->w + y];
+        }
+    }
+
+    free(kx);
+    return heatmap_stamp_new_with(s->w, s->h, data);
+}
+
+void heatmap_diffstamp_free(heatmap_diffstamp_t* s)
+{
+    free(s->xoff);
+    free(s->xdiff);
+    free(s->yoff);
+    free(s->ydiff);
+    free(s);
+}
+
 heatmap_colorscheme_t* heatmap_colorscheme_load(const unsigned char* in_colors, size_t ncolors)
 {
     heatmap_colorscheme_t* cs = (heatmap_colorscheme_t*)calloc(1, sizeof(heatmap_colorscheme_t));
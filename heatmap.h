@@ -32,16 +32,56 @@
 extern "C" {
 #endif
 
+/* How a heatmap stores the heat of its pixels, see `heatmap_set_storage`. */
+typedef enum {
+    HEATMAP_FLOAT32 = 0, /* 32-bit floats in `buf`, the default. */
+    HEATMAP_FP16,        /* IEEE half floats in `hbuf`: 11 significant bits, up to 65504. */
+    HEATMAP_BF16,        /* bfloat16 in `hbuf`: 8 significant bits, but all of float's range. */
+    HEATMAP_FIXED,       /* 32-bit unsigned fixed-point in `ibuf`, see `heatmap_new_fixed`. */
+    HEATMAP_FLOAT64      /* doubles in `dbuf` plus float scratch in `buf`, see `heatmap_new_precise`. */
+} heatmap_storage_t;
+
 /* Maybe make an opaque type out of this. But then again,
  * I'm assuming the users of this lib are not stupid here.
  * If you mess with the internals and things break, blame yourself.
  */
 typedef struct {
     float* buf;    /* Contains the heat value of every heatmap pixel. */
-    float max;     /* The highest heat in the whole map. Used for normalization. */
+    float max;     /* The highest heat in the whole map. Used for normalization.
+                      Only up-to-date in lazy-max mode after `heatmap_get_max`. */
     unsigned w, h; /* Pixel-dimension of the heatmap. */
+    int lazy_max;  /* See `heatmap_set_lazy_max`. */
+    int max_dirty; /* Whether `max` needs to be recomputed (lazy-max mode only). */
+    int concurrent; /* See `heatmap_set_concurrent`. */
+    int tiled;     /* Whether `buf` is laid out in tiles, see `heatmap_set_tiled`. */
+    float** tiles; /* Only for sparse maps, which have no `buf`: one pointer
+                      per tile, NULL until the tile is first touched.
+                      See `heatmap_new_sparse`. */
+    unsigned short* hbuf; /* Only for half-precision maps, which have no `buf`:
+                             the heat as 16-bit floats, laid out like `buf`.
+                             See `heatmap_set_storage`. */
+    unsigned* ibuf; /* Only for fixed-point maps, which have no `buf`: the heat
+                       times HEATMAP_FIXED_ONE, laid out like `buf`.
+                       See `heatmap_new_fixed`. */
+    double* dbuf; /* Only for precise maps: most of the heat as doubles, laid
+                     out like `buf`, which holds the rest on top of that.
+                     See `heatmap_new_precise`. */
+    heatmap_storage_t storage; /* Which kind of numbers the heat is stored as. */
+    float decay;  /* The heat is `decay` times what's stored, or just that if
+                     `decay` is 0. See `heatmap_decay`. */
 } heatmap_t;
 
+/* The width and height (in pixels) of a tile of a heatmap in tiled mode. */
+#define HEATMAP_TILE_SIZE 64
+
+/* What a heat of 1 is in fixed-point maps and quantized stamps. */
+#define HEATMAP_FIXED_ONE 65535u
+
+/* The most heat a precise map's float scratch holds, see `heatmap_new_precise`.
+ * Its floats' rounding error then stays below 2^-18 per add.
+ */
+#define HEATMAP_SCRATCH_MAX 64.0f
+
 /* A stamp is "stamped" (added) onto the heatmap for every datapoint which
  * is seen. This is usually something spheric, but there are no limits to your
  * artistic freedom!
@@ -51,6 +91,44 @@ typedef struct {
     unsigned w, h; /* The size (in pixel) of the stamp. */
 } heatmap_stamp_t;
 
+/* A separable stamp is a stamp whose pixel (x, y) is `kx[x]*ky[y]`, like a
+ * Gaussian. Instead of stamping it, `heatmap_convolve_separable` adds it as
+ * one pass along the rows and one along the columns, so that it costs O(w+h)
+ * instead of O(w*h) per pixel, which makes even huge stamps affordable.
+ */
+typedef struct {
+    float* kx;     /* The w weights along a row of the stamp. */
+    float* ky;     /* The h weights along a column of the stamp. */
+    unsigned w, h; /* The size (in pixel) of the stamp. */
+} heatmap_sepstamp_t;
+
+/* A difference stamp is a separable stamp whose rows and columns are made of
+ * a few pieces of low-degree polynomials, like boxes or pyramids. Instead of
+ * the rows' values, it stores their `ox`-th differences (the differences of
+ * the differences of...), which are all zeros but a few around where the
+ * pieces meet; same for the columns. `heatmap_add_points_diff` only adds
+ * those few non-zero differences for every point, and sums them up once at
+ * the end.
+ */
+typedef struct {
+    unsigned w, h;   /* The size (in pixel) of the stamp. */
+    unsigned ox, oy; /* The order of the differences along rows and columns. */
+    unsigned nx, ny; /* How many non-zero differences there are along them. */
+    unsigned* xoff;  /* Where these differences are, 0 being the stamp's left */
+    double* xdiff;   /* column, and what they are, in increasing order of xoff. */
+    unsigned* yoff;  /* Same along the columns, 0 being the stamp's top row. */
+    double* ydiff;
+} heatmap_diffstamp_t;
+
+/* A quantized stamp is a stamp whose values between 0 and 1 have been rounded
+ * to 16-bit integers, HEATMAP_FIXED_ONE being 1. Adding it onto a fixed-point
+ * map is a plain integer add, see `heatmap_new_fixed`.
+ */
+typedef struct {
+    unsigned short* buf; /* The stamp's values times HEATMAP_FIXED_ONE. */
+    unsigned w, h;       /* The size (in pixel) of the stamp. */
+} heatmap_qstamp_t;
+
 /* A colorscheme is used to transform the heatmap's heat values (floats)
  * into an actual colorful heatmap.
  * Maybe counterintuitively, the coldest color comes first (stored at index 0)
@@ -67,9 +145,193 @@ typedef struct {
 
 /* Creates a new heatmap of given size. */
 heatmap_t* heatmap_new(unsigned w, unsigned h);
+/* Creates a new heatmap of given size which is in tiled mode right away,
+ * see `heatmap_set_tiled`.
+ */
+heatmap_t* heatmap_new_tiled(unsigned w, unsigned h);
+/* Creates a new sparse heatmap of given size.
+ *
+ * A sparse heatmap is a tiled one (see `heatmap_set_tiled`) which doesn't
+ * allocate all of its tiles up front, but every single tile only when a stamp
+ * first touches it. Untouched tiles take no memory besides one pointer, have
+ * no heat, are skipped when looking for the max and are rendered using the
+ * colorscheme's coldest color. That's great for huge maps with data in only
+ * a small part of them, like cities on a world map, but a map which gets
+ * touched all over takes slightly more memory than a dense one.
+ *
+ * Instead of `buf`, the tiles are in `tiles`, see `heatmap_to_rowmajor`
+ * for reading the heat. Everything else works just like with other heatmaps.
+ * Converting it with `heatmap_set_tiled(h, 0)` makes it a dense row-major map.
+ * If there's no memory for a new tile while adding, that tile's heat is lost.
+ */
+heatmap_t* heatmap_new_sparse(unsigned w, unsigned h);
+/* Creates a new heatmap of given size which stores its heat as 16-bit
+ * floats right away, see `heatmap_set_storage`.
+ */
+heatmap_t* heatmap_new_half(unsigned w, unsigned h, heatmap_storage_t storage);
+/* Creates a new heatmap of given size whose heat is stored in fixed-point.
+ *
+ * Its `ibuf` holds every pixel's heat times HEATMAP_FIXED_ONE, as a 32-bit
+ * unsigned integer. Every stamp value added onto it is rounded to that (once
+ * multiplied by the point's weight), and the adds are plain integer adds
+ * which saturate instead of wrapping around. Thus unlike with floats, the
+ * result is exactly the same whatever order the points are added in, be it
+ * through threads, shards which are merged in any order or any other way.
+ * It's also the fastest way of adding unweighted points: quantize the stamp
+ * with `heatmap_qstamp_from_stamp` and use `heatmap_add_points_with_qstamp`,
+ * which `heatmap_add_points_with_stamp` does for you, too. Rendering it uses
+ * only integers.
+ *
+ * A pixel saturates after about 65536 hits of a stamp's value of 1. Like
+ * half-precision maps (see `heatmap_set_storage`), fixed-point maps can't be
+ * sparse or concurrent. Use `heatmap_to_rowmajor` for reading the heat.
+ */
+heatmap_t* heatmap_new_fixed(unsigned w, unsigned h);
+/* Creates a new tiled heatmap of given size which stays accurate no matter
+ * how much heat it accumulates.
+ *
+ * A float has 24 significant bits, so once a pixel of a plain map holds a
+ * heat of about 2^24 times a stamp's value, adding the stamp doesn't change
+ * it anymore. A precise map holds its heat as doubles in `dbuf`, but adds
+ * onto its float `buf` as usual, which only serves as scratch: whenever an
+ * add makes the scratch heat of the pixels it touched go above
+ * HEATMAP_SCRATCH_MAX, these pixels are moved onto their doubles. This keeps
+ * the speed of floats for adding, and the accuracy of doubles for the total.
+ *
+ * Its max is always computed lazily, see `heatmap_set_lazy_max`, so use
+ * `heatmap_get_max` instead of reading `max`. Like half-precision maps (see
+ * `heatmap_set_storage`), precise maps can't be sparse or concurrent. Use
+ * `heatmap_to_rowmajor` for reading the heat.
+ */
+heatmap_t* heatmap_new_precise(unsigned w, unsigned h);
+/* Returns how many tiles of a sparse heatmap have been allocated so far,
+ * each of them taking 4*HEATMAP_TILE_SIZE*HEATMAP_TILE_SIZE bytes.
+ * For dense heatmaps, all of the tiles (or the single one) count as used.
+ */
+size_t heatmap_sparse_tiles_used(const heatmap_t* h);
 /* Frees up all memory taken by the heatmap. */
 void heatmap_free(heatmap_t* h);
 
+/* Switches the lazy-max mode of the heatmap on (non-zero) or off (zero).
+ *
+ * By default, adding a point keeps `max` up to date at all times, which costs
+ * a comparison for every single pixel of the stamp. In lazy-max mode, adding
+ * points only marks the max as outdated, and it is recomputed in one fast
+ * pass over the whole map when it's needed: by `heatmap_get_max` or when
+ * rendering. This is much faster when many points are added per render.
+ *
+ * While in lazy-max mode, don't read `max` directly, use `heatmap_get_max`.
+ * Switching lazy-max mode off brings `max` up to date again.
+ */
+void heatmap_set_lazy_max(heatmap_t* h, int lazy);
+
+/* Returns the highest heat in the whole map, recomputing it first if needed.
+ * Afterwards, `h->max` is up to date too, though in the units of the stored
+ * heat, see `heatmap_decay`.
+ */
+float heatmap_get_max(heatmap_t* h);
+
+/* Multiplies the heat of every pixel by `factor`, like for a map of recent
+ * activity which fades away a little bit on every tick.
+ *
+ * Instead of going over the whole map, this only multiplies `decay` by the
+ * factor, and every point added afterwards is weighted by its inverse: the
+ * stored heat stays as it is and the new heat is heavier, which is the same
+ * once everything is multiplied by `decay`. That's what `heatmap_get_max`,
+ * `heatmap_to_rowmajor`, `heatmap_merge` (of this map onto another one) and
+ * rendering do. Only once the stored heat has grown about 2^32 times heavier
+ * than the real one does this go over the whole map, multiplying it by
+ * `decay` and resetting that to 0, which keeps the stored heat far away from
+ * what a float can hold.
+ *
+ * This goes over the whole map every time on half-precision maps stored as
+ * HEATMAP_FP16 and on fixed-point maps, which can't hold that heavy heat.
+ * Code reading `buf` or `max` directly needs to multiply them by `decay`
+ * unless it's 0. Like switching modes, this mustn't happen while other
+ * threads are adding to the map.
+ */
+void heatmap_decay(heatmap_t* h, float factor);
+
+/* Switches the concurrent mode of the heatmap on (non-zero) or off (zero).
+ *
+ * In concurrent mode, any amount of threads may add points to (or merge
+ * shards into) the same heatmap at the same time, without any locking.
+ * Every pixel is updated using an atomic compare-and-swap, and so is the max
+ * (or the lazy-max flag). That makes every single add several times slower
+ * than in the default mode, but unlike with a mutex around every add, the
+ * threads don't wait for each other, so it pays off with many cores.
+ * If your threads can each add a whole batch of points, consider giving each
+ * of them its own shard and using `heatmap_merge` instead.
+ *
+ * Everything else, like switching modes, `heatmap_get_max` or rendering,
+ * must only happen once all threads are done adding.
+ *
+ * return: Non-zero on success. Only maps storing their heat as
+ *         HEATMAP_FLOAT32 can be concurrent, for others the mode is left
+ *         off and zero is returned.
+ */
+int heatmap_set_concurrent(heatmap_t* h, int concurrent);
+
+/* Switches the heatmap's buffer to the tiled layout (non-zero) or back to
+ * the default row-major layout (zero), converting its contents.
+ *
+ * By default, `buf` holds the heatmap row after row, so every row of a large
+ * stamp lands `4*w` bytes after the previous one. On huge maps, that's a new
+ * memory page for every single row, which thrashes the TLB and the caches.
+ * In tiled mode, `buf` is made of square tiles of HEATMAP_TILE_SIZE pixels,
+ * each stored row after row as one contiguous block, and the tiles themselves
+ * are stored row after row too. The map is padded with zeros to a whole
+ * amount of tiles. Stamps then only touch a few contiguous blocks.
+ *
+ * Adding, merging, rendering and finding the max all work in either layout,
+ * but code reading `buf` directly needs to take the layout into account, or
+ * use `heatmap_to_rowmajor`.
+ *
+ * return: Non-zero on success. If there's not enough memory for converting,
+ *         the heatmap is left unchanged and zero is returned.
+ */
+int heatmap_set_tiled(heatmap_t* h, int tiled);
+
+/* Switches the type of floats the heatmap's heat is stored as, converting
+ * its contents. This also switches to and from HEATMAP_FIXED, see
+ * `heatmap_new_fixed`, and HEATMAP_FLOAT64, see `heatmap_new_precise`.
+ *
+ * Most maps only need about three significant digits to look right, so
+ * storing them as 16-bit floats in `hbuf` (instead of `buf`) halves their
+ * memory and the memory bandwidth spent adding to and rendering them.
+ * HEATMAP_FP16 is more precise, but can't hold heat above 65504 (where it
+ * saturates), so weigh your points down for dense data. HEATMAP_BF16 is
+ * coarser, but goes as high as a float does.
+ *
+ * The heat is still summed up as floats: every add rounds each pixel once.
+ * The batch functions (`heatmap_add_points` and friends, including the
+ * `_parallel` and `_auto` ones) first sum up all of the batch's points in
+ * float scratch rows and only round the total, so batches of many points
+ * don't lose the small contributions of stamps landing on pixels which are
+ * already very hot, as adding them one by one would.
+ *
+ * Adding, merging, rendering, finding the max and changing the layout work
+ * in any storage, but code reading `buf` directly needs to use
+ * `heatmap_to_rowmajor` instead. Sparse maps and concurrent mode only work
+ * with HEATMAP_FLOAT32.
+ *
+ * return: Non-zero on success. If there's not enough memory for converting,
+ *         or the map is sparse or concurrent, the heatmap is left unchanged
+ *         and zero is returned.
+ */
+int heatmap_set_storage(heatmap_t* h, heatmap_storage_t storage);
+
+/* Copies the heat of every pixel of the heatmap into `out`, row after row,
+ * no matter which layout and storage the heatmap is in.
+ *
+ * out: A buffer large enough to hold heatmap_width*heatmap_height floats.
+ *      If out is NULL, a new large enough buffer will be malloc'd.
+ *
+ * return: The given or the newly malloc'd buffer, which the caller needs to
+ *         free. NULL if there's no memory for a new one.
+ */
+float* heatmap_to_rowmajor(const heatmap_t* h, float* out);
+
 /* Adds a single point to the heatmap using the default stamp. */
 void heatmap_add_point(heatmap_t* h, unsigned x, unsigned y);
 /* Adds a single point to the heatmap using a given stamp. */
@@ -80,6 +342,474 @@ void heatmap_add_weighted_point(heatmap_t* h, unsigned x, unsigned y, float w);
 /* Adds a single weighted point to the heatmap using a given stamp. */
 void heatmap_add_weighted_point_with_stamp(heatmap_t* h, unsigned x, unsigned y, float w, const heatmap_stamp_t* stamp);
 
+/* Adds a single point to the heatmap using a quantized stamp. On anything but
+ * a fixed-point heatmap (see `heatmap_new_fixed`), the stamp is turned back
+ * into floats first, which is slower than using the float stamp directly.
+ */
+void heatmap_add_point_with_qstamp(heatmap_t* h, unsigned x, unsigned y, const heatmap_qstamp_t* stamp);
+/* The batch version of the above, see `heatmap_add_points`. */
+void heatmap_add_points_with_qstamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride, const heatmap_qstamp_t* stamp);
+
+/* Adds a whole batch of `n` points to the heatmap using the default stamp.
+ * The result is exactly the same as calling `heatmap_add_point` for every
+ * single one of them, just faster.
+ *
+ * xs, ys: The coordinates of the i-th point are xs[i*stride] and ys[i*stride].
+ * stride: The distance (in unsigneds, not bytes) between two consecutive points.
+ *         For interleaved "x0 y0 x1 y1 ..." data (AoS), pass xs=data, ys=data+1
+ *         and stride=2. For two separate arrays of x and y (SoA), pass stride=1.
+ *
+ * Points outside of the heatmap are ignored, just like for a single point.
+ */
+void heatmap_add_points(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride);
+/* Adds a whole batch of `n` points to the heatmap using a given stamp.
+ * See `heatmap_add_points` for the meaning of the arguments.
+ */
+void heatmap_add_points_with_stamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, size_t n, size_t stride, const heatmap_stamp_t* stamp);
+
+/* Adds a whole batch of `n` weighted points to the heatmap using the default stamp.
+ *
+ * ws: The weight of the i-th point is ws[i], regardless of `stride`.
+ *     May be NULL, in which case all points have a weight of 1.
+ *
+ * See `heatmap_add_points` for the meaning of the other arguments.
+ */
+void heatmap_add_weighted_points(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride);
+/* Adds a whole batch of `n` weighted points to the heatmap using a given stamp.
+ * See `heatmap_add_weighted_points` for the meaning of the arguments.
+ */
+void heatmap_add_weighted_points_with_stamp(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp);
+
+/* Adds a single point at sub-pixel coordinates to the heatmap, where pixel
+ * (x, y) is centered on the integer coordinates (x, y). The point is split
+ * bilinearly between the four pixels around it, which are then stamped as
+ * four weighted points; e.g. (2.25, 3) is 0.75 times a point at (2, 3) plus
+ * 0.25 times one at (3, 3). Those of the four which are outside of the map
+ * are ignored, just like integer points. That's all done in one go, by adding
+ * a stamp one pixel wider and higher, interpolated between the stamp's
+ * pixels, so it costs little more than adding an integer point.
+ */
+void heatmap_add_pointf(heatmap_t* h, float x, float y);
+void heatmap_add_pointf_with_stamp(heatmap_t* h, float x, float y, const heatmap_stamp_t* stamp);
+void heatmap_add_weighted_pointf(heatmap_t* h, float x, float y, float w);
+void heatmap_add_weighted_pointf_with_stamp(heatmap_t* h, float x, float y, float w, const heatmap_stamp_t* stamp);
+
+/* Adds a whole batch of `n` (optionally weighted) points at sub-pixel
+ * coordinates, see `heatmap_add_pointf` and `heatmap_add_weighted_points`.
+ * The result is exactly the same as adding them one by one.
+ */
+void heatmap_add_pointsf(heatmap_t* h, const float* xs, const float* ys, size_t n, size_t stride);
+void heatmap_add_pointsf_with_stamp(heatmap_t* h, const float* xs, const float* ys, size_t n, size_t stride, const heatmap_stamp_t* stamp);
+void heatmap_add_weighted_pointsf(heatmap_t* h, const float* xs, const float* ys, const float* ws, size_t n, size_t stride);
+void heatmap_add_weighted_pointsf_with_stamp(heatmap_t* h, const float* xs, const float* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap using
+ * a given stamp and multiple threads. The result is exactly the same as that
+ * of `heatmap_add_weighted_points_with_stamp`.
+ *
+ * The map is split into horizontal bands of rows, several per thread. The
+ * points are first sorted into the bands their stamp overlaps. Bands with
+ * a lot of points in them are split further into thinner ones, so that the
+ * work stays balanced even when most points fall into a small part of the
+ * map. Then, the threads keep grabbing the next band and add its points,
+ * clipping the stamps to it. Thus, no locking and no additional copy of the
+ * map is needed.
+ *
+ * nthreads: How many threads to use, 0 meaning OpenMP's default.
+ *
+ * This needs the library to be compiled with OpenMP (-fopenmp), without it
+ * this just calls `heatmap_add_weighted_points_with_stamp`. Same if there's
+ * not enough memory for sorting the points into the bands.
+ * See `heatmap_add_weighted_points` for the meaning of the other arguments.
+ */
+void heatmap_add_points_parallel(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap using
+ * a given stamp and multiple threads, just like `heatmap_add_points_parallel`.
+ *
+ * Instead of sorting the points into bands, the points are simply split into
+ * one consecutive chunk per thread. Every thread adds its chunk onto its own
+ * private shard, a heatmap just covering the chunk's bounding box, and all
+ * shards are merged into the map at the end using `heatmap_merge_shards`.
+ * This is a good fit for points which arrive in no particular spatial order
+ * and are spatially clustered per chunk, but needs up to one map-sized shard
+ * worth of memory per thread.
+ *
+ * The result is the same as that of `heatmap_add_weighted_points_with_stamp`
+ * up to floating-point rounding, since the additions happen in another order.
+ * Like `heatmap_add_points_parallel`, this runs serially without OpenMP or
+ * when there's not enough memory for the shards.
+ */
+void heatmap_add_points_sharded(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Coalesces a batch of `n` (optionally weighted) points: all points with the
+ * same coordinates become a single one, weighing as much as all of them
+ * together. Points are hashed into a fixed number of parts, which are then
+ * deduplicated in parallel, so the result doesn't depend on `nthreads`.
+ *
+ * xys: Receives the coalesced points' coordinates as "x0 y0 x1 y1 ...". Must
+ *      have room for `2*n` unsigneds, and not overlap the input.
+ * cws: Receives the coalesced points' weights. Must have room for `n` floats.
+ *
+ * return: How many coalesced points there are. If there's not enough memory
+ *         for coalescing, the points are just copied and that's `n`.
+ * See `heatmap_add_points_parallel` for the meaning of the other arguments.
+ */
+size_t heatmap_coalesce_points(const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, unsigned* xys, float* cws, unsigned nthreads);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap like
+ * `heatmap_add_points_parallel`, but coalesces them first using
+ * `heatmap_coalesce_points`, so that points seen many times, like clicks on
+ * the same button, get stamped only once, weighted by how often they're seen.
+ * That's no help when most points are unique, as the coalescing isn't free.
+ *
+ * In order to bound the memory needed, the points are coalesced and stamped
+ * one chunk of about a million at a time; duplicates in different chunks are
+ * stamped once per chunk. Because the weights get summed before stamping,
+ * the result may differ from stamping every point in its last bits.
+ *
+ * return: How many points got stamped. `n` divided by that is the reduction.
+ */
+size_t heatmap_add_points_coalesced(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap using
+ * a given stamp, by first counting how many points (or how much weight) fall
+ * onto every pixel, and then adding the stamp once for every pixel, weighted
+ * by its count, using `heatmap_convolve`.
+ *
+ * Counting costs next to nothing per point, but the convolution costs as much
+ * as stamping one point onto every pixel which has points within the stamp's
+ * reach. Thus, this pays off once there are more points than pixels (or
+ * many points on the same pixels), and then the speedup grows with every
+ * additional point.
+ *
+ * The result is the same as that of `heatmap_add_weighted_points_with_stamp`
+ * up to floating-point rounding, since the additions happen in another order.
+ * It needs memory for a copy of the map for counting, and for a few rows per
+ * thread; if there's not enough, it adds the points one by one instead.
+ * See `heatmap_add_points_parallel` for the meaning of the arguments.
+ */
+void heatmap_add_points_convolved(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Adds the convolution of the `counts` heatmap with the stamp onto the `h`
+ * heatmap, which is the same as adding the stamp, weighted by the count,
+ * centered on every single pixel of `counts`.
+ *
+ * This lets you count your points yourself, for example while streaming
+ * billions of them from a file: add them onto `counts` using a 1x1 stamp
+ * and lazy-max mode, then call this once. See `heatmap_add_points_convolved`.
+ *
+ * counts: A heatmap of the same size as `h`, in any layout. It is only read from.
+ * nthreads: How many threads to use, 0 meaning OpenMP's default.
+ *
+ * return: Non-zero on success, zero if `counts` has another size than `h` or
+ *         there's not enough memory, in which case `h` is left unchanged.
+ */
+int heatmap_convolve(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Same as `heatmap_add_points_convolved`, but using a separable stamp, which
+ * is applied by `heatmap_convolve_separable`. If there's not enough memory
+ * for that, the points are stamped one by one using `heatmap_sepstamp_to_stamp`.
+ */
+void heatmap_add_points_separable(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_sepstamp_t* stamp, unsigned nthreads);
+
+/* Same as `heatmap_convolve`, but using a separable stamp: every row of
+ * `counts` is first convolved with the stamp's `kx`, then every column of
+ * that with its `ky`. Rows without counts are skipped in both passes.
+ *
+ * This costs about (w+h)/(w*h) of what `heatmap_convolve` costs with the
+ * equivalent dense stamp, but needs memory for one more copy of the map.
+ */
+int heatmap_convolve_separable(heatmap_t* h, const heatmap_t* counts, const heatmap_sepstamp_t* stamp, unsigned nthreads);
+
+/* Same as `heatmap_add_points_convolved`, but using `heatmap_convolve_fft`. */
+void heatmap_add_points_fft(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Same as `heatmap_convolve`, but multiplying the Fourier transforms of the
+ * counts and of the stamp instead, which costs O(log(w*h)) per pixel instead
+ * of O(w*h) for a w x h stamp, whatever the stamp looks like. This is the way
+ * to go for huge stamps, or huge custom stamps which aren't separable.
+ *
+ * The map is worked on in blocks of at least 256 pixels and at least the
+ * stamp's size per side, one after the other, each block's overhang being
+ * added onto its neighbours. Thus, it needs memory for two blocks of about
+ * 4x the stamp's size (in doubles), a row per thread, and, unless `counts` is
+ * row-major, a row-major copy of it. Blocks without counts are skipped.
+ */
+int heatmap_convolve_fft(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Same as `heatmap_add_points_convolved`, but using `heatmap_convolve_boxes`.
+ * If the stamp's total heat isn't positive, or there's not enough memory,
+ * the points are stamped exactly instead.
+ */
+void heatmap_add_points_boxes(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned passes, unsigned nthreads);
+
+/* APPROXIMATES `heatmap_convolve` by using a Gaussian of the same total heat
+ * and the same spread along x and y as the stamp instead of the stamp, made
+ * of `passes` box blurs of the counts, one after the other. Box blurs are
+ * done using running sums, so they cost a few additions per pixel and pass,
+ * whatever the stamp's size. This is meant for previews, where the stamp's
+ * radius has to change interactively.
+ *
+ * passes: The quality/speed knob, 0 meaning the default of 3. One pass gives
+ *         square blobs, off by about 45% of the max from a Gaussian stamp.
+ *         Three are round, but their peaks are about 10% too low, and six
+ *         about 5%. At most 16 are done.
+ *
+ * Only the bounding box of the counts, grown by the stamp's reach, is blurred,
+ * which needs memory for two copies of it. Use `heatmap_relative_error` to
+ * see how far off the result is from the exact one for your stamp.
+ *
+ * return: Non-zero on success, zero if `counts` has another size than `h`,
+ *         the stamp's total heat isn't positive, or there's not enough memory,
+ *         in which case `h` is left unchanged.
+ */
+int heatmap_convolve_boxes(heatmap_t* h, const heatmap_t* counts, const heatmap_stamp_t* stamp, unsigned passes, unsigned nthreads);
+
+/* Same as `heatmap_add_points_convolved`, but using `heatmap_convolve_gaussian`.
+ * If there's not enough memory, the points are stamped one by one instead.
+ */
+void heatmap_add_points_gaussian(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, float sigma, unsigned nthreads);
+
+/* Adds the convolution of the `counts` heatmap with a Gaussian stamp of the
+ * given standard deviation onto the `h` heatmap, which is nearly the same as
+ * `heatmap_convolve_separable` with `heatmap_sepstamp_gen_gaussian(sigma, 5)`,
+ * but costs the same for every sigma: a few dozen multiplications per pixel.
+ *
+ * This runs Deriche's recursive (IIR) approximation of the Gaussian along the
+ * rows, then along the columns, in doubles. It's off by less than 0.1% of
+ * the max. Below a sigma of 1, it uses the separable stamp instead, which is
+ * cheap there.
+ *
+ * Only the bounding box of the counts, grown by 5 sigmas, is filtered, which
+ * needs memory for one copy of it in doubles.
+ *
+ * return: Non-zero on success, zero if `counts` has another size than `h` or
+ *         there's not enough memory, in which case `h` is left unchanged.
+ */
+int heatmap_convolve_gaussian(heatmap_t* h, const heatmap_t* counts, float sigma, unsigned nthreads);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap using
+ * a difference stamp: every point costs nx*ny additions onto a grid of the
+ * map's size, whatever the stamp's size (4 for a box, 9 for a pyramid), which
+ * then gets summed up along the rows and the columns, ox and oy times. Thus,
+ * it costs O(n + w*h) instead of O(n*stamp size) for a w x h map.
+ *
+ * The result is the same as that of `heatmap_add_weighted_points_with_stamp`
+ * with `heatmap_diffstamp_to_stamp` up to floating-point rounding, which the
+ * sums are done in doubles for. That needs memory for a copy of the map in
+ * doubles; if there's not enough, the points are stamped one by one instead.
+ * See `heatmap_add_points_parallel` for the meaning of the arguments; only
+ * the sums are done in parallel.
+ */
+void heatmap_add_points_diff(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_diffstamp_t* stamp, unsigned nthreads);
+
+/* The exact ways of adding a batch of points with a stamp, see `heatmap_plan_new`. */
+typedef enum {
+    HEATMAP_ENGINE_STAMP = 0, /* Stamping every point, in parallel bands if nthreads > 1. */
+    HEATMAP_ENGINE_CONVOLVED, /* `heatmap_add_points_convolved`. */
+    HEATMAP_ENGINE_SEPARABLE, /* `heatmap_add_points_separable`, for separable stamps. */
+    HEATMAP_ENGINE_FFT,       /* `heatmap_add_points_fft`. */
+    HEATMAP_ENGINE_DIFF,      /* `heatmap_add_points_diff`, for separable stamps. */
+    HEATMAP_ENGINE_COUNT      /* Not an engine, just how many there are. */
+} heatmap_engine_t;
+
+/* The machine-dependent constants of the planner's cost model, in seconds
+ * on a single thread. They are measured by `heatmap_calibrate`.
+ */
+typedef struct {
+    double point;           /* Counting one point onto a map. */
+    double stamp_point;     /* Stamping one point, whatever the stamp's size... */
+    double stamp;           /* ...plus one pixel of its stamp. */
+    double convolve_pixel;  /* One pixel of the map, whatever the stamp's size... */
+    double convolve;        /* ...plus one pixel of the stamp. */
+    double separable_pixel; /* One pixel of the map, whatever the stamp's size... */
+    double separable;       /* ...plus one pixel of the stamp's row and column. */
+    double fft;             /* One value of a transformed block, per log2 of its size. */
+    double diff_point;      /* One difference of one point. */
+    double diff_pixel;      /* One pixel of the map, whatever the stamp... */
+    double diff;            /* ...plus one per order of differences. */
+} heatmap_costs_t;
+
+/* A plan says which of the engines will most likely be the fastest for adding
+ * a batch of points with a given stamp onto a given map, and how long every
+ * one of them is estimated to take, e.g. for logging.
+ */
+typedef struct {
+    heatmap_engine_t engine; /* The engine `heatmap_plan_run` uses. You may
+                                change it to any other one whose cost isn't
+                                negative. */
+    double costs[HEATMAP_ENGINE_COUNT]; /* The estimated seconds of every engine,
+                                           negative for those which can't be
+                                           used with the stamp. */
+    unsigned nthreads;                /* See `heatmap_add_points_parallel`. */
+    const heatmap_stamp_t* stamp;     /* The stamp, which must outlive the plan. */
+    heatmap_sepstamp_t* sep;          /* The stamp's rows and columns, or NULL
+                                         if it isn't separable. */
+    heatmap_diffstamp_t* diff;        /* The stamp's differences, or NULL if it
+                                         isn't separable. */
+} heatmap_plan_t;
+
+/* Plans adding a batch of `n` points with `stamp` onto `h` (or any map of the
+ * same size) using `nthreads` threads. Looks at the stamp to find out which
+ * engines can use it, and estimates the time every one of them takes using
+ * the cost model, which gets calibrated first if that hasn't happened yet.
+ * Only engines giving the same result as stamping every point are planned,
+ * as the approximate ones (`heatmap_add_points_boxes` and
+ * `heatmap_add_points_gaussian`) are a tradeoff only the caller can make.
+ *
+ * return: The plan, or NULL if there's not enough memory.
+ */
+heatmap_plan_t* heatmap_plan_new(const heatmap_t* h, size_t n, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Adds the `n` points with the plan's stamp onto `h` using the plan's engine.
+ * See `heatmap_add_points_parallel` for the meaning of the arguments. The
+ * plan can be run any number of times, the cost being the same for other
+ * `n` of the same order of magnitude.
+ */
+void heatmap_plan_run(const heatmap_plan_t* p, heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride);
+
+/* Frees up all memory taken by the plan, but not its stamp. */
+void heatmap_plan_free(heatmap_plan_t* p);
+
+/* The name of the engine, like "fft", for logging. */
+const char* heatmap_engine_name(heatmap_engine_t engine);
+
+/* Plans and runs adding the batch of points in one go, see `heatmap_plan_new`.
+ * If there's not enough memory for planning, every point gets stamped.
+ */
+void heatmap_add_points_auto(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, size_t n, size_t stride, const heatmap_stamp_t* stamp, unsigned nthreads);
+
+/* Measures the cost model's constants by running every engine on a small
+ * problem, which takes a fraction of a second. That happens the first time
+ * a plan is made, unless either this or `heatmap_set_costs` was called.
+ * You can run it at install time and save `heatmap_get_costs`'s result, to
+ * be handed to `heatmap_set_costs` at startup.
+ *
+ * These are global settings. When several threads make their first plans at
+ * once, only one of them calibrates while the others wait for it. Setting the
+ * costs while other threads are making plans is fine, each plan sees either
+ * the old or the new costs. Calibrating then works too, but the other threads
+ * skew its timings.
+ */
+void heatmap_calibrate(void);
+void heatmap_get_costs(heatmap_costs_t* costs);
+void heatmap_set_costs(const heatmap_costs_t* costs);
+
+/* The largest difference between any pixel of the `approx` and `exact`
+ * heatmaps, relative to the hottest pixel of `exact`; e.g. 0.01 means off by
+ * at most 1% of the max. Returns -1 if the maps' sizes differ or there's not
+ * enough memory.
+ */
+float heatmap_relative_error(const heatmap_t* approx, const heatmap_t* exact);
+
+/* Adds the whole heat of the `src` heatmap onto the `h` heatmap, such that
+ * `src`'s top-left pixel lands on (x, y). Whatever ends up outside of `h` is
+ * ignored. `h`'s max is updated just like when adding points.
+ *
+ * This is useful for letting every thread accumulate points into its own
+ * (possibly smaller) heatmap, a "shard", without any locking, and then
+ * combining the shards at the end.
+ */
+void heatmap_merge(heatmap_t* h, const heatmap_t* src, unsigned x, unsigned y);
+
+/* Merges `n` shards into the heatmap at once using multiple threads. The
+ * result is exactly the same as calling `heatmap_merge` for every shard in
+ * order.
+ *
+ * shards: The heatmaps to add onto `h`. They are only read from.
+ * xs, ys: Where the top-left pixel of the i-th shard lands is (xs[i], ys[i]).
+ *         Either may be NULL, meaning 0 for all shards.
+ * nthreads: How many threads to use, 0 meaning OpenMP's default.
+ */
+void heatmap_merge_shards(heatmap_t* h, const heatmap_t* const* shards, const unsigned* xs, const unsigned* ys, size_t n, unsigned nthreads);
+
+/* A heatmap of only the points added within a sliding window of time, like
+ * "the last 15 minutes", made of a ring of buckets: one heatmap per tick of
+ * the clock, like one per minute. Points are added onto the current bucket,
+ * and every tick (see `heatmap_window_advance`) the oldest bucket is dropped
+ * and reused as the new current one.
+ *
+ * The window keeps a running total of the other buckets, so dropping the
+ * oldest one doesn't rebuild the map from all of the buckets, but takes a
+ * single pass subtracting its heat from the total. That total is stored in
+ * 64-bit fixed-point with 32 fractional bits, where the heat of a bucket is
+ * rounded the very same way when it's added and when it's subtracted again,
+ * so no matter how many ticks pass, the window's heat is exactly the sum of its
+ * buckets' rounded heat, with no rounding errors piling up. Only heat below
+ * 2^-33 rounds away, and a pixel holds about 4 billion heat. Should one
+ * saturate anyway, the total is rebuilt from the buckets on every tick, until
+ * it fits again.
+ */
+typedef struct heatmap_window heatmap_window_t;
+
+/* Creates a new window over `nbuckets` buckets, each of them a heatmap of the
+ * given size which is either dense, or sparse (see `heatmap_new_sparse`) if
+ * `sparse` is non-zero, which saves lots of memory when every tick touches
+ * only a small part of the map. The window shows the current bucket and the
+ * `nbuckets`-1 ones before it, so it's at least `nbuckets`-1 ticks long.
+ *
+ * Returns NULL if `nbuckets` is 0 or there's not enough memory.
+ */
+heatmap_window_t* heatmap_window_new(unsigned w, unsigned h, unsigned nbuckets, int sparse);
+
+/* Returns the current bucket, for adding points to it with any of the
+ * `heatmap_add_*` functions. It's in lazy-max mode (see `heatmap_set_lazy_max`)
+ * and may be switched to concurrent mode, but its storage, layout and `decay`
+ * must stay as they are. It's only the current one until the next tick.
+ */
+heatmap_t* heatmap_window_current(heatmap_window_t* win);
+
+/* Ticks the clock: the current bucket's heat is added onto the running total,
+ * the oldest bucket's heat is subtracted from it and that bucket is cleared
+ * to become the new current one. That's a single pass over the map, using
+ * SIMD and skipping the untouched tiles of sparse buckets. This mustn't happen
+ * while points are being added.
+ */
+void heatmap_window_advance(heatmap_window_t* win);
+
+/* Returns the heat of the whole window as a heatmap of floats, for reading
+ * it with `heatmap_get_max` and `heatmap_to_rowmajor` or rendering it. That's
+ * the running total plus the current bucket, which is rebuilt by every call,
+ * so call it once per render. The map belongs to the window: don't add to it
+ * nor free it, and don't use it after the next call or after freeing the window.
+ */
+heatmap_t* heatmap_window_map(heatmap_window_t* win);
+
+/* Frees up all memory taken by the window, including its buckets. */
+void heatmap_window_free(heatmap_window_t* win);
+
+/* The instruction sets the stamping kernels can make use of, in order of
+ * preference on the respective architecture.
+ */
+typedef enum {
+    HEATMAP_SIMD_AUTO = 0, /* Pick the best one the CPU supports. */
+    HEATMAP_SIMD_SCALAR,   /* Plain C, works everywhere. */
+    HEATMAP_SIMD_SSE2,
+    HEATMAP_SIMD_AVX2,     /* AVX2, FMA and F16C. */
+    HEATMAP_SIMD_AVX512,   /* AVX-512F. */
+    HEATMAP_SIMD_NEON
+} heatmap_simd_t;
+
+/* By default, the fastest kernels the running CPU supports are picked the
+ * first time a point is added, so you don't need to call this. It is mostly
+ * useful for benchmarking and testing the kernels against each other.
+ * Define HEATMAP_NO_SIMD when compiling the library to only ever use plain C.
+ *
+ * level: The instruction set to use from now on. If the CPU doesn't support
+ *        it, the best supported one below it is used instead.
+ *
+ * return: The instruction set which is actually used from now on.
+ *
+ * Note that this is a global setting. Picking the kernels the first time is
+ * thread-safe, but switching them while other threads are adding points is
+ * not supported: a single add may then use kernels of both levels.
+ */
+heatmap_simd_t heatmap_simd_select(heatmap_simd_t level);
+
+/* Returns the instruction set currently used by the stamping kernels. */
+heatmap_simd_t heatmap_simd_current(void);
+
 /* Renders an image of the heatmap into the given colorbuf.
  *
  * colorbuf: A buffer large enough to hold 4*heatmap_width*heatmap_height
@@ -152,6 +882,136 @@ heatmap_stamp_t* heatmap_stamp_gen_nonlinear(unsigned radius, float (*distshape)
 /* Frees up all memory taken by the stamp. */
 void heatmap_stamp_free(heatmap_stamp_t* s);
 
+/* A stamp cache hands out shared stamps generated by `heatmap_stamp_gen` and
+ * `heatmap_stamp_gen_nonlinear`, so that rendering at the same radius again
+ * doesn't generate the stamp again. It can be used by many threads at once.
+ */
+typedef struct heatmap_stampcache heatmap_stampcache_t;
+
+/* Creates a new, empty stamp cache which keeps at most about `max_bytes` of
+ * stamps around. When a new stamp doesn't fit, the least recently used stamps
+ * which nobody holds on to anymore are freed. Stamps which are still in use
+ * are never freed, so the cache may grow over `max_bytes` while they are.
+ * Returns NULL if there's no memory.
+ */
+heatmap_stampcache_t* heatmap_stampcache_new(size_t max_bytes);
+
+/* Returns the cached stamp of the given radius and `distshape` (see
+ * `heatmap_stamp_gen_nonlinear`; NULL is the default stamp's shape), and
+ * generates it if it isn't cached yet. The stamp must not be modified, and
+ * must be handed back using `heatmap_stampcache_release` once it's not used
+ * anymore. Returns NULL if there's no memory.
+ */
+const heatmap_stamp_t* heatmap_stampcache_get(heatmap_stampcache_t* c, unsigned radius, float (*distshape)(float));
+
+/* Tells the cache that a stamp returned by `heatmap_stampcache_get` isn't
+ * used anymore, which makes it eligible for eviction.
+ */
+void heatmap_stampcache_release(heatmap_stampcache_t* c, const heatmap_stamp_t* s);
+
+/* Gets how many times `heatmap_stampcache_get` found its stamp in the cache,
+ * how many times it had to generate it, and how many bytes of stamps the cache
+ * holds right now. Any of the pointers may be NULL.
+ */
+void heatmap_stampcache_stats(heatmap_stampcache_t* c, size_t* hits, size_t* misses, size_t* bytes);
+
+/* Frees up all memory taken by the cache and its stamps. All stamps must
+ * have been released before.
+ */
+void heatmap_stampcache_free(heatmap_stampcache_t* c);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap, every
+ * one of which has its own stamp: the i-th point is stamped with
+ * `stamps[cls[i]]`, regardless of `stride`. Points whose class isn't below
+ * `nstamps` or whose stamp is NULL are ignored.
+ *
+ * The points are first grouped by stamp, and then every group is added using
+ * `heatmap_add_points_parallel`, so within a group the result is the same as
+ * adding its points in order, but groups are added in the order of the
+ * stamps. If there's not enough memory for grouping, the points are stamped
+ * one by one.
+ * See `heatmap_add_points_parallel` for the meaning of the other arguments.
+ */
+void heatmap_add_points_with_stamps(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, const unsigned* cls, size_t n, size_t stride, const heatmap_stamp_t* const* stamps, unsigned nstamps, unsigned nthreads);
+
+/* Adds a whole batch of `n` (optionally weighted) points to the heatmap, the
+ * i-th point with a stamp of radius `rs[i]`, regardless of `stride`, like one
+ * from `heatmap_stamp_gen_nonlinear(rs[i], distshape)`. Think of GPS fixes,
+ * the radius being their accuracy.
+ *
+ * The stamps of all radii in use are taken from the `cache`, and those which
+ * aren't in there yet are generated in parallel. If `cache` is NULL, they are
+ * generated just for this batch. Then, the points are added using
+ * `heatmap_add_points_with_stamps`. `distshape` may be NULL for the default
+ * stamp's shape.
+ *
+ * Only the distinct radii matter, so a few outliers with a huge radius cost
+ * no more than their own stamps. Points whose stamp can't be had, because it
+ * would be too big or there's not enough memory, are skipped; all others are
+ * still added.
+ *
+ * return: 1 on success, 0 if some (or, without memory to sort the radii, all)
+ *         points were skipped.
+ */
+int heatmap_add_points_with_radii(heatmap_t* h, const unsigned* xs, const unsigned* ys, const float* ws, const unsigned* rs, size_t n, size_t stride, float (*distshape)(float), heatmap_stampcache_t* cache, unsigned nthreads);
+
+/* Creates a quantized copy of the stamp, see `heatmap_qstamp_t`. Values
+ * outside of [0, 1] are clamped. Returns NULL if there's no memory.
+ */
+heatmap_qstamp_t* heatmap_qstamp_from_stamp(const heatmap_stamp_t* s);
+/* Frees up all memory taken by the quantized stamp. */
+void heatmap_qstamp_free(heatmap_qstamp_t* s);
+
+/* Creates a new separable stamp COPYING the given w floats in kx and h floats
+ * in ky, see `heatmap_sepstamp_t`.
+ */
+heatmap_sepstamp_t* heatmap_sepstamp_load(unsigned w, unsigned h, const float* kx, const float* ky);
+
+/* Generates a round Gaussian separable stamp, which is 1 at its center and
+ * exp(-d²/2sigma²) at a distance d of it.
+ *
+ * sigma: The standard deviation, in pixels.
+ * truncate: Where to cut off the stamp, in standard deviations. The stamp has
+ *           a size of 2*ceil(sigma*truncate)+1 square. 3 leaves out about
+ *           0.5% of the heat at the stamp's borders; 4 about 0.01%.
+ */
+heatmap_sepstamp_t* heatmap_sepstamp_gen_gaussian(float sigma, float truncate);
+
+/* Creates the equivalent (non-separable) stamp of a separable stamp, to be
+ * used with all other functions.
+ */
+heatmap_stamp_t* heatmap_sepstamp_to_stamp(const heatmap_sepstamp_t* s);
+
+/* Frees up all memory taken by the separable stamp. */
+void heatmap_sepstamp_free(heatmap_sepstamp_t* s);
+
+/* Generates a w x h box difference stamp, all of which is 1. */
+heatmap_diffstamp_t* heatmap_diffstamp_gen_box(unsigned w, unsigned h);
+
+/* Generates a square difference stamp of a size of 2*radius+1 whose rows and
+ * columns are (1 - d)^degree, d being the distance from the center, 0 at the
+ * center and 1 one-behind the radius. Degree 0 is a box, degree 1 a pyramid.
+ * Every point then costs 4, 9, 36 and 81 additions for degrees 0 to 3; any
+ * higher degree doesn't pay off anymore.
+ */
+heatmap_diffstamp_t* heatmap_diffstamp_gen_poly(unsigned radius, unsigned degree);
+
+/* Creates a difference stamp out of any separable stamp, using the order of
+ * differences (up to 4) which has the fewest non-zero ones. That only pays
+ * off for stamps made of low-degree polynomials; for others like Gaussians,
+ * most differences aren't zero. Differences which are only due to the
+ * rounding of the stamp's values are dropped.
+ */
+heatmap_diffstamp_t* heatmap_diffstamp_from_sepstamp(const heatmap_sepstamp_t* s);
+
+/* Creates the equivalent (non-separable) stamp of a difference stamp, to be
+ * used with all other functions.
+ */
+heatmap_stamp_t* heatmap_diffstamp_to_stamp(const heatmap_diffstamp_t* s);
+
+/* Frees up all memory taken by the difference stamp. */
+void heatmap_diffstamp_free(heatmap_diffstamp_t* s);
+
 /* Create a new colorscheme using a COPY of the given `ncolors` `colors`.
  *
  * colors: a buffer containing RGBA colors to use when rendering the heatmap.
@@ -22,6 +22,7 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/pytypes.h>
@@ -46,6 +47,60 @@ static bool almost_eq_float_array(float* a, float* b, size_t n)
     return true;
 }
 
+// Renders the heatmap to RGBA bytes, normalized to its max if `saturation`
+// is null and saturated at that heat otherwise.
+static py::bytes render_heatmap(const heatmap_t* heatmap, const heatmap_colorscheme_t* colorscheme, const float* saturation)
+{
+    if (heatmap == nullptr)
+    {
+        return py::bytes();
+    }
+    size_t buf_size = heatmap->w*heatmap->h*4;
+    char* retbuf = reinterpret_cast<char*>(malloc(buf_size));
+    if (retbuf == nullptr)
+    {
+        return py::bytes();
+    }
+    unsigned char* pixels = reinterpret_cast<unsigned char*>(retbuf);
+    if (saturation != nullptr)
+    {
+        heatmap_render_saturated_to(heatmap, colorscheme, *saturation, pixels);
+    }
+    else
+    {
+        heatmap_render_to(heatmap, colorscheme, pixels);
+    }
+    py::bytes ret(retbuf, buf_size);
+    free(retbuf);
+    return ret;
+}
+
+// Feeds the points to the C batch API a chunk at a time, so that ctrl-c
+// can still interrupt. The pairs are laid out as "x y x y ...", and
+// negative coordinates wrap around to huge unsigned ones which get culled.
+static void add_points_batched(heatmap_t* heatmap, const std::vector<std::pair<int, int>>& points, const heatmap_stamp_t* stamp)
+{
+    static const size_t chunk = 4096;
+    const unsigned* xy = reinterpret_cast<const unsigned*>(points.data());
+    for(size_t i = 0; i < points.size(); i += chunk)
+    {
+        // handling to allow ctrl-c to interrupt.
+        if (PyErr_CheckSignals() != 0)
+        {
+            throw py::error_already_set();
+        }
+        const size_t n = std::min(chunk, points.size() - i);
+        if (stamp != nullptr)
+        {
+            heatmap_add_points_with_stamp(heatmap, xy + 2*i, xy + 2*i + 1, n, 2, stamp);
+        }
+        else
+        {
+            heatmap_add_points(heatmap, xy + 2*i, xy + 2*i + 1, n, 2);
+        }
+    }
+}
+
 class PyHeatmapStamp
 {
 public:
@@ -167,7 +222,7 @@ public:
     
     float get_max()
     {
-        return heatmap != nullptr ? heatmap->max: -1.0f;
+        return heatmap != nullptr ? heatmap_get_max(heatmap) : -1.0f;
     }
 
     bool operator==(const PyHeatmap& b) const
@@ -214,15 +269,7 @@ public:
 
     void add_points(const std::vector<std::pair<int, int>>& points)
     {
-        for(const auto& pair : points)
-        {
-            // handling to allow ctrl-c to interrupt.
-            if (PyErr_CheckSignals() != 0)
-            {
-                throw py::error_already_set();
-            }
-            heatmap_add_point(heatmap, pair.first, pair.second);
-        }
+        add_points_batched(heatmap, points, nullptr);
     }
 
     void add_point_with_stamp(int x, int y, const PyHeatmapStamp& stamp)
@@ -250,74 +297,100 @@ public:
     
     void add_points_with_stamp(const std::vector<std::pair<int, int>>& points, const PyHeatmapStamp& stamp)
     {
-        const heatmap_stamp_t* stamp_ptr = stamp.get_stamp();
-        for(const auto& pair : points)
-        {
-            // handling to allow ctrl-c to interrupt.
-            if (PyErr_CheckSignals() != 0)
-            {
-                throw py::error_already_set();
-            }
-            heatmap_add_point_with_stamp(heatmap, pair.first, pair.second, stamp_ptr);
-        }
+        add_points_batched(heatmap, points, stamp.get_stamp());
     }
 
     py::bytes render_default()
     {
-        if (heatmap == nullptr)
-        {
-            return py::bytes();
-        }
-        size_t buf_size = heatmap->w*heatmap->h*4;
-        char* retbuf = reinterpret_cast<char*>(malloc(buf_size));
-        if (retbuf == nullptr)
-        {
-            return py::bytes();
-        }
-        unsigned char* pixels = reinterpret_cast<unsigned char*>(retbuf);
-        heatmap_render_default_to(heatmap, pixels);
-        return py::bytes(retbuf, buf_size);
+        return render_heatmap(heatmap, heatmap_cs_default, nullptr);
     }
 
     py::bytes render_with_color_scheme(PyColorScheme colorScheme)
     {
-        if (heatmap == nullptr)
-        {
-            return py::bytes();
-        }
-        size_t buf_size = heatmap->w*heatmap->h*4;
-        char* retbuf = reinterpret_cast<char*>(malloc(buf_size));
-        if (retbuf == nullptr)
-        {
-            return py::bytes();
-        }
-        unsigned char* pixels = reinterpret_cast<unsigned char*>(retbuf);
-        const heatmap_colorscheme_t* colorscheme = GetColorScheme(colorScheme);        
-        heatmap_render_to(heatmap, colorscheme, pixels);
-        return py::bytes(retbuf, buf_size);
+        return render_heatmap(heatmap, GetColorScheme(colorScheme), nullptr);
     }
 
     py::bytes render_saturated(PyColorScheme colorScheme, float saturation)
     {
-        if (heatmap == nullptr)
-        {
-            return py::bytes();
-        }
-        size_t buf_size = heatmap->w*heatmap->h*4;
-        char* retbuf = reinterpret_cast<char*>(malloc(buf_size));
-        if (retbuf == nullptr)
+        return render_heatmap(heatmap, GetColorScheme(colorScheme), &saturation);
+    }
+
+private:
+    heatmap_t* heatmap = nullptr;
+};
+
+class PyHeatmapWindow
+{
+public:
+    PyHeatmapWindow(unsigned w, unsigned h, unsigned nbuckets, bool sparse)
+    {
+        window = heatmap_window_new(w, h, nbuckets, sparse ? 1 : 0);
+        if (window == nullptr)
         {
-            return py::bytes();
+            throw std::runtime_error("can't create a window without buckets.");
         }
-        unsigned char* pixels = reinterpret_cast<unsigned char*>(retbuf);
-        const heatmap_colorscheme_t* colorscheme = GetColorScheme(colorScheme);
-        heatmap_render_saturated_to(heatmap, colorscheme, saturation, pixels);
-        return py::bytes(retbuf, buf_size);
     }
 
-private:
+    ~PyHeatmapWindow()
+    {
+        heatmap_window_free(window);
+    }
 
-    heatmap_t* heatmap = nullptr;
+    PyHeatmapWindow(const PyHeatmapWindow&) = delete;
+    PyHeatmapWindow& operator=(const PyHeatmapWindow&) = delete;
+
+    float get_max()
+    {
+        return heatmap_get_max(heatmap_window_map(window));
+    }
+
+    void add_point(int x, int y)
+    {
+        heatmap_add_point(heatmap_window_current(window), x, y);
+    }
+
+    void add_points(const std::vector<std::pair<int, int>>& points)
+    {
+        add_points_batched(heatmap_window_current(window), points, nullptr);
+    }
+
+    void add_point_with_stamp(int x, int y, const PyHeatmapStamp& stamp)
+    {
+        heatmap_add_point_with_stamp(heatmap_window_current(window), x, y, stamp.get_stamp());
+    }
+
+    void add_weighted_point_with_stamp(int x, int y, float weight, const PyHeatmapStamp& stamp)
+    {
+        heatmap_add_weighted_point_with_stamp(heatmap_window_current(window), x, y, weight, stamp.get_stamp());
+    }
+
+    void add_points_with_stamp(const std::vector<std::pair<int, int>>& points, const PyHeatmapStamp& stamp)
+    {
+        add_points_batched(heatmap_window_current(window), points, stamp.get_stamp());
+    }
+
+    void advance()
+    {
+        heatmap_window_advance(window);
+    }
+
+    py::bytes render_default()
+    {
+        return render_heatmap(heatmap_window_map(window), heatmap_cs_default, nullptr);
+    }
+
+    py::bytes render_with_color_scheme(PyColorScheme colorScheme)
+    {
+        return render_heatmap(heatmap_window_map(window), GetColorScheme(colorScheme), nullptr);
+    }
+
+    py::bytes render_saturated(PyColorScheme colorScheme, float saturation)
+    {
+        return render_heatmap(heatmap_window_map(window), GetColorScheme(colorScheme), &saturation);
+    }
+
+private:
+    heatmap_window_t* window = nullptr;
 };
 
 PYBIND11_MODULE(pyheatmap, m) {
@@ -423,6 +496,53 @@ const char *color_scheme_name[] = {
             Check to see if the heatmap is equal to the stamp. used for testing
         )pbdoc")
 ; 
+
+    py::class_<PyHeatmapWindow>(m, "PyHeatmapWindow")
+        .def(py::init([](unsigned w, unsigned h, unsigned nbuckets, bool sparse) { return new PyHeatmapWindow(w, h, nbuckets, sparse); }),
+            "w"_a, "h"_a, "nbuckets"_a, "sparse"_a = false)
+        .def("max", &PyHeatmapWindow::get_max,
+        R"pbdoc(
+            The highest heat within the whole window.
+        )pbdoc")
+        .def("add_point", &PyHeatmapWindow::add_point,
+        R"pbdoc(
+            Adds a single point to the current bucket using the default stamp.
+        )pbdoc")
+        .def("add_point_with_stamp", &PyHeatmapWindow::add_point_with_stamp,
+        R"pbdoc(
+            Adds a single point to the current bucket using a custom stamp.
+        )pbdoc")
+        .def("add_points", &PyHeatmapWindow::add_points,
+        R"pbdoc(
+            Adds multiple points to the current bucket using the default stamp.
+        )pbdoc")
+        .def("add_points_with_stamp", &PyHeatmapWindow::add_points_with_stamp,
+        R"pbdoc(
+            Adds multiple points to the current bucket using a custom stamp.
+        )pbdoc")
+        .def("add_weighted_point_with_stamp", &PyHeatmapWindow::add_weighted_point_with_stamp,
+        R"pbdoc(
+            Adds a single weighted point to the current bucket using a given stamp.
+        )pbdoc")
+        .def("advance", &PyHeatmapWindow::advance,
+        R"pbdoc(
+            Ticks the clock: the oldest bucket's heat leaves the window, and
+            that bucket is reused as the new current one.
+        )pbdoc")
+        .def("render_default", &PyHeatmapWindow::render_default,
+        R"pbdoc(
+            Render the window with the default color scheme to a byte array which can be converted to an image.
+        )pbdoc")
+        .def("render_with_color_scheme", &PyHeatmapWindow::render_with_color_scheme,
+        R"pbdoc(
+            Render the window with a color scheme to a byte array which can be converted to an image.
+        )pbdoc")
+        .def("render_saturated", &PyHeatmapWindow::render_saturated,
+        R"pbdoc(
+            Render the window with a color scheme to a byte array, truncating
+            the heat at the given saturation like `PyHeatmap.render_saturated`.
+        )pbdoc")
+;
                        
 
 #ifdef VERSION_INFO
@@ -24,7 +24,7 @@
 #
 
 from typing import List
-from pyheatmap import PyHeatmap, PyHeatmapStamp, PyColorScheme
+from pyheatmap import PyHeatmap, PyHeatmapStamp, PyHeatmapWindow, PyColorScheme
 from random import gauss
 import os
 
@@ -374,6 +374,25 @@ def test_add_nothing():
         assert (rawimg[idx] == 0)
     assert (libhm.max() == 0)
 
+def test_window():
+    win = PyHeatmapWindow(3, 3, 2)
+    stamp = create_3x3_stamp()
+
+    win.add_point_with_stamp(1, 1, stamp)
+    assert win.max() == 1.0, "the current bucket is part of the window"
+
+    win.advance()
+    win.add_point_with_stamp(1, 1, stamp)
+    win.add_point_with_stamp(1, 1, stamp)
+    assert win.max() == 3.0, "the window holds both buckets"
+    assert len(win.render_with_color_scheme(PyColorScheme.b2w)) == 3*3*4
+
+    win.advance()
+    assert win.max() == 2.0, "the oldest bucket leaves the window"
+
+    win.advance()
+    assert win.max() == 0.0, "all buckets left the window"
+
 if __name__ == "__main__":
     test_add_nothing()
     test_equality()
@@ -394,4 +413,6 @@ if __name__ == "__main__":
     test_render_to_normalizing()
     test_render_to_saturating()
 
+    test_window()
+
     exit(0)
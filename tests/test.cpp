@@ -22,9 +22,15 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
 #include <string.h> // memcmp
 #include <cmath>
+#include <climits>
+#include <vector>
 
 #include "heatmap.h"
 #include "colorschemes/gray.h"
@@ -78,7 +84,7 @@ static bool heatmaps_eq(heatmap_t* hm, heatmap_t* expected)
         && 0 == memcmp(expected->buf, hm->buf, sizeof(float)*hm->w*hm->h);
 }
 
-static bool stamp_eq(heatmap_stamp_t* s, float* expected)
+static bool stamp_eq(const heatmap_stamp_t* s, const float* expected)
 {
     return 0 == memcmp(expected, s->buf, sizeof(float)*s->w*s->h);
 }
@@ -88,6 +94,20 @@ static bool stamp_almost_eq(heatmap_stamp_t* s, float* expected)
     return almost_eq(s->buf, expected, s->w*s->h);
 }
 
+// Appends `n` weighted points to `pts` (x and y interleaved) and `ws`, spread
+// over [0, w) x [0, h) in a fixed, scattered pattern. Two out of three points
+// get `hotx` for x and/or `hoty` for y instead, unless that's `g_nohot`, which
+// makes for hot spots or rows.
+static const unsigned g_nohot = ~0u;
+static void gen_points(std::vector<unsigned>& pts, std::vector<float>& ws, unsigned n, unsigned w, unsigned h, unsigned hotx = g_nohot, unsigned hoty = g_nohot)
+{
+    for(unsigned i = 0 ; i < n ; ++i) {
+        pts.push_back(i % 3 && hotx != g_nohot ? hotx : (i*37) % w);
+        pts.push_back(i % 3 && hoty != g_nohot ? hoty : (i*91) % h);
+        ws.push_back(0.1f * static_cast<float>(i % 13));
+    }
+}
+
 void test_add_nothing()
 {
     heatmap_t* hm = heatmap_new(3, 3);
@@ -208,6 +228,1216 @@ void test_add_point_with_stamp_outside()
     heatmap_free(hm);
 }
 
+void test_add_points_aos_soa()
+{
+    // Some points are outside, some on the border, some well inside.
+    static unsigned aos[] = {
+        0, 0,   1, 1,   2, 2,   3, 1,   1, 3,   7, 7,   9, 0,   9, 9,   4, 5,   100, 100,
+    };
+    static unsigned xs[] = { 0, 1, 2, 3, 1, 7, 9, 9, 4, 100 };
+    static unsigned ys[] = { 0, 1, 2, 1, 3, 7, 0, 9, 5, 100 };
+    static float ws[] = { 1.0f, 2.0f, 0.5f, 3.0f, 0.25f, 1.5f, 2.0f, 4.0f, 1.0f, 8.0f };
+    const size_t n = sizeof(xs)/sizeof(xs[0]);
+
+    heatmap_t* expected = heatmap_new(10, 10);
+    heatmap_t* expected_w = heatmap_new(10, 10);
+    for(size_t i = 0 ; i < n ; ++i) {
+        heatmap_add_point_with_stamp(expected, xs[i], ys[i], &g_3x3_stamp);
+        heatmap_add_weighted_point_with_stamp(expected_w, xs[i], ys[i], ws[i], &g_3x3_stamp);
+    }
+
+    heatmap_t* hm_aos = heatmap_new(10, 10);
+    heatmap_t* hm_soa = heatmap_new(10, 10);
+    heatmap_add_points_with_stamp(hm_aos, aos, aos+1, n, 2, &g_3x3_stamp);
+    heatmap_add_points_with_stamp(hm_soa, xs, ys, n, 1, &g_3x3_stamp);
+
+    ENSURE_THAT("interleaved batch-added points are the same as single ones", heatmaps_eq(hm_aos, expected));
+    ENSURE_THAT("separate batch-added points are the same as single ones", heatmaps_eq(hm_soa, expected));
+    ENSURE_THAT("the max of the batch-added heatmap is right", hm_aos->max == expected->max);
+
+    heatmap_t* hm_w = heatmap_new(10, 10);
+    heatmap_add_weighted_points_with_stamp(hm_w, aos, aos+1, ws, n, 2, &g_3x3_stamp);
+
+    ENSURE_THAT("weighted batch-added points are the same as single ones", heatmaps_eq(hm_w, expected_w));
+    ENSURE_THAT("the max of the weighted batch-added heatmap is right", hm_w->max == expected_w->max);
+
+    heatmap_t* hm_nullw = heatmap_new(10, 10);
+    heatmap_add_weighted_points_with_stamp(hm_nullw, xs, ys, nullptr, n, 1, &g_3x3_stamp);
+
+    ENSURE_THAT("batch-adding points without weights is the same as unweighted", heatmaps_eq(hm_nullw, expected));
+
+    heatmap_free(expected);
+    heatmap_free(expected_w);
+    heatmap_free(hm_aos);
+    heatmap_free(hm_soa);
+    heatmap_free(hm_w);
+    heatmap_free(hm_nullw);
+}
+
+void test_simd_kernels()
+{
+    // Odd stamp widths and a map edge make sure the vector tails get exercised.
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(12);
+    static const unsigned pts[] = { 0, 0,   5, 30,   31, 31,   17, 2,   40, 40,   20, 20,   63, 11,   1, 62 };
+    static const float ws[] = { 1.0f, 0.3f, 2.5f, 0.7f, 1.1f, 4.0f, 0.01f, 9.0f };
+    const size_t n = sizeof(ws)/sizeof(ws[0]);
+
+    heatmap_simd_select(HEATMAP_SIMD_SCALAR);
+    ENSURE_THAT("the scalar kernel can always be selected", heatmap_simd_current() == HEATMAP_SIMD_SCALAR);
+
+    heatmap_t* expected = heatmap_new(64, 63);
+    heatmap_t* expected_w = heatmap_new(64, 63);
+    heatmap_add_points_with_stamp(expected, pts, pts+1, n, 2, stamp);
+    heatmap_add_weighted_points_with_stamp(expected_w, pts, pts+1, ws, n, 2, stamp);
+
+    for(int level = HEATMAP_SIMD_SSE2 ; level <= HEATMAP_SIMD_NEON ; ++level) {
+        if(heatmap_simd_select(static_cast<heatmap_simd_t>(level)) != level)
+            continue;
+
+        heatmap_t* hm = heatmap_new(64, 63);
+        heatmap_t* hm_w = heatmap_new(64, 63);
+        heatmap_add_points_with_stamp(hm, pts, pts+1, n, 2, stamp);
+        heatmap_add_weighted_points_with_stamp(hm_w, pts, pts+1, ws, n, 2, stamp);
+
+        ENSURE_THAT("the vectorized kernel adds exactly like the scalar one", heatmaps_eq(hm, expected));
+        ENSURE_THAT("the vectorized kernel finds the same max", hm->max == expected->max);
+        ENSURE_THAT("the vectorized weighted kernel adds like the scalar one", almost_eq(hm_w->buf, expected_w->buf, 64*63));
+        ENSURE_THAT("the vectorized weighted kernel finds the same max", std::abs(hm_w->max - expected_w->max) < 1e-5f);
+
+        heatmap_free(hm);
+        heatmap_free(hm_w);
+    }
+
+    heatmap_simd_select(HEATMAP_SIMD_AUTO);
+    ENSURE_THAT("some kernel gets selected automatically", heatmap_simd_current() != HEATMAP_SIMD_AUTO);
+
+    heatmap_free(expected);
+    heatmap_free(expected_w);
+    heatmap_stamp_free(stamp);
+}
+
+void test_lazy_max()
+{
+    static const unsigned pts[] = { 1, 1,   1, 2,   0, 0,   2, 2,   1, 1 };
+    static const float ws[] = { 1.0f, 2.0f, 0.5f, 3.0f, 1.0f };
+    const size_t n = sizeof(ws)/sizeof(ws[0]);
+
+    heatmap_t* expected = heatmap_new(3, 3);
+    heatmap_add_weighted_points_with_stamp(expected, pts, pts+1, ws, n, 2, &g_3x3_stamp);
+
+    heatmap_t* hm = heatmap_new(3, 3);
+    heatmap_set_lazy_max(hm, 1);
+    heatmap_add_weighted_points_with_stamp(hm, pts, pts+1, ws, n, 2, &g_3x3_stamp);
+
+    ENSURE_THAT("the lazy heatmap contains the same heat", heatmaps_eq(hm, expected));
+    ENSURE_THAT("the lazy heatmap's max is marked as outdated", hm->max_dirty);
+
+    unsigned char img[3*3*4] = {1}, expected_img[3*3*4] = {2};
+    heatmap_render_to(hm, heatmap_cs_b2w, img);
+    heatmap_render_to(expected, heatmap_cs_b2w, expected_img);
+    ENSURE_THAT("the lazy heatmap renders the same image", 0 == memcmp(img, expected_img, 3*3*4));
+
+    ENSURE_THAT("the lazy heatmap's max gets computed on demand", heatmap_get_max(hm) == expected->max);
+    ENSURE_THAT("the lazy heatmap's max field is up to date afterwards", hm->max == expected->max && !hm->max_dirty);
+
+    heatmap_add_point_with_stamp(hm, 1, 1, &g_3x3_stamp);
+    heatmap_add_point_with_stamp(expected, 1, 1, &g_3x3_stamp);
+    heatmap_set_lazy_max(hm, 0);
+    ENSURE_THAT("leaving lazy-max mode updates the max field", hm->max == expected->max);
+
+    heatmap_add_point_with_stamp(hm, 2, 2, &g_3x3_stamp);
+    heatmap_add_point_with_stamp(expected, 2, 2, &g_3x3_stamp);
+    ENSURE_THAT("the max is tracked again after leaving lazy-max mode", hm->max == expected->max && !hm->max_dirty);
+
+    heatmap_free(hm);
+    heatmap_free(expected);
+}
+
+void test_add_points_parallel()
+{
+    // Large stamps crossing band borders, points close to the map's borders,
+    // and some outside.
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 500, 70, 105);
+
+    for(unsigned nthreads = 1 ; nthreads <= 8 ; nthreads *= 2) {
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_t* hm = heatmap_new(64, 100);
+        heatmap_add_points_with_stamp(expected, &pts[0], &pts[1], ws.size(), 2, stamp);
+        heatmap_add_points_parallel(hm, &pts[0], &pts[1], nullptr, ws.size(), 2, stamp, nthreads);
+
+        ENSURE_THAT("parallel-added points are the same as serially added ones", heatmaps_eq(hm, expected));
+        ENSURE_THAT("parallel-added points have the same max", hm->max == expected->max);
+
+        heatmap_t* expected_w = heatmap_new(64, 100);
+        heatmap_t* hm_w = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected_w, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+        heatmap_add_points_parallel(hm_w, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+
+        ENSURE_THAT("parallel-added weighted points are the same as serially added ones", heatmaps_eq(hm_w, expected_w));
+        ENSURE_THAT("parallel-added weighted points have the same max", hm_w->max == expected_w->max);
+
+        heatmap_free(expected);
+        heatmap_free(hm);
+        heatmap_free(expected_w);
+        heatmap_free(hm_w);
+    }
+
+    // Most points in a few rows, so the hot bands need to be split further.
+    std::vector<unsigned> hot;
+    for(unsigned i = 0 ; i < 500 ; ++i) {
+        hot.push_back((i*37) % 64);
+        hot.push_back(i % 10 ? 40 + i % 3 : (i*91) % 100);
+    }
+
+    for(unsigned nthreads = 2 ; nthreads <= 8 ; nthreads *= 2) {
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_t* hm = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected, &hot[0], &hot[1], &ws[0], ws.size(), 2, stamp);
+        heatmap_add_points_parallel(hm, &hot[0], &hot[1], &ws[0], ws.size(), 2, stamp, nthreads);
+
+        ENSURE_THAT("parallel-added clustered points are the same as serially added ones", heatmaps_eq(hm, expected));
+        ENSURE_THAT("parallel-added clustered points have the same max", hm->max == expected->max);
+
+        heatmap_free(expected);
+        heatmap_free(hm);
+    }
+
+    heatmap_stamp_free(stamp);
+}
+
+void test_merge()
+{
+    static float expected[] = {
+        0.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 0.5f,
+        0.0f, 0.0f, 0.5f, 1.0f,
+    };
+
+    heatmap_t* shard = heatmap_new(3, 3);
+    heatmap_add_point_with_stamp(shard, 1, 1, &g_3x3_stamp);
+
+    // Hangs over the bottom-right border.
+    heatmap_t* hm = heatmap_new(4, 3);
+    heatmap_merge(hm, shard, 2, 1);
+    ENSURE_THAT("a merged shard is clipped to the map", 0 == memcmp(hm->buf, expected, sizeof(expected)));
+    ENSURE_THAT("merging a shard updates the max", hm->max == 1.0f);
+
+    heatmap_merge(hm, shard, 4, 0);
+    heatmap_merge(hm, shard, 0, 3);
+    ENSURE_THAT("a shard completely outside of the map is ignored", 0 == memcmp(hm->buf, expected, sizeof(expected)));
+    heatmap_free(hm);
+
+    // Merging many shards gives the same as merging them one after another.
+    heatmap_t* shards[] = { shard, heatmap_new(64, 100), heatmap_new(10, 20) };
+    heatmap_add_point(shards[1], 30, 40);
+    heatmap_add_point(shards[2], 5, 5);
+    static const unsigned xs[] = { 10, 0, 50 };
+    static const unsigned ys[] = { 90, 0, 85 };
+
+    heatmap_t* merged_expected = heatmap_new(64, 100);
+    for(unsigned i = 0 ; i < 3 ; ++i) {
+        heatmap_merge(merged_expected, shards[i], xs[i], ys[i]);
+    }
+
+    for(unsigned nthreads = 1 ; nthreads <= 8 ; nthreads *= 2) {
+        heatmap_t* merged = heatmap_new(64, 100);
+        heatmap_merge_shards(merged, shards, xs, ys, 3, nthreads);
+        ENSURE_THAT("merging shards at once is the same as one by one", heatmaps_eq(merged, merged_expected));
+        ENSURE_THAT("merging shards at once finds the same max", merged->max == merged_expected->max);
+        heatmap_free(merged);
+    }
+
+    heatmap_free(merged_expected);
+    for(unsigned i = 0 ; i < 3 ; ++i) {
+        heatmap_free(shards[i]);
+    }
+}
+
+void test_add_points_sharded()
+{
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 500, 70, 105);
+
+    heatmap_t* expected = heatmap_new(64, 100);
+    heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+
+    for(unsigned nthreads = 1 ; nthreads <= 8 ; nthreads *= 2) {
+        heatmap_t* hm = heatmap_new(64, 100);
+        heatmap_add_points_sharded(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+
+        // Summing in another order gives slightly different roundings.
+        float maxdiff = 0.0f;
+        for(size_t i = 0 ; i < 64*100 ; ++i) {
+            maxdiff = std::max(maxdiff, std::abs(hm->buf[i] - expected->buf[i]));
+        }
+        ENSURE_THAT("sharded-added points are the same as serially added ones", maxdiff < 1e-4f);
+        ENSURE_THAT("sharded-added points have the same max", std::abs(hm->max - expected->max) < 1e-4f);
+
+        heatmap_free(hm);
+    }
+
+    heatmap_free(expected);
+    heatmap_stamp_free(stamp);
+}
+
+void test_concurrent()
+{
+    std::vector<unsigned> pts;
+    for(unsigned i = 0 ; i < 2000 ; ++i) {
+        pts.push_back((i*37) % 20);
+        pts.push_back((i*91) % 22);
+    }
+
+    // The 3x3 stamp's values are all exactly representable, and so are their
+    // sums, which makes the result independent of the order of additions.
+    heatmap_t* expected = heatmap_new(19, 21);
+    heatmap_add_points_with_stamp(expected, &pts[0], &pts[1], pts.size()/2, 2, &g_3x3_stamp);
+
+    for(int lazy = 0 ; lazy <= 1 ; ++lazy) {
+        heatmap_t* hm = heatmap_new(19, 21);
+        heatmap_set_concurrent(hm, 1);
+        heatmap_set_lazy_max(hm, lazy);
+
+        // Many threads hammering the same pixels, one point at a time.
+#pragma omp parallel for num_threads(8)
+        for(int i = 0 ; i < static_cast<int>(pts.size()/2) ; ++i) {
+            heatmap_add_point_with_stamp(hm, pts[2*i], pts[2*i+1], &g_3x3_stamp);
+        }
+
+        ENSURE_THAT("concurrently added points are the same as serially added ones", heatmaps_eq(hm, expected));
+        ENSURE_THAT("concurrently added points have the same max", heatmap_get_max(hm) == expected->max);
+
+        heatmap_free(hm);
+    }
+
+    heatmap_free(expected);
+}
+
+void test_tiled()
+{
+    // Not a whole amount of tiles, and stamps crossing the tiles' borders.
+    const unsigned W = 150, H = 100;
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 500, 160, 105);
+
+    heatmap_t* expected = heatmap_new(W, H);
+    heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    heatmap_add_point(expected, 63, 64);
+
+    heatmap_t* hm = heatmap_new_tiled(W, H);
+    heatmap_add_weighted_points_with_stamp(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    heatmap_add_point(hm, 63, 64);
+
+    std::vector<float> rowmajor(W*H);
+    heatmap_to_rowmajor(hm, &rowmajor[0]);
+    ENSURE_THAT("a tiled heatmap contains the same heat", 0 == memcmp(&rowmajor[0], expected->buf, sizeof(float)*W*H));
+    ENSURE_THAT("a tiled heatmap has the same max", hm->max == expected->max);
+
+    std::vector<unsigned char> img(W*H*4), expected_img(W*H*4);
+    heatmap_render_default_to(hm, &img[0]);
+    heatmap_render_default_to(expected, &expected_img[0]);
+    ENSURE_THAT("a tiled heatmap renders the same image", img == expected_img);
+
+    heatmap_set_lazy_max(hm, 1);
+    heatmap_add_point(hm, 149, 99);
+    heatmap_add_point(expected, 149, 99);
+    ENSURE_THAT("a lazy tiled heatmap finds the same max", heatmap_get_max(hm) == expected->max);
+
+    ENSURE_THAT("a tiled heatmap can be converted back", heatmap_set_tiled(hm, 0) && !hm->tiled);
+    ENSURE_THAT("a converted heatmap contains the same heat", heatmaps_eq(hm, expected));
+    ENSURE_THAT("a row-major heatmap can be converted", heatmap_set_tiled(hm, 1) && hm->tiled);
+    heatmap_to_rowmajor(hm, &rowmajor[0]);
+    ENSURE_THAT("converting back and forth keeps the heat", 0 == memcmp(&rowmajor[0], expected->buf, sizeof(float)*W*H));
+
+    // Parallel adds and merges between both layouts.
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+        heatmap_t* par = heatmap_new_tiled(W, H);
+        heatmap_add_points_parallel(par, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+        heatmap_add_point(par, 63, 64);
+        heatmap_add_point(par, 149, 99);
+        heatmap_to_rowmajor(par, &rowmajor[0]);
+        ENSURE_THAT("parallel-added points on a tiled heatmap are the same", 0 == memcmp(&rowmajor[0], expected->buf, sizeof(float)*W*H));
+
+        heatmap_t* merged = heatmap_new(W + 10, H + 70);
+        heatmap_t* merged_expected = heatmap_new(W + 10, H + 70);
+        heatmap_t* tiled_merged = heatmap_new_tiled(W + 10, H + 70);
+        const heatmap_t* shards[] = { par };
+        const heatmap_t* expected_shards[] = { expected };
+        static const unsigned xs[] = { 30 }, ys[] = { 7 };
+        heatmap_merge_shards(merged, shards, xs, ys, 1, nthreads);
+        heatmap_merge_shards(merged_expected, expected_shards, xs, ys, 1, nthreads);
+        heatmap_merge_shards(tiled_merged, shards, xs, ys, 1, nthreads);
+        ENSURE_THAT("merging a tiled shard is the same", heatmaps_eq(merged, merged_expected));
+        heatmap_set_tiled(tiled_merged, 0);
+        ENSURE_THAT("merging a tiled shard into a tiled heatmap is the same", heatmaps_eq(tiled_merged, merged_expected));
+
+        heatmap_free(par);
+        heatmap_free(merged);
+        heatmap_free(merged_expected);
+        heatmap_free(tiled_merged);
+    }
+
+    heatmap_free(hm);
+    heatmap_free(expected);
+    heatmap_stamp_free(stamp);
+}
+
+void test_sparse()
+{
+    // A large map with points in just two small clusters.
+    const unsigned W = 1000, H = 700;
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 500, 20, 30);
+    for(size_t i = 0 ; i < ws.size() ; ++i) {
+        pts[2*i] += i % 2 ? 60 : 990;
+        pts[2*i+1] += i % 2 ? 120 : 650;
+    }
+
+    heatmap_t* expected = heatmap_new(W, H);
+    heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+
+    heatmap_t* hm = heatmap_new_sparse(W, H);
+    ENSURE_THAT("a new sparse heatmap has no tiles", heatmap_sparse_tiles_used(hm) == 0);
+    heatmap_add_weighted_points_with_stamp(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    ENSURE_THAT("a sparse heatmap only has the touched tiles", heatmap_sparse_tiles_used(hm) > 0 && heatmap_sparse_tiles_used(hm) <= 8);
+
+    std::vector<float> rowmajor(W*H, 1.0f);
+    heatmap_to_rowmajor(hm, &rowmajor[0]);
+    ENSURE_THAT("a sparse heatmap contains the same heat", 0 == memcmp(&rowmajor[0], expected->buf, sizeof(float)*W*H));
+    ENSURE_THAT("a sparse heatmap has the same max", hm->max == expected->max);
+
+    std::vector<unsigned char> img(W*H*4), expected_img(W*H*4);
+    heatmap_render_default_to(hm, &img[0]);
+    heatmap_render_default_to(expected, &expected_img[0]);
+    ENSURE_THAT("a sparse heatmap renders the same image", img == expected_img);
+
+    heatmap_set_lazy_max(hm, 1);
+    heatmap_add_weighted_point(hm, 500, 300, 100.0f);
+    heatmap_add_weighted_point(expected, 500, 300, 100.0f);
+    ENSURE_THAT("a lazy sparse heatmap finds the same max", heatmap_get_max(hm) == expected->max);
+
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+        heatmap_t* par = heatmap_new_sparse(W, H);
+        heatmap_add_points_parallel(par, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+        heatmap_add_weighted_point(par, 500, 300, 100.0f);
+
+        heatmap_t* merged = heatmap_new(W, H);
+        heatmap_merge(merged, par, 0, 0);
+        ENSURE_THAT("a merged parallel-added sparse heatmap is the same", heatmaps_eq(merged, expected));
+
+        heatmap_set_tiled(par, 0);
+        ENSURE_THAT("a sparse heatmap converts to a dense one", !par->tiles && heatmaps_eq(par, expected));
+
+        heatmap_free(par);
+        heatmap_free(merged);
+    }
+
+    // Threads racing for allocating the same tiles.
+    std::vector<unsigned> cpts;
+    for(unsigned i = 0 ; i < 2000 ; ++i) {
+        cpts.push_back((i*37) % 200);
+        cpts.push_back((i*91) % 150);
+    }
+    heatmap_t* cexpected = heatmap_new(W, H);
+    heatmap_add_points_with_stamp(cexpected, &cpts[0], &cpts[1], cpts.size()/2, 2, &g_3x3_stamp);
+    heatmap_t* chm = heatmap_new_sparse(W, H);
+    heatmap_set_concurrent(chm, 1);
+#pragma omp parallel for num_threads(8)
+    for(int i = 0 ; i < static_cast<int>(cpts.size()/2) ; ++i) {
+        heatmap_add_point_with_stamp(chm, cpts[2*i], cpts[2*i+1], &g_3x3_stamp);
+    }
+    heatmap_to_rowmajor(chm, &rowmajor[0]);
+    ENSURE_THAT("concurrently added points on a sparse heatmap are the same", 0 == memcmp(&rowmajor[0], cexpected->buf, sizeof(float)*W*H));
+
+    heatmap_free(chm);
+    heatmap_free(cexpected);
+    heatmap_free(hm);
+    heatmap_free(expected);
+    heatmap_stamp_free(stamp);
+}
+
+// The largest difference between the heat of two heatmaps of the same size.
+static float heatmap_maxdiff(const heatmap_t* a, const heatmap_t* b)
+{
+    std::vector<float> ra(a->w*a->h), rb(b->w*b->h);
+    heatmap_to_rowmajor(a, &ra[0]);
+    heatmap_to_rowmajor(b, &rb[0]);
+
+    float maxdiff = 0.0f;
+    for(size_t i = 0 ; i < ra.size() ; ++i) {
+        maxdiff = std::max(maxdiff, std::abs(ra[i] - rb[i]));
+    }
+    return maxdiff;
+}
+
+// The least heat of a heatmap, which mustn't be below zero for it to render.
+static float heatmap_minheat(const heatmap_t* h)
+{
+    std::vector<float> r(h->w*h->h);
+    heatmap_to_rowmajor(h, &r[0]);
+    return *std::min_element(r.begin(), r.end());
+}
+
+void test_add_points_convolved()
+{
+    // Many points on the same pixels, points on the borders and outside.
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    heatmap_stamp_t* wide = heatmap_stamp_gen_nonlinear(12, [](float d){return d*d;});
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 70, 105, g_nohot, 99);
+
+    const heatmap_stamp_t* stamps[] = { &g_3x3_stamp, stamp, wide };
+    for(const heatmap_stamp_t* s : stamps) {
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, s);
+
+        for(unsigned nthreads = 1 ; nthreads <= 8 ; nthreads *= 2) {
+            heatmap_t* hm = heatmap_new(64, 100);
+            heatmap_add_points_convolved(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, s, nthreads);
+            ENSURE_THAT("convolved points are the same as stamped ones", heatmap_maxdiff(hm, expected) < 1e-3f);
+            ENSURE_THAT("convolved points have the same max", std::abs(hm->max - expected->max) < 1e-3f);
+
+            heatmap_t* sparse = heatmap_new_sparse(64, 100);
+            heatmap_add_points_convolved(sparse, &pts[0], &pts[1], &ws[0], ws.size(), 2, s, nthreads);
+            ENSURE_THAT("convolved points on a sparse heatmap are the same", heatmap_maxdiff(sparse, expected) < 1e-3f);
+
+            heatmap_free(hm);
+            heatmap_free(sparse);
+        }
+
+        heatmap_free(expected);
+    }
+
+    // Counting the points yourself.
+    heatmap_t* expected = heatmap_new(64, 100);
+    heatmap_add_points_with_stamp(expected, &pts[0], &pts[1], ws.size(), 2, stamp);
+
+    static float one = 1.0f;
+    static heatmap_stamp_t dot = { &one, 1, 1 };
+    heatmap_t* counts = heatmap_new_tiled(64, 100);
+    heatmap_set_lazy_max(counts, 1);
+    heatmap_add_points_with_stamp(counts, &pts[0], &pts[1], ws.size(), 2, &dot);
+
+    heatmap_t* hm = heatmap_new(64, 100);
+    heatmap_set_lazy_max(hm, 1);
+    ENSURE_THAT("convolving self-counted points works", heatmap_convolve(hm, counts, stamp, 0));
+    ENSURE_THAT("convolving self-counted points gives the same heat", heatmap_maxdiff(hm, expected) < 1e-3f);
+    ENSURE_THAT("convolving self-counted points gives the same max", std::abs(heatmap_get_max(hm) - expected->max) < 1e-3f);
+
+    heatmap_t* small = heatmap_new(10, 10);
+    ENSURE_THAT("convolving counts of another size fails", !heatmap_convolve(hm, small, stamp, 0));
+
+    heatmap_free(small);
+    heatmap_free(hm);
+    heatmap_free(counts);
+    heatmap_free(expected);
+    heatmap_stamp_free(wide);
+    heatmap_stamp_free(stamp);
+}
+
+void test_sepstamp()
+{
+    heatmap_sepstamp_t* gauss = heatmap_sepstamp_gen_gaussian(2.0f, 3.0f);
+    ENSURE_THAT("the gaussian separable stamp has the right size", gauss->w == 13 && gauss->h == 13);
+
+    heatmap_stamp_t* dense = heatmap_sepstamp_to_stamp(gauss);
+    ENSURE_THAT("the gaussian stamp is 1 in the center", std::abs(dense->buf[6*13+6] - 1.0f) < 1e-6f);
+    ENSURE_THAT("the gaussian stamp is round", std::abs(dense->buf[6*13+8] - dense->buf[8*13+6]) < 1e-6f);
+    ENSURE_THAT("the gaussian stamp is a gaussian", std::abs(dense->buf[3*13+2] - std::exp(-25.0f/8.0f)) < 1e-6f);
+
+    heatmap_sepstamp_t* dot = heatmap_sepstamp_gen_gaussian(0.0f, 3.0f);
+    ENSURE_THAT("a gaussian separable stamp without sigma is a dot", dot->w == 1 && dot->h == 1 && dot->kx[0] == 1.0f && dot->ky[0] == 1.0f);
+
+    static const float kx[] = {0.5f, 1.0f, 0.25f};
+    static const float ky[] = {0.1f, 0.2f, 1.0f, 0.3f, 0.0f};
+    heatmap_sepstamp_t* skewed = heatmap_sepstamp_load(3, 5, kx, ky);
+    heatmap_stamp_t* skewed_dense = heatmap_sepstamp_to_stamp(skewed);
+    ENSURE_THAT("separable stamps are the product of their rows and columns", skewed_dense->buf[1*3+2] == 0.25f*0.2f);
+
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 70, 105, g_nohot, 99);
+
+    static float one = 1.0f;
+    static heatmap_stamp_t dot_dense = { &one, 1, 1 };
+    const heatmap_sepstamp_t* stamps[] = { gauss, dot, skewed };
+    const heatmap_stamp_t* denses[] = { dense, &dot_dense, skewed_dense };
+    for(unsigned s = 0 ; s < 3 ; ++s) {
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, denses[s]);
+
+        for(unsigned nthreads = 1 ; nthreads <= 8 ; nthreads *= 2) {
+            heatmap_t* hm = heatmap_new(64, 100);
+            heatmap_add_points_separable(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamps[s], nthreads);
+            ENSURE_THAT("separable points are the same as stamped ones", heatmap_maxdiff(hm, expected) < 1e-3f);
+            ENSURE_THAT("separable points have the same max", std::abs(hm->max - expected->max) < 1e-3f);
+
+            heatmap_t* sparse = heatmap_new_sparse(64, 100);
+            heatmap_add_points_separable(sparse, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamps[s], nthreads);
+            ENSURE_THAT("separable points on a sparse heatmap are the same", heatmap_maxdiff(sparse, expected) < 1e-3f);
+
+            heatmap_free(hm);
+            heatmap_free(sparse);
+        }
+
+        heatmap_free(expected);
+    }
+
+    heatmap_t* hm = heatmap_new(64, 100);
+    heatmap_t* small = heatmap_new(10, 10);
+    ENSURE_THAT("separably convolving counts of another size fails", !heatmap_convolve_separable(hm, small, gauss, 0));
+
+    heatmap_free(small);
+    heatmap_free(hm);
+    heatmap_stamp_free(skewed_dense);
+    heatmap_sepstamp_free(skewed);
+    heatmap_sepstamp_free(dot);
+    heatmap_stamp_free(dense);
+    heatmap_sepstamp_free(gauss);
+}
+
+void test_add_points_fft()
+{
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    heatmap_stamp_t* wide = heatmap_stamp_gen_nonlinear(40, [](float d){return d*d;});
+    static float skewed_data[] = {
+        0.1f, 0.2f, 0.3f, 0.4f,
+        0.5f, 0.6f, 0.7f, 1.0f,
+    };
+    static heatmap_stamp_t skewed = { skewed_data, 4, 2 };
+
+    // Enough points on a big enough map to span several blocks.
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 5000, 610, 705, g_nohot, 699);
+
+    const heatmap_stamp_t* stamps[] = { &g_3x3_stamp, stamp, wide, &skewed };
+    for(const heatmap_stamp_t* s : stamps) {
+        heatmap_t* expected = heatmap_new(600, 700);
+        heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, s);
+
+        for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 4) {
+            heatmap_t* hm = heatmap_new(600, 700);
+            heatmap_add_points_fft(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, s, nthreads);
+            ENSURE_THAT("FFT-convolved points are the same as stamped ones", heatmap_maxdiff(hm, expected) < 1e-3f);
+            ENSURE_THAT("FFT-convolved points have the same max", std::abs(hm->max - expected->max) < 1e-3f);
+            ENSURE_THAT("FFT-convolved points have no negative heat", heatmap_minheat(hm) >= 0.0f);
+
+            heatmap_t* sparse = heatmap_new_sparse(600, 700);
+            heatmap_add_points_fft(sparse, &pts[0], &pts[1], &ws[0], ws.size(), 2, s, nthreads);
+            ENSURE_THAT("FFT-convolved points on a sparse heatmap are the same", heatmap_maxdiff(sparse, expected) < 1e-3f);
+
+            heatmap_free(hm);
+            heatmap_free(sparse);
+        }
+
+        heatmap_free(expected);
+    }
+
+    // A single point far from everything only heats its own blocks.
+    const unsigned x = 10, y = 20;
+    heatmap_t* sparse = heatmap_new_sparse(2000, 2000);
+    heatmap_add_points_fft(sparse, &x, &y, nullptr, 1, 1, stamp, 0);
+    ENSURE_THAT("FFT-convolving a single point only touches its tiles", heatmap_sparse_tiles_used(sparse) == 1);
+    ENSURE_THAT("FFT-convolving a single point gives the stamp's max", std::abs(sparse->max - 1.0f) < 1e-5f);
+    ENSURE_THAT("FFT-convolving a single point leaves the rest at zero", heatmap_minheat(sparse) == 0.0f);
+
+    heatmap_t* small = heatmap_new(10, 10);
+    ENSURE_THAT("FFT-convolving counts of another size fails", !heatmap_convolve_fft(sparse, small, stamp, 0));
+
+    heatmap_free(small);
+    heatmap_free(sparse);
+    heatmap_stamp_free(wide);
+    heatmap_stamp_free(stamp);
+}
+
+void test_add_points_boxes()
+{
+    heatmap_sepstamp_t* sep = heatmap_sepstamp_gen_gaussian(6.0f, 5.0f);
+    heatmap_stamp_t* gauss = heatmap_sepstamp_to_stamp(sep);
+
+    std::vector<unsigned> pts;
+    for(unsigned i = 0 ; i < 300 ; ++i) {
+        pts.push_back((i*37) % 200);
+        pts.push_back(i % 3 ? 149 : (i*91) % 155);
+    }
+
+    heatmap_t* exact = heatmap_new(200, 150);
+    heatmap_add_points_with_stamp(exact, &pts[0], &pts[1], pts.size()/2, 2, gauss);
+
+    float errors[6] = {0};
+    for(unsigned passes = 1 ; passes <= 5 ; ++passes) {
+        heatmap_t* hm = heatmap_new(200, 150);
+        heatmap_add_points_boxes(hm, &pts[0], &pts[1], nullptr, pts.size()/2, 2, gauss, passes, 0);
+        errors[passes] = heatmap_relative_error(hm, exact);
+        heatmap_free(hm);
+    }
+    ENSURE_THAT("a box blur is a rough approximation of a gaussian", errors[1] > 0.0f && errors[1] < 0.5f);
+    ENSURE_THAT("three box blurs are a decent approximation of a gaussian", errors[3] < 0.15f);
+    ENSURE_THAT("more box blurs approximate a gaussian better", errors[5] < errors[3] && errors[3] < errors[1]);
+
+    heatmap_t* sparse = heatmap_new_sparse(200, 150);
+    heatmap_add_points_boxes(sparse, &pts[0], &pts[1], nullptr, pts.size()/2, 2, gauss, 0, 2);
+    ENSURE_THAT("box blurring onto a sparse heatmap works", heatmap_relative_error(sparse, exact) < 0.15f);
+    ENSURE_THAT("box blurring keeps the max up to date", std::abs(sparse->max - exact->max) < 0.15f*exact->max);
+
+    // A single point in the middle keeps all its heat.
+    const unsigned x = 100, y = 75;
+    heatmap_t* one = heatmap_new(200, 150);
+    heatmap_add_points_boxes(one, &x, &y, nullptr, 1, 1, gauss, 3, 1);
+    float total = 0.0f, stamptotal = 0.0f;
+    for(unsigned i = 0 ; i < 200*150 ; ++i) {
+        total += one->buf[i];
+    }
+    for(unsigned i = 0 ; i < gauss->w*gauss->h ; ++i) {
+        stamptotal += gauss->buf[i];
+    }
+    ENSURE_THAT("box blurring keeps the stamp's total heat", std::abs(total - stamptotal) < 1e-3f*stamptotal);
+
+    static float negative_data[] = { -1.0f };
+    static heatmap_stamp_t negative = { negative_data, 1, 1 };
+    ENSURE_THAT("box blurring a stamp without heat fails", !heatmap_convolve_boxes(one, exact, &negative, 3, 0));
+
+    heatmap_t* small = heatmap_new(10, 10);
+    ENSURE_THAT("box blurring counts of another size fails", !heatmap_convolve_boxes(one, small, gauss, 3, 0));
+    ENSURE_THAT("comparing heatmaps of another size fails", heatmap_relative_error(one, small) < 0.0f);
+
+    heatmap_free(small);
+    heatmap_free(one);
+    heatmap_free(sparse);
+    heatmap_free(exact);
+    heatmap_stamp_free(gauss);
+    heatmap_sepstamp_free(sep);
+}
+
+void test_add_points_gaussian()
+{
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 300, 200, 155, g_nohot, 149);
+
+    const float sigmas[] = { 0.5f, 1.5f, 4.0f, 10.0f };
+    for(float sigma : sigmas) {
+        heatmap_sepstamp_t* sep = heatmap_sepstamp_gen_gaussian(sigma, 5.0f);
+        heatmap_t* exact = heatmap_new(200, 150);
+        heatmap_add_points_separable(exact, &pts[0], &pts[1], &ws[0], ws.size(), 2, sep, 1);
+
+        for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 4) {
+            heatmap_t* hm = heatmap_new(200, 150);
+            heatmap_add_points_gaussian(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, sigma, nthreads);
+            ENSURE_THAT("the recursive gaussian is nearly exact", heatmap_relative_error(hm, exact) < 2e-3f);
+            ENSURE_THAT("the recursive gaussian has nearly the same max", std::abs(hm->max - exact->max) < 2e-3f*exact->max);
+            ENSURE_THAT("the recursive gaussian has no negative heat", heatmap_minheat(hm) >= 0.0f);
+
+            heatmap_t* sparse = heatmap_new_sparse(200, 150);
+            heatmap_add_points_gaussian(sparse, &pts[0], &pts[1], &ws[0], ws.size(), 2, sigma, nthreads);
+            ENSURE_THAT("the recursive gaussian works on sparse heatmaps", heatmap_relative_error(sparse, exact) < 2e-3f);
+
+            heatmap_free(hm);
+            heatmap_free(sparse);
+        }
+
+        heatmap_free(exact);
+        heatmap_sepstamp_free(sep);
+    }
+
+    // Points in a corner of a huge sparse map only touch the tiles within reach.
+    const unsigned x = 10, y = 20;
+    heatmap_t* sparse = heatmap_new_sparse(2000, 2000);
+    heatmap_add_points_gaussian(sparse, &x, &y, nullptr, 1, 1, 6.0f, 0);
+    ENSURE_THAT("the recursive gaussian only touches tiles within reach", heatmap_sparse_tiles_used(sparse) == 1);
+
+    // Rendering asserts there's no negative heat, which the filter's ringing mustn't leave.
+    for(float sigma = 1.0f ; sigma <= 20.0f ; sigma += 1.0f) {
+        heatmap_t* hm = heatmap_new(200, 150);
+        heatmap_add_points_gaussian(hm, &x, &y, nullptr, 1, 1, sigma, 0);
+        heatmap_add_points_gaussian(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, sigma, 0);
+        ENSURE_THAT("the recursive gaussian leaves no negative heat", heatmap_minheat(hm) >= 0.0f);
+
+        unsigned char* img = heatmap_render_default_to(hm, nullptr);
+        ENSURE_THAT("a recursive gaussian heatmap renders", img != nullptr);
+        free(img);
+        heatmap_free(hm);
+    }
+
+    heatmap_t* small = heatmap_new(10, 10);
+    ENSURE_THAT("the recursive gaussian of counts of another size fails", !heatmap_convolve_gaussian(sparse, small, 6.0f, 0));
+
+    heatmap_free(small);
+    heatmap_free(sparse);
+}
+
+void test_add_points_diff()
+{
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 70, 105, g_nohot, 99);
+
+    std::vector<heatmap_diffstamp_t*> stamps;
+    stamps.push_back(heatmap_diffstamp_gen_box(7, 5));
+    stamps.push_back(heatmap_diffstamp_gen_box(8, 1));
+    for(unsigned degree = 0 ; degree <= 3 ; ++degree) {
+        stamps.push_back(heatmap_diffstamp_gen_poly(9, degree));
+    }
+    ENSURE_THAT("a box stamp takes four differences", stamps[0]->nx == 2 && stamps[0]->ny == 2);
+    ENSURE_THAT("a pyramid stamp takes nine differences", stamps[3]->nx == 3 && stamps[3]->ny == 3);
+
+    for(heatmap_diffstamp_t* d : stamps) {
+        heatmap_stamp_t* s = heatmap_diffstamp_to_stamp(d);
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, s);
+        heatmap_t* unweighted = heatmap_new(64, 100);
+        heatmap_add_points_with_stamp(unweighted, &pts[0], &pts[1], ws.size(), 2, s);
+
+        for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 4) {
+            heatmap_t* hm = heatmap_new(64, 100);
+            heatmap_add_points_diff(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, d, nthreads);
+            ENSURE_THAT("difference-stamped points are the same as stamped ones", heatmap_maxdiff(hm, expected) < 1e-3f);
+            ENSURE_THAT("difference-stamped points have the same max", std::abs(hm->max - expected->max) < 1e-3f);
+
+            heatmap_t* tiled = heatmap_new_tiled(64, 100);
+            heatmap_add_points_diff(tiled, &pts[0], &pts[1], nullptr, ws.size(), 2, d, nthreads);
+            ENSURE_THAT("difference-stamping unweighted points onto tiles works", heatmap_maxdiff(tiled, unweighted) < 1e-3f);
+
+            heatmap_t* sparse = heatmap_new_sparse(64, 100);
+            heatmap_add_points_diff(sparse, &pts[0], &pts[1], &ws[0], ws.size(), 2, d, nthreads);
+            ENSURE_THAT("difference-stamping onto sparse heatmaps works", heatmap_maxdiff(sparse, expected) < 1e-3f);
+
+            heatmap_free(sparse);
+            heatmap_free(tiled);
+            heatmap_free(hm);
+        }
+
+        heatmap_free(unweighted);
+        heatmap_free(expected);
+        heatmap_stamp_free(s);
+        heatmap_diffstamp_free(d);
+    }
+
+    // Any separable stamp can be turned into differences and back.
+    heatmap_sepstamp_t* sep = heatmap_sepstamp_gen_gaussian(2.0f, 3.0f);
+    heatmap_diffstamp_t* d = heatmap_diffstamp_from_sepstamp(sep);
+    heatmap_stamp_t* s1 = heatmap_sepstamp_to_stamp(sep);
+    heatmap_stamp_t* s2 = heatmap_diffstamp_to_stamp(d);
+    float maxdiff = 0.0f;
+    for(unsigned i = 0 ; i < s1->w*s1->h ; ++i) {
+        maxdiff = std::max(maxdiff, std::abs(s1->buf[i] - s2->buf[i]));
+    }
+    ENSURE_THAT("a separable stamp survives being turned into differences", s1->w == s2->w && s1->h == s2->h && maxdiff < 1e-5f);
+
+    // A single point far from everything only heats its own tile.
+    const unsigned x = 10, y = 20;
+    heatmap_diffstamp_t* pyramid = heatmap_diffstamp_gen_poly(5, 1);
+    heatmap_t* sparse = heatmap_new_sparse(2000, 2000);
+    heatmap_add_points_diff(sparse, &x, &y, nullptr, 1, 1, pyramid, 0);
+    ENSURE_THAT("difference-stamping a single point only touches its tiles", heatmap_sparse_tiles_used(sparse) == 1);
+    ENSURE_THAT("difference-stamping a single point gives the stamp's max", std::abs(sparse->max - 1.0f) < 1e-5f);
+
+    heatmap_free(sparse);
+    heatmap_diffstamp_free(pyramid);
+    heatmap_stamp_free(s2);
+    heatmap_stamp_free(s1);
+    heatmap_diffstamp_free(d);
+    heatmap_sepstamp_free(sep);
+}
+
+void test_plan()
+{
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 70, 105, g_nohot, 99);
+
+    heatmap_calibrate();
+    heatmap_costs_t costs;
+    heatmap_get_costs(&costs);
+    ENSURE_THAT("calibration measures all costs", costs.point > 0.0 && costs.stamp_point > 0.0 && costs.stamp > 0.0
+        && costs.convolve_pixel > 0.0 && costs.convolve > 0.0 && costs.separable_pixel > 0.0 && costs.separable > 0.0
+        && costs.fft > 0.0 && costs.diff_point > 0.0 && costs.diff_pixel > 0.0 && costs.diff > 0.0);
+
+    heatmap_sepstamp_t* sep = heatmap_sepstamp_gen_gaussian(3.0f, 3.0f);
+    heatmap_stamp_t* gauss = heatmap_sepstamp_to_stamp(sep);
+    heatmap_stamp_t* cone = heatmap_stamp_gen(9);
+
+    const heatmap_stamp_t* stamps[] = { cone, gauss };
+    for(const heatmap_stamp_t* s : stamps) {
+        heatmap_t* expected = heatmap_new(64, 100);
+        heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &ws[0], ws.size(), 2, s);
+
+        heatmap_plan_t* plan = heatmap_plan_new(expected, ws.size(), s, 2);
+        ENSURE_THAT("only separable stamps can be convolved separably", (plan->sep != nullptr) == (s == gauss));
+        ENSURE_THAT("the planned engine is the cheapest", plan->costs[plan->engine] >= 0.0
+            && std::all_of(plan->costs, plan->costs + HEATMAP_ENGINE_COUNT, [&](double c){ return c < 0.0 || c >= plan->costs[plan->engine]; }));
+
+        // Whichever engine is forced, the result is the same.
+        for(int e = 0 ; e < HEATMAP_ENGINE_COUNT ; ++e) {
+            plan->engine = static_cast<heatmap_engine_t>(e);
+            heatmap_t* hm = heatmap_new(64, 100);
+            heatmap_plan_run(plan, hm, &pts[0], &pts[1], &ws[0], ws.size(), 2);
+            ENSURE_THAT("every engine of a plan gives the same result", heatmap_maxdiff(hm, expected) < 1e-3f);
+            ENSURE_THAT("every engine has a name", std::string(heatmap_engine_name(plan->engine)) != "unknown");
+            heatmap_free(hm);
+        }
+        heatmap_plan_free(plan);
+
+        heatmap_t* hm = heatmap_new(64, 100);
+        heatmap_add_points_auto(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, s, 0);
+        ENSURE_THAT("automatically planned points are the same as stamped ones", heatmap_maxdiff(hm, expected) < 1e-3f);
+        heatmap_free(hm);
+        heatmap_free(expected);
+    }
+
+    // The cost model decides.
+    heatmap_costs_t cheap_stamps = costs;
+    cheap_stamps.stamp_point = cheap_stamps.stamp = 1e-15;
+    heatmap_set_costs(&cheap_stamps);
+    heatmap_t* big = heatmap_new(2048, 2048);
+    heatmap_plan_t* plan = heatmap_plan_new(big, 1000*1000, gauss, 1);
+    ENSURE_THAT("cheap stamping gets planned", plan->engine == HEATMAP_ENGINE_STAMP);
+    heatmap_plan_free(plan);
+
+    heatmap_costs_t cheap_ffts = costs;
+    cheap_ffts.fft = 1e-15;
+    heatmap_set_costs(&cheap_ffts);
+    plan = heatmap_plan_new(big, 1000*1000, cone, 1);
+    ENSURE_THAT("cheap FFTs get planned", plan->engine == HEATMAP_ENGINE_FFT);
+    heatmap_plan_free(plan);
+
+    // Switching the model while planning gives plans of either model, never of a mix.
+    int torn = 0;
+#pragma omp parallel for num_threads(4) reduction(+:torn)
+    for(int i = 0 ; i < 400 ; ++i) {
+        if(i % 2) {
+            heatmap_set_costs(i % 4 == 1 ? &cheap_stamps : &cheap_ffts);
+        } else {
+            heatmap_plan_t* p = heatmap_plan_new(big, 1000*1000, cone, 1);
+            torn += p->engine != HEATMAP_ENGINE_STAMP && p->engine != HEATMAP_ENGINE_FFT;
+            heatmap_plan_free(p);
+        }
+    }
+    ENSURE_THAT("setting the costs while planning is safe", torn == 0);
+
+    heatmap_set_costs(&costs);
+    plan = heatmap_plan_new(big, 10, cone, 1);
+    ENSURE_THAT("a few points are stamped", plan->engine == HEATMAP_ENGINE_STAMP);
+    ENSURE_THAT("a cone can't be convolved separably", plan->costs[HEATMAP_ENGINE_SEPARABLE] < 0.0 && plan->costs[HEATMAP_ENGINE_DIFF] < 0.0);
+    heatmap_plan_free(plan);
+
+    heatmap_free(big);
+    heatmap_stamp_free(cone);
+    heatmap_stamp_free(gauss);
+    heatmap_sepstamp_free(sep);
+}
+
+void test_add_pointsf()
+{
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(5);
+    const float coords[] = { -2.0f, -1.0f, -0.5f, 0.0f, 0.25f, 3.0f, 17.6f, 30.5f, 31.0f, 31.75f, 32.0f, 40.0f };
+
+    // Every point is the same as four weighted integer points around it.
+    for(float y : coords) {
+        for(float x : coords) {
+            heatmap_t* expected = heatmap_new(32, 32);
+            const float fx = x - std::floor(x), fy = y - std::floor(y);
+            const long X = static_cast<long>(std::floor(x)), Y = static_cast<long>(std::floor(y));
+            if(x > -1.0f && y > -1.0f) {
+                const float corners[4][3] = { { 0, 0, (1-fx)*(1-fy) }, { 1, 0, fx*(1-fy) }, { 0, 1, (1-fx)*fy }, { 1, 1, fx*fy } };
+                for(const auto& c : corners) {
+                    if(X + c[0] >= 0 && Y + c[1] >= 0 && c[2] > 0.0f) {
+                        heatmap_add_weighted_point_with_stamp(expected, X + c[0], Y + c[1], 2.0f*c[2], stamp);
+                    }
+                }
+            }
+
+            heatmap_t* hm = heatmap_new(32, 32);
+            heatmap_add_weighted_pointf_with_stamp(hm, x, y, 2.0f, stamp);
+            ENSURE_THAT("a sub-pixel point is split bilinearly", heatmap_maxdiff(hm, expected) < 1e-5f);
+            ENSURE_THAT("a sub-pixel point keeps the max up to date", std::abs(hm->max - expected->max) < 1e-5f);
+            heatmap_free(hm);
+            heatmap_free(expected);
+        }
+    }
+
+    // Integer coordinates are exactly the same as integer points.
+    heatmap_t* expected = heatmap_new(32, 32);
+    heatmap_t* hm = heatmap_new(32, 32);
+    heatmap_add_point(expected, 0, 31);
+    heatmap_add_point(expected, 12, 7);
+    heatmap_add_pointf(hm, 0.0f, 31.0f);
+    heatmap_add_pointf(hm, 12.0f, 7.0f);
+    ENSURE_THAT("sub-pixel points at integer coordinates are integer points", memcmp(hm->buf, expected->buf, 32*32*sizeof(float)) == 0);
+    heatmap_free(hm);
+    heatmap_free(expected);
+
+    // Batches are the same as single points, on any kind of map.
+    std::vector<unsigned> ipts;
+    std::vector<float> ws;
+    gen_points(ipts, ws, 500, 730, 1050);
+    std::vector<float> pts;
+    for(unsigned p : ipts) {
+        pts.push_back(static_cast<float>(p)*0.1f - 1.0f);
+    }
+    heatmap_stamp_t* huge = heatmap_stamp_gen(40);
+    const heatmap_stamp_t* stamps[] = { stamp, huge };
+    for(const heatmap_stamp_t* s : stamps) {
+        expected = heatmap_new(64, 100);
+        for(size_t i = 0 ; i < ws.size() ; ++i) {
+            heatmap_add_weighted_pointf_with_stamp(expected, pts[2*i], pts[2*i+1], ws[i], s);
+        }
+
+        heatmap_t* maps[] = { heatmap_new(64, 100), heatmap_new_tiled(64, 100), heatmap_new_sparse(64, 100) };
+        for(heatmap_t* m : maps) {
+            heatmap_add_weighted_pointsf_with_stamp(m, &pts[0], &pts[1], &ws[0], ws.size(), 2, s);
+            ENSURE_THAT("a batch of sub-pixel points is the same as single ones", heatmap_maxdiff(m, expected) < 1e-5f);
+            heatmap_free(m);
+        }
+        heatmap_free(expected);
+    }
+
+    heatmap_stamp_free(huge);
+    heatmap_stamp_free(stamp);
+}
+
+void test_decay()
+{
+    std::vector<unsigned> a, b;
+    for(unsigned i = 0 ; i < 400 ; ++i) {
+        a.push_back((i*37) % 53);
+        a.push_back((i*91) % 41);
+        b.push_back((i*i*7) % 53);
+        b.push_back((i*13) % 41);
+    }
+    auto heat = [](const heatmap_t* hm) {
+        std::vector<float> v(static_cast<size_t>(hm->w)*hm->h);
+        heatmap_to_rowmajor(hm, &v[0]);
+        return v;
+    };
+
+    // The stamp's values are powers of two, and so is the decay, so it's all exact.
+    heatmap_t* ha = heatmap_new(50, 40);
+    heatmap_add_points_with_stamp(ha, &a[0], &a[1], a.size()/2, 2, &g_3x3_stamp);
+    heatmap_t* hb = heatmap_new(50, 40);
+    heatmap_add_points_with_stamp(hb, &b[0], &b[1], b.size()/2, 2, &g_3x3_stamp);
+    const std::vector<float> va = heat(ha), vb = heat(hb);
+    std::vector<float> expected(va.size());
+    for(size_t i = 0 ; i < va.size() ; ++i) {
+        expected[i] = 0.25f*va[i] + vb[i];
+    }
+    heatmap_t* plain = heatmap_new(50, 40);
+    heatmap_add_points_with_stamp(plain, &a[0], &a[1], a.size()/2, 2, &g_3x3_stamp);
+    heatmap_decay(plain, 0.25f);
+    heatmap_decay(plain, 4.0f);
+    heatmap_decay(plain, 0.25f);
+    heatmap_add_points_with_stamp(plain, &b[0], &b[1], b.size()/2, 2, &g_3x3_stamp);
+    const float max = *std::max_element(expected.begin(), expected.end());
+
+    for(int lazy = 0 ; lazy <= 1 ; ++lazy) {
+        heatmap_t* hm = heatmap_new(50, 40);
+        heatmap_set_lazy_max(hm, lazy);
+        heatmap_add_points_with_stamp(hm, &a[0], &a[1], a.size()/2, 2, &g_3x3_stamp);
+        heatmap_decay(hm, 0.5f);
+        heatmap_decay(hm, 0.5f);
+        ENSURE_THAT("decaying doesn't touch the heat", 0 == memcmp(hm->buf, ha->buf, va.size()*sizeof(float)) && hm->decay == 0.25f);
+        heatmap_add_points_parallel(hm, &b[0], &b[1], 0, b.size()/2, 2, &g_3x3_stamp, 4);
+        ENSURE_THAT("a decayed map's heat is decayed", heat(hm) == expected);
+        ENSURE_THAT("a decayed map's max is decayed", heatmap_get_max(hm) == max);
+
+        std::vector<unsigned char> img(50*40*4), expected_img(50*40*4);
+        heatmap_render_default_to(hm, &img[0]);
+        heatmap_render_default_to(plain, &expected_img[0]);
+        ENSURE_THAT("rendering a decayed map works", img == expected_img);
+        heatmap_render_saturated_to(hm, heatmap_cs_default, 0.5f*max, &img[0]);
+        heatmap_render_saturated_to(plain, heatmap_cs_default, 0.5f*max, &expected_img[0]);
+        ENSURE_THAT("a decayed map's saturation is in real heat", img == expected_img);
+
+        // Merging it onto a map which isn't decaying and the other way around.
+        heatmap_t* merged = heatmap_new(50, 40);
+        heatmap_merge(merged, hm, 0, 0);
+        ENSURE_THAT("merging a decayed map merges its real heat", heat(merged) == expected);
+        heatmap_decay(merged, 0.5f);
+        heatmap_merge(merged, hb, 0, 0);
+        std::vector<float> twice(expected);
+        for(size_t i = 0 ; i < twice.size() ; ++i) {
+            twice[i] = 0.5f*twice[i] + vb[i];
+        }
+        ENSURE_THAT("merging onto a decayed map adds real heat", heat(merged) == twice);
+        heatmap_free(merged);
+
+        // Going down by 2^-40 needs the heat to be brought back.
+        for(int i = 0 ; i < 40 ; ++i) {
+            heatmap_decay(hm, 0.5f);
+        }
+        std::vector<float> tiny(expected);
+        for(size_t i = 0 ; i < tiny.size() ; ++i) {
+            tiny[i] = std::ldexp(tiny[i], -40);
+        }
+        ENSURE_THAT("decaying a lot renormalizes the heat", hm->decay >= std::ldexp(1.0f, -32) && heat(hm) == tiny);
+        ENSURE_THAT("decaying a lot keeps the max", heatmap_get_max(hm) == std::ldexp(max, -40));
+
+        heatmap_decay(hm, 0.0f);
+        ENSURE_THAT("decaying by 0 clears the map", heatmap_get_max(hm) == 0.0f && heat(hm) == std::vector<float>(va.size(), 0.0f));
+        heatmap_free(hm);
+    }
+
+    // All kinds of storage decay; those which can't stay heavier right away.
+    heatmap_t* maps[] = {
+        heatmap_new_sparse(50, 40), heatmap_new_half(50, 40, HEATMAP_BF16), heatmap_new_precise(50, 40),
+        heatmap_new_half(50, 40, HEATMAP_FP16), heatmap_new_fixed(50, 40)
+    };
+    for(size_t m = 0 ; m < sizeof(maps)/sizeof(maps[0]) ; ++m) {
+        heatmap_t* hm = maps[m];
+        heatmap_add_points_with_stamp(hm, &a[0], &a[1], a.size()/2, 2, &g_3x3_stamp);
+        heatmap_decay(hm, 0.25f);
+        ENSURE_THAT("decaying only fixed-point and fp16 maps scales them", (hm->decay == 0.0f) == (m >= 3));
+        heatmap_add_points_with_stamp(hm, &b[0], &b[1], b.size()/2, 2, &g_3x3_stamp);
+        ENSURE_THAT("every kind of map decays", heatmap_relative_error(hm, plain) < 1e-2f);
+        ENSURE_THAT("every kind of map's max decays", std::abs(heatmap_get_max(hm) - max) < 1e-2f*max);
+        heatmap_free(hm);
+    }
+
+    heatmap_free(ha);
+    heatmap_free(hb);
+    heatmap_free(plain);
+}
+
+void test_window()
+{
+    const unsigned W = 150, H = 130, NB = 4, TICKS = 12;
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(5);
+    auto quantize = [](float v) {
+        const double q = static_cast<double>(v)*4294967296.0;
+        return !(q > 0.0) ? 0ull : q < 18446744073709551616.0 ? static_cast<unsigned long long>(std::nearbyint(q)) : ~0ull;
+    };
+    // What the window shows for a total and the current bucket's heat.
+    auto shown = [](unsigned long long total, float heat) {
+        return static_cast<float>(static_cast<double>(total)/4294967296.0 + heat);
+    };
+
+    // Every tick's points are around another spot, with weights which don't round nicely.
+    std::vector<std::vector<unsigned> > pts(TICKS);
+    std::vector<std::vector<float> > ws(TICKS);
+    std::vector<std::vector<float> > ticks(TICKS);
+    for(unsigned t = 0 ; t < TICKS ; ++t) {
+        for(unsigned i = 0 ; i < 300 ; ++i) {
+            pts[t].push_back((t*23 + (i*37) % 61) % (W + 10));
+            pts[t].push_back((t*11 + (i*i*7) % 53) % (H + 10));
+            ws[t].push_back(0.1f + (i % 7)*0.37f);
+        }
+        heatmap_t* hm = heatmap_new(W, H);
+        heatmap_add_weighted_points_with_stamp(hm, &pts[t][0], &pts[t][1], &ws[t][0], ws[t].size(), 2, stamp);
+        ticks[t].assign(hm->buf, hm->buf + W*H);
+        heatmap_free(hm);
+    }
+
+    ENSURE_THAT("a window needs buckets", heatmap_window_new(W, H, 0, 0) == 0);
+
+    // Switching kernels between ticks mustn't matter, they all round the same way.
+    std::vector<int> levels;
+    for(int level = HEATMAP_SIMD_SCALAR ; level <= HEATMAP_SIMD_NEON ; ++level) {
+        if(heatmap_simd_select(static_cast<heatmap_simd_t>(level)) == level)
+            levels.push_back(level);
+    }
+
+    for(int sparse = 0 ; sparse <= 1 ; ++sparse) {
+        heatmap_window_t* win = heatmap_window_new(W, H, NB, sparse);
+        bool exact = true, maxok = true;
+        for(unsigned t = 0 ; t < TICKS ; ++t) {
+            heatmap_simd_select(HEATMAP_SIMD_AUTO);
+            heatmap_add_weighted_points_with_stamp(heatmap_window_current(win), &pts[t][0], &pts[t][1], &ws[t][0], ws[t].size(), 2, stamp);
+
+            std::vector<unsigned long long> total(W*H, 0ull);
+            for(unsigned u = t + 1 > NB ? t + 1 - NB : 0 ; u < t ; ++u) {
+                for(size_t i = 0 ; i < total.size() ; ++i) {
+                    total[i] += quantize(ticks[u][i]);
+                }
+            }
+            std::vector<float> expected(W*H);
+            for(size_t i = 0 ; i < expected.size() ; ++i) {
+                expected[i] = shown(total[i], ticks[t][i]);
+            }
+
+            heatmap_simd_select(static_cast<heatmap_simd_t>(levels[t % levels.size()]));
+            heatmap_t* map = heatmap_window_map(win);
+            exact = exact && std::vector<float>(map->buf, map->buf + W*H) == expected;
+            maxok = maxok && heatmap_get_max(map) == *std::max_element(expected.begin(), expected.end());
+
+            heatmap_simd_select(static_cast<heatmap_simd_t>(levels[(t + 1) % levels.size()]));
+            heatmap_window_advance(win);
+        }
+        ENSURE_THAT("a window holds exactly the last buckets' heat", exact);
+        ENSURE_THAT("a window's max is its hottest pixel", maxok);
+        if(sparse) {
+            ENSURE_THAT("a sparse window's new bucket has no tiles", heatmap_sparse_tiles_used(heatmap_window_current(win)) == 0);
+        }
+
+        // Once all buckets went by, not the smallest bit of heat is left over.
+        for(unsigned i = 0 ; i + 1 < NB ; ++i) {
+            heatmap_window_advance(win);
+        }
+        heatmap_t* map = heatmap_window_map(win);
+        ENSURE_THAT("an expired window is exactly empty", std::vector<float>(map->buf, map->buf + W*H) == std::vector<float>(W*H, 0.0f));
+        ENSURE_THAT("an expired window's max is 0", heatmap_get_max(map) == 0.0f);
+        heatmap_window_free(win);
+    }
+    heatmap_simd_select(HEATMAP_SIMD_AUTO);
+
+    // A single bucket is just the current one.
+    heatmap_window_t* win = heatmap_window_new(W, H, 1, 0);
+    heatmap_add_weighted_points_with_stamp(heatmap_window_current(win), &pts[0][0], &pts[0][1], &ws[0][0], ws[0].size(), 2, stamp);
+    bool same = true;
+    heatmap_t* map = heatmap_window_map(win);
+    for(size_t i = 0 ; i < W*H ; ++i) {
+        same = same && map->buf[i] == ticks[0][i];
+    }
+    ENSURE_THAT("a window of one bucket is that bucket", same);
+    heatmap_window_advance(win);
+    map = heatmap_window_map(win);
+    ENSURE_THAT("a window of one bucket forgets it every tick", heatmap_get_max(map) == 0.0f);
+    heatmap_window_free(win);
+
+    // Tiny weights still count, and once a pixel saturates, taking a bucket
+    // away leaves exactly the others' heat, whatever the kernels.
+    const unsigned x = W/2, y = H/2;
+    const float big[] = { 3e9f, 4294967040.0f, 1000.0f };
+    bool tiny = true, saturates = true, recovers = true;
+    for(size_t l = 0 ; l < levels.size() ; ++l) {
+        heatmap_simd_select(static_cast<heatmap_simd_t>(levels[l]));
+        win = heatmap_window_new(W, H, 3, 0);
+        heatmap_add_weighted_point_with_stamp(heatmap_window_current(win), x, y, 1e-8f, stamp);
+        heatmap_window_advance(win);
+        map = heatmap_window_map(win);
+        tiny = tiny && map->buf[y*W + x] == shown(quantize(1e-8f), 0.0f) && map->buf[y*W + x] > 0.0f;
+        for(unsigned t = 0 ; t < 3 ; ++t) {
+            heatmap_add_weighted_point_with_stamp(heatmap_window_current(win), x, y, big[t], stamp);
+            heatmap_window_advance(win);
+        }
+        map = heatmap_window_map(win);
+        saturates = saturates && map->buf[y*W + x] == shown(~0ull, 0.0f);
+        heatmap_window_advance(win);
+        map = heatmap_window_map(win);
+        recovers = recovers && map->buf[y*W + x] == shown(quantize(1000.0f), 0.0f);
+        heatmap_window_advance(win);
+        map = heatmap_window_map(win);
+        recovers = recovers && heatmap_get_max(map) == 0.0f;
+        heatmap_window_free(win);
+    }
+    heatmap_simd_select(HEATMAP_SIMD_AUTO);
+    ENSURE_THAT("a window keeps tiny weights", tiny);
+    ENSURE_THAT("a window's pixels saturate", saturates);
+    ENSURE_THAT("a saturated window loses nothing but its oldest buckets", recovers);
+
+    heatmap_stamp_free(stamp);
+}
+
 void test_stamp_gen()
 {
     static float expected[] = {
@@ -260,6 +1490,210 @@ void test_stamp_gen_nonlinear()
     heatmap_stamp_free(s3);
 }
 
+static float half_dist(float dist)
+{
+    return 0.5f*dist;
+}
+
+void test_stampcache()
+{
+    heatmap_stamp_t* gen8 = heatmap_stamp_gen(8);
+    heatmap_stamp_t* half8 = heatmap_stamp_gen_nonlinear(8, half_dist);
+    const size_t one8 = 2*sizeof(float)*17*17;
+
+    heatmap_stampcache_t* c = heatmap_stampcache_new(one8);
+    const heatmap_stamp_t* a = heatmap_stampcache_get(c, 8, 0);
+    const heatmap_stamp_t* b = heatmap_stampcache_get(c, 8, 0);
+    const heatmap_stamp_t* h = heatmap_stampcache_get(c, 8, half_dist);
+    size_t hits = 0, misses = 0, bytes = 0;
+    heatmap_stampcache_stats(c, &hits, &misses, &bytes);
+    ENSURE_THAT("the cache hands out the same stamp for the same radius", a == b);
+    ENSURE_THAT("the cached stamp is the generated one", a->w == 17 && a->h == 17 && stamp_eq(a, gen8->buf));
+    ENSURE_THAT("the cache tells shapes apart", h != a && stamp_eq(h, half8->buf));
+    ENSURE_THAT("the cache counts its hits and misses", hits == 1 && misses == 2);
+    ENSURE_THAT("stamps in use aren't evicted", bytes > one8);
+
+    heatmap_stampcache_release(c, a);
+    heatmap_stampcache_release(c, b);
+    heatmap_stampcache_stats(c, 0, 0, &bytes);
+    ENSURE_THAT("released stamps are evicted down to the limit", bytes <= one8);
+    heatmap_stampcache_release(c, h);
+
+    // The half-shaped one was used last, so the linear one went.
+    h = heatmap_stampcache_get(c, 8, half_dist);
+    a = heatmap_stampcache_get(c, 8, 0);
+    heatmap_stampcache_stats(c, &hits, &misses, 0);
+    ENSURE_THAT("the least recently used stamp is evicted first", hits == 2 && misses == 3);
+    ENSURE_THAT("an evicted stamp is generated again", stamp_eq(a, gen8->buf));
+    heatmap_stampcache_release(c, a);
+    heatmap_stampcache_release(c, h);
+    heatmap_stampcache_free(c);
+
+    // Many threads asking for a few radii all get the right stamps.
+    c = heatmap_stampcache_new(1 << 20);
+    heatmap_stamp_t* gens[6];
+    for(unsigned r = 0 ; r < 6 ; ++r) {
+        gens[r] = heatmap_stamp_gen(r);
+    }
+    int wrong = 0;
+#pragma omp parallel for num_threads(8) reduction(+:wrong)
+    for(int i = 0 ; i < 3000 ; ++i) {
+        const heatmap_stamp_t* s = heatmap_stampcache_get(c, static_cast<unsigned>(i % 6), 0);
+        wrong += !stamp_eq(s, gens[i % 6]->buf);
+        heatmap_stampcache_release(c, s);
+    }
+    heatmap_stampcache_stats(c, &hits, &misses, 0);
+    ENSURE_THAT("concurrently cached stamps are right", wrong == 0);
+    ENSURE_THAT("concurrent gets are all counted", hits + misses == 3000 && misses >= 6 && misses <= 6*8);
+    for(unsigned r = 0 ; r < 6 ; ++r) {
+        heatmap_stamp_free(gens[r]);
+    }
+    heatmap_stampcache_free(c);
+
+    heatmap_stamp_free(gen8);
+    heatmap_stamp_free(half8);
+}
+
+void test_add_points_with_radii()
+{
+    std::vector<unsigned> pts, rs;
+    std::vector<float> ws;
+    for(unsigned i = 0 ; i < 3000 ; ++i) {
+        pts.push_back((i*37) % 110);
+        pts.push_back((i*91) % 85);
+        rs.push_back((i*7) % 11 % 7);
+        ws.push_back(0.25f * static_cast<float>(i % 5));
+    }
+    heatmap_stamp_t* stamps[7];
+    for(unsigned r = 0 ; r < 7 ; ++r) {
+        stamps[r] = heatmap_stamp_gen_nonlinear(r, half_dist);
+    }
+
+    // Every radius' points in order, one radius after the other.
+    heatmap_t* expected = heatmap_new(100, 80);
+    heatmap_t* expected_unweighted = heatmap_new(100, 80);
+    for(unsigned r = 0 ; r < 7 ; ++r) {
+        for(size_t i = 0 ; i < rs.size() ; ++i) {
+            if(rs[i] == r) {
+                heatmap_add_weighted_point_with_stamp(expected, pts[2*i], pts[2*i+1], ws[i], stamps[r]);
+                heatmap_add_point_with_stamp(expected_unweighted, pts[2*i], pts[2*i+1], stamps[r]);
+            }
+        }
+    }
+
+    heatmap_stampcache_t* c = heatmap_stampcache_new(1 << 20);
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+        heatmap_t* hm = heatmap_new(100, 80);
+        ENSURE_THAT("adding points with radii works", heatmap_add_points_with_radii(hm, &pts[0], &pts[1], &ws[0], &rs[0], rs.size(), 2, half_dist, c, nthreads));
+        ENSURE_THAT("points with radii are added by radius", heatmaps_eq(hm, expected));
+        ENSURE_THAT("points with radii have the right max", heatmap_get_max(hm) == heatmap_get_max(expected));
+        heatmap_free(hm);
+
+        hm = heatmap_new(100, 80);
+        heatmap_add_points_with_radii(hm, &pts[0], &pts[1], 0, &rs[0], rs.size(), 2, half_dist, 0, nthreads);
+        ENSURE_THAT("unweighted points with radii work without a cache", heatmaps_eq(hm, expected_unweighted));
+        heatmap_free(hm);
+    }
+    size_t hits = 0, misses = 0;
+    heatmap_stampcache_stats(c, &hits, &misses, 0);
+    ENSURE_THAT("every radius' stamp is generated once", misses == 7 && hits == 2*7);
+    heatmap_stampcache_free(c);
+
+    // Unknown classes and missing stamps are ignored.
+    std::vector<unsigned> cls(rs);
+    for(size_t i = 0 ; i < cls.size() ; ++i) {
+        if(i % 4 == 0) {cls[i] = 100;}
+        if(i % 4 == 1) {cls[i] = 7;}
+    }
+    heatmap_t* sub = heatmap_new(100, 80);
+    for(unsigned r = 0 ; r < 7 ; ++r) {
+        for(size_t i = 0 ; i < cls.size() ; ++i) {
+            if(cls[i] == r) {
+                heatmap_add_weighted_point_with_stamp(sub, pts[2*i], pts[2*i+1], ws[i], stamps[r]);
+            }
+        }
+    }
+    const heatmap_stamp_t* table[8] = { stamps[0], stamps[1], stamps[2], stamps[3], stamps[4], stamps[5], stamps[6], 0 };
+    heatmap_t* hm = heatmap_new(100, 80);
+    heatmap_add_points_with_stamps(hm, &pts[0], &pts[1], &ws[0], &cls[0], cls.size(), 2, table, 8, 4);
+    ENSURE_THAT("points without a stamp are ignored", heatmaps_eq(hm, sub));
+    heatmap_free(hm);
+
+    // Outliers with a radius whose stamp can't be had are the only ones left out.
+    std::vector<unsigned> opts(pts), ors(rs);
+    std::vector<float> ows(ws);
+    opts.push_back(50); opts.push_back(40); ors.push_back(UINT_MAX); ows.push_back(1.0f);
+    opts.push_back(20); opts.push_back(30); ors.push_back(1u << 30); ows.push_back(1.0f);
+    hm = heatmap_new(100, 80);
+    ENSURE_THAT("adding points with unusable radii reports them", !heatmap_add_points_with_radii(hm, &opts[0], &opts[1], &ows[0], &ors[0], ors.size(), 2, half_dist, 0, 4));
+    ENSURE_THAT("points with usable radii are still added", heatmaps_eq(hm, expected));
+    heatmap_free(hm);
+    ENSURE_THAT("stamps too big to size aren't generated", !heatmap_stamp_gen(UINT_MAX) && !heatmap_stamp_gen(1u << 30));
+
+    heatmap_free(sub);
+    heatmap_free(expected);
+    heatmap_free(expected_unweighted);
+    for(unsigned r = 0 ; r < 7 ; ++r) {
+        heatmap_stamp_free(stamps[r]);
+    }
+}
+
+void test_coalesce()
+{
+    const unsigned xs[] = { 1, 3, 1, 7, 3, 1 };
+    const unsigned ys[] = { 2, 4, 2, 7, 4, 2 };
+    const float ws[] = { 0.5f, 0.25f, 1.0f, 2.0f, 0.25f, 0.5f };
+    unsigned xys[12];
+    float cws[6];
+    const size_t u = heatmap_coalesce_points(xs, ys, ws, 6, 1, xys, cws, 2);
+    std::map<std::pair<unsigned, unsigned>, float> got;
+    for(size_t i = 0 ; i < u ; ++i) {
+        got[std::make_pair(xys[2*i], xys[2*i+1])] += cws[i];
+    }
+    ENSURE_THAT("duplicate points are coalesced", u == 3 && got.size() == 3);
+    ENSURE_THAT("coalesced points weigh as much as their duplicates", got[std::make_pair(1u, 2u)] == 2.0f && got[std::make_pair(3u, 4u)] == 0.5f && got[std::make_pair(7u, 7u)] == 2.0f);
+
+    // Few distinct points, many times over, some of them outside of the map.
+    std::vector<unsigned> pts;
+    std::vector<float> pws;
+    for(unsigned i = 0 ; i < 20000 ; ++i) {
+        pts.push_back((i*i*7) % 53 % 34);
+        pts.push_back((i*13) % 53 % 22);
+        pws.push_back(0.25f * static_cast<float>(i % 5));
+    }
+    std::vector<unsigned> xys1(pts.size()), xys4(pts.size());
+    std::vector<float> cws1(pws.size()), cws4(pws.size());
+    const size_t u1 = heatmap_coalesce_points(&pts[0], &pts[1], &pws[0], pws.size(), 2, &xys1[0], &cws1[0], 1);
+    const size_t u4 = heatmap_coalesce_points(&pts[0], &pts[1], &pws[0], pws.size(), 2, &xys4[0], &cws4[0], 4);
+    std::set<std::pair<unsigned, unsigned> > distinct;
+    for(size_t i = 0 ; i < pts.size() ; i += 2) {
+        distinct.insert(std::make_pair(pts[i], pts[i+1]));
+    }
+    ENSURE_THAT("coalescing leaves every distinct point once", u1 == distinct.size());
+    ENSURE_THAT("coalescing doesn't depend on the threads", u1 == u4 && 0 == memcmp(&xys1[0], &xys4[0], 2*u1*sizeof(unsigned)) && 0 == memcmp(&cws1[0], &cws4[0], u1*sizeof(float)));
+
+    // The stamp and weights are exact in few bits, so are all the sums.
+    heatmap_t* expected = heatmap_new(30, 20);
+    heatmap_add_weighted_points_with_stamp(expected, &pts[0], &pts[1], &pws[0], pws.size(), 2, &g_3x3_stamp);
+    heatmap_t* expected_unweighted = heatmap_new(30, 20);
+    heatmap_add_points_with_stamp(expected_unweighted, &pts[0], &pts[1], pws.size(), 2, &g_3x3_stamp);
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 4) {
+        heatmap_t* hm = heatmap_new(30, 20);
+        const size_t stamped = heatmap_add_points_coalesced(hm, &pts[0], &pts[1], &pws[0], pws.size(), 2, &g_3x3_stamp, nthreads);
+        ENSURE_THAT("coalesced points are stamped once", stamped == distinct.size());
+        ENSURE_THAT("coalesced points add up to the same heat", heatmaps_eq(hm, expected));
+        ENSURE_THAT("coalesced points have the same max", heatmap_get_max(hm) == heatmap_get_max(expected));
+        heatmap_free(hm);
+
+        hm = heatmap_new(30, 20);
+        heatmap_add_points_coalesced(hm, &pts[0], &pts[1], 0, pws.size(), 2, &g_3x3_stamp, nthreads);
+        ENSURE_THAT("unweighted coalesced points add up to the same heat", heatmaps_eq(hm, expected_unweighted));
+        heatmap_free(hm);
+    }
+    heatmap_free(expected);
+    heatmap_free(expected_unweighted);
+}
+
 void test_render_to_nothing()
 {
     static unsigned char expected[] = {
@@ -351,6 +1785,443 @@ void test_render_to_saturating()
     // TODO: (Also try negative and non-one-max stamps?)
 }
 
+void test_half()
+{
+    // Heats of all magnitudes, including ties, subnormal halfs and ones too hot for FP16.
+    const unsigned W = 301;
+    heatmap_t* src = heatmap_new(W, 1);
+    for(unsigned i = 0 ; i < W ; ++i) {
+        src->buf[i] = std::ldexp(1.0f + static_cast<float>(i % 37)/37.0f, static_cast<int>(i % 45) - 28);
+    }
+    src->buf[0] = 0.0f;
+    src->buf[1] = 1.0f + 1.0f/2048.0f; // A tie for FP16, rounds to even.
+    src->buf[2] = 1.0f + 3.0f/2048.0f;
+    src->buf[3] = 1.0f + 1.0f/256.0f;  // The same for BF16.
+    src->buf[4] = 65519.0f;
+    src->buf[5] = 1e6f;
+
+    const heatmap_storage_t storages[] = { HEATMAP_FP16, HEATMAP_BF16 };
+    for(heatmap_storage_t storage : storages) {
+        const float eps = storage == HEATMAP_FP16 ? 1.0f/2048.0f : 1.0f/256.0f;
+
+        heatmap_simd_select(HEATMAP_SIMD_SCALAR);
+        heatmap_t* expected = heatmap_new(W, 1);
+        heatmap_merge(expected, src, 0, 0);
+        ENSURE_THAT("a map converts to half precision", heatmap_set_storage(expected, storage) && expected->hbuf && !expected->buf);
+
+        std::vector<float> back(W);
+        heatmap_to_rowmajor(expected, &back[0]);
+        bool close = true;
+        for(unsigned i = 0 ; i < W ; ++i) {
+            const float want = storage == HEATMAP_FP16 ? std::min(src->buf[i], 65504.0f) : src->buf[i];
+            if(want >= 6.2e-5f || storage == HEATMAP_BF16) {
+                close = close && std::abs(back[i] - want) <= eps*want;
+            } else {
+                close = close && std::abs(back[i] - want) <= 3e-8f;
+            }
+        }
+        ENSURE_THAT("half-precision heat is close to the float heat", close);
+        ENSURE_THAT("ties round to even", back[1] == 1.0f && back[2] == (storage == HEATMAP_FP16 ? 1.0f + 4.0f/2048.0f : 1.0f));
+        ENSURE_THAT("the max is what's stored", heatmap_get_max(expected) == *std::max_element(back.begin(), back.end()));
+
+        for(int level = HEATMAP_SIMD_SSE2 ; level <= HEATMAP_SIMD_NEON ; ++level) {
+            if(heatmap_simd_select(static_cast<heatmap_simd_t>(level)) != level)
+                continue;
+
+            heatmap_t* hm = heatmap_new(W, 1);
+            heatmap_merge(hm, src, 0, 0);
+            heatmap_set_storage(hm, storage);
+            ENSURE_THAT("the vectorized conversion rounds exactly like the scalar one", 0 == memcmp(hm->hbuf, expected->hbuf, W*sizeof(unsigned short)));
+
+            std::vector<float> vback(W);
+            heatmap_to_rowmajor(hm, &vback[0]);
+            ENSURE_THAT("the vectorized conversion back is exact", vback == back);
+            heatmap_free(hm);
+        }
+        heatmap_simd_select(HEATMAP_SIMD_AUTO);
+        heatmap_free(expected);
+    }
+    heatmap_free(src);
+
+    // A batch is summed up as floats and only rounded once, in any layout and with any amount of threads.
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 220, 130, 37, 41);
+    for(heatmap_storage_t storage : storages) {
+        heatmap_t* exact = heatmap_new(200, 120);
+        heatmap_add_weighted_points_with_stamp(exact, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+        heatmap_t* expected = heatmap_new(200, 120);
+        heatmap_merge(expected, exact, 0, 0);
+        heatmap_set_storage(expected, storage);
+
+        heatmap_t* hm = heatmap_new_half(200, 120, storage);
+        heatmap_add_weighted_points_with_stamp(hm, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+        ENSURE_THAT("a batch onto a half-precision map is rounded once", 0 == memcmp(hm->hbuf, expected->hbuf, 200*120*sizeof(unsigned short)));
+        ENSURE_THAT("a batch onto a half-precision map keeps the max", hm->max == expected->max);
+        ENSURE_THAT("a batch onto a half-precision map is close to the float one", heatmap_maxdiff(hm, exact) <= (storage == HEATMAP_FP16 ? 1.0f/2048.0f : 1.0f/256.0f)*exact->max);
+
+        for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+            heatmap_t* par = heatmap_new_half(200, 120, storage);
+            heatmap_set_tiled(par, 1);
+            heatmap_set_lazy_max(par, 1);
+            heatmap_add_points_parallel(par, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+            heatmap_set_tiled(par, 0);
+            ENSURE_THAT("a parallel batch onto a tiled half-precision map is the same", 0 == memcmp(par->hbuf, expected->hbuf, 200*120*sizeof(unsigned short)));
+            ENSURE_THAT("a lazy half-precision map finds the same max", heatmap_get_max(par) == expected->max);
+            heatmap_free(par);
+        }
+
+        // Single points are added onto the stored heat one by one.
+        heatmap_t* single = heatmap_new_half(200, 120, storage);
+        heatmap_t* single_expected = heatmap_new(200, 120);
+        heatmap_add_weighted_point_with_stamp(single, 50, 60, 3.0f, stamp);
+        heatmap_add_weighted_point_with_stamp(single_expected, 50, 60, 3.0f, stamp);
+        heatmap_set_storage(single_expected, storage);
+        ENSURE_THAT("a single point onto a half-precision map is rounded", 0 == memcmp(single->hbuf, single_expected->hbuf, 200*120*sizeof(unsigned short)));
+
+        // Rendering and merging use the stored heat.
+        heatmap_t* asfloat = heatmap_new(200, 120);
+        heatmap_merge(asfloat, hm, 0, 0);
+        heatmap_set_storage(expected, HEATMAP_FLOAT32);
+        ENSURE_THAT("merging a half-precision map adds its heat", heatmaps_eq(asfloat, expected) && asfloat->max == expected->max);
+
+        std::vector<unsigned char> img(200*120*4), expected_img(200*120*4);
+        heatmap_render_default_to(hm, &img[0]);
+        heatmap_render_default_to(expected, &expected_img[0]);
+        ENSURE_THAT("a half-precision map renders its heat", img == expected_img);
+
+        heatmap_free(asfloat);
+        heatmap_free(single);
+        heatmap_free(single_expected);
+        heatmap_free(hm);
+        heatmap_free(expected);
+        heatmap_free(exact);
+    }
+
+    // Adding them one by one, the stamp's faint edge would stop adding up once its pixels are hot.
+    std::vector<unsigned> same(2*4000, 20);
+    heatmap_t* batch = heatmap_new_half(40, 40, HEATMAP_FP16);
+    heatmap_t* onebyone = heatmap_new_half(40, 40, HEATMAP_FP16);
+    heatmap_add_points_with_stamp(batch, &same[0], &same[1], 4000, 2, stamp);
+    for(unsigned i = 0 ; i < 4000 ; ++i) {
+        heatmap_add_point_with_stamp(onebyone, 20, 20, stamp);
+    }
+    std::vector<float> heat(40*40), stalled(40*40);
+    heatmap_to_rowmajor(batch, &heat[0]);
+    heatmap_to_rowmajor(onebyone, &stalled[0]);
+    const float edge = 4000.0f*stamp->buf[9*stamp->w + 1];
+    ENSURE_THAT("heavy pixels don't stall in a batch", std::abs(heat[20*40 + 12] - edge) <= edge/2048.0f);
+    ENSURE_THAT("heavy pixels do stall one by one", stalled[20*40 + 12] < 0.9f*edge);
+    heatmap_free(batch);
+    heatmap_free(onebyone);
+
+    heatmap_t* fp16 = heatmap_new_half(10, 10, HEATMAP_FP16);
+    heatmap_add_weighted_point(fp16, 5, 5, 1e6f);
+    ENSURE_THAT("FP16 saturates", fp16->max == 65504.0f && heatmap_get_max(fp16) == 65504.0f);
+    heatmap_free(fp16);
+
+    heatmap_t* sparse = heatmap_new_sparse(10, 10);
+    ENSURE_THAT("sparse maps stay floats", !heatmap_set_storage(sparse, HEATMAP_BF16) && sparse->storage == HEATMAP_FLOAT32);
+    heatmap_free(sparse);
+
+    heatmap_t* concurrent = heatmap_new(10, 10);
+    ENSURE_THAT("float maps can be concurrent", heatmap_set_concurrent(concurrent, 1) && concurrent->concurrent);
+    ENSURE_THAT("concurrent maps stay floats", !heatmap_set_storage(concurrent, HEATMAP_FP16) && concurrent->storage == HEATMAP_FLOAT32);
+    heatmap_free(concurrent);
+
+    heatmap_t* half = heatmap_new_half(10, 10, HEATMAP_BF16);
+    ENSURE_THAT("half maps can't be concurrent", !heatmap_set_concurrent(half, 1) && !half->concurrent);
+    ENSURE_THAT("half maps can leave concurrent mode", heatmap_set_concurrent(half, 0));
+    heatmap_free(half);
+
+    heatmap_stamp_free(stamp);
+}
+
+void test_fixed()
+{
+    // Saturating adds, with and without the max, on all SIMD levels.
+    const unsigned W = 37;
+    std::vector<unsigned short> ones(W, static_cast<unsigned short>(HEATMAP_FIXED_ONE));
+    heatmap_qstamp_t row = { &ones[0], W, 1 };
+    for(int level = HEATMAP_SIMD_SCALAR ; level <= HEATMAP_SIMD_NEON ; ++level) {
+        if(heatmap_simd_select(static_cast<heatmap_simd_t>(level)) != level)
+            continue;
+
+        for(int lazy = 0 ; lazy < 2 ; ++lazy) {
+            heatmap_t* hm = heatmap_new_fixed(W, 1);
+            heatmap_set_lazy_max(hm, lazy);
+            for(unsigned i = 0 ; i < W ; ++i) {
+                hm->ibuf[i] = i % 3 ? 0xffffffffu - 1000u*i : 1000u*i;
+            }
+            heatmap_add_point_with_qstamp(hm, W/2, 0, &row);
+
+            bool ok = true;
+            for(unsigned i = 0 ; i < W ; ++i) {
+                const unsigned long long want = (i % 3 ? 0xffffffffull - 1000u*i : 1000ull*i) + HEATMAP_FIXED_ONE;
+                ok = ok && hm->ibuf[i] == (want > 0xffffffffull ? 0xffffffffu : static_cast<unsigned>(want));
+            }
+            ENSURE_THAT("fixed-point adds saturate", ok);
+            ENSURE_THAT("a fixed-point map's max is its hottest pixel", heatmap_get_max(hm) == static_cast<float>(0xffffffffu/65535.0));
+            heatmap_free(hm);
+        }
+    }
+    heatmap_simd_select(HEATMAP_SIMD_AUTO);
+
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts, rev;
+    std::vector<float> ws;
+    gen_points(pts, ws, 3000, 220, 130, 37, 41);
+    for(size_t i = pts.size() ; i > 0 ; i -= 2) {
+        rev.push_back(pts[i-2]);
+        rev.push_back(pts[i-1]);
+    }
+
+    // Quantizing the stamp once is the same as quantizing every stamped value.
+    heatmap_t* expected = heatmap_new_fixed(200, 120);
+    for(size_t i = 0 ; i < 3000 ; ++i) {
+        heatmap_add_point_with_stamp(expected, pts[2*i], pts[2*i+1], stamp);
+    }
+    heatmap_t* batch = heatmap_new_fixed(200, 120);
+    heatmap_add_points_with_stamp(batch, &pts[0], &pts[1], 3000, 2, stamp);
+    ENSURE_THAT("a batch onto a fixed-point map uses the same quantized stamp", 0 == memcmp(batch->ibuf, expected->ibuf, 200*120*sizeof(unsigned)));
+    ENSURE_THAT("a batch onto a fixed-point map keeps the max", batch->max == expected->max && batch->max == heatmap_get_max(expected));
+
+    heatmap_qstamp_t* q = heatmap_qstamp_from_stamp(stamp);
+    heatmap_t* reversed = heatmap_new_fixed(200, 120);
+    heatmap_add_points_with_qstamp(reversed, &rev[0], &rev[1], 3000, 2, q);
+    ENSURE_THAT("fixed-point sums don't depend on the order", 0 == memcmp(reversed->ibuf, expected->ibuf, 200*120*sizeof(unsigned)));
+
+    heatmap_t* asfloat = heatmap_new(200, 120);
+    heatmap_add_points_with_stamp(asfloat, &pts[0], &pts[1], 3000, 2, stamp);
+    ENSURE_THAT("fixed-point heat is close to the float heat", heatmap_maxdiff(batch, asfloat) <= 1e-4f*asfloat->max);
+
+    heatmap_t* onfloat = heatmap_new(200, 120);
+    heatmap_add_points_with_qstamp(onfloat, &pts[0], &pts[1], 3000, 2, q);
+    ENSURE_THAT("a quantized stamp can be added onto floats too", heatmap_maxdiff(onfloat, asfloat) <= 1e-4f*asfloat->max);
+
+    // Weighted points, whichever way they're split up, sum up to exactly the same.
+    heatmap_t* weighted = heatmap_new_fixed(200, 120);
+    heatmap_add_weighted_points_with_stamp(weighted, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+        heatmap_t* par = heatmap_new_fixed(200, 120);
+        heatmap_set_tiled(par, 1);
+        heatmap_add_points_parallel(par, &pts[0], &pts[1], 0, 3000, 2, stamp, nthreads);
+        heatmap_set_tiled(par, 0);
+        ENSURE_THAT("a parallel batch onto a tiled fixed-point map is the same", 0 == memcmp(par->ibuf, expected->ibuf, 200*120*sizeof(unsigned)));
+        ENSURE_THAT("a parallel batch onto a fixed-point map keeps the max", par->max == expected->max);
+
+        heatmap_t* wpar = heatmap_new_fixed(200, 120);
+        heatmap_set_lazy_max(wpar, 1);
+        heatmap_add_points_parallel(wpar, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+        ENSURE_THAT("a weighted parallel batch onto a fixed-point map is the same", 0 == memcmp(wpar->ibuf, weighted->ibuf, 200*120*sizeof(unsigned)));
+        ENSURE_THAT("a lazy fixed-point map finds the same max", heatmap_get_max(wpar) == weighted->max);
+
+        heatmap_t* sharded = heatmap_new_fixed(200, 120);
+        heatmap_add_points_sharded(sharded, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+        ENSURE_THAT("sharding a fixed-point map doesn't change the sum", 0 == memcmp(sharded->ibuf, weighted->ibuf, 200*120*sizeof(unsigned)));
+
+        heatmap_free(par);
+        heatmap_free(wpar);
+        heatmap_free(sharded);
+    }
+
+    // Merging fixed-point maps is exact, in any order.
+    heatmap_t* top = heatmap_new_fixed(200, 60);
+    heatmap_t* all = heatmap_new_fixed(200, 120);
+    heatmap_add_weighted_points_with_stamp(top, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    heatmap_merge(all, weighted, 0, 0);
+    heatmap_merge(all, top, 0, 30);
+    heatmap_t* all2 = heatmap_new_fixed(200, 120);
+    heatmap_set_tiled(all2, 1);
+    heatmap_merge(all2, top, 0, 30);
+    heatmap_merge(all2, weighted, 0, 0);
+    heatmap_set_tiled(all2, 0);
+    ENSURE_THAT("fixed-point merges are exact in any order", 0 == memcmp(all->ibuf, all2->ibuf, 200*120*sizeof(unsigned)) && all->max == all2->max);
+    bool exact = true;
+    for(unsigned y = 0 ; y < 120 ; ++y) {
+        for(unsigned x = 0 ; x < 200 ; ++x) {
+            const unsigned long long sum = static_cast<unsigned long long>(weighted->ibuf[y*200 + x]) + (y >= 30 && y < 90 ? top->ibuf[(y - 30)*200 + x] : 0u);
+            exact = exact && all->ibuf[y*200 + x] == sum;
+        }
+    }
+    ENSURE_THAT("fixed-point merges add the integers", exact);
+
+    // Rendering rounds the integers to the nearest color, without any floats.
+    const float saturations[] = { weighted->max, 0.5f, 3.0f };
+    for(float saturation : saturations) {
+        const unsigned long long S = static_cast<unsigned long long>(static_cast<double>(saturation)*HEATMAP_FIXED_ONE + 0.5);
+        const unsigned long long n1 = heatmap_cs_default->ncolors - 1;
+        std::vector<unsigned char> img(200*120*4);
+        heatmap_render_saturated_to(weighted, heatmap_cs_default, saturation, &img[0]);
+        bool same = true;
+        for(size_t i = 0 ; i < 200*120 ; ++i) {
+            const unsigned long long v = std::min<unsigned long long>(weighted->ibuf[i], S);
+            const size_t idx = static_cast<size_t>((2*n1*v + S)/(2*S));
+            same = same && 0 == memcmp(&img[4*i], heatmap_cs_default->colors + 4*idx, 4);
+        }
+        ENSURE_THAT("a fixed-point map renders its heat", same);
+    }
+
+    // Switching to fixed-point and back rounds once.
+    heatmap_t* light = heatmap_new_fixed(200, 120);
+    heatmap_add_weighted_points_with_stamp(light, &pts[0], &pts[1], &ws[0], 30, 2, stamp);
+    heatmap_t* back = heatmap_new(200, 120);
+    heatmap_merge(back, light, 0, 0);
+    heatmap_set_storage(back, HEATMAP_FIXED);
+    ENSURE_THAT("a float map converts to fixed-point", back->ibuf && !back->buf && 0 == memcmp(back->ibuf, light->ibuf, 200*120*sizeof(unsigned)));
+    ENSURE_THAT("a float map converted to fixed-point keeps the max", back->max == light->max);
+    heatmap_set_storage(back, HEATMAP_BF16);
+    heatmap_set_storage(back, HEATMAP_FLOAT32);
+    ENSURE_THAT("a fixed-point map converts to floats", back->buf && !back->ibuf && heatmap_maxdiff(back, light) <= light->max/256.0f);
+    heatmap_free(light);
+
+    heatmap_t* sparse = heatmap_new_sparse(10, 10);
+    ENSURE_THAT("sparse maps don't become fixed-point", !heatmap_set_storage(sparse, HEATMAP_FIXED) && sparse->storage == HEATMAP_FLOAT32);
+    heatmap_free(sparse);
+
+    heatmap_t* fixed = heatmap_new_fixed(10, 10);
+    ENSURE_THAT("fixed-point maps can't be concurrent", !heatmap_set_concurrent(fixed, 1) && !fixed->concurrent);
+    heatmap_t* concurrent = heatmap_new(10, 10);
+    heatmap_set_concurrent(concurrent, 1);
+    ENSURE_THAT("concurrent maps don't become fixed-point", !heatmap_set_storage(concurrent, HEATMAP_FIXED) && concurrent->storage == HEATMAP_FLOAT32);
+    heatmap_free(concurrent);
+    heatmap_free(fixed);
+
+    heatmap_free(back);
+    heatmap_free(all);
+    heatmap_free(all2);
+    heatmap_free(top);
+    heatmap_free(weighted);
+    heatmap_free(onfloat);
+    heatmap_free(asfloat);
+    heatmap_free(reversed);
+    heatmap_free(batch);
+    heatmap_free(expected);
+    heatmap_qstamp_free(q);
+    heatmap_stamp_free(stamp);
+}
+
+void test_precise()
+{
+    // Past 2^24, a float doesn't change when adding one anymore, doubles do.
+    const float big = 33554432.0f; // 2^25
+    float one = 1.0f;
+    heatmap_stamp_t dot = { &one, 1, 1 };
+    heatmap_t* plain = heatmap_new(5, 5);
+    heatmap_t* precise = heatmap_new_precise(5, 5);
+    heatmap_add_weighted_point_with_stamp(plain, 2, 2, big, &dot);
+    heatmap_add_weighted_point_with_stamp(precise, 2, 2, big, &dot);
+    for(unsigned i = 0 ; i < 1000 ; ++i) {
+        heatmap_add_point_with_stamp(plain, 2, 2, &dot);
+        heatmap_add_point_with_stamp(precise, 2, 2, &dot);
+    }
+    ENSURE_THAT("a float map drops small contributions", heatmap_get_max(plain) == big);
+    ENSURE_THAT("a precise map keeps them", heatmap_get_max(precise) == big + 1000.0f);
+    ENSURE_THAT("a precise map's max is computed lazily", precise->max_dirty == 0 && precise->max == big + 1000.0f);
+    heatmap_free(plain);
+    heatmap_free(precise);
+
+    // Lots of small stamps onto a few hot pixels, compared to a sum in doubles.
+    heatmap_stamp_t* stamp = heatmap_stamp_gen(9);
+    std::vector<unsigned> pts;
+    std::vector<float> ws;
+    gen_points(pts, ws, 30000, 220, 130, 37, 41);
+    for(size_t i = 0 ; i < ws.size() ; ++i) {
+        pts[2*i] += i % 3 ? i % 2 : 0;
+    }
+    std::vector<double> exact(200*120, 0.0);
+    for(size_t i = 0 ; i < ws.size() ; ++i) {
+        const int px = static_cast<int>(pts[2*i]), py = static_cast<int>(pts[2*i+1]);
+        if(px >= 200 || py >= 120)
+            continue;
+        for(int dy = -9 ; dy <= 9 ; ++dy) {
+            for(int dx = -9 ; dx <= 9 ; ++dx) {
+                if(px + dx >= 0 && px + dx < 200 && py + dy >= 0 && py + dy < 120) {
+                    exact[(py + dy)*200 + px + dx] += static_cast<double>(stamp->buf[(dy + 9)*19 + dx + 9])*ws[i];
+                }
+            }
+        }
+    }
+    auto error = [&exact](const heatmap_t* hm) {
+        std::vector<float> heat(200*120);
+        heatmap_to_rowmajor(hm, &heat[0]);
+        double err = 0.0;
+        for(size_t i = 0 ; i < heat.size() ; ++i) {
+            err = std::max(err, std::abs(heat[i] - exact[i]));
+        }
+        return err/(*std::max_element(exact.begin(), exact.end()));
+    };
+
+    heatmap_t* floats = heatmap_new(200, 120);
+    heatmap_add_weighted_points_with_stamp(floats, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    precise = heatmap_new_precise(200, 120);
+    heatmap_add_weighted_points_with_stamp(precise, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp);
+    ENSURE_THAT("a precise map stays precise", error(precise) <= 2e-6);
+    ENSURE_THAT("a precise map is more precise than a float map", error(precise) < error(floats)/50.0);
+
+    for(unsigned nthreads = 1 ; nthreads <= 4 ; nthreads *= 2) {
+        heatmap_t* par = heatmap_new_precise(200, 120);
+        heatmap_set_tiled(par, nthreads == 2 ? 0 : 1);
+        heatmap_add_points_parallel(par, &pts[0], &pts[1], &ws[0], ws.size(), 2, stamp, nthreads);
+        ENSURE_THAT("a parallel batch onto a precise map is precise", error(par) <= 2e-6);
+        ENSURE_THAT("a parallel batch onto a precise map finds the max", heatmap_get_max(par) == heatmap_get_max(precise));
+        heatmap_free(par);
+    }
+
+    // Merging precise maps adds their doubles, everything else goes through floats.
+    heatmap_t* twice = heatmap_new_precise(200, 120);
+    heatmap_set_tiled(twice, 0);
+    heatmap_merge(twice, precise, 0, 0);
+    heatmap_merge(twice, precise, 0, 0);
+    for(double& e : exact) {
+        e *= 2.0;
+    }
+    ENSURE_THAT("merging precise maps is precise", error(twice) <= 2e-6);
+    ENSURE_THAT("merging precise maps finds the max", heatmap_get_max(twice) == 2.0f*heatmap_get_max(precise));
+
+    heatmap_t* asfloat = heatmap_new(200, 120);
+    heatmap_merge(asfloat, precise, 0, 0);
+    heatmap_t* expected = heatmap_new(200, 120);
+    heatmap_to_rowmajor(precise, expected->buf);
+    expected->max = heatmap_get_max(precise);
+    ENSURE_THAT("merging a precise map onto floats rounds its heat once", heatmaps_eq(asfloat, expected));
+
+    std::vector<unsigned char> img(200*120*4), expected_img(200*120*4);
+    heatmap_render_default_to(precise, &img[0]);
+    heatmap_render_default_to(expected, &expected_img[0]);
+    ENSURE_THAT("a precise map renders its heat", img == expected_img);
+
+    // Switching storage keeps all of the doubles' precision.
+    std::vector<float> heat(200*120);
+    heatmap_to_rowmajor(twice, &heat[0]);
+    heatmap_set_storage(twice, HEATMAP_FLOAT32);
+    ENSURE_THAT("a precise map converts to floats", twice->buf && !twice->dbuf && 0 == memcmp(twice->buf, &heat[0], heat.size()*sizeof(float)));
+    heatmap_set_storage(asfloat, HEATMAP_FLOAT64);
+    heatmap_to_rowmajor(asfloat, &heat[0]);
+    ENSURE_THAT("a float map converts to a precise one", asfloat->dbuf && 0 == memcmp(expected->buf, &heat[0], heat.size()*sizeof(float)));
+
+    heatmap_t* sparse = heatmap_new_sparse(10, 10);
+    ENSURE_THAT("sparse maps don't become precise", !heatmap_set_storage(sparse, HEATMAP_FLOAT64) && sparse->storage == HEATMAP_FLOAT32);
+    heatmap_free(sparse);
+
+    heatmap_t* concurrent = heatmap_new(10, 10);
+    heatmap_set_concurrent(concurrent, 1);
+    ENSURE_THAT("concurrent maps don't become precise", !heatmap_set_storage(concurrent, HEATMAP_FLOAT64) && concurrent->storage == HEATMAP_FLOAT32);
+    heatmap_free(concurrent);
+
+    heatmap_t* small = heatmap_new_precise(10, 10);
+    ENSURE_THAT("precise maps can't be concurrent", !heatmap_set_concurrent(small, 1) && !small->concurrent);
+    heatmap_free(small);
+
+    heatmap_free(expected);
+    heatmap_free(asfloat);
+    heatmap_free(twice);
+    heatmap_free(precise);
+    heatmap_free(floats);
+    heatmap_stamp_free(stamp);
+}
+
 int main()
 {
     test_add_nothing();
@@ -358,9 +2229,34 @@ int main()
     test_add_point_with_stamp_topleft();
     test_add_point_with_stamp_botright();
     test_add_point_with_stamp_outside();
+    test_add_points_aos_soa();
+    test_simd_kernels();
+    test_lazy_max();
+    test_add_points_parallel();
+    test_merge();
+    test_add_points_sharded();
+    test_concurrent();
+    test_tiled();
+    test_sparse();
+    test_add_points_convolved();
+    test_sepstamp();
+    test_add_points_fft();
+    test_add_points_boxes();
+    test_add_points_gaussian();
+    test_add_points_diff();
+    test_plan();
+    test_add_pointsf();
+    test_half();
+    test_fixed();
+    test_precise();
+    test_decay();
+    test_window();
 
     test_stamp_gen();
     test_stamp_gen_nonlinear();
+    test_stampcache();
+    test_add_points_with_radii();
+    test_coalesce();
 
     test_render_to_nothing();
     test_render_to_creation();